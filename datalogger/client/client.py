@@ -65,9 +65,19 @@ def parseQueryStr(s):
 
 def parseObserveStr(s):
 	recStr = s.split(',')
-	if len(recStr) != 2:
-		print 'OBSERVE must be of format SERIAL,DEVTYPE'
+	if len(recStr) not in (2, 3):
+		print 'OBSERVE must be of format SERIAL,DEVTYPE[,AGE]'
 		print 'SERIAL and DEVTYPE may be \'*\' for wildcard'
+		print 'AGE replays Records newer than AGE seconds before switching to live Records'
+		exit(1)
+	if len(recStr) == 2:
+		recStr.append(0)
+	try:
+		recStr[2] = int(recStr[2])
+		if (recStr[2] != 0):
+			recStr[2] = time.time() - recStr[2]
+	except:
+		print 'AGE must be an integer'
 		exit(1)
 	return recStr
 
@@ -183,9 +193,13 @@ def makeQueryPacket(serial, devType, since):
 	return data
 
 
-def makeObservePacket(serial, devType):
-	values = (0x5A5A, PRM_ACTION, 2, REC_ACT_OBSERVE, PRM_SERNUM, len(serial), serial, PRM_DEVTYPE, len(devType), devType)
-	s = struct.Struct('! H HHH HH%is HH%is' % (len(serial), len(devType)))
+def makeObservePacket(serial, devType, since):
+	if since == 0:
+		values = (0x5A5A, PRM_ACTION, 2, REC_ACT_OBSERVE, PRM_SERNUM, len(serial), serial, PRM_DEVTYPE, len(devType), devType)
+		s = struct.Struct('! H HHH HH%is HH%is' % (len(serial), len(devType)))
+	else:
+		values = (0x5A5A, PRM_ACTION, 2, REC_ACT_OBSERVE, PRM_SERNUM, len(serial), serial, PRM_DEVTYPE, len(devType), devType, PRM_TIME, 8, int(since), int(since % 1 * 1000000))
+		s = struct.Struct('! H HHH HH%is HH%is HHII' % (len(serial), len(devType)))
 	data = s.pack(*values)
 	return data
 
@@ -264,7 +278,7 @@ if __name__ == "__main__":
 		parseQueryPackets(sock)
 
 	elif args.observe:
-		packet = makeObservePacket(recStr[0], recStr[1])
+		packet = makeObservePacket(recStr[0], recStr[1], recStr[2])
 		sock.send(packet)
 		parseQueryPackets(sock)
 
@@ -0,0 +1,278 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "aggregate.hpp"
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Start with no Records. Without grouping there is one group to begin
+    with.
+
+  Wants:
+    COUNT or STATS request. Its priv is used when sending.
+----------------------------------------------------------------------------*/
+Aggregate::Aggregate(Record const &ref)
+: action_(ref.action), groupBy_(ref.groupBy), serial_(ref.serial), devType_(ref.devType), priv_(ref.priv), count_(0)
+{
+    if (0 == groupBy_) {
+        Group &group = groups_[key_];
+        memset(&group, 0, sizeof(group));
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Count one matching row to its group.
+
+  Wants:
+    Row's serial and devType, timestamp and data length.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+Aggregate::add(char const *const serial, size_t const serialLen, char const *const devType, size_t const devTypeLen, 
+               struct timeval const &ts, size_t const dataLen)
+{
+    if (groupBy_ & REC_GROUP_SERIAL) {
+        key_.first.assign(serial, serialLen);
+    }
+    if (groupBy_ & REC_GROUP_DEVTYPE) {
+        key_.second.assign(devType, devTypeLen);
+    }
+
+    Groups_t::iterator it = groups_.find(key_);
+    if (groups_.end() == it) {
+        Group group;
+        memset(&group, 0, sizeof(group));
+        it = groups_.insert(std::make_pair(key_, group)).first;
+    }
+
+    add(it->second, ts, 1, dataLen);
+    ++count_;
+}
+
+
+void
+Aggregate::add(Group &group, struct timeval const &ts, uint64_t const count, uint64_t const bytes) const
+{
+    if (0 == group.count  ||  timercmp(&ts, &group.first, < )) {
+        group.first = ts;
+    }
+    if (0 == group.count  ||  timercmp(&ts, &group.last, > )) {
+        group.last = ts;
+    }
+    group.count += count;
+    group.bytes += bytes;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add the groups of another aggregate of the same request, e.g. one
+    computed by another thread.
+----------------------------------------------------------------------------*/
+void
+Aggregate::merge(Aggregate const &other)
+{
+    for (Groups_t::const_iterator it = other.groups_.begin(); it != other.groups_.end(); ++it) {
+        merge(it->first, it->second);
+    }
+
+    count_ += other.count_;
+}
+
+
+void
+Aggregate::merge(Key_t const &key, Group const &theirs)
+{
+    Groups_t::iterator const mine = groups_.find(key);
+
+    if (groups_.end() == mine  ||  0 == mine->second.count) {
+        groups_[key] = theirs;
+    }
+    else if (theirs.count > 0) {
+        add(mine->second, theirs.first, 0, 0);
+        add(mine->second, theirs.last, theirs.count, theirs.bytes);
+    }
+}
+
+
+static inline uint32_t
+getU32(char const *const ptr)
+{
+    uint32_t tmp;
+    memcpy(&tmp, ptr, sizeof(tmp));
+    return ntohl(tmp);
+}
+
+
+static inline uint64_t
+getU64(char const *const ptr)
+{
+    return ((uint64_t) getU32(ptr) << 32) | getU32(ptr + sizeof(uint32_t));
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add a group as another Sink sent it in reply to the same request, e.g.
+    a Sink that runs in another thread and can only send.
+
+  Wants:
+    Reply Record with the group's fields, as send() makes them.
+
+  Gives:
+    True on success, false if the reply is not one of this request's.
+----------------------------------------------------------------------------*/
+bool
+Aggregate::addReply(Record const &reply)
+{
+    size_t const size = REC_ACT_STATS == action_ ? 32 : 8;
+    char const *const data = reply.data.data();
+
+    if (reply.data.length() != size) {
+        return false;
+    }
+
+    uint64_t const count = getU64(data);
+    if (0 == count) {
+        // Sent only for the one group without grouping, which we have
+        return true;
+    }
+
+    if (groupBy_ & REC_GROUP_SERIAL) {
+        key_.first = reply.serial;
+    }
+    if (groupBy_ & REC_GROUP_DEVTYPE) {
+        key_.second = reply.devType;
+    }
+
+    Group theirs;
+    theirs.count = count;
+    theirs.first = reply.timestamp;
+    theirs.last = reply.timestamp;
+    theirs.bytes = 0;
+
+    if (REC_ACT_STATS == action_) {
+        theirs.first.tv_sec = getU32(data + 8);
+        theirs.first.tv_usec = getU32(data + 12);
+        theirs.last.tv_sec = getU32(data + 16);
+        theirs.last.tv_usec = getU32(data + 20);
+        theirs.bytes = getU64(data + 24);
+    }
+
+    merge(key_, theirs);
+    count_ += count;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give a send function that adds the Records to this aggregate instead
+    of sending them, for the Sinks that have only Records to give. It
+    must not outlive the aggregate.
+----------------------------------------------------------------------------*/
+Sink::SendRecord_f
+Aggregate::collector(void)
+{
+    return [this] (Record const &rec, uint64_t) { add(rec); return 0; };
+}
+
+
+static inline char *
+putU32(char *const ptr, uint32_t const value)
+{
+    uint32_t const tmp = htonl(value);
+    memcpy(ptr, &tmp, sizeof(tmp));
+    return ptr + sizeof(tmp);
+}
+
+
+static inline char *
+putU64(char *const ptr, uint64_t const value)
+{
+    return putU32(putU32(ptr, value >> 32), value & 0xffffffff);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send one reply per group, in serial and devType order.
+
+  Wants:
+    Handler to a function to use to send the replies.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+Aggregate::send(Sink::SendRecord_f const &send) const
+{
+    std::vector<Groups_t::const_iterator> order;
+    Record rec(REC_ACT_REPLY);
+    char data[32];
+
+
+    for (Groups_t::const_iterator it = groups_.begin(); it != groups_.end(); ++it) {
+        order.push_back(it);
+    }
+    std::sort(order.begin(), order.end(), [] (Groups_t::const_iterator a, Groups_t::const_iterator b) { return a->first < b->first; });
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        Groups_t::const_iterator const it = order[i];
+        Group const &group = it->second;
+        char *ptr = putU64(data, group.count);
+
+        if (REC_ACT_STATS == action_) {
+            ptr = putU32(ptr, group.first.tv_sec);
+            ptr = putU32(ptr, group.first.tv_usec);
+            ptr = putU32(ptr, group.last.tv_sec);
+            ptr = putU32(ptr, group.last.tv_usec);
+            ptr = putU64(ptr, group.bytes);
+        }
+
+        rec.serial = groupBy_ & REC_GROUP_SERIAL ? it->first.first : serial_;
+        rec.devType = groupBy_ & REC_GROUP_DEVTYPE ? it->first.second : devType_;
+        rec.timestamp = group.last;
+        rec.data.assign(data, ptr - data);
+
+        if (send(rec, priv_) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
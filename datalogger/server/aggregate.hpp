@@ -0,0 +1,105 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_AGGREGATE_HPP
+#define HOMEWORK_SERVER_AGGREGATE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "sink.hpp"
+#include "record.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Answer of a COUNT or STATS request: the Records matching its reference
+    counted in groups, without sending them. Sinks add every matching row
+    while they scan, from wherever the row's fields are.
+
+    Groups are by serial, devType, both or neither, as the request's
+    groupBy tells. Each group is sent as one reply, in serial and devType
+    order: the group's serial and devType, or the reference's for the
+    fields not grouped by, the newest timestamp, and in the data field
+    COUNT:  count
+    STATS:  count, oldest timestamp, newest timestamp, data bytes
+    Counts and bytes are 64 bits, timestamps seconds and microseconds
+    32 bits each, all in network byte order. Without grouping there is
+    always one reply, even if nothing matched.
+----------------------------------------------------------------------------*/
+class Aggregate
+{
+public:
+    explicit Aggregate(Record const &ref);
+
+    void add(char const *serial, size_t serialLen, char const *devType, size_t devTypeLen, struct timeval const &ts, size_t dataLen);
+    void add(Record const &rec) { add(rec.serial.data(), rec.serial.length(), rec.devType.data(), rec.devType.length(), rec.timestamp, rec.data.length()); }
+    void merge(Aggregate const &other);
+    bool addReply(Record const &reply);
+
+    Sink::SendRecord_f collector(void);
+    bool send(Sink::SendRecord_f const &send) const;
+
+    uint64_t count(void) const { return count_; }
+
+private:
+    struct Group {
+        uint64_t count;
+        struct timeval first;
+        struct timeval last;
+        uint64_t bytes;
+    };
+
+    typedef std::pair<std::string, std::string> Key_t;  // Serial and devType
+
+    struct KeyHash {
+        size_t operator () (Key_t const &key) const { 
+            return std::hash<std::string>()(key.first) * 31 + std::hash<std::string>()(key.second); 
+        }
+    };
+
+    typedef std::unordered_map<Key_t, Group, KeyHash> Groups_t;
+
+    void add(Group &group, struct timeval const &ts, uint64_t count, uint64_t bytes) const;
+    void merge(Key_t const &key, Group const &theirs);
+
+    uint16_t action_;
+    uint16_t groupBy_;
+    std::string serial_;     // Reference's, sent for the fields not grouped by
+    std::string devType_;
+    uint64_t priv_;
+
+    Groups_t groups_;
+    Key_t key_;              // Reused to look groups up without allocating
+    uint64_t count_;
+};
+
+
+#endif  // HOMEWORK_SERVER_AGGREGATE_HPP
@@ -25,9 +25,24 @@ OTHER DEALINGS IN THE SOFTWARE.
 For more information, please refer to <http://unlicense.org>
 ----------------------------------------------------------------------------*/
 
+
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <algorithm>
 #include "asciitxtSink.hpp"
+#include "sinkOptions.hpp"
+#include "aggregate.hpp"
+#include "queryPage.hpp"
+#include "record.hpp"
+
+
+// Longest line of a Record without its fields: seconds, dot, microseconds, three spaces and newline
+#define LINE_OVERHEAD  (10 + 1 + 6 + 3 + 1)
 
 
 /*---- Singleton ------------------------------------------------------------
@@ -37,40 +52,737 @@ For more information, please refer to <http://unlicense.org>
 static AsciitxtSink const *sinkSingleton = new AsciitxtSink;
 
 
+/*---- Namespace ------------------------------------------------------------
+  Contains:
+    Formatting and parsing of the line fields. They work on raw buffers
+    and never allocate, unlike iostreams and snprintf().
+----------------------------------------------------------------------------*/
+namespace {
+
+    char const hexDigits[] = "0123456789abcdef";
+
+    // Bytes that are escaped in serial and devType
+    inline bool
+    needsEscape(unsigned char const c)
+    {
+        return c <= ' '  ||  c >= 0x7f  ||  '%' == c;
+    }
+
+    // Value of a hex digit, or -1
+    inline int
+    hexValue(char const c)
+    {
+        if (c >= '0'  &&  c <= '9')  return c - '0';
+        if (c >= 'a'  &&  c <= 'f')  return c - 'a' + 10;
+        if (c >= 'A'  &&  c <= 'F')  return c - 'A' + 10;
+        return -1;
+    }
+
+    char *
+    putUint(char *ptr, uint32_t value)
+    {
+        char tmp[10];
+        int n = 0;
+
+        do {
+            tmp[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+
+        while (n) {
+            *ptr++ = tmp[--n];
+        }
+        return ptr;
+    }
+
+    // Exactly six digits
+    char *
+    putUsec(char *const ptr, uint32_t value)
+    {
+        for (int i = 5; i >= 0; --i) {
+            ptr[i] = '0' + value % 10;
+            value /= 10;
+        }
+        return ptr + 6;
+    }
+
+    char *
+    putEscaped(char *ptr, std::string const &field)
+    {
+        for (size_t i = 0; i < field.length(); ++i) {
+            unsigned char const c = field[i];
+            if (needsEscape(c)) {
+                *ptr++ = '%';
+                *ptr++ = hexDigits[c >> 4];
+                *ptr++ = hexDigits[c & 15];
+            }
+            else {
+                *ptr++ = c;
+            }
+        }
+        return ptr;
+    }
+
+    char *
+    putHex(char *ptr, std::string const &data)
+    {
+        for (size_t i = 0; i < data.length(); ++i) {
+            unsigned char const c = data[i];
+            *ptr++ = hexDigits[c >> 4];
+            *ptr++ = hexDigits[c & 15];
+        }
+        return ptr;
+    }
+
+    // Parse decimal digits up to the delimiter. Gives the position after the delimiter or NULL.
+    char const *
+    getUint(char const *ptr, char const *const end, char const delim, uint32_t &value)
+    {
+        char const *const start = ptr;
+        uint64_t v = 0;
+
+        while (ptr < end  &&  *ptr >= '0'  &&  *ptr <= '9') {
+            v = v * 10 + (*ptr++ - '0');
+        }
+        if (ptr == start  ||  ptr - start > 10  ||  ptr == end  ||  *ptr != delim  ||  v > UINT32_MAX) {
+            return NULL;
+        }
+
+        value = v;
+        return ptr + 1;
+    }
+
+    bool
+    getUnescaped(std::string &dest, char const *ptr, char const *const end)
+    {
+        dest.clear();
+
+        while (ptr < end) {
+            if ('%' != *ptr) {
+                dest += *ptr++;
+                continue;
+            }
+            int const hi = end - ptr > 2 ? hexValue(ptr[1]) : -1;
+            int const lo = hi >= 0 ? hexValue(ptr[2]) : -1;
+            if (lo < 0) {
+                return false;
+            }
+            dest += (char) (hi << 4 | lo);
+            ptr += 3;
+        }
+        return true;
+    }
+
+    bool
+    getHex(std::string &dest, char const *ptr, char const *const end)
+    {
+        dest.clear();
+
+        if ((end - ptr) & 1) {
+            return false;
+        }
+        for (; ptr < end; ptr += 2) {
+            int const hi = hexValue(ptr[0]);
+            int const lo = hexValue(ptr[1]);
+            if ((hi | lo) < 0) {
+                return false;
+            }
+            dest += (char) (hi << 4 | lo);
+        }
+        return true;
+    }
+
+
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        Line split to its fields in place.
+    ----------------------------------------------------------------------------*/
+    struct LineView {
+        struct timeval timestamp;
+        char const *serial;
+        char const *devType;
+        char const *data;
+        uint32_t serialLen;
+        uint32_t devTypeLen;
+        uint32_t dataLen;
+    };
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Split one line to its fields.
+
+      Wants:
+        Destination view.
+        Line's start and end, without the newline.
+
+      Gives:
+        True if the line is well formed.
+    ----------------------------------------------------------------------------*/
+    bool
+    viewLine(LineView &view, char const *const line, char const *const end)
+    {
+        uint32_t sec, usec;
+        char const *ptr = getUint(line, end, '.', sec);
+
+        if (!ptr  ||  end - ptr < 7  ||  ' ' != ptr[6]) {
+            return false;
+        }
+        if (!getUint(ptr, ptr + 7, ' ', usec)  ||  usec > 999999) {
+            return false;
+        }
+        ptr += 7;
+
+        view.timestamp.tv_sec = sec;
+        view.timestamp.tv_usec = usec;
+
+        char const *const space1 = (char const *) memchr(ptr, ' ', end - ptr);
+        char const *const space2 = space1 ? (char const *) memchr(space1 + 1, ' ', end - space1 - 1) : NULL;
+        if (!space2) {
+            return false;
+        }
+
+        view.serial = ptr;
+        view.serialLen = space1 - ptr;
+        view.devType = space1 + 1;
+        view.devTypeLen = space2 - space1 - 1;
+        view.data = space2 + 1;
+        view.dataLen = end - space2 - 1;
+        return true;
+    }
+
+    // Escaped field against escaped reference
+    inline bool
+    fieldMatch(char const *const field, uint32_t const len, std::string const &ref, std::string const &escapedRef)
+    {
+        return ref == "*"  ||  (escapedRef.length() == len  &&  0 == memcmp(field, escapedRef.data(), len));
+    }
+
+    std::string
+    escaped(std::string const &field)
+    {
+        std::string out(field.length() * 3, '\0');
+        out.resize(putEscaped(&out[0], field) - out.data());
+        return out;
+    }
+
+}  // namespace
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members.
+----------------------------------------------------------------------------*/
+AsciitxtSinkImpl::AsciitxtSinkImpl()
+: fd_(-1), size_(0), orderedEnd_(UINT64_MAX), syncBatch_(false), wpos_(0), bufferedRecs_(0), pendingRecs_(0)
+{
+    timerclear(&maxTs_);
+}
+
+
 /*---- Destructor -----------------------------------------------------------
   Does:
     Called on application termination. Close the database.
 ----------------------------------------------------------------------------*/
 AsciitxtSinkImpl::~AsciitxtSinkImpl()
 { 
+    if (fd_ >= 0) {
+        writeOut();
+        if (syncBatch_) {
+            fdatasync(fd_);
+        }
+        close(fd_);
+        std::cout << "Closed sink file" << std::endl;
+        printStats(std::cout);
+    }
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Open the datebase file in binary mode for reading and writing.
+    Open the datebase file for appending and reading, and cut off a torn
+    line that a crash may have left at its end.
   
   Wants:
     File name.
+    Size of the write buffer.
+    True to make every batch durable.
     
   Gives: 
     True on success
 ----------------------------------------------------------------------------*/
 bool
-AsciitxtSinkImpl::open(std::string const &filename)
+AsciitxtSinkImpl::open(std::string const &filename, size_t const bufferSize, bool const syncBatch)
 {
-    std::cerr << "Sorry, no implementation" << std::endl;
-    std::cerr << "This is an example of what is required to implement a new Sink" << std::endl;
-    abort();
+    struct stat st;
+
+
+    if (fd_ >= 0) {
+        return false;
+    }
+
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0  ||  fstat(fd_, &st) < 0) {
+        std::cerr << "Can't open " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_ = st.st_size;
+    syncBatch_ = syncBatch;
+    wbuf_.resize(bufferSize);
+
+    return recover()  &&  loadLatest();
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Allocate implementation for Bintxt sink. Allow only one instance.
-      
+    Rebuild the latest Records view from all lines, and find how far they
+    are in timestamp order.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+AsciitxtSinkImpl::loadLatest(void)
+{
+    Record all(REC_ACT_GET_AFTER);
+
+    checkOrder();
+
+    all.serial = "*";
+    all.devType = "*";
+    return queryRec(all, latest_.collector());
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Find the newest timestamp and the first line older than a line before
+    it, if any. Malformed lines are passed over.
+----------------------------------------------------------------------------*/
+void
+AsciitxtSinkImpl::checkOrder(void)
+{
+    char const *const base = map_.data();
+    char const *line = base;
+    char const *const fileEnd = base + size_;
+
+
+    while (line < fileEnd) {
+        char const *const end = (char const *) memchr(line, '\n', fileEnd - line);
+        LineView view;
+
+        if (!end) {
+            break;
+        }
+
+        if (viewLine(view, line, end)) {
+            if (!timercmp(&view.timestamp, &maxTs_, < )) {
+                maxTs_ = view.timestamp;
+            }
+            else if (UINT64_MAX == orderedEnd_) {
+                orderedEnd_ = line - base;
+            }
+        }
+
+        line = end + 1;
+    }
+
+    if (orderedEnd_ < size_) {
+        std::cout << "Sink lines are out of timestamp order from offset " << orderedEnd_ << std::endl;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Truncate the file after its last complete line.
+----------------------------------------------------------------------------*/
+bool
+AsciitxtSinkImpl::recover(void)
+{
+    if (0 == size_) {
+        return true;
+    }
+
+    if (!map_.cover(fd_, size_)) {
+        return false;
+    }
+
+    char const *const base = map_.data();
+    char const *const lastNl = (char const *) memrchr(base, '\n', size_);
+    uint64_t const keep = lastNl ? lastNl - base + 1 : 0;
+
+    if (keep == size_) {
+        return true;
+    }
+
+    std::cerr << "Sink line at offset " << keep << " is torn, truncated " << size_ - keep << " bytes" << std::endl;
+    if (ftruncate(fd_, keep) < 0) {
+        std::cerr << "Sink truncate error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_ = keep;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process record received from client based on its 'action'.
+  
+  Wants:
+    Record's data.
+    Handler to a function to use to send the reply.
+    
+  Gives: 
+    1 on successful store action, or
+    0 on other success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+AsciitxtSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    bool ret = false;
+
+
+    switch (rec.action) {
+    case REC_ACT_STORE:
+        if (true == (ret = storeRec(rec))) {
+            return 1;
+        }
+        break;
+
+    case REC_ACT_GET_AFTER:
+        ret = queryRec(rec, send);
+        break;
+
+    case REC_ACT_COUNT:
+    case REC_ACT_STATS: {
+        // Lines are parsed to Records anyway, so count those
+        Aggregate agg(rec);
+        ret = queryRec(rec, agg.collector())  &&  agg.send(send);
+        break;
+    }
+
+    case REC_ACT_GET_LATEST:
+        ret = latest_.send(rec, send);
+        break;
+    }
+
+    return ret ? 0 : -1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    End of a batch of Records. Write the buffered lines to the file with
+    one write(), and make them durable if asked to.
+----------------------------------------------------------------------------*/
+void
+AsciitxtSinkImpl::flush(void)
+{
+    writeOut();
+
+    if (syncBatch_  &&  pendingRecs_ > 0) {
+        if (fdatasync(fd_) < 0) {
+            std::cerr << "Sink sync error: " << strerror(errno) << std::endl;
+        }
+        ++stats_.syncs;
+        pendingRecs_ = 0;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Format one record to the write buffer. Write the buffer out first if
+    the line might not fit.
+  
+  Wants:
+    Record's data.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+AsciitxtSinkImpl::storeRec(Record const &rec)
+{
+    size_t const maxLen = LINE_OVERHEAD + 3 * (rec.serial.length() + rec.devType.length()) + 2 * rec.data.length();
+    bool ok = true;
+
+
+    if (wpos_ + maxLen > wbuf_.size()) {
+        ok = writeOut();
+        if (maxLen > wbuf_.size()) {
+            wbuf_.resize(maxLen);
+        }
+    }
+
+    // The clock may step back
+    if (!timercmp(&rec.timestamp, &maxTs_, < )) {
+        maxTs_ = rec.timestamp;
+    }
+    else {
+        orderedEnd_ = std::min<uint64_t>(orderedEnd_, size_ + wpos_);
+    }
+
+    char *ptr = &wbuf_[wpos_];
+
+    ptr = putUint(ptr, rec.timestamp.tv_sec);
+    *ptr++ = '.';
+    ptr = putUsec(ptr, rec.timestamp.tv_usec);
+    *ptr++ = ' ';
+    ptr = putEscaped(ptr, rec.serial);
+    *ptr++ = ' ';
+    ptr = putEscaped(ptr, rec.devType);
+    *ptr++ = ' ';
+    ptr = putHex(ptr, rec.data);
+    *ptr++ = '\n';
+
+    wpos_ = ptr - &wbuf_[0];
+    ++bufferedRecs_;
+    latest_.store(rec);
+    ++pendingRecs_;
+
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the buffered lines to the file.
+  
   Wants:
     Nothing.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+AsciitxtSinkImpl::writeOut(void)
+{
+    size_t done = 0;
+
+
+    if (0 == wpos_) {
+        return true;
+    }
+
+    while (done < wpos_) {
+        ssize_t const ret = write(fd_, &wbuf_[done], wpos_ - done);
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            std::cerr << "Sink write error: " << strerror(errno) << std::endl;
+            break;
+        }
+        done += ret;
+    }
+
+    bool const ok = done == wpos_;
+    if (!ok) {
+        std::cerr << "Sink lost " << bufferedRecs_ << " records" << std::endl;
+        // Don't leave a torn line for the next write to continue
+        if (ftruncate(fd_, size_) < 0) {
+            std::cerr << "Sink truncate error: " << strerror(errno) << std::endl;
+        }
+        done = 0;
+    }
+
+    ++stats_.writes;
+    stats_.writtenRecs += ok ? bufferedRecs_ : 0;
+    stats_.writtenBytes += done;
+    size_ += done;
+
+    wpos_ = 0;
+    bufferedRecs_ = 0;
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print write batch sizes and how many lines queries parsed.
+  
+  Wants:
+    Output stream.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+AsciitxtSinkImpl::printStats(std::ostream &os) const
+{
+    os << "Asciitxt: " << stats_.writtenRecs << " records, " << stats_.writtenBytes << " bytes in " << stats_.writes << " writes, " 
+        << (stats_.writes ? stats_.writtenRecs / stats_.writes : 0) << " records per write, " << stats_.syncs << " syncs" << std::endl;
+
+    os << "  " << stats_.queries << " queries parsed " << stats_.linesParsed << " lines, " << stats_.linesMatched << " matched, " 
+        << stats_.linesBad << " malformed" << std::endl;
+
+    if (orderedEnd_ < UINT64_MAX) {
+        os << "  Lines out of timestamp order from offset " << orderedEnd_ << std::endl;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Find the first line that may be newer than the given time. Up to
+    orderedEnd_ lines are in timestamp order, so it is a binary search on
+    line starts there. A malformed line ends the search where it is.
+  
+  Wants:
+    Timestamp.
+    
+  Gives: 
+    Offset of a line to start the scan from.
+----------------------------------------------------------------------------*/
+uint64_t
+AsciitxtSinkImpl::findFirst(struct timeval const &after) const
+{
+    char const *const base = map_.data();
+    uint64_t lo = 0;          // A line start. Lines before it are older.
+    uint64_t hi = std::min(size_, orderedEnd_);   // The first new enough line starts at or before this.
+
+
+    while (hi - lo > 4096) {
+        uint64_t const mid = lo + (hi - lo) / 2;
+        char const *const nl = (char const *) memchr(base + mid, '\n', hi - mid);
+
+        if (!nl  ||  (uint64_t) (nl + 1 - base) >= hi) {
+            break;
+        }
+
+        uint64_t const start = nl + 1 - base;
+        char const *const end = (char const *) memchr(base + start, '\n', size_ - start);
+        LineView view;
+
+        if (!end  ||  !viewLine(view, base + start, end)) {
+            break;
+        }
+
+        if (timercmp(&view.timestamp, &after, < )) {
+            lo = start;
+        }
+        else {
+            hi = start;
+        }
+    }
+
+    return lo;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every record matching the given reference: newer or as new as its
+    timestamp and older than its end, with its serial and devType unless
+    they are wildcards '*'. Lines are matched in place against the escaped
+    reference and parsed to a Record only when they match. A paged query
+    starts from the line in its cursor and stops when the page is full.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+AsciitxtSinkImpl::queryRec(Record const &reference, Sink::SendRecord_f const &send)
+{
+    std::string const serial(escaped(reference.serial));
+    std::string const devType(escaped(reference.devType));
+    QueryPage page(reference);
+    Record rec(REC_ACT_REPLY);
+
+
+    if (!page.valid()) {
+        return false;
+    }
+
+    // Buffered Records must be visible to the query
+    writeOut();
+
+    ++stats_.queries;
+
+    if (0 == size_) {
+        return true;
+    }
+
+    if (!map_.cover(fd_, size_)) {
+        return false;
+    }
+
+    char const *const base = map_.data();
+    char const *const fileEnd = base + size_;
+    char const *line = base + std::max(findFirst(reference.timestamp), std::min(page.position(), size_));
+
+    while (line < fileEnd  &&  !page.full()) {
+        char const *const end = (char const *) memchr(line, '\n', fileEnd - line);
+        if (!end) {
+            break;
+        }
+
+        LineView view;
+        uint64_t const at = line - base;
+        char const *const next = end + 1;
+
+        ++stats_.linesParsed;
+
+        if (!viewLine(view, line, end)) {
+            ++stats_.linesBad;
+            line = next;
+            continue;
+        }
+        line = next;
+
+        if (!reference.beforeEnd(view.timestamp)) {
+            // Lines up to orderedEnd_ are in timestamp order, so the rest of them are too new
+            if (at < orderedEnd_) {
+                line = base + std::min(size_, orderedEnd_);
+            }
+            continue;
+        }
+
+        if (timercmp(&view.timestamp, &reference.timestamp, < )  ||  
+            !fieldMatch(view.devType, view.devTypeLen, reference.devType, devType)  ||  
+            !fieldMatch(view.serial, view.serialLen, reference.serial, serial)) 
+        {
+            continue;
+        }
+
+        rec.timestamp = view.timestamp;
+        if (!getUnescaped(rec.serial, view.serial, view.serial + view.serialLen)  ||  
+            !getUnescaped(rec.devType, view.devType, view.devType + view.devTypeLen)  ||  
+            !getHex(rec.data, view.data, view.data + view.dataLen)) 
+        {
+            ++stats_.linesBad;
+            continue;
+        }
+
+        ++stats_.linesMatched;
+        if (page.send(rec, 0, line - base, send) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate implementation for Asciitxt sink. Allow only one instance.
+      
+  Wants:
+    Options: FILE[,buffer=BYTES][,commit=none|batch]
 
   Gives: 
     True on success.
@@ -78,23 +790,40 @@ AsciitxtSinkImpl::open(std::string const &filename)
 bool
 AsciitxtSink::open(std::string const &opts)
 {
-    std::string filename(opts.length() > 0 ? opts : "filedb.txt");
+    SinkOptions const options(opts, "filedb.txt");
+    std::string const &filename(options.path());
+    long long const bufferSize = options.getSize("buffer", 256 << 10);
+    std::string const commit(options.get("commit", "none"));
 
 
     if (pImpl_) {
         return false;
     }
 
+    if (options.unknown().length() > 0) {
+        std::cerr << "Unknown asciitxt option '" << options.unknown() << "'" << std::endl;
+        return false;
+    }
+
+    if (bufferSize < 4096  ||  bufferSize > (64 << 20)) {
+        std::cerr << "Invalid buffer size " << bufferSize << std::endl;
+        return false;
+    }
+
+    if (commit != "none"  &&  commit != "batch") {
+        std::cerr << "Invalid commit policy '" << commit << "'" << std::endl;
+        return false;
+    }
+
     if (NULL == (pImpl_ = new AsciitxtSinkImpl)) {
         return false;
     }
 
-    if (!pImpl_->open(filename)) {
+    if (!pImpl_->open(filename, bufferSize, "batch" == commit)) {
         std::cerr << "Can't open file " << filename << std::endl;
         abort();
     }
 
-    std::cout << "Opened sink: File " << filename << std::endl;
+    std::cout << "Opened sink: File " << filename << ", commit " << commit << std::endl;
     return true;
 }
-
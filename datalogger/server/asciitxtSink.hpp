@@ -25,28 +25,89 @@ OTHER DEALINGS IN THE SOFTWARE.
 For more information, please refer to <http://unlicense.org>
 ----------------------------------------------------------------------------*/
 
-#ifndef HOMEWORK_SERVER_BINTXT_SINK_HPP
-#define HOMEWORK_SERVER_BINTXT_SINK_HPP
+#ifndef HOMEWORK_SERVER_ASCIITXT_SINK_HPP
+#define HOMEWORK_SERVER_ASCIITXT_SINK_HPP
 
+#include <stdint.h>
+#include <string>
+#include <vector>
 #include "sink.hpp"
+#include "bintxtMap.hpp"
+#include "latestView.hpp"
 
 struct Record;
 
 
 /*---- Class ----------------------------------------------------------------
   Does:
-    Servers as an example of another Sink. Currently has no implementation.
+    Implement Asciitxt Sink functionality: a human readable database, one
+    line per Record:
+
+      SECONDS.MICROSECONDS SERIAL DEVTYPE DATA
+
+    Serial and devType are written as such, except that spaces, control
+    characters, '%' and bytes over 0x7e are escaped as %XX. Data is written
+    in hex. The file can be read with grep, cut and xxd -r -p.
+
+    Records are formatted to a write buffer without allocations and written
+    with one write() per batch. Queries read the file through a memory map
+    and parse the lines in place, so only the matching Records are copied.
+    Lines are appended in timestamp order unless the clock steps back, so
+    the Sink tracks how far the file is in order. A query binary searches
+    that part for the first line that is new enough, and skips the rest of
+    it at the first line past the end of the window; lines after it are
+    all read. A paged query resumes from the line offset in its cursor. The latest
+    Record of every serial and devType is kept in memory for GET_LATEST
+    and rebuilt with one scan on open.
 ----------------------------------------------------------------------------*/
 class AsciitxtSinkImpl
 {
 public:
-    AsciitxtSinkImpl() {}
+    AsciitxtSinkImpl();
     ~AsciitxtSinkImpl();
 
-    bool open(std::string const &filename);
-    int processRec(Record const &rec, Sink::SendRecord_f const &send) { return -1; }
+    bool open(std::string const &filename, size_t bufferSize, bool syncBatch);
+
+    int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    void flush(void);
+
+    void printStats(std::ostream &os) const;
 
 private:
+    bool recover(void);
+    bool loadLatest(void);
+    void checkOrder(void);
+    bool storeRec(Record const &rec);
+    bool queryRec(Record const &ref, Sink::SendRecord_f const &send);
+    bool writeOut(void);
+    uint64_t findFirst(struct timeval const &after) const;
+
+    int fd_;
+    uint64_t size_;             // Bytes in the file
+    struct timeval maxTs_;      // Newest line's timestamp
+    uint64_t orderedEnd_;       // Lines before this are in timestamp order, UINT64_MAX if all
+    bool syncBatch_;            // fdatasync() at the end of every batch
+
+    std::vector<char> wbuf_;    // Lines not yet written
+    size_t wpos_;
+    unsigned bufferedRecs_;
+    unsigned pendingRecs_;      // Records since the last fdatasync()
+
+    BintxtMap map_;
+    LatestView latest_;
+
+    struct Stats {
+        Stats() : writes(0), writtenRecs(0), writtenBytes(0), syncs(0), queries(0), linesParsed(0), linesMatched(0), linesBad(0) {}
+
+        uint64_t writes;
+        uint64_t writtenRecs;
+        uint64_t writtenBytes;
+        uint64_t syncs;
+        uint64_t queries;
+        uint64_t linesParsed;
+        uint64_t linesMatched;
+        uint64_t linesBad;
+    } stats_;
 };
 
 
@@ -59,7 +120,7 @@ private:
 class AsciitxtSink : public Sink
 {
 public:
-    AsciitxtSink() : Sink("asciitxt"), pImpl_(NULL) {}
+    explicit AsciitxtSink(char const *const name = "asciitxt") : Sink(name), pImpl_(NULL) {}
     virtual ~AsciitxtSink() { if (pImpl_) delete pImpl_; }
 
     virtual bool open(std::string const &opts);
@@ -72,10 +133,18 @@ public:
         Creates binding to implementation's functions.
     ----------------------------------------------------------------------------*/
     virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&AsciitxtSinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&Sink::processEach<AsciitxtSinkImpl *>, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&AsciitxtSinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { if (pImpl_) pImpl_->printStats(os); }
+    virtual Sink *another(void) const { return new AsciitxtSink(NULL); }
 
 private:
     AsciitxtSinkImpl *pImpl_;
 };
 
 
-#endif  // HOMEWORK_SERVER_BINTXT_SINK_HPP
+#endif  // HOMEWORK_SERVER_ASCIITXT_SINK_HPP
@@ -0,0 +1,758 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+#include <arpa/inet.h>
+#include "bintxtIndex.hpp"
+#include "bintxtRow.hpp"
+#include "record.hpp"
+
+
+// Side file: magic, version, then entries of maxBefore seconds and
+// microseconds and 64 bit offset. Network byte order.
+#define TIME_INDEX_MAGIC     0x42544958  // "BTIX"
+#define TIME_INDEX_VERSION   1
+#define TIME_INDEX_HDR_SIZE  8
+#define TIME_INDEX_ENT_SIZE  16
+
+// A block never grows larger than this, regardless of its row count
+#define TIME_INDEX_MAX_BLOCK  65536
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Index is disabled until open().
+----------------------------------------------------------------------------*/
+BintxtTimeIndex::BintxtTimeIndex()
+: fd_(-1), everyRecs_(0), persisted_(0), maxTs_({0, 0}), recsSince_(0), bytesSince_(0)
+{
+}
+
+
+BintxtTimeIndex::~BintxtTimeIndex()
+{
+    if (fd_ >= 0) {
+        persist();
+        close(fd_);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the side file and load it. Index the rows the side file does not
+    cover yet, or all of them if the side file is missing or invalid.
+
+  Wants:
+    Side file's path.
+    Data file's descriptor and size.
+    Number of rows in a block.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtTimeIndex::open(std::string const &path, int const dataFd, uint64_t const dataSize, uint32_t const everyRecs)
+{
+    if (fd_ >= 0) {
+        return false;
+    }
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Can't open index " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    everyRecs_ = everyRecs;
+
+    if (!load(dataSize)) {
+        if (dataSize > 0) {
+            std::cout << "Rebuilding index " << path << std::endl;
+        }
+        if (!reset()) {
+            return false;
+        }
+    }
+
+    uint64_t const from = entries_.empty() ? 0 : entries_.back().offset;
+
+    bintxt::scanRows(dataFd, from, dataSize, [this] (char const *const row, int const len, uint64_t const offset) {
+        struct timeval ts;
+        bintxt::peekRow(ts, row, len);
+        note(ts, offset, len);
+        return true;
+    });
+
+    return persist();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the side file. Entries that point past the data file's end, or are
+    out of order, are dropped together with everything after them.
+
+  Wants:
+    Data file's size.
+
+  Gives:
+    False if the side file must be rebuilt.
+----------------------------------------------------------------------------*/
+bool
+BintxtTimeIndex::load(uint64_t const dataSize)
+{
+    struct stat st;
+    uint32_t hdr[2];
+
+
+    if (fstat(fd_, &st) < 0  ||  st.st_size < TIME_INDEX_HDR_SIZE) {
+        return false;
+    }
+    if (pread(fd_, hdr, sizeof(hdr), 0) != sizeof(hdr)  ||
+        ntohl(hdr[0]) != TIME_INDEX_MAGIC  ||  ntohl(hdr[1]) != TIME_INDEX_VERSION)
+    {
+        return false;
+    }
+
+    size_t const count = (st.st_size - TIME_INDEX_HDR_SIZE) / TIME_INDEX_ENT_SIZE;
+    std::vector<uint32_t> raw(count * 4);
+
+    if (count > 0  &&  pread(fd_, &raw[0], count * TIME_INDEX_ENT_SIZE, TIME_INDEX_HDR_SIZE) != (ssize_t) (count * TIME_INDEX_ENT_SIZE)) {
+        return false;
+    }
+
+    entries_.clear();
+    for (size_t i = 0; i < count; ++i) {
+        Entry e;
+        e.maxBefore.tv_sec = ntohl(raw[4*i]);
+        e.maxBefore.tv_usec = ntohl(raw[4*i + 1]);
+        e.offset = ((uint64_t) ntohl(raw[4*i + 2]) << 32) | ntohl(raw[4*i + 3]);
+
+        if (e.offset > dataSize) {
+            break;
+        }
+        if (!entries_.empty()  &&
+            (e.offset <= entries_.back().offset  ||  timercmp(&e.maxBefore, &entries_.back().maxBefore, <)))
+        {
+            break;
+        }
+        entries_.push_back(e);
+    }
+
+    persisted_ = entries_.size();
+    if (persisted_ < count  &&  ftruncate(fd_, TIME_INDEX_HDR_SIZE + persisted_ * TIME_INDEX_ENT_SIZE) < 0) {
+        return false;
+    }
+
+    maxTs_ = entries_.empty() ? timeval({0, 0}) : entries_.back().maxBefore;
+    recsSince_ = 0;
+    bytesSince_ = 0;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Empty the index and the side file.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtTimeIndex::reset(void)
+{
+    uint32_t const hdr[2] = { htonl(TIME_INDEX_MAGIC), htonl(TIME_INDEX_VERSION) };
+
+    entries_.clear();
+    persisted_ = 0;
+    maxTs_.tv_sec = maxTs_.tv_usec = 0;
+    recsSince_ = 0;
+    bytesSince_ = 0;
+
+    if (ftruncate(fd_, 0) < 0  ||  pwrite(fd_, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        std::cerr << "Can't write index: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Account one row appended to the data file. Start a new block if the
+    current one is full.
+
+  Wants:
+    Row's timestamp, offset and size.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtTimeIndex::note(struct timeval const &ts, uint64_t const offset, uint32_t const size)
+{
+    if (fd_ < 0) {
+        return;
+    }
+
+    if (recsSince_ >= everyRecs_  ||  bytesSince_ >= TIME_INDEX_MAX_BLOCK) {
+        Entry const e = { maxTs_, offset };
+        entries_.push_back(e);
+        recsSince_ = 0;
+        bytesSince_ = 0;
+    }
+
+    if (timercmp(&ts, &maxTs_, >)) {
+        maxTs_ = ts;
+    }
+    ++recsSince_;
+    bytesSince_ += size;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append new entries to the side file. Should be called only after the
+    rows they point to are written, but losing or having extra entries after
+    a crash is harmless: load() drops the ones that point too far.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtTimeIndex::persist(void)
+{
+    if (fd_ < 0  ||  persisted_ == entries_.size()) {
+        return true;
+    }
+
+    std::vector<uint32_t> raw;
+    raw.reserve((entries_.size() - persisted_) * 4);
+
+    for (size_t i = persisted_; i < entries_.size(); ++i) {
+        raw.push_back(htonl(entries_[i].maxBefore.tv_sec));
+        raw.push_back(htonl(entries_[i].maxBefore.tv_usec));
+        raw.push_back(htonl(entries_[i].offset >> 32));
+        raw.push_back(htonl(entries_[i].offset & 0xFFFFFFFF));
+    }
+
+    ssize_t const bytes = raw.size() * sizeof(uint32_t);
+    if (pwrite(fd_, &raw[0], bytes, TIME_INDEX_HDR_SIZE + persisted_ * TIME_INDEX_ENT_SIZE) != bytes) {
+        std::cerr << "Can't write index: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    persisted_ = entries_.size();
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Forget entries past the data file's end after the file was cut short.
+    The running maximum is kept: too large a maximum only makes queries
+    start earlier.
+
+  Wants:
+    New data file size.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtTimeIndex::truncate(uint64_t const dataSize)
+{
+    while (!entries_.empty()  &&  entries_.back().offset > dataSize) {
+        entries_.pop_back();
+    }
+
+    if (persisted_ > entries_.size()) {
+        persisted_ = entries_.size();
+        if (fd_ >= 0  &&  ftruncate(fd_, TIME_INDEX_HDR_SIZE + persisted_ * TIME_INDEX_ENT_SIZE) < 0) {
+            std::cerr << "Can't truncate index: " << strerror(errno) << std::endl;
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Find where to start scanning for rows not older than given time.
+
+  Wants:
+    Query's timestamp.
+
+  Gives:
+    File offset of a row. Every row before it is older than the timestamp.
+----------------------------------------------------------------------------*/
+uint64_t
+BintxtTimeIndex::seek(struct timeval const &after) const
+{
+    size_t lo = 0;
+    size_t hi = entries_.size();
+
+    // Find the first entry with maxBefore >= after
+    while (lo < hi) {
+        size_t const mid = (lo + hi) / 2;
+        if (timercmp(&entries_[mid].maxBefore, &after, <)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return 0 == lo ? 0 : entries_[lo - 1].offset;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell where to split a scan to parts of at least given size. Parts start
+    at index entries, so at rows.
+
+  Wants:
+    Scan's range.
+    Least size of a part.
+    Destination for the offsets inside the range where parts start.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtTimeIndex::split(uint64_t const from, uint64_t const to, uint64_t const bytes, std::vector<uint64_t> &at) const
+{
+    uint64_t last = from;
+
+    for (std::vector<Entry>::const_iterator it = entries_.begin(); it != entries_.end()  &&  it->offset < to; ++it) {
+        if (it->offset > last  &&  it->offset - last >= bytes) {
+            at.push_back(it->offset);
+            last = it->offset;
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give the start of the first block after an offset, where a scan can
+    go on past a damaged row.
+
+  Wants:
+    Offset.
+
+  Gives:
+    Offset of a row, or UINT64_MAX if no block starts after the offset.
+----------------------------------------------------------------------------*/
+uint64_t
+BintxtTimeIndex::next(uint64_t const offset) const
+{
+    std::vector<Entry>::const_iterator const it = 
+        std::upper_bound(entries_.begin(), entries_.end(), offset, [] (uint64_t const at, Entry const &entry) { return at < entry.offset; });
+
+    return it == entries_.end() ? UINT64_MAX : it->offset;
+}
+
+
+// Serial index side file: magic, version, then entries of 64 bit offset,
+// serial length byte and serial. Network byte order.
+#define SERIAL_INDEX_MAGIC    0x42545349  // "BTSI"
+#define SERIAL_INDEX_VERSION  1
+#define SERIAL_INDEX_HDR_SIZE 8
+
+// Enough to decode any row the protocol lets through
+#define SERIAL_INDEX_CHECK_SIZE  256
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Index is disabled until open().
+----------------------------------------------------------------------------*/
+BintxtSerialIndex::BintxtSerialIndex() : fd_(-1), fileSize_(0), stale_(false), lastOffset_(-1)
+{
+}
+
+
+BintxtSerialIndex::~BintxtSerialIndex()
+{
+    if (fd_ >= 0) {
+        persist();
+        close(fd_);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the side file and load it. Index the rows the side file does not
+    cover yet, or all of them if the side file is missing or stale.
+
+  Wants:
+    Side file's path.
+    Data file's descriptor and size.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSerialIndex::open(std::string const &path, int const dataFd, uint64_t const dataSize)
+{
+    if (fd_ >= 0) {
+        return false;
+    }
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Can't open index " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (!load(dataFd, dataSize)) {
+        if (dataSize > 0) {
+            std::cout << "Rebuilding index " << path << std::endl;
+        }
+        if (!reset()) {
+            return false;
+        }
+    }
+
+    Record rec;
+    bintxt::scanRows(dataFd, lastOffset_ < 0 ? 0 : lastOffset_, dataSize, [this, &rec] (char const *const row, int const len, uint64_t const offset) {
+        bintxt::decodeRow(rec, row, len);
+        note(rec.serial, offset);
+        return true;
+    });
+
+    return persist();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the side file. Entries that point past the data file's end are
+    dropped. The last entry must point to a row with the same serial.
+
+  Wants:
+    Data file's descriptor and size.
+
+  Gives:
+    False if the side file must be rebuilt.
+----------------------------------------------------------------------------*/
+bool
+BintxtSerialIndex::load(int const dataFd, uint64_t const dataSize)
+{
+    struct stat st;
+    std::vector<char> raw;
+    uint32_t hdr[2];
+
+
+    if (fstat(fd_, &st) < 0  ||  st.st_size < SERIAL_INDEX_HDR_SIZE) {
+        return false;
+    }
+
+    raw.resize(st.st_size);
+    if (pread(fd_, &raw[0], raw.size(), 0) != (ssize_t) raw.size()) {
+        return false;
+    }
+
+    memcpy(hdr, &raw[0], sizeof(hdr));
+    if (ntohl(hdr[0]) != SERIAL_INDEX_MAGIC  ||  ntohl(hdr[1]) != SERIAL_INDEX_VERSION) {
+        return false;
+    }
+
+    serials_.clear();
+    lastOffset_ = -1;
+
+    size_t pos = SERIAL_INDEX_HDR_SIZE;
+    std::string serial;
+
+    while (pos + 9 <= raw.size()) {
+        uint32_t off[2];
+        memcpy(off, &raw[pos], sizeof(off));
+        uint64_t const offset = ((uint64_t) ntohl(off[0]) << 32) | ntohl(off[1]);
+        size_t const len = (unsigned char) raw[pos + 8];
+
+        if (pos + 9 + len > raw.size()  ||  offset >= dataSize  ||  (int64_t) offset <= lastOffset_) {
+            break;
+        }
+
+        serial.assign(&raw[pos + 9], len);
+        serials_[serial].push_back(offset);
+        lastOffset_ = offset;
+        pos += 9 + len;
+    }
+
+    fileSize_ = pos;
+    if (pos < raw.size()  &&  ftruncate(fd_, pos) < 0) {
+        return false;
+    }
+
+    if (lastOffset_ >= 0) {
+        char row[SERIAL_INDEX_CHECK_SIZE];
+        Record rec;
+        ssize_t const got = pread(dataFd, row, sizeof(row), lastOffset_);
+
+        if (got <= 0  ||  0 == bintxt::decodeRow(rec, row, got)  ||  rec.serial != serial) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Empty the index and the side file.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSerialIndex::reset(void)
+{
+    uint32_t const hdr[2] = { htonl(SERIAL_INDEX_MAGIC), htonl(SERIAL_INDEX_VERSION) };
+
+    serials_.clear();
+    pending_.clear();
+    lastOffset_ = -1;
+    fileSize_ = SERIAL_INDEX_HDR_SIZE;
+
+    if (ftruncate(fd_, 0) < 0  ||  pwrite(fd_, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        std::cerr << "Can't write index: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Account one row appended to the data file. Rows already indexed are
+    ignored, which lets open() re-scan from the last indexed row.
+
+  Wants:
+    Row's serial and offset.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSerialIndex::note(std::string const &serial, uint64_t const offset)
+{
+    if (fd_ < 0  ||  (int64_t) offset <= lastOffset_) {
+        return;
+    }
+
+    serials_[serial].push_back(offset);
+    lastOffset_ = offset;
+
+    Pending const p = { serial, offset };
+    pending_.push_back(p);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append new entries to the side file.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSerialIndex::persist(void)
+{
+    if (fd_ < 0) {
+        return true;
+    }
+
+    if (stale_) {
+        return rewrite();
+    }
+
+    if (pending_.empty()) {
+        return true;
+    }
+
+    if (!append(pending_)) {
+        return false;
+    }
+
+    pending_.clear();
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append entries to the end of the side file.
+
+  Wants:
+    Entries in ascending offset order.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSerialIndex::append(std::vector<Pending> const &entries)
+{
+    std::vector<char> raw;
+    raw.reserve(entries.size() * 20);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        uint32_t const off[2] = { htonl(entries[i].offset >> 32), htonl(entries[i].offset & 0xFFFFFFFF) };
+        size_t const len = entries[i].serial.length() < 255 ? entries[i].serial.length() : 255;
+
+        raw.insert(raw.end(), (char const *) off, (char const *) off + sizeof(off));
+        raw.push_back((char) len);
+        raw.insert(raw.end(), entries[i].serial.begin(), entries[i].serial.begin() + len);
+    }
+
+    if (!raw.empty()  &&  pwrite(fd_, &raw[0], raw.size(), fileSize_) != (ssize_t) raw.size()) {
+        std::cerr << "Can't write index: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    fileSize_ += raw.size();
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the whole side file again from memory, in offset order.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSerialIndex::rewrite(void)
+{
+    std::vector<Pending> all;
+    Serials_t keep;
+
+    for (Serials_t::const_iterator it = serials_.begin(); it != serials_.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            Pending const p = { it->first, it->second[i] };
+            all.push_back(p);
+        }
+    }
+
+    std::sort(all.begin(), all.end(), [] (Pending const &a, Pending const &b) { return a.offset < b.offset; });
+
+    keep.swap(serials_);
+    int64_t const last = lastOffset_;
+
+    bool const ok = reset()  &&  append(all);
+
+    serials_.swap(keep);
+    lastOffset_ = last;
+    stale_ = !ok;
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Forget rows past the data file's end after the file was cut short. The
+    side file is rewritten on next persist() if it holds some of them.
+
+  Wants:
+    New data file size.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSerialIndex::truncate(uint64_t const dataSize)
+{
+    if (lastOffset_ < (int64_t) dataSize) {
+        return;
+    }
+
+    for (Serials_t::iterator it = serials_.begin(); it != serials_.end(); ++it) {
+        while (!it->second.empty()  &&  it->second.back() >= dataSize) {
+            it->second.pop_back();
+        }
+    }
+
+    while (!pending_.empty()  &&  pending_.back().offset >= dataSize) {
+        pending_.pop_back();
+    }
+
+    if (pending_.empty()) {
+        // Some of the cut rows are in the side file already
+        stale_ = true;
+    }
+
+    lastOffset_ = -1;
+    for (Serials_t::const_iterator it = serials_.begin(); it != serials_.end(); ++it) {
+        if (!it->second.empty()  &&  (int64_t) it->second.back() > lastOffset_) {
+            lastOffset_ = it->second.back();
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Look up the rows of one serial.
+
+  Wants:
+    Serial.
+
+  Gives:
+    Ascending row offsets, or NULL if the serial has no rows.
+----------------------------------------------------------------------------*/
+BintxtSerialIndex::Offsets_t const *
+BintxtSerialIndex::find(std::string const &serial) const
+{
+    Serials_t::const_iterator const it = serials_.find(serial);
+    return serials_.end() == it ? NULL : &it->second;
+}
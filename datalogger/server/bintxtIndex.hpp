@@ -0,0 +1,144 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_BINTXT_INDEX_HPP
+#define HOMEWORK_SERVER_BINTXT_INDEX_HPP
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Sparse timestamp index of a bintxt file. An entry is made at the start
+    of every block of N rows or 64 KB. The entry holds the block's offset
+    and the greatest timestamp of all rows before it.
+
+    That maximum only grows with the offset, so a binary search finds the
+    last block that has nothing but older rows before it. The scan for
+    "newer than T" starts there. Rows need not be in timestamp order for the
+    result to be correct; the nearer they are, the less is scanned.
+
+    Entries are appended to a side file. A missing side file is rebuilt from
+    the data file, and rows stored after the last entry are re-indexed on
+    open.
+----------------------------------------------------------------------------*/
+class BintxtTimeIndex
+{
+public:
+    BintxtTimeIndex();
+    ~BintxtTimeIndex();
+
+    bool open(std::string const &path, int dataFd, uint64_t dataSize, uint32_t everyRecs);
+
+    void note(struct timeval const &ts, uint64_t offset, uint32_t size);
+    bool persist(void);
+    void truncate(uint64_t dataSize);
+
+    uint64_t seek(struct timeval const &after) const;
+    void split(uint64_t from, uint64_t to, uint64_t bytes, std::vector<uint64_t> &at) const;
+    uint64_t next(uint64_t offset) const;
+    uint64_t checkpoint(void) const { return entries_.empty() ? 0 : entries_.back().offset; }
+    size_t blocks(void) const { return entries_.size(); }
+
+    bool enabled(void) const { return fd_ >= 0; }
+
+private:
+    struct Entry {
+        struct timeval maxBefore;
+        uint64_t offset;
+    };
+
+    bool load(uint64_t dataSize);
+    bool reset(void);
+
+    int fd_;
+    uint32_t everyRecs_;
+
+    std::vector<Entry> entries_;
+    size_t persisted_;        // Number of entries in the side file
+
+    struct timeval maxTs_;    // Of all rows noted
+    uint32_t recsSince_;      // Rows since the last entry
+    uint32_t bytesSince_;
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Secondary index from serial to the offsets of all its rows, so that a
+    query for one device reads only that device's rows. Costs 8 bytes of
+    memory per row, which is why it is optional.
+
+    Entries are appended to a side file like the time index's. On open the
+    last entry is checked against the data file: if the row there has some
+    other serial, the data file was replaced and the index is rebuilt.
+----------------------------------------------------------------------------*/
+class BintxtSerialIndex
+{
+public:
+    typedef std::vector<uint64_t> Offsets_t;
+
+    BintxtSerialIndex();
+    ~BintxtSerialIndex();
+
+    bool open(std::string const &path, int dataFd, uint64_t dataSize);
+
+    void note(std::string const &serial, uint64_t offset);
+    bool persist(void);
+    void truncate(uint64_t dataSize);
+
+    Offsets_t const *find(std::string const &serial) const;
+
+    bool enabled(void) const { return fd_ >= 0; }
+
+private:
+    struct Pending {
+        std::string serial;
+        uint64_t offset;
+    };
+
+    bool load(int dataFd, uint64_t dataSize);
+    bool reset(void);
+    bool rewrite(void);
+    bool append(std::vector<Pending> const &entries);
+
+    int fd_;
+    uint64_t fileSize_;  // Side file's size
+    bool stale_;         // Side file has rows that were cut off
+
+    typedef std::unordered_map<std::string, Offsets_t> Serials_t;
+    Serials_t serials_;
+    int64_t lastOffset_;            // Of the last row indexed, -1 if none
+    std::vector<Pending> pending_;  // Not yet in the side file
+};
+
+
+#endif  // HOMEWORK_SERVER_BINTXT_INDEX_HPP
@@ -0,0 +1,175 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <iostream>
+#include <algorithm>
+#include "bintxtMap.hpp"
+
+
+// Mapping is grown in steps this large to remap seldom
+#define MAP_GROW_STEP  (64ULL << 20)
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Nothing is mapped until cover().
+----------------------------------------------------------------------------*/
+BintxtMap::BintxtMap()
+: base_(NULL), mapLen_(0), size_(0)
+{
+}
+
+
+BintxtMap::~BintxtMap()
+{
+    unmap();
+}
+
+
+void
+BintxtMap::unmap(void)
+{
+    if (base_) {
+        munmap(base_, mapLen_);
+        base_ = NULL;
+        mapLen_ = 0;
+    }
+    size_ = 0;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Make sure that the first bytes of the file are mapped. Remap if the file
+    has grown past the current mapping.
+
+  Wants:
+    File descriptor open for reading.
+    Number of bytes that must be readable. The file must be that large.
+
+  Gives:
+    True on success. On failure nothing stays mapped and the caller should
+    read the file by other means.
+----------------------------------------------------------------------------*/
+bool
+BintxtMap::cover(int const fd, uint64_t const size)
+{
+    if (size <= mapLen_) {
+        size_ = size;
+        return true;
+    }
+
+    uint64_t const len = (size + MAP_GROW_STEP - 1) / MAP_GROW_STEP * MAP_GROW_STEP;
+
+    unmap();
+
+    if (len != (size_t) len) {
+        // Does not fit in the address space
+        return false;
+    }
+
+    void *const ptr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == ptr) {
+        std::cerr << "Sink mmap error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    base_ = (char *) ptr;
+    mapLen_ = len;
+    size_ = size;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Hand every complete row from given offset up to another offset, or the
+    end of the covered size, to the visitor. Tell the kernel to read ahead and drop pages
+    behind while at it.
+
+  Wants:
+    Offset of a row to start from.
+    Offset to stop at.
+    Visitor.
+    Optional destination for the offset following the last complete row.
+
+  Gives:
+    True if all rows were visited, false if the visitor stopped the scan.
+    A torn or corrupt row ends the scan like in bintxt::scanRows().
+----------------------------------------------------------------------------*/
+bool
+BintxtMap::scan(uint64_t const from, uint64_t const to, bintxt::RowVisitor_f const &visit, uint64_t *const end) const
+{
+    struct timeval ts;
+    uint64_t offset = from;
+    uint64_t const last = std::min(to, size_);
+
+
+    if (end) {
+        *end = from;
+    }
+
+    if (from >= last) {
+        return true;
+    }
+
+    uint64_t const page = sysconf(_SC_PAGESIZE);
+    uint64_t const start = from / page * page;
+    madvise(base_ + start, last - start, MADV_SEQUENTIAL);
+
+    bool ret = true;
+
+    while (offset < last) {
+        uint64_t const left = last - offset;
+        int const len = bintxt::peekRow(ts, base_ + offset, left > INT32_MAX ? INT32_MAX : (int) left);
+
+        if (0 == len) {
+            std::cerr << "Sink row at offset " << offset << " is torn or corrupt" << std::endl;
+            ret = NULL != end;
+            break;
+        }
+
+        if (!visit(base_ + offset, len, offset)) {
+            ret = false;
+            break;
+        }
+
+        offset += len;
+    }
+
+    if (end) {
+        *end = offset;
+    }
+
+    // Random reads through the serial index need no read-ahead
+    madvise(base_ + start, last - start, MADV_NORMAL);
+    return ret;
+}
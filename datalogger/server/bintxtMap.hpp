@@ -0,0 +1,68 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_BINTXT_MAP_HPP
+#define HOMEWORK_SERVER_BINTXT_MAP_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bintxtRow.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Read-only memory map of a bintxt file for zero-copy scans. The rows are
+    handed to the visitor right where they are in the page cache; nothing
+    is copied unless the visitor does so.
+
+    The mapping reaches past the end of the file, so it has to be redone
+    only when the file has grown by that slack. Bytes past the size given
+    to cover() must not be touched.
+----------------------------------------------------------------------------*/
+class BintxtMap
+{
+public:
+    BintxtMap();
+    ~BintxtMap();
+
+    bool cover(int fd, uint64_t size);
+
+    char const *data(void) const { return base_; }
+    uint64_t size(void) const { return size_; }
+
+    bool scan(uint64_t from, uint64_t to, bintxt::RowVisitor_f const &visit, uint64_t *end = NULL) const;
+
+private:
+    void unmap(void);
+
+    char *base_;
+    size_t mapLen_;
+    uint64_t size_;   // Valid bytes in the mapping
+};
+
+
+#endif  // HOMEWORK_SERVER_BINTXT_MAP_HPP
@@ -0,0 +1,387 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include <arpa/inet.h>
+#include "bintxtRow.hpp"
+#include "crc32c.hpp"
+#include "record.hpp"
+
+
+// Read buffer of the scanner. Must hold at least one whole row.
+#define SCAN_BUFFER_SIZE  1500
+
+
+namespace bintxt {
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read 32 bit integer in network byte order from unaligned position.
+----------------------------------------------------------------------------*/
+static inline uint32_t
+getU32(char const *const ptr)
+{
+    uint32_t tmp;
+    memcpy(&tmp, ptr, sizeof(tmp));
+    return ntohl(tmp);
+}
+
+
+static inline char *
+putU32(char *const ptr, uint32_t const value)
+{
+    uint32_t const tmp = htonl(value);
+    memcpy(ptr, &tmp, sizeof(tmp));
+    return ptr + sizeof(tmp);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell the size of the Record in database format.
+
+  Wants:
+    Record's data.
+    True if the row gets a CRC.
+
+  Gives:
+    Number of bytes.
+----------------------------------------------------------------------------*/
+int
+rowSize(Record const &rec, bool const crc)
+{
+    return ROW_HEADER_SIZE + rec.serial.length() + rec.devType.length() + rec.data.length() + (crc ? ROW_CRC_SIZE : 0);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Convert one Record from internal structure to the database format.
+
+  Wants:
+    Destination buffer that has room for rowSize() bytes.
+    Record's data.
+    True to end the row with its CRC.
+
+  Gives:
+    Number of bytes written to the buffer.
+----------------------------------------------------------------------------*/
+int
+encodeRow(char *const buffer, Record const &rec, bool const crc)
+{
+    char *ptr = buffer;
+
+    ptr = putU32(ptr, rec.timestamp.tv_sec);
+    ptr = putU32(ptr, rec.timestamp.tv_usec | (crc ? ROW_CRC_FLAG : 0));
+
+    ptr = putU32(ptr, rec.serial.length());
+    ptr += rec.serial.copy(ptr, rec.serial.length());
+
+    ptr = putU32(ptr, rec.devType.length());
+    ptr += rec.devType.copy(ptr, rec.devType.length());
+
+    ptr = putU32(ptr, rec.data.length());
+    ptr += rec.data.copy(ptr, rec.data.length());
+
+    if (crc) {
+        ptr = putU32(ptr, crc32c(buffer, ptr - buffer));
+    }
+
+    return ptr - buffer;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell the timestamp and the length of one row without copying it.
+
+  Wants:
+    Destination for the timestamp.
+    Buffer and size of its valid contents.
+
+  Gives:
+    Number of bytes the row occupies, or
+    0 in case the buffer's data was incomplete or failed its CRC.
+----------------------------------------------------------------------------*/
+int
+peekRow(struct timeval &ts, char const *const buffer, int const dataSize)
+{
+    RowView view;
+    int const ret = viewRow(view, buffer, dataSize);
+
+    ts = view.timestamp;
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Decode one row in place without copying its fields. Check its CRC if it
+    has one.
+
+  Wants:
+    Destination view.
+    Buffer and size of its valid contents.
+
+  Gives:
+    Number of bytes the row occupies, or
+    0 in case the buffer's data was incomplete, failed its CRC or is
+    padding.
+----------------------------------------------------------------------------*/
+int
+viewRow(RowView &view, char const *const buffer, int const dataSize)
+{
+    char const **const fields[3] = { &view.serial, &view.devType, &view.data };
+    uint32_t *const lengths[3] = { &view.serialLen, &view.devTypeLen, &view.dataLen };
+    int pos = 2 * sizeof(uint32_t);
+
+
+    if (dataSize < ROW_HEADER_SIZE) {
+        timerclear(&view.timestamp);
+        return 0;
+    }
+
+    uint32_t const usec = getU32(buffer + sizeof(uint32_t));
+    view.timestamp.tv_sec = getU32(buffer);
+    view.timestamp.tv_usec = usec & ~ROW_CRC_FLAG;
+
+    for (int i = 0; i < 3; ++i) {
+        if (dataSize - pos < (int) sizeof(uint32_t)) {
+            return 0;
+        }
+        uint32_t const len = getU32(buffer + pos);
+        pos += sizeof(uint32_t);
+
+        if ((uint32_t) (dataSize - pos) < len) {
+            return 0;
+        }
+        *fields[i] = buffer + pos;
+        *lengths[i] = len;
+        pos += len;
+    }
+
+    if (ROW_HEADER_SIZE == pos  &&  0 == usec  &&  0 == view.timestamp.tv_sec) {
+        // Zeros that pad the last block of a file, see BintxtWriter
+        return 0;
+    }
+
+    if (usec & ROW_CRC_FLAG) {
+        if (dataSize - pos < ROW_CRC_SIZE  ||  getU32(buffer + pos) != crc32c(buffer, pos)) {
+            return 0;
+        }
+        pos += ROW_CRC_SIZE;
+    }
+
+    return pos;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read one record in database format from buffer and store its data into
+    Record structure.
+
+  Wants:
+    Destination Record.
+    Buffer and size of its valid contents.
+
+  Gives:
+    Number of bytes consumed from the buffer, or
+    0 in case the buffer's data was incomplete.
+----------------------------------------------------------------------------*/
+int
+decodeRow(Record &rec, char const *const buffer, int const dataSize)
+{
+    RowView view;
+    int const ret = viewRow(view, buffer, dataSize);
+
+    if (ret > 0) {
+        view.toRecord(rec);
+    }
+
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Same as Record::match(), without making a Record of the row first.
+----------------------------------------------------------------------------*/
+static inline bool
+fieldMatch(char const *const field, uint32_t const len, std::string const &ref)
+{
+    return ref == "*"  ||  (ref.length() == len  &&  0 == memcmp(field, ref.data(), len));
+}
+
+
+bool
+RowView::match(Record const &rhs) const
+{
+    if (timercmp(&timestamp, &rhs.timestamp, < )  ||  !rhs.beforeEnd(timestamp)) {
+        return false;
+    }
+
+    return fieldMatch(devType, devTypeLen, rhs.devType)  &&  fieldMatch(serial, serialLen, rhs.serial);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Copy the row's fields to a Record.
+----------------------------------------------------------------------------*/
+void
+RowView::toRecord(Record &rec) const
+{
+    rec.timestamp = timestamp;
+    rec.serial.assign(serial, serialLen);
+    rec.devType.assign(devType, devTypeLen);
+    rec.data.assign(data, dataLen);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the database file from given offset up to given size and hand every
+    complete row to the visitor. Graciously handle the situations where a
+    row is cut at the end of the buffer's capacity.
+
+  Wants:
+    File descriptor.
+    Offset of a row to start from.
+    Size of the file's row data. Anything after it is not read.
+    Visitor.
+    Optional destination for the offset following the last complete row.
+
+  Gives:
+    True if all rows were scanned, false on read error or if the
+    visitor stopped the scan. A torn or corrupt row ends the scan: with
+    the destination for the offset it is there, and the scan is true;
+    without it the scan is false, so that the caller can't take what it
+    got for all rows.
+----------------------------------------------------------------------------*/
+bool
+scanRows(int const fd, uint64_t const from, uint64_t const to, RowVisitor_f const &visit, uint64_t *const end)
+{
+    char buffer[SCAN_BUFFER_SIZE];
+    uint64_t offset = from;  // File offset of buffer[0]
+    int bytes = 0;
+    struct timeval ts;
+
+
+    while (true) {
+        uint64_t const left = to > offset + bytes ? to - (offset + bytes) : 0;
+        size_t const want = std::min<uint64_t>(sizeof(buffer) - bytes, left);
+        ssize_t const got = want ? pread(fd, buffer + bytes, want, offset + bytes) : 0;
+
+        if (got < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            std::cerr << "Sink read error: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (0 == got) {
+            break;
+        }
+
+        bytes += got;
+        int bufPos = 0;
+
+        while (true) {
+            int const ret = peekRow(ts, buffer + bufPos, bytes - bufPos);
+
+            if (0 == ret) {
+                break;
+            }
+
+            if (!visit(buffer + bufPos, ret, offset + bufPos)) {
+                return false;
+            }
+
+            bufPos += ret;
+        }
+
+        if (0 == bufPos  &&  bytes == (int) sizeof(buffer)) {
+            // No valid row fits the buffer
+            break;
+        }
+
+        offset += bufPos;
+        bytes -= bufPos;
+        memmove(buffer, buffer + bufPos, bytes);
+    }
+
+    if (end) {
+        *end = offset;
+    }
+
+    if (bytes > 0) {
+        std::cerr << "Sink row at offset " << offset << " is torn or corrupt" << std::endl;
+        return NULL != end;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read one row from known offset.
+
+  Wants:
+    File descriptor and row's offset.
+    Buffer and its capacity.
+
+  Gives:
+    Row's length, or
+    0 if there is no complete row at the offset or on read error.
+----------------------------------------------------------------------------*/
+int
+readRow(int const fd, uint64_t const offset, char *const buffer, int const size)
+{
+    struct timeval ts;
+    ssize_t got;
+
+    do {
+        got = pread(fd, buffer, size, offset);
+    } while (got < 0  &&  EINTR == errno);
+
+    if (got < 0) {
+        std::cerr << "Sink read error: " << strerror(errno) << std::endl;
+        return 0;
+    }
+
+    return peekRow(ts, buffer, got);
+}
+
+
+}  // namespace bintxt
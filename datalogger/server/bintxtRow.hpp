@@ -0,0 +1,102 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_BINTXT_ROW_HPP
+#define HOMEWORK_SERVER_BINTXT_ROW_HPP
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <functional>
+
+struct Record;
+
+
+/*---- Namespace ------------------------------------------------------------
+  Contains:
+    Bintxt database row format and the file scanner shared by the Sink and
+    its indices.
+
+    Row: timestamp seconds and microseconds, then serial, devType and data
+    as Pascal strings. All integers are 32 bits in network byte order.
+    If the top bit of microseconds is set, the row ends with CRC-32C of all
+    its preceding bytes. A row whose CRC does not match is not a row, nor
+    is one of all zeros: that is padding.
+----------------------------------------------------------------------------*/
+namespace bintxt {
+
+    // Timestamp and three string lengths
+    #define ROW_HEADER_SIZE  (5 * (int) sizeof(uint32_t))
+
+    #define ROW_CRC_FLAG  0x80000000
+    #define ROW_CRC_SIZE  ((int) sizeof(uint32_t))
+
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        Row decoded in place. The fields point into the buffer the row was
+        read from and are valid only as long as it is.
+    ----------------------------------------------------------------------------*/
+    struct RowView {
+        struct timeval timestamp;
+
+        char const *serial;
+        char const *devType;
+        char const *data;
+        uint32_t serialLen;
+        uint32_t devTypeLen;
+        uint32_t dataLen;
+
+        bool match(Record const &rhs) const;
+        void toRecord(Record &rec) const;
+    };
+
+    int rowSize(Record const &rec, bool crc);
+    int encodeRow(char *buffer, Record const &rec, bool crc);
+    int decodeRow(Record &rec, char const *buffer, int dataSize);
+    int viewRow(RowView &view, char const *buffer, int dataSize);
+    int peekRow(struct timeval &ts, char const *buffer, int dataSize);
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Called for each complete row by scanRows().
+
+      Wants:
+        Row's bytes and its length.
+        Row's offset in the file.
+
+      Gives:
+        True to continue the scan.
+    ----------------------------------------------------------------------------*/
+    typedef std::function<bool (char const *row, int len, uint64_t offset)> RowVisitor_f;
+
+    bool scanRows(int fd, uint64_t from, uint64_t to, RowVisitor_f const &visit, uint64_t *end = NULL);
+    int readRow(int fd, uint64_t offset, char *buffer, int size);
+
+}  // namespace bintxt
+
+
+#endif  // HOMEWORK_SERVER_BINTXT_ROW_HPP
@@ -0,0 +1,1025 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+#include <arpa/inet.h>
+#include "bintxtSegment.hpp"
+#include "bintxtRow.hpp"
+#include "lz4Block.hpp"
+#include "record.hpp"
+
+
+// Footer of a sealed segment: magic, version, oldest and newest timestamp,
+// 64 bit row count and 64 bit row data size. Network byte order.
+#define SEGMENT_FOOTER_MAGIC    0x42545346  // "BTSF"
+#define SEGMENT_FOOTER_VERSION  1
+#define SEGMENT_FOOTER_SIZE     40
+
+// Footer of a compressed segment: magic, version, the same summary and
+// uncompressed row data size as above, 64 bit offset of the block index and
+// the number of blocks. Network byte order.
+#define COMPRESSED_FOOTER_MAGIC  0x42545a46  // "BTZF"
+#define COMPRESSED_FOOTER_SIZE   52
+
+// Block index entry: 64 bit row data offset, 64 bit file offset, compressed
+// and uncompressed size, newest timestamp.
+#define BLOCK_ENTRY_WORDS  8
+#define BLOCK_SIZE_MAX     (16 * 1024 * 1024)
+
+// Enough for any row the protocol lets through
+#define ROW_READ_SIZE  256
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members.
+----------------------------------------------------------------------------*/
+BintxtSegment::BintxtSegment(unsigned const seq)
+: seq_(seq), fd_(-1), dataEnd_(0), sealed_(false), summarized_(false), compressed_(false), storedSize_(0), mapped_(false), writer_(NULL)
+{
+    memset(&summary_, 0, sizeof(summary_));
+}
+
+
+BintxtSegment::~BintxtSegment()
+{
+    delete writer_;
+
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the data file for reading and appending, and its indices next to it
+    as PATH.idx and PATH.sidx. If the file is sealed, take the summary from
+    its footer. Otherwise cut off a torn or corrupt tail, and scan the rows
+    for the summary if asked to. A compressed segment has only its block
+    index. The Bloom filter of serials is loaded from PATH.bloom if the
+    segment is sealed, or built from the rows.
+
+  Wants:
+    Data file's path.
+    Rows per index block, 0 for no index.
+    True to use the serial index.
+    True to keep the summary.
+    Number of serials to size the Bloom filter for, 0 for no filter.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::open(std::string const &path, uint32_t const indexEvery, bool const serialIndex, bool const summarize, uint32_t const bloomSerials)
+{
+    struct stat st;
+
+
+    if (fd_ >= 0) {
+        return false;
+    }
+
+    path_ = path;
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0  ||  fstat(fd_, &st) < 0) {
+        return false;
+    }
+
+    dataEnd_ = st.st_size;
+
+    if (summarize  &&  !readBlockIndex(st.st_size)) {
+        readFooter(st.st_size);
+    }
+
+    filter_.configure(bloomSerials);
+
+    if (compressed_) {
+        loadFilter();
+        return true;
+    }
+
+    if (indexEvery > 0  &&  !timeIndex_.open(path + ".idx", fd_, dataEnd_, indexEvery)) {
+        return false;
+    }
+
+    if (!sealed_  &&  !recover()) {
+        return false;
+    }
+
+    if (summarize  &&  !sealed_) {
+        this->summarize();
+    }
+
+    if (serialIndex  &&  !serialIndex_.open(path + ".sidx", fd_, dataEnd_)) {
+        return false;
+    }
+
+    if (sealed_) {
+        loadFilter();
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the summary from the footer, if there is a valid one at the end of
+    the file.
+
+  Wants:
+    File's size.
+
+  Gives:
+    True if the segment is sealed.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::readFooter(uint64_t const fileSize)
+{
+    uint32_t footer[SEGMENT_FOOTER_SIZE / sizeof(uint32_t)];
+
+
+    if (fileSize < SEGMENT_FOOTER_SIZE  ||  
+        pread(fd_, footer, sizeof(footer), fileSize - sizeof(footer)) != (ssize_t) sizeof(footer)) 
+    {
+        return false;
+    }
+
+    for (unsigned i = 0; i < sizeof(footer) / sizeof(footer[0]); ++i) {
+        footer[i] = ntohl(footer[i]);
+    }
+
+    uint64_t const dataSize = ((uint64_t) footer[8] << 32) | footer[9];
+
+    if (SEGMENT_FOOTER_MAGIC != footer[0]  ||  SEGMENT_FOOTER_VERSION != footer[1]  ||  
+        dataSize != fileSize - sizeof(footer)) 
+    {
+        return false;
+    }
+
+    summary_.minTs.tv_sec = footer[2];
+    summary_.minTs.tv_usec = footer[3];
+    summary_.maxTs.tv_sec = footer[4];
+    summary_.maxTs.tv_usec = footer[5];
+    summary_.count = ((uint64_t) footer[6] << 32) | footer[7];
+
+    dataEnd_ = dataSize;
+    sealed_ = true;
+    summarized_ = true;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the summary and the block index of a compressed segment, if the
+    file has a valid compressed footer.
+
+  Wants:
+    File's size.
+
+  Gives:
+    True if the segment is compressed.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::readBlockIndex(uint64_t const fileSize)
+{
+    uint32_t footer[COMPRESSED_FOOTER_SIZE / sizeof(uint32_t)];
+
+
+    if (fileSize < COMPRESSED_FOOTER_SIZE  ||  
+        pread(fd_, footer, sizeof(footer), fileSize - sizeof(footer)) != (ssize_t) sizeof(footer)) 
+    {
+        return false;
+    }
+
+    for (unsigned i = 0; i < sizeof(footer) / sizeof(footer[0]); ++i) {
+        footer[i] = ntohl(footer[i]);
+    }
+
+    uint64_t const indexOffset = ((uint64_t) footer[10] << 32) | footer[11];
+    uint64_t const indexSize = (uint64_t) footer[12] * BLOCK_ENTRY_WORDS * sizeof(uint32_t);
+
+    if (COMPRESSED_FOOTER_MAGIC != footer[0]  ||  SEGMENT_FOOTER_VERSION != footer[1]  ||  
+        indexOffset + indexSize != fileSize - sizeof(footer)) 
+    {
+        return false;
+    }
+
+    std::vector<uint32_t> index(indexSize / sizeof(uint32_t));
+
+    if (indexSize > 0  &&  pread(fd_, &index[0], indexSize, indexOffset) != (ssize_t) indexSize) {
+        return false;
+    }
+
+    blocks_.clear();
+    for (size_t i = 0; i < index.size(); i += BLOCK_ENTRY_WORDS) {
+        Block block;
+        block.offset = ((uint64_t) ntohl(index[i]) << 32) | ntohl(index[i + 1]);
+        block.fileOffset = ((uint64_t) ntohl(index[i + 2]) << 32) | ntohl(index[i + 3]);
+        block.packedSize = ntohl(index[i + 4]);
+        block.rawSize = ntohl(index[i + 5]);
+        block.maxTs.tv_sec = ntohl(index[i + 6]);
+        block.maxTs.tv_usec = ntohl(index[i + 7]);
+
+        if (block.fileOffset + block.packedSize > indexOffset  ||  block.rawSize > BLOCK_SIZE_MAX  ||  block.packedSize > block.rawSize) {
+            std::cerr << "Invalid block index in " << path_ << std::endl;
+            blocks_.clear();
+            return false;
+        }
+        blocks_.push_back(block);
+    }
+
+    summary_.minTs.tv_sec = footer[2];
+    summary_.minTs.tv_usec = footer[3];
+    summary_.maxTs.tv_sec = footer[4];
+    summary_.maxTs.tv_usec = footer[5];
+    summary_.count = ((uint64_t) footer[6] << 32) | footer[7];
+
+    dataEnd_ = ((uint64_t) footer[8] << 32) | footer[9];
+    storedSize_ = indexOffset;
+    sealed_ = true;
+    summarized_ = true;
+    compressed_ = true;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Check the rows after the last checkpoint, i.e. the last block of the
+    time index, and truncate the file at the first one that is torn or fails
+    its CRC. Without the time index the whole file is checked.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::recover(void)
+{
+    uint64_t end = dataEnd_;
+
+
+    if (!bintxt::scanRows(fd_, timeIndex_.checkpoint(), dataEnd_, [] (char const *, int, uint64_t) { return true; }, &end)) {
+        return false;
+    }
+
+    if (end < dataEnd_) {
+        std::cout << "Truncating " << dataEnd_ - end << " bytes of torn tail of " << path_ << std::endl;
+        if (ftruncate(fd_, end) < 0) {
+            std::cerr << "Can't truncate " << path_ << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        dataEnd_ = end;
+        timeIndex_.truncate(end);
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Build the summary and the Bloom filter by scanning all rows.
+----------------------------------------------------------------------------*/
+void
+BintxtSegment::summarize(void)
+{
+    memset(&summary_, 0, sizeof(summary_));
+    summarized_ = true;
+    filter_.clear();
+
+    bintxt::scanRows(fd_, 0, dataEnd_, [this] (char const *const row, int const len, uint64_t) {
+        bintxt::RowView view;
+        bintxt::viewRow(view, row, len);
+        if (0 == summary_.count++  ||  timercmp(&view.timestamp, &summary_.minTs, < )) {
+            summary_.minTs = view.timestamp;
+        }
+        if (timercmp(&view.timestamp, &summary_.maxTs, > )) {
+            summary_.maxTs = view.timestamp;
+        }
+        if (filter_.enabled()) {
+            filter_.add(view.serial, view.serialLen);
+        }
+        return true;
+    });
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append the footer and save the Bloom filter. No rows can be added
+    after this.
+
+  Wants:
+    True to fdatasync() the footer.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::seal(bool const durable)
+{
+    uint32_t const footer[SEGMENT_FOOTER_SIZE / sizeof(uint32_t)] = {
+        htonl(SEGMENT_FOOTER_MAGIC), htonl(SEGMENT_FOOTER_VERSION),
+        htonl(summary_.minTs.tv_sec), htonl(summary_.minTs.tv_usec),
+        htonl(summary_.maxTs.tv_sec), htonl(summary_.maxTs.tv_usec),
+        htonl(summary_.count >> 32), htonl(summary_.count & 0xffffffff),
+        htonl(dataEnd_ >> 32), htonl(dataEnd_ & 0xffffffff)
+    };
+    size_t done;
+
+
+    if (sealed_  ||  !summarized_) {
+        return false;
+    }
+
+    sealed_ = true;
+
+    // The footer must follow the rows, not the writer's padding
+    if (writer_) {
+        bool const closed = writer_->close();
+        delete writer_;
+        writer_ = NULL;
+        if (!closed) {
+            return false;
+        }
+    }
+
+    if (!write((char const *) footer, sizeof(footer), done)) {
+        return false;
+    }
+
+    if (durable  &&  !sync()) {
+        return false;
+    }
+
+    // A missing filter is rebuilt on open
+    if (filter_.enabled()) {
+        filter_.save(path_ + ".bloom", durable);
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Delete the segment's files. The segment must not be used after this.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True if the data file was deleted.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::remove(void)
+{
+    ::unlink((path_ + ".idx").c_str());
+    ::unlink((path_ + ".sidx").c_str());
+    ::unlink((path_ + ".bloom").c_str());
+
+    if (::unlink(path_.c_str()) < 0) {
+        std::cerr << "Can't remove segment " << path_ << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write all of buffer to a file descriptor.
+----------------------------------------------------------------------------*/
+static bool
+writeAll(int const fd, char const *const buffer, size_t const len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t const ret = ::write(fd, buffer + done, len - done);
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        done += ret;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Rewrite a sealed segment compressed. The rows are cut to blocks of at
+    least given size and each is compressed, or stored as is if it does not
+    compress. The new file is written next to the old one as PATH.tmp and
+    renamed over it when complete, so a crash leaves one of them intact.
+    The side indices are deleted. The segment must be reopened after this.
+
+  Wants:
+    Uncompressed size of a block.
+    True to fdatasync() the new file before it replaces the old one.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::compress(uint32_t const blockSize, bool const durable)
+{
+    std::string const tmpPath(path_ + ".tmp");
+    std::vector<char> raw;
+    std::vector<char> packed;
+    std::vector<uint32_t> index;
+    struct timeval maxTs;
+    uint64_t blockOffset = 0;
+    uint64_t fileOffset = 0;
+    uint64_t end = 0;
+    bool ok = true;
+
+
+    if (!sealed_  ||  compressed_) {
+        return false;
+    }
+
+    int const out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        std::cerr << "Can't create " << tmpPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    raw.reserve(blockSize + ROW_READ_SIZE);
+    timerclear(&maxTs);
+
+    auto const writeBlock = [&] () {
+        packed.resize(lz4::compressBound(raw.size()));
+        int size = lz4::compress(&raw[0], raw.size(), &packed[0], packed.size());
+        char const *data = &packed[0];
+
+        if (size <= 0  ||  size >= (int) raw.size()) {
+            size = raw.size();
+            data = &raw[0];
+        }
+
+        uint32_t const entry[BLOCK_ENTRY_WORDS] = {
+            htonl(blockOffset >> 32), htonl(blockOffset & 0xffffffff),
+            htonl(fileOffset >> 32), htonl(fileOffset & 0xffffffff),
+            htonl(size), htonl(raw.size()),
+            htonl(maxTs.tv_sec), htonl(maxTs.tv_usec)
+        };
+
+        index.insert(index.end(), entry, entry + BLOCK_ENTRY_WORDS);
+        ok = ok  &&  writeAll(out, data, size);
+
+        fileOffset += size;
+        blockOffset += raw.size();
+        raw.clear();
+        timerclear(&maxTs);
+        return ok;
+    };
+
+    bintxt::scanRows(fd_, 0, dataEnd_, [&] (char const *const row, int const len, uint64_t) {
+        struct timeval ts;
+        bintxt::peekRow(ts, row, len);
+        if (timercmp(&ts, &maxTs, > )) {
+            maxTs = ts;
+        }
+        raw.insert(raw.end(), row, row + len);
+        return raw.size() < blockSize  ||  writeBlock();
+    }, &end);
+
+    if (ok  &&  !raw.empty()) {
+        writeBlock();
+    }
+
+    uint32_t const footer[COMPRESSED_FOOTER_SIZE / sizeof(uint32_t)] = {
+        htonl(COMPRESSED_FOOTER_MAGIC), htonl(SEGMENT_FOOTER_VERSION),
+        htonl(summary_.minTs.tv_sec), htonl(summary_.minTs.tv_usec),
+        htonl(summary_.maxTs.tv_sec), htonl(summary_.maxTs.tv_usec),
+        htonl(summary_.count >> 32), htonl(summary_.count & 0xffffffff),
+        htonl(dataEnd_ >> 32), htonl(dataEnd_ & 0xffffffff),
+        htonl(fileOffset >> 32), htonl(fileOffset & 0xffffffff),
+        htonl(index.size() / BLOCK_ENTRY_WORDS)
+    };
+
+    ok = ok  &&  end == dataEnd_  &&  
+        (index.empty()  ||  writeAll(out, (char const *) &index[0], index.size() * sizeof(uint32_t)))  &&  
+        writeAll(out, (char const *) footer, sizeof(footer))  &&  
+        (!durable  ||  0 == fdatasync(out));
+
+    if (close(out) < 0  ||  !ok  ||  ::rename(tmpPath.c_str(), path_.c_str()) < 0) {
+        std::cerr << "Can't compress segment " << path_ << ": " << strerror(errno) << std::endl;
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+
+    ::unlink((path_ + ".idx").c_str());
+    ::unlink((path_ + ".sidx").c_str());
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Account a row that is about to be written at the end of the file.
+
+  Wants:
+    Record's data.
+    Row's size in database format.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSegment::note(Record const &rec, uint32_t const size)
+{
+    timeIndex_.note(rec.timestamp, dataEnd_, size);
+    serialIndex_.note(rec.serial, dataEnd_);
+    dataEnd_ += size;
+
+    if (filter_.enabled()) {
+        filter_.add(rec.serial.data(), rec.serial.length());
+    }
+
+    if (summarized_) {
+        if (0 == summary_.count++  ||  timercmp(&rec.timestamp, &summary_.minTs, < )) {
+            summary_.minTs = rec.timestamp;
+        }
+        if (timercmp(&rec.timestamp, &summary_.maxTs, > )) {
+            summary_.maxTs = rec.timestamp;
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the noted rows to the file with as few write() calls as the kernel
+    allows. If that fails, forget the rows that did not make it.
+
+  Wants:
+    Encoded rows and their size.
+    Destination for the number of bytes written.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::write(char const *const buffer, size_t const len, size_t &done)
+{
+    done = 0;
+
+    if (writer_) {
+        writer_->write(buffer, len, done);
+    }
+
+    while (!writer_  &&  done < len) {
+        ssize_t const ret = ::write(fd_, buffer + done, len - done);
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            std::cerr << "Sink write error: " << strerror(errno) << std::endl;
+            break;
+        }
+        done += ret;
+    }
+
+    bool const ok = done == len;
+
+    if (!ok  &&  !sealed_) {
+        // Lost rows must not stay in the index
+        struct stat st;
+        dataEnd_ = writer_ ? writer_->end() : fstat(fd_, &st) < 0 ? 0 : st.st_size;
+        timeIndex_.truncate(dataEnd_);
+        serialIndex_.truncate(dataEnd_);
+        if (summarized_) {
+            summarize();
+        }
+    }
+
+    bool const indexed = timeIndex_.persist();
+    return serialIndex_.persist()  &&  indexed  &&  ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append the rows from now on with a BintxtWriter instead of write().
+
+  Wants:
+    Writer's mode.
+    Bytes to preallocate at a time, 0 not to.
+    Writer's statistics.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::startWriter(BintxtWriter::Mode const mode, uint64_t const prealloc, BintxtWriter::Stats &stats)
+{
+    if (fd_ < 0  ||  sealed_  ||  writer_) {
+        return false;
+    }
+
+    writer_ = new BintxtWriter(mode, prealloc, stats);
+    if (!writer_->open(path_, fd_, dataEnd_)) {
+        delete writer_;
+        writer_ = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Make everything written so far durable.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::sync(void)
+{
+    if (fdatasync(fd_) < 0) {
+        std::cerr << "Sink fdatasync error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell if the segment may have rows matching the reference: some not
+    older than its start and some before its end. Without a summary it
+    always may.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::mayMatch(Record const &ref) const
+{
+    if (!summarized_) {
+        return true;
+    }
+
+    return summary_.count > 0  &&  !timercmp(&summary_.maxTs, &ref.timestamp, < )  &&  ref.beforeEnd(summary_.minTs);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell if the segment may have rows of the serial. Without a Bloom filter
+    it always may.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::mayHaveSerial(std::string const &serial) const
+{
+    return serial == "*"  ||  !filter_.enabled()  ||  filter_.mayContain(serial.data(), serial.length());
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every row matching the given reference, up to given offset.
+
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    True to use the memory map.
+    Offset to stop at.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::query(Record const &reference, Sink::SendRecord_f const &send, bool const useMap, uint64_t const end)
+{
+    Ranges_t ranges;
+
+    plan(reference, end, 0, useMap, ranges);
+
+    for (Ranges_t::const_iterator it = ranges.begin(); it != ranges.end(); ++it) {
+        if (!queryRange(reference, send, it->first, it->second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell which part of the row data a query has to read, optionally split
+    to ranges that can be read concurrently with queryRange(). Start from
+    where the timestamp index tells that older rows end, or from the first
+    compressed block with new enough rows. Ranges are split at index or
+    block boundaries, which are row boundaries. Map the rows unless told
+    not to.
+
+  Wants:
+    Reference Record.
+    Offset to stop at.
+    Least size of a range in bytes, 0 for one range.
+    True to use the memory map.
+    Destination for the ranges, in file order.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSegment::plan(Record const &reference, uint64_t const end, uint64_t const split, bool const useMap, Ranges_t &ranges)
+{
+    uint64_t const to = std::min(end, dataEnd_);
+    std::vector<uint64_t> at;
+    uint64_t from = to;
+
+
+    mapped_ = !compressed_  &&  useMap  &&  map_.cover(fd_, dataEnd_);
+
+    if (compressed_) {
+        for (std::vector<Block>::const_iterator block = blocks_.begin(); block != blocks_.end()  &&  block->offset < to; ++block) {
+            if (timercmp(&block->maxTs, &reference.timestamp, < )) {
+                continue;
+            }
+            if (from == to) {
+                from = block->offset;
+            }
+            else if (split > 0  &&  block->offset - (at.empty() ? from : at.back()) >= split) {
+                at.push_back(block->offset);
+            }
+        }
+    }
+    else {
+        from = timeIndex_.seek(reference.timestamp);
+        if (split > 0) {
+            timeIndex_.split(from, to, split, at);
+        }
+    }
+
+    if (from >= to) {
+        return;
+    }
+
+    at.push_back(to);
+    for (size_t i = 0; i < at.size(); ++i) {
+        ranges.push_back(std::make_pair(i > 0 ? at[i - 1] : from, at[i]));
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every row in a range of row data that matches the given reference.
+
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    Range from plan().
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::queryRange(Record const &reference, Sink::SendRecord_f const &send, uint64_t const from, uint64_t const to) const
+{
+    Record rec;
+
+    // Only matching rows are copied to a Record
+    return matchRows(reference, [&rec, &reference, &send] (bintxt::RowView const &view, char const *, int, uint64_t) {
+        view.toRecord(rec);
+        rec.action = REC_ACT_REPLY;
+        return send(rec, reference.priv) >= 0;
+    }, from, to);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Hand every row in a range of row data that matches the given reference
+    to a function, decoded in place. If the serial index is on and the
+    reference has a serial, read only its rows. Read through the memory map
+    if plan() mapped the rows. A compressed segment is read block by block
+    instead.
+
+    A row that is torn or fails its CRC is skipped with the rest of its
+    time index block, and the scan goes on from the next block. If the
+    range does not reach the next block the scan fails, so a damaged range
+    is never taken for all of its rows.
+
+    Touches no members, so ranges of one plan() can be read concurrently.
+
+  Wants:
+    Reference Record.
+    Function to call for the matching rows.
+    Range from plan().
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::matchRows(Record const &reference, RowMatch_f const &hit, uint64_t const from, uint64_t const to) const
+{
+    if (compressed_) {
+        return matchBlocks(reference, hit, from, to);
+    }
+
+    bintxt::RowVisitor_f const visit =
+        [&reference, &hit] (char const *const row, int const len, uint64_t const offset) {
+            bintxt::RowView view;
+            if (0 == bintxt::viewRow(view, row, len)  ||  !view.match(reference)) {
+                return true;
+            }
+            return hit(view, row, len, offset);
+        };
+
+    if (serialIndex_.enabled()  &&  reference.serial != "*") {
+        BintxtSerialIndex::Offsets_t const *const offsets = serialIndex_.find(reference.serial);
+        char buffer[ROW_READ_SIZE];
+
+        if (!offsets) {
+            return true;
+        }
+
+        for (BintxtSerialIndex::Offsets_t::const_iterator it = std::lower_bound(offsets->begin(), offsets->end(), from); 
+             it != offsets->end()  &&  *it < to; ++it)  
+        {
+            char const *row = buffer;
+            struct timeval ts;
+            int len;
+
+            if (mapped_) {
+                row = map_.data() + *it;
+                len = bintxt::peekRow(ts, row, std::min<uint64_t>(ROW_READ_SIZE, dataEnd_ - *it));
+            }
+            else {
+                len = bintxt::readRow(fd_, *it, buffer, std::min<uint64_t>(ROW_READ_SIZE, dataEnd_ - *it));
+            }
+
+            if (0 == len  ||  !visit(row, len, *it)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    uint64_t at = from;
+
+    while (true) {
+        uint64_t end = to;
+        bool const read = mapped_ ? map_.scan(at, to, visit, &end) : bintxt::scanRows(fd_, at, to, visit, &end);
+
+        if (!read  ||  end >= to) {
+            return read;
+        }
+
+        // The next block may be where the range ends, and then only the rest of the range is lost
+        uint64_t const next = timeIndex_.next(end);
+        if (next > to) {
+            return false;
+        }
+
+        std::cerr << "Skipping " << next - end << " bytes of damaged rows at offset " << end << " of " << path_ << std::endl;
+        at = next;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    matchRows() of a compressed segment. Decompress only the blocks that
+    have rows new enough, and decode the rows in place from the
+    decompressed block.
+
+  Wants:
+    Reference Record.
+    Function to call for the matching rows.
+    Range of uncompressed row data, starting at a row.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSegment::matchBlocks(Record const &reference, RowMatch_f const &hit, uint64_t const from, uint64_t const to) const
+{
+    std::vector<char> packed;
+    std::vector<char> unpacked;
+
+
+    for (std::vector<Block>::const_iterator block = blocks_.begin(); block != blocks_.end()  &&  block->offset < to; ++block) {
+        if (block->offset + block->rawSize <= from  ||  timercmp(&block->maxTs, &reference.timestamp, < )) {
+            continue;
+        }
+
+        unpacked.resize(block->rawSize);
+        packed.resize(block->packedSize);
+        char *const into = block->packedSize == block->rawSize ? &unpacked[0] : &packed[0];
+
+        if (block->packedSize > 0  &&  pread(fd_, into, block->packedSize, block->fileOffset) != (ssize_t) block->packedSize) {
+            std::cerr << "Sink read error: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        if (into == &packed[0]  &&  
+            lz4::decompress(&packed[0], block->packedSize, &unpacked[0], block->rawSize) != (int) block->rawSize) 
+        {
+            std::cerr << "Corrupt block at offset " << block->fileOffset << " of " << path_ << std::endl;
+            return false;
+        }
+
+        uint32_t pos = 0;
+        while (pos < block->rawSize  &&  block->offset + pos < to) {
+            bintxt::RowView view;
+            char const *const row = &unpacked[pos];
+            uint64_t const offset = block->offset + pos;
+            int const len = bintxt::viewRow(view, row, block->rawSize - pos);
+
+            if (0 == len) {
+                std::cerr << "Sink row at offset " << offset << " is torn or corrupt" << std::endl;
+                return false;
+            }
+            pos += len;
+
+            // The range may start within the block
+            if (offset >= from  &&  view.match(reference)  &&  !hit(view, row, len, offset)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Load the Bloom filter of a sealed segment. If its file is missing or
+    broken, rebuild it by reading all rows and save it. If that fails too,
+    go without.
+----------------------------------------------------------------------------*/
+void
+BintxtSegment::loadFilter(void)
+{
+    std::string const path(path_ + ".bloom");
+    Record all;
+
+
+    if (!filter_.enabled()  ||  filter_.load(path)) {
+        return;
+    }
+
+    all.serial = "*";
+    all.devType = "*";
+
+    Sink::SendRecord_f const add = [this] (Record const &rec, uint64_t) {
+        filter_.add(rec.serial.data(), rec.serial.length());
+        return 0;
+    };
+
+    if (!query(all, add, false, dataEnd_)) {
+        filter_.configure(0);
+        return;
+    }
+
+    std::cout << "Rebuilt " << path << std::endl;
+    filter_.save(path, false);
+}
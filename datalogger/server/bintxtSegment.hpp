@@ -0,0 +1,156 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_BINTXT_SEGMENT_HPP
+#define HOMEWORK_SERVER_BINTXT_SEGMENT_HPP
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include "sink.hpp"
+#include "bintxtIndex.hpp"
+#include "bintxtRow.hpp"
+#include "bintxtMap.hpp"
+#include "bloomFilter.hpp"
+#include "bintxtWriter.hpp"
+
+struct Record;
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    One bintxt data file with its indices and memory map.
+
+    The segment may keep a summary of its rows: the oldest and newest
+    timestamp and the row count. Queries skip segments whose newest row is
+    older than asked for. A segment that is full is sealed by appending the
+    summary as a footer after the rows, so it need not be scanned on the
+    next start. The footer is never read as a row; all scans stop at the
+    end of the row data.
+
+    A sealed segment can be rewritten compressed: its rows are cut to blocks
+    of whole rows, each compressed on its own, followed by a block index of
+    the blocks' row data offsets and newest timestamps. Offsets stay those
+    of the uncompressed rows. Queries decompress only the blocks that have
+    rows new enough. The side indices are not kept for compressed segments.
+
+    A query can be planned as ranges of row data that are then read
+    concurrently, each by its own thread.
+
+    A Bloom filter of the serials in the segment lets queries for one serial
+    skip segments that do not have it. It is kept up to date on every row
+    and saved as PATH.bloom when the segment is sealed.
+
+    Rows are appended with write(), or by a BintxtWriter that bypasses the
+    page cache. Its padding is cut off when the segment is sealed or closed.
+----------------------------------------------------------------------------*/
+class BintxtSegment
+{
+public:
+    typedef std::vector<std::pair<uint64_t, uint64_t> > Ranges_t;  // Row data [from, to)
+
+    // Gets a matching row decoded in place, its bytes and offset, gives true to go on
+    typedef std::function<bool (bintxt::RowView const &view, char const *row, int len, uint64_t offset)> RowMatch_f;
+
+    struct Summary {
+        struct timeval minTs;
+        struct timeval maxTs;
+        uint64_t count;
+    };
+
+    explicit BintxtSegment(unsigned seq = 0);
+    ~BintxtSegment();
+
+    bool open(std::string const &path, uint32_t indexEvery, bool serialIndex, bool summarize, uint32_t bloomSerials);
+    bool seal(bool durable);
+    bool remove(void);
+    bool compress(uint32_t blockSize, bool durable);
+    bool startWriter(BintxtWriter::Mode mode, uint64_t prealloc, BintxtWriter::Stats &stats);
+
+    void note(Record const &rec, uint32_t size);
+    bool write(char const *buffer, size_t len, size_t &done);
+    bool sync(void);
+
+    bool mayMatch(Record const &ref) const;
+    bool mayHaveSerial(std::string const &serial) const;
+    bool query(Record const &ref, Sink::SendRecord_f const &send, bool mapped, uint64_t end);
+    void plan(Record const &ref, uint64_t end, uint64_t split, bool mapped, Ranges_t &ranges);
+    bool queryRange(Record const &ref, Sink::SendRecord_f const &send, uint64_t from, uint64_t to) const;
+    bool matchRows(Record const &ref, RowMatch_f const &hit, uint64_t from, uint64_t to) const;
+
+    unsigned seq(void) const { return seq_; }
+    std::string const &path(void) const { return path_; }
+    uint64_t size(void) const { return dataEnd_; }
+    bool sealed(void) const { return sealed_; }
+    bool summarized(void) const { return summarized_; }
+    bool compressed(void) const { return compressed_; }
+    uint64_t storedSize(void) const { return compressed_ ? storedSize_ : dataEnd_; }
+    Summary const &summary(void) const { return summary_; }
+    size_t indexBlocks(void) const { return timeIndex_.blocks(); }
+
+private:
+    struct Block {
+        uint64_t offset;       // Of the first row in uncompressed row data
+        uint64_t fileOffset;   // Of compressed data in the file
+        uint32_t packedSize;   // Same as rawSize if stored uncompressed
+        uint32_t rawSize;
+        struct timeval maxTs;  // Of the block's rows
+    };
+
+    bool readFooter(uint64_t fileSize);
+    bool readBlockIndex(uint64_t fileSize);
+    bool matchBlocks(Record const &ref, RowMatch_f const &hit, uint64_t from, uint64_t to) const;
+    void loadFilter(void);
+    bool recover(void);
+    void summarize(void);
+
+    unsigned seq_;       // Number in the log
+    std::string path_;
+    int fd_;
+    uint64_t dataEnd_;   // Size of row data, including rows not yet written
+    bool sealed_;        // Footer written, no more rows
+    bool summarized_;    // summary_ is kept up to date
+    Summary summary_;
+
+    bool compressed_;              // Rows are in compressed blocks
+    uint64_t storedSize_;          // Bytes the compressed blocks take
+    std::vector<Block> blocks_;
+    bool mapped_;                  // Last plan() mapped the rows
+
+    BloomFilter filter_;           // Of serials
+
+    BintxtWriter *writer_;         // Appends the rows, NULL to use write()
+
+    BintxtTimeIndex timeIndex_;
+    BintxtSerialIndex serialIndex_;
+    BintxtMap map_;
+};
+
+
+#endif  // HOMEWORK_SERVER_BINTXT_SEGMENT_HPP
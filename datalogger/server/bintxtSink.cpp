@@ -26,13 +26,32 @@ For more information, please refer to <http://unlicense.org>
 ----------------------------------------------------------------------------*/
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <iostream>
-#include <arpa/inet.h>
+#include <algorithm>
 #include "bintxtSink.hpp"
+#include "sinkOptions.hpp"
+#include "bintxtRow.hpp"
+#include "queryPage.hpp"
+#include "monoClock.hpp"
 #include "record.hpp"
 
 
+// Write buffer is written out when it grows over this
+#define WRITE_BUFFER_SIZE  65536
+
+// Segment files are FILE.NNNNNN
+#define SEGMENT_SEQ_DIGITS  6
+
+// Latest Records view is saved after this many bytes of rows are committed,
+// so that a crash rereads at most these for it
+#define LATEST_SAVE_BYTES  (16 << 20)
+
+
 /*---- Singleton ------------------------------------------------------------
   Does:
     Register the sink to sinkManager on application startup.
@@ -40,39 +59,459 @@ For more information, please refer to <http://unlicense.org>
 static BintxtSink const *sinkSingleton = new BintxtSink;
 
 
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members.
+----------------------------------------------------------------------------*/
+BintxtSinkImpl::BintxtSinkImpl() 
+: indexEvery_(0), serialIndex_(false), rotateBytes_(0), rotateSecs_(0), retainSegs_(0), retainSecs_(0), nextSeq_(1), compressBlock_(0), bloomSerials_(0), 
+  mapped_(false), crc_(true), unbuffered_(false), writerMode_(BintxtWriter::DIRECT), prealloc_(0), pool_(NULL), split_(0), 
+  bufferedRecs_(0), policy_(COMMIT_NONE), policyArg_(0), pendingRecs_(0), latestSavedAt_(0)
+{
+    wbuf_.reserve(WRITE_BUFFER_SIZE + 1024);
+    memset(&writerStats_, 0, sizeof(writerStats_));
+}
+
+
 /*---- Destructor -----------------------------------------------------------
   Does:
-    Called on application termination. Close the database.
+    Called on application termination. Commit and close the database, and
+    save the latest Records view.
 ----------------------------------------------------------------------------*/
 BintxtSinkImpl::~BintxtSinkImpl()
 { 
-    if (file_) {
-        fclose(file_); 
-        file_ = NULL;
+    if (!segments_.empty()) {
+        commit();
+        saveLatest();
+        while (!segments_.empty()) {
+            delete segments_.front();
+            segments_.pop_front();
+        }
         std::cout << "Closed sink file " << std::endl;
+        printStats(std::cout);
     }
+
+    delete pool_;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run queries on a pool of threads.
+  
+  Wants:
+    Number of threads, 0 to query in the calling thread.
+    Least bytes of row data per range a thread scans.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::setQueryThreads(unsigned const threads, uint64_t const split)
+{
+    delete pool_;
+    pool_ = threads > 0 ? new WorkerPool(threads) : NULL;
+    split_ = split;
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Open the datebase file in binary mode for reading and writing.
+    Open the datebase file in binary mode for reading and appending.
+    Open its timestamp index next to it as FILE.idx and serial index as
+    FILE.sidx. If rotation is set, open all segments FILE.NNNNNN instead.
+    Then bring the latest Records view up to date.
   
   Wants:
     File name.
+    Rows per index block, 0 for no index.
+    True to use the serial index.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::open(std::string const &filename, uint32_t const indexEvery, bool const serialIndex)
+{
+    if (!segments_.empty()) {
+        return false;
+    }
+
+    filename_ = filename;
+    indexEvery_ = indexEvery;
+    serialIndex_ = serialIndex;
+
+    if (segmented()) {
+        if (!openSegments()) {
+            return false;
+        }
+    }
+    else {
+        BintxtSegment *const segment = new BintxtSegment(0);
+        segments_.push_back(segment);
+        if (!segment->open(filename, indexEvery, serialIndex, false, 0)  ||  !startWriter()) {
+            return false;
+        }
+    }
+
+    loadLatest();
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Load the latest Records view saved in FILE.latest and read the rows
+    stored after the position it covers. If there is no valid view, or it
+    is ahead of the log, rebuild it from all rows.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::loadLatest(void)
+{
+    uint32_t seq = 0;
+    uint64_t offset = 0;
+    bool saved = latest_.load(filename_ + ".latest", seq, offset);
+    Record all(REC_ACT_GET_AFTER);
+
+
+    for (std::deque<BintxtSegment *>::const_iterator it = segments_.begin(); saved  &&  it != segments_.end(); ++it) {
+        saved = (*it)->seq() != seq  ||  offset <= (*it)->size();
+    }
+    if (saved  &&  seq > segments_.back()->seq()) {
+        saved = false;
+    }
+
+    if (!saved) {
+        latest_.clear();
+        seq = 0;
+        offset = 0;
+    }
+
+    all.serial = "*";
+    all.devType = "*";
+
+    for (std::deque<BintxtSegment *>::const_iterator it = segments_.begin(); it != segments_.end(); ++it) {
+        if ((*it)->seq() < seq) {
+            continue;
+        }
+        (*it)->matchRows(all, [this] (bintxt::RowView const &view, char const *, int, uint64_t) {
+            latest_.store(view.serial, view.serialLen, view.devType, view.devTypeLen, view.timestamp, view.data, view.dataLen);
+            return true;
+        }, (*it)->seq() == seq ? offset : 0, (*it)->size());
+    }
+
+    std::cout << (saved ? "Loaded" : "Rebuilt") << " latest view of " << latest_.size() << " Records" << std::endl;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Save the latest Records view to FILE.latest with the end of the log
+    as its position. All rows must be written.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::saveLatest(void)
+{
+    latest_.save(filename_ + ".latest", segments_.back()->seq(), segments_.back()->size(), COMMIT_NONE != policy_);
+    latestSavedAt_ = stats_.writtenBytes;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Save the latest Records view if enough rows were written since it was
+    last saved. Call only when every written row is committed, so the
+    saved view is never ahead of the durable log.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::saveLatestIfDue(void)
+{
+    if (wbuf_.empty()  &&  stats_.writtenBytes - latestSavedAt_ >= LATEST_SAVE_BYTES) {
+        saveLatest();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the existing segments in order. Continue appending to the last one
+    unless it is sealed. Compress the sealed ones that a crash or an earlier
+    run left uncompressed, if compression is on.
+  
+  Wants:
+    Nothing.
     
   Gives: 
     True on success
 ----------------------------------------------------------------------------*/
 bool
-BintxtSinkImpl::open(std::string const &filename)
+BintxtSinkImpl::openSegments(void)
 {
-    if (file_) {
+    std::string::size_type const slash = filename_.rfind('/');
+    std::string const dir(slash == filename_.npos ? "." : filename_.substr(0, slash + 1));
+    std::string const prefix(filename_.substr(slash == filename_.npos ? 0 : slash + 1) + ".");
+    std::vector<unsigned> seqs;
+    DIR *const dp = opendir(dir.c_str());
+    struct dirent *ent;
+
+
+    if (NULL == dp) {
+        std::cerr << "Can't open directory " << dir << ": " << strerror(errno) << std::endl;
         return false;
     }
 
-    file_ = fopen(filename.c_str(), "a+b");
-    return file_ != NULL;
+    // Segment files are PREFIX.NNNNNN, side files have a suffix after that
+    while (NULL != (ent = readdir(dp))) {
+        std::string const name(ent->d_name);
+        if (name.length() == prefix.length() + SEGMENT_SEQ_DIGITS  &&  0 == name.compare(0, prefix.length(), prefix)  &&  
+            name.find_first_not_of("0123456789", prefix.length()) == name.npos) 
+        {
+            seqs.push_back(strtoul(name.c_str() + prefix.length(), NULL, 10));
+        }
+    }
+    closedir(dp);
+
+    std::sort(seqs.begin(), seqs.end());
+
+    for (unsigned i = 0; i < seqs.size(); ++i) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), ".%0*u", SEGMENT_SEQ_DIGITS, seqs[i]);
+
+        BintxtSegment *const segment = new BintxtSegment(seqs[i]);
+        segments_.push_back(segment);
+        if (!segment->open(filename_ + suffix, indexEvery_, serialIndex_, true, bloomSerials_)) {
+            return false;
+        }
+        if (compressBlock_ > 0  &&  segment->sealed()  &&  !segment->compressed()  &&  !compress(segments_.back())) {
+            return false;
+        }
+        nextSeq_ = seqs[i] + 1;
+    }
+
+    std::cout << "Opened " << segments_.size() << " segments" << std::endl;
+
+    if (segments_.empty()  ||  segments_.back()->sealed()) {
+        if (!addSegment()) {
+            return false;
+        }
+    }
+    else if (!startWriter()) {
+        return false;
+    }
+
+    retain();
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Create the next segment file and start appending to it.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::addSegment(void)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%0*u", SEGMENT_SEQ_DIGITS, nextSeq_);
+
+    BintxtSegment *const segment = new BintxtSegment(nextSeq_++);
+    if (!segment->open(filename_ + suffix, indexEvery_, serialIndex_, true, bloomSerials_)) {
+        std::cerr << "Can't open segment " << filename_ + suffix << std::endl;
+        delete segment;
+        return false;
+    }
+
+    segments_.push_back(segment);
+    return startWriter();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Have the rows of the last segment appended by a BintxtWriter, if so
+    configured.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::startWriter(void)
+{
+    if (!unbuffered_) {
+        return true;
+    }
+
+    // No use preallocating past where the segment is rotated
+    uint64_t const prealloc = rotateBytes_ > 0 ? std::min(prealloc_, rotateBytes_) : prealloc_;
+
+    if (!segments_.back()->startWriter(writerMode_, prealloc, writerStats_)) {
+        std::cerr << "Can't start writer for " << segments_.back()->path() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Rewrite a sealed segment compressed and reopen it in place. If the
+    rewrite fails, the segment stays uncompressed.
+  
+  Wants:
+    Segment in segments_.
+    
+  Gives: 
+    False if the segment could not be reopened.
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::compress(BintxtSegment *&segment)
+{
+    unsigned const seq = segment->seq();
+    std::string const path(segment->path());
+    uint64_t const rawSize = segment->size();
+
+
+    if (!segment->compress(compressBlock_, COMMIT_NONE != policy_)) {
+        return true;
+    }
+
+    delete segment;
+    segment = new BintxtSegment(seq);
+    if (!segment->open(path, indexEvery_, serialIndex_, true, bloomSerials_)) {
+        std::cerr << "Can't open segment " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "Compressed " << path << " from " << rawSize << " to " << segment->storedSize() << " bytes" << std::endl;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Commit and seal the current segment and start a new one. Compress the
+    sealed one if asked to. Drop the old segments that retention no longer
+    keeps.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::rotate(void)
+{
+    bool const ok = commit();
+
+    if (!segments_.back()->seal(COMMIT_NONE != policy_)) {
+        return false;
+    }
+
+    if (compressBlock_ > 0  &&  !compress(segments_.back())) {
+        return false;
+    }
+
+    if (!addSegment()) {
+        return false;
+    }
+
+    // A crash now rereads only the new segment for the view
+    saveLatest();
+
+    ++stats_.rotations;
+    retain();
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Delete the oldest segments beyond the retained count, and those whose
+    newest row is older than the retention time. The current segment is
+    always kept.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::retain(void)
+{
+    time_t const now = time(NULL);
+
+    while (segments_.size() > 1) {
+        BintxtSegment *const oldest = segments_.front();
+        bool const tooMany = retainSegs_ > 0  &&  segments_.size() > retainSegs_;
+        bool const tooOld = retainSecs_ > 0  &&  oldest->summary().maxTs.tv_sec + (time_t) retainSecs_ < now;
+
+        if (!tooMany  &&  !tooOld) {
+            break;
+        }
+
+        std::cout << "Removing segment " << oldest->path() << std::endl;
+        oldest->remove();
+        cache_.dropSegment(oldest->seq());
+        delete oldest;
+        segments_.pop_front();
+        ++stats_.removals;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Parse and set commit policy: none, batch, records:N or ms:T.
+  
+  Wants:
+    Policy string.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::setCommitPolicy(std::string const &policy)
+{
+    std::string::size_type const colon = policy.find(':');
+    std::string const name(policy.substr(0, colon));
+    long const arg = (policy.npos == colon) ? 0 : atol(policy.c_str() + colon + 1);
+
+    if ("none" == name  &&  policy.npos == colon) {
+        policy_ = COMMIT_NONE;
+    }
+    else if ("batch" == name  &&  policy.npos == colon) {
+        policy_ = COMMIT_BATCH;
+    }
+    else if ("records" == name  &&  arg > 0) {
+        policy_ = COMMIT_RECORDS;
+    }
+    else if ("ms" == name  &&  arg > 0) {
+        policy_ = COMMIT_INTERVAL;
+    }
+    else {
+        return false;
+    }
+
+    policyArg_ = arg;
+    return true;
 }
 
 
@@ -103,18 +542,71 @@ BintxtSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
         break;
 
     case REC_ACT_GET_AFTER:
-        ret = queryRec(rec, send);
+    case REC_ACT_COUNT:
+    case REC_ACT_STATS: {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (REC_ACT_GET_AFTER == rec.action) {
+            ret = queryRec(rec, send);
+        }
+        else {
+            Aggregate agg(rec);
+            ret = aggregate(rec, agg)  &&  agg.send(send);
+        }
+
+        stats_.queryUsLast = monoClock::elapsedUs(start);
+        stats_.queryUsSum += stats_.queryUsLast;
+        stats_.queryUsMax = std::max(stats_.queryUsMax, stats_.queryUsLast);
+        break;
+    }
+
+    case REC_ACT_GET_LATEST:
+        ++stats_.latestQueries;
+        ret = latest_.send(rec, send);
         break;
     }
 
-    return ret ? 0 : 1;
+    return ret ? 0 : -1;
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Write one record to database file. Convert from internal structure to the
-    database format.
+    End of a batch of Records. Write the buffered Records to the file and
+    commit them if the policy says so.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::flush(void)
+{
+    if (pendingRecs_ > 0) {
+        if (COMMIT_BATCH == policy_  ||  
+            (COMMIT_INTERVAL == policy_  &&  monoClock::elapsedUs(firstPending_) >= (uint64_t) policyArg_ * 1000)) 
+        {
+            commit();
+            retain();
+            return;
+        }
+    }
+
+    writeOut();
+    if (COMMIT_NONE == policy_) {
+        saveLatestIfDue();
+    }
+    retain();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Encode one record to the write buffer. Write the buffer out or commit
+    when it is due.
   
   Wants:
     Record's data.
@@ -123,26 +615,43 @@ BintxtSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
     True on success.
 ----------------------------------------------------------------------------*/
 bool
-BintxtSinkImpl::storeRec(Record const &rec) const
+BintxtSinkImpl::storeRec(Record const &rec)
 {
-    uint32_t tmp;
+    int const size = bintxt::rowSize(rec, crc_);
+    BintxtSegment const *const current = segments_.back();
+
+    if (segmented()  &&  current->summary().count > 0  &&  
+        ((rotateBytes_ > 0  &&  current->size() + size > rotateBytes_)  ||  
+         (rotateSecs_ > 0  &&  rec.timestamp.tv_sec - current->summary().minTs.tv_sec >= (time_t) rotateSecs_)))
+    {
+        if (!rotate()) {
+            return false;
+        }
+    }
+
+    size_t const pos = wbuf_.size();
 
-    tmp = htonl(rec.timestamp.tv_sec);
-    fwrite(&tmp, sizeof(tmp), 1, file_);
-    tmp = htonl(rec.timestamp.tv_usec);
-    fwrite(&tmp, sizeof(tmp), 1, file_);
+    wbuf_.resize(pos + size);
+    bintxt::encodeRow(&wbuf_[pos], rec, crc_);
+    ++bufferedRecs_;
 
-    tmp = htonl(rec.serial.length());
-    fwrite(&tmp, sizeof(tmp), 1, file_);
-    fwrite(rec.serial.c_str(), 1, rec.serial.length(), file_);
+    cache_.store(rec, segments_.back()->seq(), segments_.back()->size(), size);
+    segments_.back()->note(rec, size);
+    latest_.store(rec);
 
-    tmp = htonl(rec.devType.length());
-    fwrite(&tmp, sizeof(tmp), 1, file_);
-    fwrite(rec.devType.c_str(), 1, rec.devType.length(), file_);
+    if (0 == pendingRecs_++) {
+        clock_gettime(CLOCK_MONOTONIC, &firstPending_);
+    }
 
-    tmp = htonl(rec.data.length());
-    fwrite(&tmp, sizeof(tmp), 1, file_);
-    fwrite(rec.data.c_str(), 1, rec.data.length(), file_);
+    if (COMMIT_RECORDS == policy_  &&  pendingRecs_ >= (unsigned) policyArg_) {
+        return commit();
+    }
+    if (COMMIT_INTERVAL == policy_  &&  monoClock::elapsedUs(firstPending_) >= (uint64_t) policyArg_ * 1000) {
+        return commit();
+    }
+    if (wbuf_.size() >= WRITE_BUFFER_SIZE) {
+        return writeOut();
+    }
 
     return true;
 }
@@ -150,140 +659,621 @@ BintxtSinkImpl::storeRec(Record const &rec) const
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Scan through the database from start and send every record matching the
-    given reference. Graciously handle the situations where a record from
-    database is cut at the end of the buffer's capacity.
+    Write the buffered Records to the file with as few write() calls as the
+    kernel allows.
   
   Wants:
-    Reference record data.
-    Handler to a function to use to send the replies.
+    Nothing.
     
   Gives: 
     True on success.
 ----------------------------------------------------------------------------*/
 bool
-BintxtSinkImpl::queryRec(Record const &reference, Sink::SendRecord_f const &send) const
+BintxtSinkImpl::writeOut(void)
 {
-    char buffer[1500];
-    fseek(file_, 0, SEEK_SET);
-    Record rec;
-    int bytes = 0;
+    size_t done = 0;
+    struct timespec start;
 
 
-    while (!feof(file_)) {
-        bytes += fread(buffer + bytes, 1, sizeof(buffer) - bytes, file_);
-        int bufPos = 0;
+    if (wbuf_.empty()) {
+        return true;
+    }
 
-        while (1) {
-            int const ret = readRec(rec, buffer + bufPos, bytes - bufPos);
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-            if (0 == ret) {
-                bytes -= bufPos;
-                memmove(buffer, buffer + bufPos, bytes);
-                break;
-            }
+    bool const ok = segments_.back()->write(&wbuf_[0], wbuf_.size(), done);
+    uint64_t const latency = monoClock::elapsedUs(start);
+    if (done < wbuf_.size()) {
+        std::cerr << "Sink lost " << bufferedRecs_ << " records" << std::endl;
+        cache_.invalidate();
+    }
 
-            rec.action = REC_ACT_REPLY;
-            if (rec.match(reference)  &&  send(rec, reference.priv) < 0) {
-                return false;
+    ++stats_.writes;
+    stats_.writtenRecs += bufferedRecs_;
+    stats_.writtenBytes += done;
+    stats_.writeUsSum += latency;
+    if (latency > stats_.writeUsMax)  stats_.writeUsMax = latency;
+
+    wbuf_.clear();
+    bufferedRecs_ = 0;
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write out the buffered Records and make everything written so far
+    durable, unless the policy is 'none'. All Records pending since the last
+    commit share one fdatasync().
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::commit(void)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    bool ok = writeOut();
+
+    if (COMMIT_NONE == policy_  ||  0 == pendingRecs_) {
+        pendingRecs_ = 0;
+        if (ok) {
+            saveLatestIfDue();
+        }
+        return ok;
+    }
+
+    if (!segments_.back()->sync()) {
+        ok = false;
+    }
+
+    uint64_t const latency = monoClock::elapsedUs(start);
+    ++stats_.commits;
+    stats_.committedRecs += pendingRecs_;
+    stats_.commitUsSum += latency;
+    if (pendingRecs_ > stats_.commitRecsMax)  stats_.commitRecsMax = pendingRecs_;
+    if (latency > stats_.commitUsMax)  stats_.commitUsMax = latency;
+
+    pendingRecs_ = 0;
+    if (ok) {
+        saveLatestIfDue();
+    }
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print write and commit batch sizes and commit latency, and how many
+    segments queries could skip.
+  
+  Wants:
+    Output stream.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+BintxtSinkImpl::printStats(std::ostream &os) const
+{
+    os << "Bintxt: " << stats_.writes << " writes, " 
+        << (stats_.writes ? stats_.writtenRecs / stats_.writes : 0) << " records and " 
+        << (stats_.writes ? stats_.writtenBytes / stats_.writes : 0) << " bytes per write, "
+        << "latency avg " << (stats_.writes ? stats_.writeUsSum / stats_.writes : 0) << " us, max " << stats_.writeUsMax << " us" << std::endl;
+
+    if (unbuffered_) {
+        os << "  Writer: " << writerStats_.directWrites << " O_DIRECT writes of " << writerStats_.directBytes << " bytes, " 
+            << writerStats_.paddedBytes << " bytes padding, " << writerStats_.writebackBytes << " bytes by writeback, " 
+            << writerStats_.droppedBytes << " dropped from cache, " << writerStats_.preallocated << " preallocated, " 
+            << writerStats_.fallbacks << " fallbacks" << std::endl;
+    }
+
+    os << "  " << stats_.commits << " commits, " 
+        << (stats_.commits ? stats_.committedRecs / stats_.commits : 0) << " records per commit (max " << stats_.commitRecsMax << "), "
+        << "latency avg " << (stats_.commits ? stats_.commitUsSum / stats_.commits : 0) << " us, max " << stats_.commitUsMax << " us" << std::endl;
+
+    if (indexEvery_ > 0) {
+        size_t blocks = 0;
+        for (std::deque<BintxtSegment *>::const_iterator it = segments_.begin(); it != segments_.end(); ++it) {
+            blocks += (*it)->indexBlocks();
+        }
+        os << "  " << blocks << " index blocks" << std::endl;
+    }
+
+    if (segmented()) {
+        os << "  " << segments_.size() << " segments, " << stats_.rotations << " rotated, " << stats_.removals << " removed, "
+            << stats_.queries << " queries read " << stats_.segmentsRead << " segments, skipped " << stats_.segmentsSkipped 
+            << " by time and " << stats_.segmentsFiltered << " by serial" << std::endl;
+    }
+
+    if (compressBlock_ > 0) {
+        uint64_t raw = 0;
+        uint64_t stored = 0;
+        unsigned count = 0;
+        for (std::deque<BintxtSegment *>::const_iterator it = segments_.begin(); it != segments_.end(); ++it) {
+            if ((*it)->compressed()) {
+                raw += (*it)->size();
+                stored += (*it)->storedSize();
+                ++count;
             }
+        }
+        os << "  " << count << " compressed segments, " << raw << " bytes stored in " << stored 
+            << " (" << (raw ? stored * 100 / raw : 0) << "%)" << std::endl;
+    }
+
+    os << "  " << stats_.queries << " queries took avg " << (stats_.queries ? stats_.queryUsSum / stats_.queries : 0) 
+        << " us, max " << stats_.queryUsMax << " us, last " << stats_.queryUsLast << " us";
+    if (pool_) {
+        os << ", " << stats_.ranges << " ranges on " << pool_->size() << " threads, " << pool_->steals() << " stolen";
+    }
+    os << std::endl;
+
+    os << "  " << stats_.latestQueries << " latest queries, " << latest_.size() << " Records in latest view" << std::endl;
 
-            bufPos += ret;
+    if (cache_.enabled()) {
+        cache_.printStats(os);
+    }
+}
 
-            if (bufPos >= bytes) {
-                break;
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every record matching the given reference. Answer from the cache
+    alone if it has all newer Records. Otherwise read the disk up to where
+    the cache starts, skipping the segments that have only older rows or
+    not the serial, and take the rest from the cache. With the pool the
+    disk is read in parallel. A paged query is sent a page at a time.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::queryRec(Record const &reference, Sink::SendRecord_f const &send)
+{
+    std::vector<Part> parts;
+
+
+    // Buffered Records must be visible to the query
+    writeOut();
+
+    ++stats_.queries;
+
+    if (reference.paged()) {
+        return queryPage(reference, send);
+    }
+
+    if (cache_.enabled()  &&  cache_.covers(reference)) {
+        return cache_.send(reference, send);
+    }
+
+    bool const merge = planQuery(reference, parts);
+
+    if (pool_) {
+        if (!queryParallel(reference, send, parts)) {
+            return false;
+        }
+    }
+    else {
+        for (std::vector<Part>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+            if (!it->segment->queryRange(reference, send, it->from, it->to)) {
+                return false;
             }
         }
     }
 
-    return true;
+    return !merge  ||  cache_.send(reference, send);
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Read one record in database format from buffer and store its data into 
-    Record structure.
-      
+    Send one page of the Records matching the given reference, starting
+    from its cursor: the segment and offset of the next row to read. The
+    same segments, ranges and cache are read as for a query, but in file
+    order and without the pool, so that the cursor of every reply is where
+    the next page starts. Segments and rows before the cursor are not
+    read, and reading stops as soon as the page is full.
+  
   Wants:
-    Reference record data.
+    Paged reference Record.
     Handler to a function to use to send the replies.
     
   Gives: 
-    Number of bytes consumed from the buffer, or
-    0 in case the buffer's data was incomplete.
+    True on success.
 ----------------------------------------------------------------------------*/
-int
-BintxtSinkImpl::readRec(Record &rec, char const *const buffer, int const dataSize) const
+bool
+BintxtSinkImpl::queryPage(Record const &reference, Sink::SendRecord_f const &send)
 {
-    uint32_t tmp;
-    char const *ptr = buffer;
+    QueryPage page(reference);
+    std::vector<Part> parts;
+    bool failed = false;
+    Record rec;
+
+    auto const cached = [&page, &rec, &send, &failed] (Record const &hit, unsigned const seq, uint64_t const offset, uint32_t const size) {
+        if (!page.reached(seq, offset)) {
+            return true;
+        }
+        rec = hit;
+        failed = page.send(rec, seq, offset + size, send) < 0;
+        return !failed  &&  !page.full();
+    };
 
 
-    // Theoretical absolute minimum required for a record
-    if (dataSize < 5 * (int) sizeof(uint32_t)) {
-        return 0;
+    if (!page.valid()) {
+        return false;
+    }
+
+    if (cache_.enabled()  &&  cache_.covers(reference)) {
+        cache_.match(reference, cached);
+        return !failed;
     }
 
-    // Timestamp: 8 bytes
-    rec.timestamp.tv_sec = ntohl(*((uint32_t *) ptr));
-    ptr += sizeof(uint32_t);
-    rec.timestamp.tv_usec = ntohl(*((uint32_t *) ptr));
-    ptr += sizeof(uint32_t);
+    bool const merge = planQuery(reference, parts);
+
+    for (std::vector<Part>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+        unsigned const seq = it->segment->seq();
+
+        if (!page.reached(seq, it->to)) {
+            continue;
+        }
+
+        uint64_t const from = seq == page.part() ? std::max(it->from, page.position()) : it->from;
+
+        bool const read = it->segment->matchRows(reference, 
+            [&page, &rec, &send, &failed, seq] (bintxt::RowView const &view, char const *, int const len, uint64_t const offset) {
+                view.toRecord(rec);
+                rec.action = REC_ACT_REPLY;
+                failed = page.send(rec, seq, offset + len, send) < 0;
+                return !failed  &&  !page.full();
+            }, from, it->to);
+
+        if (!read) {
+            // Stopped by a full page, or failed
+            return !failed  &&  page.full();
+        }
+    }
+
+    if (merge) {
+        cache_.match(reference, cached);
+    }
+
+    return !failed;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Count the Records matching the given reference to an aggregate. The
+    same segments and ranges are read as for a query, but the rows are
+    only looked at in place. With the pool every range is counted in
+    parallel to an aggregate of its own, and those are merged.
+  
+  Wants:
+    Reference Record.
+    Aggregate to add to.
     
-    // Pascal strings, length is 4 bytes
-    tmp = ntohl(*((uint32_t *) ptr));
-    ptr += sizeof(uint32_t);
-    if (dataSize - (ptr - buffer) < tmp)  return 0;
-    rec.serial.assign(ptr, tmp);
-    ptr += tmp;
-
-    tmp = ntohl(*((uint32_t *) ptr));
-    ptr += sizeof(uint32_t);
-    if (dataSize - (ptr - buffer) < tmp)  return 0;
-    rec.devType.assign(ptr, tmp);
-    ptr += tmp;
-
-    tmp = ntohl(*((uint32_t *) ptr));
-    ptr += sizeof(uint32_t);
-    if (dataSize - (ptr - buffer) < tmp)  return 0;
-    rec.data.assign(ptr, tmp);
-    ptr += tmp;
-
-    return ptr - buffer;
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::aggregate(Record const &reference, Aggregate &agg)
+{
+    std::vector<Part> parts;
+    auto const count = [] (Aggregate &to) {
+        return [&to] (bintxt::RowView const &view, char const *, int, uint64_t) {
+            to.add(view.serial, view.serialLen, view.devType, view.devTypeLen, view.timestamp, view.dataLen);
+            return true;
+        };
+    };
+
+
+    writeOut();
+
+    ++stats_.queries;
+
+    if (cache_.enabled()  &&  cache_.covers(reference)) {
+        return cache_.send(reference, agg.collector());
+    }
+
+    bool const merge = planQuery(reference, parts);
+
+    if (pool_) {
+        std::vector<Aggregate> partial(parts.size(), Aggregate(reference));
+        std::vector<WorkerPool::Task_f> tasks;
+
+        for (size_t i = 0; i < parts.size(); ++i) {
+            tasks.push_back([&parts, &partial, &reference, &count, i] () {
+                parts[i].ok = parts[i].segment->matchRows(reference, count(partial[i]), parts[i].from, parts[i].to);
+            });
+        }
+
+        pool_->run(tasks);
+
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (!parts[i].ok) {
+                return false;
+            }
+            agg.merge(partial[i]);
+        }
+    }
+    else {
+        for (std::vector<Part>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+            if (!it->segment->matchRows(reference, count(agg), it->from, it->to)) {
+                return false;
+            }
+        }
+    }
+
+    return !merge  ||  cache_.send(reference, agg.collector());
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Allocate implementation for Bintxt sink. Allow only one instance.
-      
+    Tell which ranges of which segments a query reads, in file order. Only
+    with the pool are segments split to several ranges.
+  
   Wants:
-    Nothing.
+    Reference Record.
+    Destination for the ranges.
+    
+  Gives: 
+    True if the ranges end where the cache starts, so the rest of the
+    Records come from the cache.
+----------------------------------------------------------------------------*/
+bool
+BintxtSinkImpl::planQuery(Record const &reference, std::vector<Part> &parts)
+{
+    unsigned cacheSeg = 0;
+    uint64_t cacheOffset = 0;
+    bool const merge = cache_.enabled()  &&  cache_.start(cacheSeg, cacheOffset);
+    BintxtSegment::Ranges_t ranges;
 
+
+    for (std::deque<BintxtSegment *>::const_iterator it = segments_.begin(); it != segments_.end(); ++it) {
+        if (merge  &&  (*it)->seq() > cacheSeg) {
+            break;
+        }
+
+        if (!(*it)->mayMatch(reference)) {
+            ++stats_.segmentsSkipped;
+            continue;
+        }
+
+        if (!(*it)->mayHaveSerial(reference.serial)) {
+            ++stats_.segmentsFiltered;
+            continue;
+        }
+
+        ++stats_.segmentsRead;
+        ranges.clear();
+        (*it)->plan(reference, (merge  &&  (*it)->seq() == cacheSeg) ? cacheOffset : UINT64_MAX, pool_ ? split_ : 0, mapped_, ranges);
+
+        for (BintxtSegment::Ranges_t::const_iterator range = ranges.begin(); range != ranges.end(); ++range) {
+            Part part;
+            part.segment = *it;
+            part.from = range->first;
+            part.to = range->second;
+            part.ok = false;
+            parts.push_back(part);
+        }
+    }
+
+    stats_.ranges += parts.size();
+    return merge;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the ranges on the pool and send the results in file order, like
+    a query without the pool and a paged one, also if the clock has
+    stepped back. Ranges are read a window of twice the threads at a time,
+    so that only the results of one window are held in memory.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    Ranges from planQuery().
+    
   Gives: 
     True on success.
 ----------------------------------------------------------------------------*/
 bool
-BintxtSink::open(std::string const &opts)
+BintxtSinkImpl::queryParallel(Record const &reference, Sink::SendRecord_f const &send, std::vector<Part> &parts)
 {
-    std::string filename(opts.length() > 0 ? opts : "filedb.bin");
+    size_t const window = 2 * pool_->size();
+    std::vector<WorkerPool::Task_f> tasks;
+    Record rec;
 
 
-    if (pImpl_) {
-        return false;
+    for (size_t first = 0; first < parts.size(); first += window) {
+        size_t const last = std::min(parts.size(), first + window);
+
+        tasks.clear();
+        for (size_t i = first; i < last; ++i) {
+            tasks.push_back([&parts, &reference, i] () {
+                Part &part = parts[i];
+                part.ok = part.segment->matchRows(reference, [&part] (bintxt::RowView const &, char const *const row, int const len, uint64_t) {
+                    part.offsets.push_back(part.rows.size());
+                    part.rows.insert(part.rows.end(), row, row + len);
+                    return true;
+                }, part.from, part.to);
+            });
+        }
+
+        pool_->run(tasks);
+
+        // A failed range ends the answer where it failed, as without the pool
+        for (size_t i = first; i < last; ++i) {
+            Part &part = parts[i];
+
+            for (std::vector<size_t>::const_iterator offset = part.offsets.begin(); offset != part.offsets.end(); ++offset) {
+                bintxt::decodeRow(rec, &part.rows[*offset], part.rows.size() - *offset);
+                rec.action = REC_ACT_REPLY;
+
+                if (send(rec, reference.priv) < 0) {
+                    return false;
+                }
+            }
+
+            std::vector<char>().swap(part.rows);
+            std::vector<size_t>().swap(part.offsets);
+            if (!part.ok) {
+                return false;
+            }
+        }
     }
 
-    if (NULL == (pImpl_ = new BintxtSinkImpl)) {
-        return false;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate and open an implementation of Bintxt sink. Other Sinks may
+    hold their own instances, each on its own file.
+      
+  Wants:
+    Options: FILE[,commit=none|batch|records:N|ms:T][,index=N][,serials=1][,mmap=0]
+             [,segment=BYTES][,rotate=SECONDS][,retain=N][,keep=SECONDS]
+             [,cache=N][,cachesecs=T][,crc=0][,compress=1][,block=BYTES][,bloom=N]
+             [,threads=N][,split=BYTES][,writer=MODE][,prealloc=BYTES]
+
+  Gives: 
+    The implementation, or NULL on failure.
+----------------------------------------------------------------------------*/
+BintxtSinkImpl *
+BintxtSink::create(std::string const &opts)
+{
+    SinkOptions const options(opts, "filedb.bin");
+    std::string const &filename(options.path());
+    std::string const commit(options.get("commit", "none"));
+    long const indexEvery = options.getInt("index", 1024);
+    bool const serialIndex = options.getInt("serials", 0) != 0;
+    bool const mapped = options.getInt("mmap", 1) != 0;
+    long long const segmentBytes = options.getSize("segment", 0);
+    long const rotateSecs = options.getInt("rotate", 0);
+    long const retainSegs = options.getInt("retain", 0);
+    long const retainSecs = options.getInt("keep", 0);
+    long const cacheRecs = options.getInt("cache", 0);
+    long const cacheSecs = options.getInt("cachesecs", 0);
+    bool const crc = options.getInt("crc", 1) != 0;
+    bool const compress = options.getInt("compress", 0) != 0;
+    long long const blockSize = options.getSize("block", 65536);
+    long const bloomSerials = options.getInt("bloom", 10000);
+    long const queryThreads = options.getInt("threads", 0);
+    long long const splitBytes = options.getSize("split", 4 * 1024 * 1024);
+    std::string const writer(options.get("writer", "buffered"));
+    long long const prealloc = options.getSize("prealloc", 16 * 1024 * 1024);
+
+
+    if (options.unknown().length() > 0) {
+        std::cerr << "Unknown bintxt option '" << options.unknown() << "'" << std::endl;
+        return NULL;
+    }
+
+    if (indexEvery < 0) {
+        std::cerr << "Invalid index block size " << indexEvery << std::endl;
+        return NULL;
+    }
+
+    if (segmentBytes < 0  ||  rotateSecs < 0  ||  retainSegs < 0  ||  retainSecs < 0) {
+        std::cerr << "Invalid segment rotation or retention" << std::endl;
+        return NULL;
+    }
+
+    if (0 == segmentBytes  &&  0 == rotateSecs  &&  (retainSegs > 0  ||  retainSecs > 0)) {
+        std::cerr << "Retention needs segment or rotate option" << std::endl;
+        return NULL;
+    }
+
+    if (compress  &&  0 == segmentBytes  &&  0 == rotateSecs) {
+        std::cerr << "Compression needs segment or rotate option" << std::endl;
+        return NULL;
+    }
+
+    if (blockSize < 4096  ||  blockSize > 4 * 1024 * 1024) {
+        std::cerr << "Invalid compression block size " << blockSize << std::endl;
+        return NULL;
+    }
+
+    if (bloomSerials < 0  ||  bloomSerials > 100000000) {
+        std::cerr << "Invalid Bloom filter size " << bloomSerials << std::endl;
+        return NULL;
     }
 
-    if (!pImpl_->open(filename)) {
+    if (queryThreads < 0  ||  queryThreads > 256  ||  splitBytes < 65536) {
+        std::cerr << "Invalid query threads or split size" << std::endl;
+        return NULL;
+    }
+
+    if ((writer != "buffered"  &&  writer != "direct"  &&  writer != "writeback")  ||  prealloc < 0) {
+        std::cerr << "Invalid writer '" << writer << "' or preallocation" << std::endl;
+        return NULL;
+    }
+
+    if (cacheRecs < 0  ||  cacheSecs < 0) {
+        std::cerr << "Invalid cache size" << std::endl;
+        return NULL;
+    }
+
+    BintxtSinkImpl *const impl = new BintxtSinkImpl;
+
+    if (!impl->setCommitPolicy(commit)) {
+        std::cerr << "Invalid commit policy '" << commit << "'" << std::endl;
+        delete impl;
+        return NULL;
+    }
+
+    impl->setMapped(mapped);
+    impl->setCache(cacheRecs, cacheSecs);
+    impl->setCrc(crc);
+    impl->setRotation(segmentBytes, rotateSecs);
+    impl->setRetention(retainSegs, retainSecs);
+    impl->setCompression(compress ? blockSize : 0);
+    impl->setBloom(bloomSerials);
+    impl->setQueryThreads(queryThreads, splitBytes);
+    if (writer != "buffered") {
+        impl->setWriter(writer == "direct" ? BintxtWriter::DIRECT : BintxtWriter::WRITEBACK, prealloc);
+    }
+
+    if (!impl->open(filename, indexEvery, serialIndex)) {
         std::cerr << "Can't open file " << filename << std::endl;
         abort();
     }
 
-    std::cout << "Opened sink: File " << filename << std::endl;
-    return true;
+    std::cout << "Opened sink: File " << filename << ", commit " << commit << std::endl;
+    return impl;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate implementation for Bintxt sink. Allow only one instance.
+      
+  Wants:
+    Options, see create().
+
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtSink::open(std::string const &opts)
+{
+    if (pImpl_) {
+        return false;
+    }
+
+    return NULL != (pImpl_ = create(opts));
 }
 
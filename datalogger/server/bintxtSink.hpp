@@ -28,7 +28,16 @@ For more information, please refer to <http://unlicense.org>
 #ifndef HOMEWORK_SERVER_BINTXT_SINK_HPP
 #define HOMEWORK_SERVER_BINTXT_SINK_HPP
 
+#include <time.h>
+#include <vector>
+#include <deque>
+#include <string>
 #include "sink.hpp"
+#include "bintxtSegment.hpp"
+#include "tailCache.hpp"
+#include "workerPool.hpp"
+#include "aggregate.hpp"
+#include "latestView.hpp"
 
 struct Record;
 
@@ -37,22 +46,174 @@ struct Record;
   Does:
     Implement Bintxt Sink functionality. Write to and read data from the file
     (database).
+
+    Records are encoded to a write buffer and written to the file with one
+    write() per batch. Commit policy decides when written data is made
+    durable with fdatasync():
+      none       Never. The kernel writes the data back at its leisure.
+      records:N  Every N Records.
+      ms:T       T milliseconds after the oldest uncommitted Record.
+      batch      After every batch of Records received together.
+
+    Queries start from the block that the sparse timestamp index points to.
+    Queries for one serial read only its rows if the serial index is on.
+    Queries decode the rows in place from a memory map of the file.
+
+    The database is one file, or a log of segment files FILE.000001,
+    FILE.000002... when rotation by size or age is set. Queries skip the
+    segments that only have older rows. Retention deletes whole segments.
+    Sealed segments can be compressed in blocks. Queries for one serial skip
+    the segments whose Bloom filter does not have it.
+
+    Queries can run on a pool of threads. The segments to read are split
+    to ranges, which the threads scan concurrently, and the results are
+    sent in file order, the same order as a paged query's.
+
+    Recent Records can be cached in memory. Queries for them need no disk.
+
+    COUNT and STATS read the same rows as a query, but count them in place
+    instead of sending them.
+
+    A paged query resumes from the segment and offset in its cursor and
+    stops when the page is full.
+
+    The latest Record of every serial and devType is kept in memory for
+    GET_LATEST. The view is saved as FILE.latest on close, rotation and
+    after every 16 MB of committed rows, with the log position it covers;
+    on open only the rows after that are read, also after a crash.
+
+    The rows can be appended around the page cache by a BintxtWriter, with
+    O_DIRECT or with early writeback and dropping written pages.
+
+    Rows carry CRC-32C. On open only the rows after the last time index
+    block are checked, and a torn or corrupt tail is truncated. A query
+    skips a damaged row's block and goes on from the next one, or fails.
 ----------------------------------------------------------------------------*/
 class BintxtSinkImpl
 {
 public:
-    BintxtSinkImpl() : file_(NULL) {}
+    enum CommitPolicy { COMMIT_NONE, COMMIT_RECORDS, COMMIT_INTERVAL, COMMIT_BATCH };
+
+    BintxtSinkImpl();
     ~BintxtSinkImpl();
 
-    bool open(std::string const &filename);
+    bool open(std::string const &filename, uint32_t indexEvery, bool serialIndex);
+    bool setCommitPolicy(std::string const &policy);
+    void setMapped(bool mapped) { mapped_ = mapped; }
+    void setRotation(uint64_t bytes, uint32_t seconds) { rotateBytes_ = bytes; rotateSecs_ = seconds; }
+    void setRetention(uint32_t segments, uint32_t seconds) { retainSegs_ = segments; retainSecs_ = seconds; }
+    void setCache(size_t records, uint32_t seconds) { cache_.configure(records, seconds); }
+    void setCrc(bool crc) { crc_ = crc; }
+    void setCompression(uint32_t blockSize) { compressBlock_ = blockSize; }
+    void setBloom(uint32_t serials) { bloomSerials_ = serials; }
+    void setQueryThreads(unsigned threads, uint64_t split);
+    void setWriter(BintxtWriter::Mode mode, uint64_t prealloc) { unbuffered_ = true; writerMode_ = mode; prealloc_ = prealloc; }
+
     int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    bool aggregate(Record const &ref, Aggregate &agg);
+    void flush(void);
+
+    void printStats(std::ostream &os) const;
 
 private:
-    bool storeRec(Record const &rec) const;
-    bool queryRec(Record const &ref, Sink::SendRecord_f const &send) const;
-    int readRec(Record &rec, char const *buffer, int dataSize) const;
+    bool storeRec(Record const &rec);
+    bool queryRec(Record const &ref, Sink::SendRecord_f const &send);
+    bool queryPage(Record const &ref, Sink::SendRecord_f const &send);
 
-    FILE *file_;
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        Range of a segment a query reads, and its results when read by the
+        pool: matching rows encoded back to back, and their offsets.
+    ----------------------------------------------------------------------------*/
+    struct Part {
+        BintxtSegment const *segment;
+        uint64_t from;
+        uint64_t to;
+        std::vector<char> rows;
+        std::vector<size_t> offsets;
+        bool ok;
+    };
+
+    bool planQuery(Record const &ref, std::vector<Part> &parts);
+    bool queryParallel(Record const &ref, Sink::SendRecord_f const &send, std::vector<Part> &parts);
+
+    bool writeOut(void);
+    bool commit(void);
+
+    bool segmented(void) const { return rotateBytes_ > 0  ||  rotateSecs_ > 0; }
+    bool openSegments(void);
+    bool addSegment(void);
+    bool rotate(void);
+    bool startWriter(void);
+    void loadLatest(void);
+    void saveLatest(void);
+    void saveLatestIfDue(void);
+    bool compress(BintxtSegment *&segment);
+    void retain(void);
+
+    std::string filename_;
+    uint32_t indexEvery_;
+    bool serialIndex_;
+
+    uint64_t rotateBytes_;   // Start a new segment when this full
+    uint32_t rotateSecs_;    // or when its oldest row is this old
+    uint32_t retainSegs_;    // Keep at most this many segments
+    uint32_t retainSecs_;    // Delete segments with no newer rows than this
+    unsigned nextSeq_;       // Number of the next segment file
+    uint32_t compressBlock_; // Sealed segments are compressed in blocks of this, 0 not
+    uint32_t bloomSerials_;  // Segments' Bloom filters are sized for this many serials, 0 none
+
+    std::deque<BintxtSegment *> segments_;  // Oldest first, rows go to last
+
+    bool mapped_;    // Queries read through memory maps
+    TailCache cache_;
+    LatestView latest_;
+    bool crc_;       // Rows are written with CRC
+
+    bool unbuffered_;                  // Rows are appended by a BintxtWriter
+    BintxtWriter::Mode writerMode_;
+    uint64_t prealloc_;                // Writer's fallocate() step
+    BintxtWriter::Stats writerStats_;
+
+    WorkerPool *pool_;     // Query threads, NULL to query in the calling thread
+    uint64_t split_;       // Least bytes of a range for the pool
+
+    std::vector<char> wbuf_;  // Encoded Records not yet written to the file
+    unsigned bufferedRecs_;
+
+    CommitPolicy policy_;
+    long policyArg_;
+    unsigned pendingRecs_;           // Records since the last commit
+    struct timespec firstPending_;   // When the oldest of them arrived
+    uint64_t latestSavedAt_;         // Bytes written when the latest view was saved
+
+    struct Stats {
+        Stats() : writes(0), writtenRecs(0), writtenBytes(0), writeUsSum(0), writeUsMax(0), commits(0), committedRecs(0), commitRecsMax(0), commitUsSum(0), commitUsMax(0),
+                  queries(0), segmentsRead(0), segmentsSkipped(0), segmentsFiltered(0), rotations(0), removals(0),
+                  ranges(0), queryUsSum(0), queryUsMax(0), queryUsLast(0), latestQueries(0) {}
+
+        uint64_t writes;
+        uint64_t writtenRecs;
+        uint64_t writtenBytes;
+        uint64_t writeUsSum;
+        uint64_t writeUsMax;
+        uint64_t commits;
+        uint64_t committedRecs;
+        uint64_t commitRecsMax;
+        uint64_t commitUsSum;
+        uint64_t commitUsMax;
+        uint64_t queries;
+        uint64_t segmentsRead;
+        uint64_t segmentsSkipped;
+        uint64_t segmentsFiltered;
+        uint64_t rotations;
+        uint64_t removals;
+        uint64_t ranges;
+        uint64_t queryUsSum;
+        uint64_t queryUsMax;
+        uint64_t queryUsLast;
+        uint64_t latestQueries;
+    } stats_;
 };
 
 
@@ -65,10 +226,11 @@ private:
 class BintxtSink : public Sink
 {
 public:
-    BintxtSink() : Sink("bintxt"), pImpl_(NULL) {}
+    explicit BintxtSink(char const *const name = "bintxt") : Sink(name), pImpl_(NULL) {}
     virtual ~BintxtSink() { if (pImpl_) delete pImpl_; }
 
     virtual bool open(std::string const &opts);
+    static BintxtSinkImpl *create(std::string const &opts);
     
     BintxtSinkImpl const *impl(void) const { return pImpl_; }
 
@@ -78,6 +240,14 @@ public:
         Creates binding to implementation's functions.
     ----------------------------------------------------------------------------*/
     virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&BintxtSinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&Sink::processEach<BintxtSinkImpl *>, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&BintxtSinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { if (pImpl_) pImpl_->printStats(os); }
+    virtual Sink *another(void) const { return new BintxtSink(NULL); }
 
 private:
     BintxtSinkImpl *pImpl_;
@@ -0,0 +1,338 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include "bintxtWriter.hpp"
+
+
+// O_DIRECT offsets, lengths and buffers are aligned to this
+#define DIRECT_BLOCK_SIZE  4096
+
+// Staging buffer, the most written with one O_DIRECT write
+#define DIRECT_STAGE_SIZE  (1024 * 1024)
+
+// Writeback is started and the cache dropped in chunks this large
+#define WRITEBACK_CHUNK  (1024 * 1024)
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Nothing is written until open().
+
+  Wants:
+    DIRECT or WRITEBACK.
+    Bytes to preallocate at a time, 0 not to.
+    Statistics to add to. They outlive the writer.
+----------------------------------------------------------------------------*/
+BintxtWriter::BintxtWriter(Mode const mode, uint64_t const prealloc, Stats &stats)
+: mode_(mode), prealloc_(prealloc), stats_(stats), fd_(-1), directFd_(-1), end_(0), allocated_(0), 
+  stage_(NULL), stageBase_(0), staged_(0), started_(0), dropped_(0)
+{
+}
+
+
+BintxtWriter::~BintxtWriter()
+{
+    close();
+    free(stage_);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Start appending to a segment file. For DIRECT open the file again with
+    O_DIRECT and read its partial last block to the staging buffer. Fall
+    back to WRITEBACK if either fails.
+
+  Wants:
+    File's path.
+    Segment's file descriptor, open for reading and appending.
+    Size of the rows in the file.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::open(std::string const &path, int const fd, uint64_t const end)
+{
+    path_ = path;
+    fd_ = fd;
+    end_ = end;
+    allocated_ = end;
+    started_ = end;
+    dropped_ = end;
+
+    if (DIRECT != mode_) {
+        return true;
+    }
+
+    directFd_ = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+    if (directFd_ < 0) {
+        std::cerr << "Can't use O_DIRECT for " << path << ": " << strerror(errno) << ", using writeback" << std::endl;
+        ++stats_.fallbacks;
+        return true;
+    }
+
+    if (NULL == stage_  &&  0 != posix_memalign((void **) &stage_, DIRECT_BLOCK_SIZE, DIRECT_STAGE_SIZE)) {
+        stage_ = NULL;
+        return false;
+    }
+
+    stageBase_ = end / DIRECT_BLOCK_SIZE * DIRECT_BLOCK_SIZE;
+    staged_ = end - stageBase_;
+
+    if (staged_ > 0  &&  pread(fd_, stage_, staged_, stageBase_) != (ssize_t) staged_) {
+        std::cerr << "Can't read the last block of " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append rows after the ones written so far.
+
+  Wants:
+    Encoded rows and their size.
+    Destination for the number of bytes written.
+
+  Gives:
+    True on success. On failure end() tells where the rows that made it
+    end.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::write(char const *const buffer, size_t const len, size_t &done)
+{
+    done = 0;
+
+    if (directFd_ >= 0) {
+        return writeDirect(buffer, len, done);
+    }
+
+    return writeBack(buffer, len, done);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stage the rows after the partial last block and write the stage out in
+    whole blocks, the last one padded. A file system that takes the O_DIRECT
+    open but not the writes gets the rows through writeback instead.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::writeDirect(char const *const buffer, size_t const len, size_t &done)
+{
+    while (done < len) {
+        size_t const n = std::min(len - done, DIRECT_STAGE_SIZE - staged_);
+
+        memcpy(stage_ + staged_, buffer + done, n);
+        staged_ += n;
+
+        if (!flushStage(n)) {
+            staged_ -= n;
+            if (EINVAL == errno  &&  0 == stats_.directWrites) {
+                std::cerr << "O_DIRECT write to " << path_ << " failed, using writeback" << std::endl;
+                ++stats_.fallbacks;
+                ::close(directFd_);
+                directFd_ = -1;
+                if (ftruncate(fd_, end_) < 0) {
+                    return false;
+                }
+                size_t rest;
+                bool const ok = writeBack(buffer + done, len - done, rest);
+                done += rest;
+                return ok;
+            }
+            std::cerr << "Sink write error: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        done += n;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the staging buffer at its block, padded to whole blocks. Then keep
+    only its partial last block, to be written again with the next rows.
+
+  Wants:
+    Number of new bytes in the stage.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::flushStage(size_t const len)
+{
+    size_t const padded = (staged_ + DIRECT_BLOCK_SIZE - 1) / DIRECT_BLOCK_SIZE * DIRECT_BLOCK_SIZE;
+    size_t written = 0;
+
+
+    memset(stage_ + staged_, 0, padded - staged_);
+    preallocate(stageBase_ + padded);
+
+    while (written < padded) {
+        ssize_t const ret = pwrite(directFd_, stage_ + written, padded - written, stageBase_ + written);
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        written += ret;
+    }
+
+    ++stats_.directWrites;
+    stats_.directBytes += padded;
+    stats_.paddedBytes += padded - staged_;
+    end_ += len;
+
+    size_t const whole = staged_ / DIRECT_BLOCK_SIZE * DIRECT_BLOCK_SIZE;
+    memmove(stage_, stage_ + whole, staged_ - whole);
+    stageBase_ += whole;
+    staged_ -= whole;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append through the page cache. Start the writeback of each full chunk
+    as soon as it is written, and drop the chunk before it from the cache
+    after waiting for it to reach the disk. By then it mostly has.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::writeBack(char const *const buffer, size_t const len, size_t &done)
+{
+    done = 0;
+    preallocate(end_ + len);
+
+    while (done < len) {
+        ssize_t const ret = ::write(fd_, buffer + done, len - done);
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            std::cerr << "Sink write error: " << strerror(errno) << std::endl;
+            break;
+        }
+        done += ret;
+    }
+
+    end_ += done;
+    stats_.writebackBytes += done;
+
+    if (end_ - started_ < WRITEBACK_CHUNK) {
+        return done == len;
+    }
+
+    uint64_t const to = end_ / DIRECT_BLOCK_SIZE * DIRECT_BLOCK_SIZE;
+
+    sync_file_range(fd_, started_, to - started_, SYNC_FILE_RANGE_WRITE);
+
+    if (started_ > dropped_) {
+        sync_file_range(fd_, dropped_, started_ - dropped_, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd_, dropped_, started_ - dropped_, POSIX_FADV_DONTNEED);
+        stats_.droppedBytes += started_ - dropped_;
+        dropped_ = started_;
+    }
+
+    started_ = to;
+    return done == len;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Make sure the file has blocks up to given offset, allocating the next
+    step at once. The file's size does not change. A file system that can't
+    preallocate is not asked again.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::preallocate(uint64_t const to)
+{
+    if (0 == prealloc_  ||  to <= allocated_) {
+        return true;
+    }
+
+    uint64_t const next = (to + prealloc_ - 1) / prealloc_ * prealloc_;
+
+    if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_, next - allocated_) < 0) {
+        std::cerr << "Can't preallocate " << path_ << ": " << strerror(errno) << std::endl;
+        prealloc_ = 0;
+        return false;
+    }
+
+    stats_.preallocated += next - allocated_;
+    allocated_ = next;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop writing. Cut the file to the rows, dropping the padding and the
+    preallocated space after them.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BintxtWriter::close(void)
+{
+    if (fd_ < 0) {
+        return true;
+    }
+
+    if (directFd_ >= 0) {
+        ::close(directFd_);
+        directFd_ = -1;
+    }
+
+    bool const ok = ftruncate(fd_, end_) == 0;
+    if (!ok) {
+        std::cerr << "Can't truncate " << path_ << ": " << strerror(errno) << std::endl;
+    }
+
+    fd_ = -1;
+    return ok;
+}
@@ -0,0 +1,108 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_BINTXT_WRITER_HPP
+#define HOMEWORK_SERVER_BINTXT_WRITER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Appends rows to a segment file around the page cache, so that a
+    sustained ingest neither stalls on writeback nor evicts the pages
+    queries read.
+
+    DIRECT writes with O_DIRECT through a file descriptor of its own. The
+    bytes go through an aligned staging buffer and are written as whole
+    blocks at aligned offsets. The partial block at the end is padded with
+    zeros, written with the rest, and kept in the buffer to be written
+    again with the rows that follow. So the file may end with padding past
+    the rows; it is cut off when the writer is closed, and by the torn tail
+    recovery after a crash.
+
+    WRITEBACK writes through the page cache, starts the writeback of every
+    written chunk at once with sync_file_range() and drops the chunk
+    before it from the cache with posix_fadvise() once it is on disk. It is
+    what DIRECT falls back to when the file system refuses O_DIRECT.
+
+    Both preallocate the file with fallocate() in steps, without changing
+    its size, so that appends do not allocate blocks one at a time.
+----------------------------------------------------------------------------*/
+class BintxtWriter
+{
+public:
+    enum Mode { DIRECT, WRITEBACK };
+
+    struct Stats {
+        uint64_t directWrites;     // write calls with O_DIRECT
+        uint64_t directBytes;      // including padding and rewrites
+        uint64_t paddedBytes;
+        uint64_t writebackBytes;   // written through the page cache
+        uint64_t droppedBytes;     // dropped from the page cache
+        uint64_t preallocated;     // bytes given to fallocate()
+        uint64_t fallbacks;        // files that could not use O_DIRECT
+    };
+
+    BintxtWriter(Mode mode, uint64_t prealloc, Stats &stats);
+    ~BintxtWriter();
+
+    bool open(std::string const &path, int fd, uint64_t end);
+    bool write(char const *buffer, size_t len, size_t &done);
+    bool close(void);
+
+    bool direct(void) const { return directFd_ >= 0; }
+    uint64_t end(void) const { return end_; }
+
+private:
+    bool preallocate(uint64_t to);
+    bool writeDirect(char const *buffer, size_t len, size_t &done);
+    bool writeBack(char const *buffer, size_t len, size_t &done);
+    bool flushStage(size_t len);
+
+    Mode mode_;
+    uint64_t prealloc_;    // fallocate() step, 0 for none
+    Stats &stats_;
+
+    std::string path_;
+    int fd_;               // Segment's own, for writeback and truncation
+    int directFd_;         // Opened with O_DIRECT, -1 if not
+    uint64_t end_;         // Size of the rows written
+    uint64_t allocated_;   // File is preallocated up to here
+
+    char *stage_;          // Aligned, starts at the block of stageBase_
+    uint64_t stageBase_;   // File offset of stage_[0]
+    size_t staged_;        // Valid bytes in stage_
+
+    uint64_t started_;     // Writeback started up to here
+    uint64_t dropped_;     // Dropped from the cache up to here
+};
+
+
+#endif  // HOMEWORK_SERVER_BINTXT_WRITER_HPP
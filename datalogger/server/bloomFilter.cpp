@@ -0,0 +1,221 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <arpa/inet.h>
+#include "bloomFilter.hpp"
+
+
+// Side file: magic, version, hashes and bits, network byte order, then the
+// bit array
+#define BLOOM_MAGIC        0x4254424c  // "BTBL"
+#define BLOOM_VERSION      1
+#define BLOOM_HEADER_SIZE  16
+
+// For 1 % false positives: bits = -n ln(0.01) / ln(2)^2, hashes = 7
+#define BLOOM_BITS_PER_KEY  10
+#define BLOOM_HASHES        7
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    64 bit FNV-1a with a final mix, so that both halves are usable.
+----------------------------------------------------------------------------*/
+static uint64_t
+hashKey(char const *const key, size_t const len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ (uint8_t) key[i]) * 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Size an empty filter for given number of strings. 0 disables it.
+----------------------------------------------------------------------------*/
+void
+BloomFilter::configure(uint32_t const expected)
+{
+    uint64_t const bits = (uint64_t) expected * BLOOM_BITS_PER_KEY;
+
+    bits_ = bits > 0xfffffff8 ? 0xfffffff8 : (bits + 7) & ~7;
+    hashes_ = bits_ ? BLOOM_HASHES : 0;
+    array_.assign(bits_ / 8, 0);
+}
+
+
+void
+BloomFilter::clear(void)
+{
+    array_.assign(array_.size(), 0);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add a string. The bit positions come from double hashing of the two
+    halves of one 64 bit hash.
+----------------------------------------------------------------------------*/
+void
+BloomFilter::add(char const *const key, size_t const len)
+{
+    uint64_t const h = hashKey(key, len);
+    uint32_t const h1 = h;
+    uint32_t const h2 = (h >> 32) | 1;
+
+    for (uint32_t i = 0; i < hashes_; ++i) {
+        uint32_t const bit = (h1 + i * h2) % bits_;
+        array_[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell if a string may have been added. A disabled filter says it may.
+----------------------------------------------------------------------------*/
+bool
+BloomFilter::mayContain(char const *const key, size_t const len) const
+{
+    uint64_t const h = hashKey(key, len);
+    uint32_t const h1 = h;
+    uint32_t const h2 = (h >> 32) | 1;
+
+    for (uint32_t i = 0; i < hashes_; ++i) {
+        uint32_t const bit = (h1 + i * h2) % bits_;
+        if (0 == (array_[bit >> 3] & (1 << (bit & 7)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the filter from its side file. Its size comes from the file.
+
+  Wants:
+    Side file's path.
+
+  Gives:
+    True if the file was a complete filter.
+----------------------------------------------------------------------------*/
+bool
+BloomFilter::load(std::string const &path)
+{
+    uint32_t header[BLOOM_HEADER_SIZE / sizeof(uint32_t)];
+    struct stat st;
+    bool ok = false;
+
+
+    int const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) == 0  &&  pread(fd, header, sizeof(header), 0) == (ssize_t) sizeof(header)) {
+        uint32_t const bits = ntohl(header[3]);
+
+        if (BLOOM_MAGIC == ntohl(header[0])  &&  BLOOM_VERSION == ntohl(header[1])  &&  
+            bits > 0  &&  0 == bits % 8  &&  (uint64_t) st.st_size == sizeof(header) + bits / 8) 
+        {
+            array_.resize(bits / 8);
+            if (pread(fd, &array_[0], array_.size(), sizeof(header)) == (ssize_t) array_.size()) {
+                hashes_ = ntohl(header[2]);
+                bits_ = bits;
+                ok = true;
+            }
+        }
+    }
+
+    close(fd);
+
+    if (!ok) {
+        // Back to the configured empty filter
+        array_.assign(bits_ / 8, 0);
+    }
+
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the filter to its side file.
+
+  Wants:
+    Side file's path.
+    True to fdatasync() it.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+BloomFilter::save(std::string const &path, bool const durable) const
+{
+    uint32_t const header[BLOOM_HEADER_SIZE / sizeof(uint32_t)] = {
+        htonl(BLOOM_MAGIC), htonl(BLOOM_VERSION), htonl(hashes_), htonl(bits_)
+    };
+    std::vector<uint8_t> file;
+
+
+    int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Can't create " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    file.reserve(sizeof(header) + array_.size());
+    file.insert(file.end(), (uint8_t const *) header, (uint8_t const *) header + sizeof(header));
+    file.insert(file.end(), array_.begin(), array_.end());
+
+    bool const ok = write(fd, &file[0], file.size()) == (ssize_t) file.size()  &&  (!durable  ||  0 == fdatasync(fd));
+
+    if (close(fd) < 0  ||  !ok) {
+        std::cerr << "Can't write " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
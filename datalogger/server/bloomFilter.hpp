@@ -0,0 +1,70 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_BLOOM_FILTER_HPP
+#define HOMEWORK_SERVER_BLOOM_FILTER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Bloom filter of strings. Tells for sure that a string was never added,
+    or that it may have been. Sized for a number of strings at 1 % false
+    positives, about 10 bits per string.
+
+    The bit array is saved byte by byte, so the file does not depend on
+    the host's byte order.
+----------------------------------------------------------------------------*/
+class BloomFilter
+{
+public:
+    BloomFilter() : hashes_(0), bits_(0) {}
+
+    void configure(uint32_t expected);
+    bool enabled(void) const { return bits_ > 0; }
+    void clear(void);
+
+    void add(char const *key, size_t len);
+    bool mayContain(char const *key, size_t len) const;
+
+    bool load(std::string const &path);
+    bool save(std::string const &path, bool durable) const;
+
+    size_t bytes(void) const { return array_.size(); }
+
+private:
+    uint32_t hashes_;             // Bits set per string
+    uint32_t bits_;
+    std::vector<uint8_t> array_;
+};
+
+
+#endif  // HOMEWORK_SERVER_BLOOM_FILTER_HPP
@@ -0,0 +1,248 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include "columnarKernels.hpp"
+
+#if defined(__GNUC__)  &&  (defined(__x86_64__)  ||  defined(__i386__))
+#define COLUMNAR_AVX2
+#include <immintrin.h>
+#endif
+
+
+namespace columnar {
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Portable kernels. Set or keep the bit of each row whose value passes.
+
+  Wants:
+    Column values and their count.
+    Value to compare to.
+    Bitmask of maskWords(count) words.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+static void
+selectAtLeastScalar(int64_t const *const values, unsigned const count, int64_t const min, uint64_t *const mask)
+{
+    for (unsigned w = 0; w < maskWords(count); ++w) {
+        unsigned const base = w * 64;
+        unsigned const n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+
+        for (unsigned i = 0; i < n; ++i) {
+            bits |= (uint64_t) (values[base + i] >= min) << i;
+        }
+        mask[w] = bits;
+    }
+}
+
+
+static void
+keepEqualScalar(uint32_t const *const values, unsigned const count, uint32_t const value, uint64_t *const mask)
+{
+    for (unsigned w = 0; w < maskWords(count); ++w) {
+        unsigned const base = w * 64;
+        unsigned const n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+
+        if (0 == mask[w]) {
+            continue;
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            bits |= (uint64_t) (values[base + i] == value) << i;
+        }
+        mask[w] &= bits;
+    }
+}
+
+
+static void
+keepBelowScalar(int64_t const *const values, unsigned const count, int64_t const max, uint64_t *const mask)
+{
+    for (unsigned w = 0; w < maskWords(count); ++w) {
+        unsigned const base = w * 64;
+        unsigned const n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+
+        if (0 == mask[w]) {
+            continue;
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            bits |= (uint64_t) (values[base + i] < max) << i;
+        }
+        mask[w] &= bits;
+    }
+}
+
+
+#ifdef COLUMNAR_AVX2
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    AVX2 kernels. Compare 4 timestamps or 8 ids at a time.
+----------------------------------------------------------------------------*/
+__attribute__((target("avx2"))) static void
+selectAtLeastAvx2(int64_t const *const values, unsigned const count, int64_t const min, uint64_t *const mask)
+{
+    // values >= min  <=>  values > min - 1, and there is only a signed greater-than
+    __m256i const limit = _mm256_set1_epi64x(min - 1);
+
+    for (unsigned w = 0; w < maskWords(count); ++w) {
+        unsigned const base = w * 64;
+        unsigned const n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+        unsigned i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+            __m256i const v = _mm256_loadu_si256((__m256i const *) (values + base + i));
+            __m256i const gt = _mm256_cmpgt_epi64(v, limit);
+            bits |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(gt)) << i;
+        }
+        for (; i < n; ++i) {
+            bits |= (uint64_t) (values[base + i] >= min) << i;
+        }
+        mask[w] = bits;
+    }
+}
+
+
+__attribute__((target("avx2"))) static void
+keepEqualAvx2(uint32_t const *const values, unsigned const count, uint32_t const value, uint64_t *const mask)
+{
+    __m256i const ref = _mm256_set1_epi32(value);
+
+    for (unsigned w = 0; w < maskWords(count); ++w) {
+        unsigned const base = w * 64;
+        unsigned const n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+        unsigned i = 0;
+
+        if (0 == mask[w]) {
+            continue;
+        }
+        for (; i + 8 <= n; i += 8) {
+            __m256i const v = _mm256_loadu_si256((__m256i const *) (values + base + i));
+            __m256i const eq = _mm256_cmpeq_epi32(v, ref);
+            bits |= (uint64_t) (uint8_t) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+        }
+        for (; i < n; ++i) {
+            bits |= (uint64_t) (values[base + i] == value) << i;
+        }
+        mask[w] &= bits;
+    }
+}
+
+
+__attribute__((target("avx2"))) static void
+keepBelowAvx2(int64_t const *const values, unsigned const count, int64_t const max, uint64_t *const mask)
+{
+    // values < max  <=>  max > values
+    __m256i const limit = _mm256_set1_epi64x(max);
+
+    for (unsigned w = 0; w < maskWords(count); ++w) {
+        unsigned const base = w * 64;
+        unsigned const n = count - base < 64 ? count - base : 64;
+        uint64_t bits = 0;
+        unsigned i = 0;
+
+        if (0 == mask[w]) {
+            continue;
+        }
+        for (; i + 4 <= n; i += 4) {
+            __m256i const v = _mm256_loadu_si256((__m256i const *) (values + base + i));
+            __m256i const lt = _mm256_cmpgt_epi64(limit, v);
+            bits |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(lt)) << i;
+        }
+        for (; i < n; ++i) {
+            bits |= (uint64_t) (values[base + i] < max) << i;
+        }
+        mask[w] &= bits;
+    }
+}
+
+#endif  // COLUMNAR_AVX2
+
+
+/*---- Variable -------------------------------------------------------------
+  Does:
+    Kernels in use, picked on application startup.
+----------------------------------------------------------------------------*/
+struct Kernels {
+    Kernels() : selectAtLeast(selectAtLeastScalar), keepEqual(keepEqualScalar), keepBelow(keepBelowScalar), name("scalar")
+    {
+#ifdef COLUMNAR_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            selectAtLeast = selectAtLeastAvx2;
+            keepEqual = keepEqualAvx2;
+            keepBelow = keepBelowAvx2;
+            name = "avx2";
+        }
+#endif
+    }
+
+    void (*selectAtLeast)(int64_t const *, unsigned, int64_t, uint64_t *);
+    void (*keepEqual)(uint32_t const *, unsigned, uint32_t, uint64_t *);
+    void (*keepBelow)(int64_t const *, unsigned, int64_t, uint64_t *);
+    char const *name;
+};
+
+static Kernels const kernels;
+
+
+void
+selectAtLeast(int64_t const *const values, unsigned const count, int64_t const min, uint64_t *const mask)
+{
+    kernels.selectAtLeast(values, count, min, mask);
+}
+
+
+void
+keepEqual(uint32_t const *const values, unsigned const count, uint32_t const value, uint64_t *const mask)
+{
+    kernels.keepEqual(values, count, value, mask);
+}
+
+
+void
+keepBelow(int64_t const *const values, unsigned const count, int64_t const max, uint64_t *const mask)
+{
+    kernels.keepBelow(values, count, max, mask);
+}
+
+
+char const *
+kernelName(void)
+{
+    return kernels.name;
+}
+
+
+}  // namespace columnar
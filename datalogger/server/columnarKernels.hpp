@@ -0,0 +1,57 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_COLUMNAR_KERNELS_HPP
+#define HOMEWORK_SERVER_COLUMNAR_KERNELS_HPP
+
+#include <stdint.h>
+
+
+/*---- Namespace ------------------------------------------------------------
+  Contains:
+    Predicate kernels of the columnar Sink. They evaluate one condition over
+    a column and leave the result in a bitmask, one bit per row and 64 rows
+    per word. The first kernel of a filter sets the mask and the rest AND
+    into it.
+
+    AVX2 versions are picked at startup if the CPU has it, so the build
+    needs no special flags.
+----------------------------------------------------------------------------*/
+namespace columnar {
+
+    void selectAtLeast(int64_t const *values, unsigned count, int64_t min, uint64_t *mask);
+    void keepEqual(uint32_t const *values, unsigned count, uint32_t value, uint64_t *mask);
+    void keepBelow(int64_t const *values, unsigned count, int64_t max, uint64_t *mask);
+
+    char const *kernelName(void);
+
+    inline unsigned maskWords(unsigned const count) { return (count + 63) / 64; }
+
+}  // namespace columnar
+
+
+#endif  // HOMEWORK_SERVER_COLUMNAR_KERNELS_HPP
@@ -0,0 +1,883 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+#include "columnarSink.hpp"
+#include "columnarKernels.hpp"
+#include "sinkOptions.hpp"
+#include "aggregate.hpp"
+#include "queryPage.hpp"
+#include "record.hpp"
+
+
+// Columns are written out when this much is buffered
+#define WRITE_BUFFER_SIZE  65536
+
+// Id of a wildcard in queries
+#define ANY_ID  0xffffffff
+
+
+/*---- Singleton ------------------------------------------------------------
+  Does:
+    Register the sink to sinkManager on application startup.
+----------------------------------------------------------------------------*/
+static ColumnarSink const *sinkSingleton = new ColumnarSink;
+
+
+static char const *const columnNames[] = { "ts.col", "serial.col", "devtype.col", "len.col", "data.col", "dict.col", "blocks.col" };
+
+// Block statistics are stored as such
+static_assert(56 == sizeof(ColumnarSinkImpl::Block), "Block layout");
+
+static int64_t const columnWidths[] = { sizeof(int64_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint16_t), 1, 1, 1 };
+
+
+ColumnFile::~ColumnFile()
+{
+    if (fd_ >= 0) {
+        writeOut();
+        close(fd_);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the column file for reading and appending.
+
+  Wants:
+    File's path.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnFile::open(std::string const &path)
+{
+    struct stat st;
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0  ||  fstat(fd_, &st) < 0) {
+        std::cerr << "Can't open column " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_ = st.st_size;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the buffered bytes to the file.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnFile::writeOut(void)
+{
+    size_t done = 0;
+
+    while (done < wbuf_.size()) {
+        ssize_t const ret = write(fd_, &wbuf_[done], wbuf_.size() - done);
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            std::cerr << "Sink write error: " << strerror(errno) << std::endl;
+            break;
+        }
+        done += ret;
+    }
+
+    size_ += done;
+    bool const ok = done == wbuf_.size();
+    wbuf_.clear();
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read bytes that have been written to the file.
+
+  Wants:
+    Offset and destination of given size.
+
+  Gives:
+    True if all of them were read.
+----------------------------------------------------------------------------*/
+bool
+ColumnFile::read(uint64_t const offset, void *const dest, size_t const len) const
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t const ret = pread(fd_, (char *) dest + done, len - done, offset + done);
+        if (ret < 0  &&  EINTR == errno) {
+            continue;
+        }
+        if (ret <= 0) {
+            std::cerr << "Sink read error: " << (ret < 0 ? strerror(errno) : "end of file") << std::endl;
+            return false;
+        }
+        done += ret;
+    }
+
+    return true;
+}
+
+
+bool
+ColumnFile::truncate(uint64_t const size)
+{
+    if (size == size_) {
+        return true;
+    }
+    if (ftruncate(fd_, size) < 0) {
+        std::cerr << "Sink truncate error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members.
+----------------------------------------------------------------------------*/
+ColumnarSinkImpl::ColumnarSinkImpl()
+: blockRows_(0)
+{
+    memset(&current_, 0, sizeof(current_));
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Called on application termination. Write out the columns, which are
+    closed by their own destructors.
+----------------------------------------------------------------------------*/
+ColumnarSinkImpl::~ColumnarSinkImpl()
+{ 
+    if (blockRows_ > 0) {
+        writeOut();
+        std::cout << "Closed sink columns" << std::endl;
+        printStats(std::cout);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the column files in the directory, creating it if needed, and
+    recover from an unclean shutdown.
+  
+  Wants:
+    Directory.
+    Rows per block.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::open(std::string const &dir, uint32_t const blockRows)
+{
+    if (blockRows_ > 0) {
+        return false;
+    }
+
+    if (mkdir(dir.c_str(), 0755) < 0  &&  EEXIST != errno) {
+        std::cerr << "Can't create directory " << dir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < COLUMNS; ++i) {
+        if (!cols_[i].open(dir + "/" + columnNames[i])) {
+            return false;
+        }
+    }
+
+    blockRows_ = blockRows;
+    return loadDict()  &&  recover()  &&  loadLatest();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Rebuild the latest Records view from all rows.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::loadLatest(void)
+{
+    Record all(REC_ACT_GET_AFTER);
+
+    all.serial = "*";
+    all.devType = "*";
+    return queryRec(all, latest_.collector());
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read the dictionary of serials and devTypes. Entries are a kind byte, a
+    length byte and the name. A torn entry at the end is cut off.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::loadDict(void)
+{
+    ColumnFile &dict = cols_[COL_DICT];
+    std::vector<char> buf(dict.size());
+    uint64_t pos = 0;
+
+
+    if (!dict.read(0, buf.data(), buf.size())) {
+        return false;
+    }
+
+    while (pos + 2 <= buf.size()) {
+        int const kind = (uint8_t) buf[pos];
+        unsigned const len = (uint8_t) buf[pos + 1];
+
+        if (kind >= KINDS  ||  pos + 2 + len > buf.size()) {
+            break;
+        }
+
+        std::string const name(&buf[pos + 2], len);
+        ids_[kind][name] = names_[kind].size();
+        names_[kind].push_back(name);
+        pos += 2 + len;
+    }
+
+    return dict.truncate(pos);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Bring the columns to the same number of rows. Keep the block statistics
+    that are consistent with them and rebuild the rest from the columns.
+    Rows whose data or ids are missing are cut off.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::recover(void)
+{
+    uint64_t rows = UINT64_MAX;
+    ColumnFile &blockCol = cols_[COL_BLOCKS];
+
+
+    for (int i = COL_TS; i <= COL_LEN; ++i) {
+        rows = std::min<uint64_t>(rows, cols_[i].size() / columnWidths[i]);
+    }
+
+    // Keep full blocks that follow each other and have all their rows
+    blocks_.resize(blockCol.size() / sizeof(Block));
+    if (!blockCol.read(0, blocks_.data(), blocks_.size() * sizeof(Block))) {
+        return false;
+    }
+
+    uint64_t nextRow = 0;
+    uint64_t dataEnd = 0;
+    size_t kept = 0;
+
+    for (; kept < blocks_.size(); ++kept) {
+        Block const &b = blocks_[kept];
+        if (b.firstRow != nextRow  ||  b.dataOffset != dataEnd  ||  0 == b.rows  ||  
+            nextRow + b.rows > rows  ||  dataEnd + b.dataBytes > cols_[COL_DATA].size()) 
+        {
+            break;
+        }
+        nextRow += b.rows;
+        dataEnd += b.dataBytes;
+    }
+
+    blocks_.resize(kept);
+    if (!blockCol.truncate(kept * sizeof(Block))) {
+        return false;
+    }
+
+    memset(&current_, 0, sizeof(current_));
+    current_.firstRow = nextRow;
+    current_.dataOffset = dataEnd;
+
+    // Rebuild blocks of the rows after them
+    while (nextRow < rows) {
+        unsigned const n = std::min<uint64_t>(blockRows_, rows - nextRow);
+        std::vector<int64_t> ts(n);
+        std::vector<uint32_t> ids[KINDS] = { std::vector<uint32_t>(n), std::vector<uint32_t>(n) };
+        std::vector<uint16_t> lens(n);
+        unsigned i = 0;
+
+        if (!cols_[COL_TS].read(nextRow * sizeof(int64_t), ts.data(), n * sizeof(int64_t))  ||  
+            !cols_[COL_SERIAL].read(nextRow * sizeof(uint32_t), ids[KIND_SERIAL].data(), n * sizeof(uint32_t))  ||  
+            !cols_[COL_DEVTYPE].read(nextRow * sizeof(uint32_t), ids[KIND_DEVTYPE].data(), n * sizeof(uint32_t))  ||  
+            !cols_[COL_LEN].read(nextRow * sizeof(uint16_t), lens.data(), n * sizeof(uint16_t))) 
+        {
+            return false;
+        }
+
+        for (; i < n; ++i) {
+            uint32_t const rowIds[KINDS] = { ids[KIND_SERIAL][i], ids[KIND_DEVTYPE][i] };
+
+            if (dataEnd + lens[i] > cols_[COL_DATA].size()  ||  
+                rowIds[KIND_SERIAL] >= names_[KIND_SERIAL].size()  ||  rowIds[KIND_DEVTYPE] >= names_[KIND_DEVTYPE].size()) 
+            {
+                break;
+            }
+
+            addToBlock(current_, ts[i], rowIds, lens[i]);
+            dataEnd += lens[i];
+            if (current_.rows == blockRows_) {
+                sealBlock();
+            }
+        }
+
+        nextRow += i;
+        if (i < n) {
+            rows = nextRow;
+        }
+    }
+
+    for (int i = COL_TS; i <= COL_LEN; ++i) {
+        if (!cols_[i].truncate(rows * columnWidths[i])) {
+            return false;
+        }
+    }
+
+    std::cout << "Columns: " << rows << " rows in " << blocks_.size() << " full blocks, " 
+        << names_[KIND_SERIAL].size() << " serials, " << names_[KIND_DEVTYPE].size() << " devTypes" << std::endl;
+
+    return cols_[COL_DATA].truncate(dataEnd)  &&  writeOut();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process record received from client based on its 'action'.
+  
+  Wants:
+    Record's data.
+    Handler to a function to use to send the reply.
+    
+  Gives: 
+    1 on successful store action, or
+    0 on other success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+ColumnarSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    bool ret = false;
+
+
+    switch (rec.action) {
+    case REC_ACT_STORE:
+        if (true == (ret = storeRec(rec))) {
+            return 1;
+        }
+        break;
+
+    case REC_ACT_GET_AFTER:
+        ret = queryRec(rec, send);
+        break;
+
+    case REC_ACT_COUNT:
+    case REC_ACT_STATS: {
+        Aggregate agg(rec);
+        ret = queryRec(rec, send, &agg)  &&  agg.send(send);
+        break;
+    }
+
+    case REC_ACT_GET_LATEST:
+        ret = latest_.send(rec, send);
+        break;
+    }
+
+    return ret ? 0 : -1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    End of a batch of Records. Write the columns.
+----------------------------------------------------------------------------*/
+void
+ColumnarSinkImpl::flush(void)
+{
+    writeOut();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give the id of a serial or devType. A new name gets the next free id and
+    is added to the dictionary.
+  
+  Wants:
+    Kind of the name.
+    Name.
+    
+  Gives: 
+    Id.
+----------------------------------------------------------------------------*/
+uint32_t
+ColumnarSinkImpl::intern(int const kind, std::string const &name)
+{
+    std::unordered_map<std::string, uint32_t>::const_iterator const it = ids_[kind].find(name);
+
+    if (it != ids_[kind].end()) {
+        return it->second;
+    }
+
+    uint32_t const id = names_[kind].size();
+    uint8_t const hdr[2] = { (uint8_t) kind, (uint8_t) name.length() };
+
+    cols_[COL_DICT].append(hdr, sizeof(hdr));
+    cols_[COL_DICT].append(name.data(), name.length());
+
+    ids_[kind][name] = id;
+    names_[kind].push_back(name);
+    return id;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add one row to a block's statistics.
+----------------------------------------------------------------------------*/
+void
+ColumnarSinkImpl::addToBlock(Block &block, int64_t const ts, uint32_t const ids[KINDS], uint32_t const len)
+{
+    if (0 == block.rows++) {
+        block.minTs = block.maxTs = ts;
+        for (int k = 0; k < KINDS; ++k) {
+            block.minId[k] = block.maxId[k] = ids[k];
+        }
+    }
+    else {
+        block.minTs = std::min(block.minTs, ts);
+        block.maxTs = std::max(block.maxTs, ts);
+        for (int k = 0; k < KINDS; ++k) {
+            block.minId[k] = std::min(block.minId[k], ids[k]);
+            block.maxId[k] = std::max(block.maxId[k], ids[k]);
+        }
+    }
+
+    block.dataBytes += len;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Store the full current block's statistics and start the next block.
+----------------------------------------------------------------------------*/
+void
+ColumnarSinkImpl::sealBlock(void)
+{
+    blocks_.push_back(current_);
+    cols_[COL_BLOCKS].append(&current_, sizeof(current_));
+
+    uint64_t const firstRow = current_.firstRow + current_.rows;
+    uint64_t const dataOffset = current_.dataOffset + current_.dataBytes;
+
+    memset(&current_, 0, sizeof(current_));
+    current_.firstRow = firstRow;
+    current_.dataOffset = dataOffset;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append one record to the columns' write buffers.
+  
+  Wants:
+    Record's data.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::storeRec(Record const &rec)
+{
+    int64_t const ts = rec.timestamp.tv_sec * 1000000LL + rec.timestamp.tv_usec;
+    uint32_t const ids[KINDS] = { intern(KIND_SERIAL, rec.serial), intern(KIND_DEVTYPE, rec.devType) };
+    uint16_t const len = rec.data.length();
+
+    cols_[COL_TS].append(&ts, sizeof(ts));
+    cols_[COL_SERIAL].append(&ids[KIND_SERIAL], sizeof(uint32_t));
+    cols_[COL_DEVTYPE].append(&ids[KIND_DEVTYPE], sizeof(uint32_t));
+    cols_[COL_LEN].append(&len, sizeof(len));
+    cols_[COL_DATA].append(rec.data.data(), len);
+
+    addToBlock(current_, ts, ids, len);
+    latest_.store(rec);
+    if (current_.rows >= blockRows_) {
+        sealBlock();
+    }
+
+    if (cols_[COL_DATA].buffered() + cols_[COL_TS].buffered() >= WRITE_BUFFER_SIZE) {
+        return writeOut();
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write the buffered columns. The dictionary goes first so that no id is
+    written before its name, and the block statistics last.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::writeOut(void)
+{
+    static Column const order[] = { COL_DICT, COL_DATA, COL_LEN, COL_SERIAL, COL_DEVTYPE, COL_TS, COL_BLOCKS };
+    bool ok = true;
+
+    for (unsigned i = 0; i < sizeof(order) / sizeof(order[0]); ++i) {
+        ok = cols_[order[i]].writeOut()  &&  ok;
+    }
+
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print how many blocks queries could skip and how selective the filters
+    were.
+  
+  Wants:
+    Output stream.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+ColumnarSinkImpl::printStats(std::ostream &os) const
+{
+    os << "Columnar: " << blocks_.size() * blockRows_ + current_.rows << " rows, " << stats_.queries << " queries read " 
+        << stats_.blocksRead << " and skipped " << stats_.blocksSkipped << " blocks" << std::endl;
+
+    os << "  " << stats_.rowsFiltered << " rows filtered with " << columnar::kernelName() << " kernels, " 
+        << stats_.rowsMatched << " matched" << std::endl;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every record matching the given reference, or count them to an
+    aggregate. Skip the blocks whose statistics rule out a match. A paged
+    query starts from the row in its cursor and stops when the page is
+    full.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    Aggregate to count to instead, or NULL.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::queryRec(Record const &reference, Sink::SendRecord_f const &send, Aggregate *const agg)
+{
+    std::string const *const refNames[KINDS] = { &reference.serial, &reference.devType };
+    uint32_t ids[KINDS];
+    int64_t const after = reference.timestamp.tv_sec * 1000000LL + reference.timestamp.tv_usec;
+    int64_t const before = timerisset(&reference.until) ? reference.until.tv_sec * 1000000LL + reference.until.tv_usec : INT64_MAX;
+    QueryPage page(reference);
+    uint64_t const fromRow = agg ? 0 : page.position();
+
+
+    if (!page.valid()) {
+        return false;
+    }
+
+    // Buffered Records must be visible to the query
+    writeOut();
+
+    ++stats_.queries;
+
+    for (int k = 0; k < KINDS; ++k) {
+        if ("*" == *refNames[k]) {
+            ids[k] = ANY_ID;
+            continue;
+        }
+
+        std::unordered_map<std::string, uint32_t>::const_iterator const it = ids_[k].find(*refNames[k]);
+        if (it == ids_[k].end()) {
+            // Never stored
+            return true;
+        }
+        ids[k] = it->second;
+    }
+
+    for (size_t i = 0; i <= blocks_.size()  &&  !page.full(); ++i) {
+        Block const &block = i < blocks_.size() ? blocks_[i] : current_;
+        bool skip = 0 == block.rows  ||  block.maxTs < after  ||  block.minTs >= before  ||  block.firstRow + block.rows <= fromRow;
+
+        for (int k = 0; k < KINDS; ++k) {
+            skip = skip  ||  (ANY_ID != ids[k]  &&  (ids[k] < block.minId[k]  ||  ids[k] > block.maxId[k]));
+        }
+
+        if (skip) {
+            ++stats_.blocksSkipped;
+            continue;
+        }
+
+        ++stats_.blocksRead;
+        if (!queryBlock(block, reference, ids, fromRow, page, send, agg)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Filter one block: timestamps first, then the id columns that the
+    reference fixes. Read the rest of the columns only for the rows that
+    passed, and send them. An aggregate needs only the lengths, not the
+    data.
+  
+  Wants:
+    Block.
+    Reference Record and its ids, ANY_ID for wildcards.
+    Row number to start from.
+    Page to send the replies to, and the function it uses.
+    Aggregate to count to instead, or NULL.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnarSinkImpl::queryBlock(Block const &block, Record const &reference, uint32_t const ids[KINDS], uint64_t const fromRow, 
+                             QueryPage &page, Sink::SendRecord_f const &send, Aggregate *const agg)
+{
+    static Column const idCols[KINDS] = { COL_SERIAL, COL_DEVTYPE };
+    unsigned const n = block.rows;
+    unsigned const words = columnar::maskWords(n);
+    int64_t const after = reference.timestamp.tv_sec * 1000000LL + reference.timestamp.tv_usec;
+    std::vector<int64_t> ts(n);
+    std::vector<uint32_t> rowIds[KINDS];
+    std::vector<uint64_t> mask(words);
+
+
+    if (!cols_[COL_TS].read(block.firstRow * sizeof(int64_t), ts.data(), n * sizeof(int64_t))) {
+        return false;
+    }
+    columnar::selectAtLeast(ts.data(), n, after, mask.data());
+    if (timerisset(&reference.until)) {
+        columnar::keepBelow(ts.data(), n, reference.until.tv_sec * 1000000LL + reference.until.tv_usec, mask.data());
+    }
+
+    // Rows before the cursor
+    if (fromRow > block.firstRow) {
+        unsigned const skip = std::min<uint64_t>(n, fromRow - block.firstRow);
+        for (unsigned w = 0; w < skip / 64; ++w) {
+            mask[w] = 0;
+        }
+        if (skip % 64) {
+            mask[skip / 64] &= ~0ULL << (skip % 64);
+        }
+    }
+
+    for (int k = 0; k < KINDS; ++k) {
+        if (ANY_ID == ids[k]) {
+            continue;
+        }
+        rowIds[k].resize(n);
+        if (!cols_[idCols[k]].read(block.firstRow * sizeof(uint32_t), rowIds[k].data(), n * sizeof(uint32_t))) {
+            return false;
+        }
+        columnar::keepEqual(rowIds[k].data(), n, ids[k], mask.data());
+    }
+
+    stats_.rowsFiltered += n;
+
+    // Range of rows that passed
+    unsigned first = n, last = 0;
+    for (unsigned w = 0; w < words; ++w) {
+        if (mask[w]) {
+            first = std::min(first, w * 64 + __builtin_ctzll(mask[w]));
+            last = w * 64 + 63 - __builtin_clzll(mask[w]);
+        }
+    }
+    if (first == n) {
+        return true;
+    }
+
+    for (int k = 0; k < KINDS; ++k) {
+        if (rowIds[k].empty()) {
+            rowIds[k].resize(n);
+            if (!cols_[idCols[k]].read(block.firstRow * sizeof(uint32_t), rowIds[k].data(), n * sizeof(uint32_t))) {
+                return false;
+            }
+        }
+    }
+
+    // Data offsets of the rows up to the last one that passed
+    std::vector<uint16_t> lens(last + 1);
+    std::vector<uint32_t> offsets(last + 2, 0);
+
+    if (!cols_[COL_LEN].read(block.firstRow * sizeof(uint16_t), lens.data(), lens.size() * sizeof(uint16_t))) {
+        return false;
+    }
+
+    if (agg) {
+        for (unsigned i = first; i <= last; ++i) {
+            if (mask[i / 64] & (1ULL << (i % 64))) {
+                std::string const &serial = names_[KIND_SERIAL][rowIds[KIND_SERIAL][i]];
+                std::string const &devType = names_[KIND_DEVTYPE][rowIds[KIND_DEVTYPE][i]];
+                struct timeval const tv = { (time_t) (ts[i] / 1000000), (suseconds_t) (ts[i] % 1000000) };
+
+                ++stats_.rowsMatched;
+                agg->add(serial.data(), serial.length(), devType.data(), devType.length(), tv, lens[i]);
+            }
+        }
+        return true;
+    }
+
+    for (unsigned i = 0; i <= last; ++i) {
+        offsets[i + 1] = offsets[i] + lens[i];
+    }
+
+    std::vector<char> data(offsets[last + 1] - offsets[first]);
+    if (!cols_[COL_DATA].read(block.dataOffset + offsets[first], data.data(), data.size())) {
+        return false;
+    }
+
+    Record rec;
+    rec.action = REC_ACT_REPLY;
+
+    for (unsigned i = first; i <= last; ++i) {
+        if (0 == (mask[i / 64] & (1ULL << (i % 64)))) {
+            continue;
+        }
+
+        rec.timestamp.tv_sec = ts[i] / 1000000;
+        rec.timestamp.tv_usec = ts[i] % 1000000;
+        rec.serial = names_[KIND_SERIAL][rowIds[KIND_SERIAL][i]];
+        rec.devType = names_[KIND_DEVTYPE][rowIds[KIND_DEVTYPE][i]];
+        rec.data.assign(&data[offsets[i] - offsets[first]], lens[i]);
+
+        ++stats_.rowsMatched;
+        if (page.send(rec, 0, block.firstRow + i + 1, send) < 0) {
+            return false;
+        }
+        if (page.full()) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate implementation for Columnar sink. Allow only one instance.
+      
+  Wants:
+    Options: DIR[,block=N]
+
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ColumnarSink::open(std::string const &opts)
+{
+    SinkOptions const options(opts, "columnar");
+    std::string const &dir(options.path());
+    long const blockRows = options.getInt("block", 4096);
+
+
+    if (pImpl_) {
+        return false;
+    }
+
+    if (options.unknown().length() > 0) {
+        std::cerr << "Unknown columnar option '" << options.unknown() << "'" << std::endl;
+        return false;
+    }
+
+    if (blockRows <= 0  ||  blockRows > 65536) {
+        std::cerr << "Invalid block size " << blockRows << std::endl;
+        return false;
+    }
+
+    if (NULL == (pImpl_ = new ColumnarSinkImpl)) {
+        return false;
+    }
+
+    if (!pImpl_->open(dir, blockRows)) {
+        std::cerr << "Can't open directory " << dir << std::endl;
+        abort();
+    }
+
+    std::cout << "Opened sink: Directory " << dir << ", " << blockRows << " rows per block" << std::endl;
+    return true;
+}
@@ -0,0 +1,199 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_COLUMNAR_SINK_HPP
+#define HOMEWORK_SERVER_COLUMNAR_SINK_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "sink.hpp"
+#include "latestView.hpp"
+
+class QueryPage;
+
+class Aggregate;
+
+struct Record;
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    One append-only column file with its write buffer.
+----------------------------------------------------------------------------*/
+class ColumnFile
+{
+public:
+    ColumnFile() : fd_(-1), size_(0) {}
+    ~ColumnFile();
+
+    bool open(std::string const &path);
+
+    void append(void const *data, size_t len) { wbuf_.insert(wbuf_.end(), (char const *) data, (char const *) data + len); }
+    bool writeOut(void);
+    bool read(uint64_t offset, void *dest, size_t len) const;
+    bool truncate(uint64_t size);
+
+    uint64_t size(void) const { return size_; }
+    size_t buffered(void) const { return wbuf_.size(); }
+
+private:
+    int fd_;
+    uint64_t size_;           // Bytes in the file
+    std::vector<char> wbuf_;  // Bytes not yet written
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Implement Columnar Sink functionality. Each field is stored in its own
+    column file in directory DIR:
+      ts.col       Timestamp in microseconds, 64 bits per row.
+      serial.col   Serial id, 32 bits per row.
+      devtype.col  DevType id, 32 bits per row.
+      len.col      Data length, 16 bits per row.
+      data.col     Data bytes of all rows back to back.
+      dict.col     Serials and devTypes in the order their ids were given.
+      blocks.col   Statistics of each full block of rows.
+    Numbers are in host byte order so that they can be filtered in place.
+
+    Rows are grouped to blocks of N rows. A block knows its first row, where
+    its data starts, and its min/max timestamp and ids. Queries skip the
+    blocks that cannot match and filter the rest column by column, reading
+    the length and data columns only for rows that passed.
+
+    Columns are written at the end of each batch. After a crash the columns
+    are cut to the rows that all of them have. A paged query resumes from
+    the row number in its cursor. The latest Record of every
+    serial and devType is kept in memory for GET_LATEST and rebuilt with
+    one scan on open.
+----------------------------------------------------------------------------*/
+class ColumnarSinkImpl
+{
+public:
+    ColumnarSinkImpl();
+    ~ColumnarSinkImpl();
+
+    bool open(std::string const &dir, uint32_t blockRows);
+
+    int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    void flush(void);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    enum { KIND_SERIAL, KIND_DEVTYPE, KINDS };
+    enum Column { COL_TS, COL_SERIAL, COL_DEVTYPE, COL_LEN, COL_DATA, COL_DICT, COL_BLOCKS, COLUMNS };
+
+public:
+    struct Block {
+        uint64_t firstRow;
+        uint64_t dataOffset;
+        int64_t minTs;
+        int64_t maxTs;
+        uint32_t rows;
+        uint32_t minId[KINDS];
+        uint32_t maxId[KINDS];
+        uint32_t dataBytes;
+    };
+
+private:
+
+    bool storeRec(Record const &rec);
+    bool queryRec(Record const &ref, Sink::SendRecord_f const &send, Aggregate *agg = NULL);
+    bool queryBlock(Block const &block, Record const &ref, uint32_t const ids[KINDS], uint64_t fromRow, 
+                    QueryPage &page, Sink::SendRecord_f const &send, Aggregate *agg);
+
+    uint32_t intern(int kind, std::string const &name);
+    bool loadDict(void);
+    bool recover(void);
+    void addToBlock(Block &block, int64_t ts, uint32_t const ids[KINDS], uint32_t len);
+    void sealBlock(void);
+    bool writeOut(void);
+    bool loadLatest(void);
+
+    ColumnFile cols_[COLUMNS];
+    uint32_t blockRows_;
+
+    std::vector<std::string> names_[KINDS];
+    std::unordered_map<std::string, uint32_t> ids_[KINDS];
+
+    std::vector<Block> blocks_;  // Full blocks
+    Block current_;              // Block being filled
+
+    LatestView latest_;
+
+    struct Stats {
+        Stats() : queries(0), blocksRead(0), blocksSkipped(0), rowsFiltered(0), rowsMatched(0) {}
+
+        uint64_t queries;
+        uint64_t blocksRead;
+        uint64_t blocksSkipped;
+        uint64_t rowsFiltered;
+        uint64_t rowsMatched;
+    } stats_;
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Intended to be used as singleton.
+    Is fired up on application start. Registers its name to SinkManager 
+    upon construction.
+----------------------------------------------------------------------------*/
+class ColumnarSink : public Sink
+{
+public:
+    explicit ColumnarSink(char const *const name = "columnar") : Sink(name), pImpl_(NULL) {}
+    virtual ~ColumnarSink() { if (pImpl_) delete pImpl_; }
+
+    virtual bool open(std::string const &opts);
+    
+    ColumnarSinkImpl const *impl(void) const { return pImpl_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Creates binding to implementation's functions.
+    ----------------------------------------------------------------------------*/
+    virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&ColumnarSinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&Sink::processEach<ColumnarSinkImpl *>, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&ColumnarSinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { if (pImpl_) pImpl_->printStats(os); }
+    virtual Sink *another(void) const { return new ColumnarSink(NULL); }
+
+private:
+    ColumnarSinkImpl *pImpl_;
+};
+
+
+#endif  // HOMEWORK_SERVER_COLUMNAR_SINK_HPP
@@ -0,0 +1,1036 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include "coreGroup.hpp"
+#include "tcpSource.hpp"
+#include "observer.hpp"
+#include "aggregate.hpp"
+#include "queryPage.hpp"
+#include "lockfreeQueue.hpp"
+
+
+// Length of every core's inbox, in messages
+#define CORE_INBOX_SIZE  4096
+
+#define MAX_CORES  64
+
+// How long a core waiting for answers sleeps without a wake-up
+#define CORE_WAIT_MS  100
+
+
+/*---- Struct ---------------------------------------------------------------
+  Does:
+    What one core has to itself. The inbox and the flags are the only
+    members other cores touch.
+----------------------------------------------------------------------------*/
+struct CoreGroup::Core {
+    Core(unsigned const i, int const c) 
+    : index(i), cpu(c), node(-1), shard(NULL), sink(NULL), source(NULL), inbox(CORE_INBOX_SIZE), 
+      wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), interest(false), statsWanted(false) {}
+
+    unsigned const index;
+    int const cpu;                   // -1 if not pinned
+    int node;                        // Memory node allocated from, -1 for any
+
+    Sink *shard;                     // The core's own instance of the Sink
+    CoreSink *sink;
+    TcpSource *source;
+    Observer observer;
+
+    MpscQueue<Message> inbox;
+    int const wakeFd;                // Written after every message
+    std::atomic<bool> interest;      // Relay stored Records here
+    std::atomic<bool> statsWanted;
+    std::thread thread;
+};
+
+
+/*---- Struct ---------------------------------------------------------------
+  Does:
+    A query a core is waiting the other cores' answers to. Lives in the
+    asking core's stack; the other cores only read its requests.
+----------------------------------------------------------------------------*/
+struct CoreGather {
+    CoreGather(Record const &r, unsigned const cores)
+    : ref(r), refs(cores, r), answers(cores), rets(cores, -1), answered(cores, false), pending(cores), stash(false) {}
+
+    Record const &ref;
+    std::vector<Record> refs;                    // Request for every core's shard
+    std::vector<std::vector<Record> > answers;
+    std::vector<int> rets;
+    std::vector<char> answered;
+    unsigned pending;
+    bool stash;                                  // Add the matching Records relayed after an answer
+};
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Make the cores with their inboxes. Nothing is opened before open().
+
+  Wants:
+    Number of cores.
+    CPU to pin every core to, or empty for no pinning.
+    True to allocate every core's memory from its CPU's node.
+----------------------------------------------------------------------------*/
+CoreGroup::CoreGroup(unsigned const cores, std::vector<int> const &cpus, bool const numa)
+: cpus_(cpus), numa_(numa), started_(false), stopping_(false), listening_(0)
+{
+    for (unsigned i = 0; i < cores; ++i) {
+        cores_.push_back(new Core(i, i < cpus_.size() ? cpus_[i] : -1));
+    }
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Stop the cores and wait for them to finish. Close the listening
+    sockets before the shards, so that no Record comes to a closed one.
+----------------------------------------------------------------------------*/
+CoreGroup::~CoreGroup()
+{
+    stop();
+
+    for (size_t i = 0; i < cores_.size(); ++i) {
+        if (cores_[i]->thread.joinable()) {
+            cores_[i]->thread.join();
+        }
+    }
+
+    for (size_t i = 0; i < cores_.size(); ++i) {
+        Core *const core = cores_[i];
+
+        delete core->source;
+        delete core->sink;
+        delete core->shard;
+        if (core->wakeFd >= 0) {
+            close(core->wakeFd);
+        }
+        delete core;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open every core's listening socket in core order, and steer the
+    connections to them. Start the cores: each places itself on its CPU
+    and memory node and opens its shard. They start listening when all
+    have succeeded.
+
+  Wants:
+    Port number.
+    Sink selected by the user. Every core gets another instance of it,
+    the Sink itself is not opened.
+    Sink's options. Every core's path gets its suffix .cI.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+CoreGroup::open(int const port, Sink const *const sink, std::string const &opts)
+{
+    size_t const cores = cores_.size();
+    bool ok = true;
+
+
+    if (0 == cores  ||  cores > MAX_CORES  ||  started_) {
+        std::cerr << "Invalid number of cores " << cores << " (1-" << MAX_CORES << ")" << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < cores; ++i) {
+        Core &core = *cores_[i];
+
+        if (core.wakeFd < 0) {
+            std::cerr << "Can't make eventfd: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        if (NULL == (core.shard = sink->another())) {
+            std::cerr << "The Sink can't have an instance for every core" << std::endl;
+            return false;
+        }
+
+        core.sink = new CoreSink(new CoreSinkImpl(*this, core));
+        core.source = new TcpSource(&core.observer);
+
+        if (!core.source->open(port, true)) {
+            return false;
+        }
+    }
+
+    steer();
+
+    std::vector<std::promise<bool> > opened(cores);
+    listening_ = cores;
+
+    for (size_t i = 0; i < cores; ++i) {
+        cores_[i]->thread = std::thread(&CoreGroup::run, this, std::ref(*cores_[i]), opts, &opened[i]);
+    }
+
+    for (size_t i = 0; i < cores; ++i) {
+        ok = opened[i].get_future().get()  &&  ok;
+    }
+
+    if (!ok) {
+        stop();
+        return false;
+    }
+
+    std::cout << cores << " cores listening" << std::endl;
+
+    started_ = true;
+    for (size_t i = 0; i < cores; ++i) {
+        wake(i);
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Attach a classic BPF program to the listening sockets that picks the
+    socket of a new connection by the CPU that received it: the core
+    pinned to that CPU, or with no pinning CPU modulo the number of cores.
+    The program returns the socket's index in the order they were opened.
+    If the kernel refuses, it hashes the connections to the sockets.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True if the connections are steered.
+----------------------------------------------------------------------------*/
+bool
+CoreGroup::steer(void)
+{
+    std::vector<struct sock_filter> code;
+
+    code.push_back((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU)));
+
+    for (size_t i = 0; i < cores_.size(); ++i) {
+        if (cores_[i]->cpu >= 0) {
+            code.push_back((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t) cores_[i]->cpu, 0, 1));
+            code.push_back((struct sock_filter) BPF_STMT(BPF_RET | BPF_K, (uint32_t) i));
+        }
+    }
+
+    code.push_back((struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t) cores_.size()));
+    code.push_back((struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0));
+
+    struct sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = &code[0];
+
+    if (setsockopt(cores_[0]->source->listenSocket(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        std::cerr << "Can't steer connections by CPU: " << strerror(errno) << ", the kernel hashes them to the cores" << std::endl;
+        return false;
+    }
+
+    std::cout << "Connections steered to the core of the CPU that receives them" << std::endl;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give the memory node of a CPU from sysfs.
+
+  Wants:
+    CPU number.
+
+  Gives:
+    Node number, or
+    -1 if there is none.
+----------------------------------------------------------------------------*/
+static int
+nodeOf(int const cpu)
+{
+    std::string const path("/sys/devices/system/cpu/cpu" + std::to_string(cpu));
+    DIR *const dir = opendir(path.c_str());
+    struct dirent *entry;
+    int node = -1;
+
+
+    if (!dir) {
+        return -1;
+    }
+
+    while (NULL != (entry = readdir(dir))) {
+        int n;
+        char c;
+
+        if (1 == sscanf(entry->d_name, "node%d%c", &n, &c)) {
+            node = n;
+            break;
+        }
+    }
+
+    closedir(dir);
+    return node;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Pin the calling core's thread to its CPU, and make it prefer the
+    memory of the CPU's node if NUMA awareness was asked for.
+
+  Wants:
+    Calling core.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+CoreGroup::place(Core &core)
+{
+    if (core.cpu < 0) {
+        return true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core.cpu, &set);
+
+    int const error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (0 != error) {
+        std::cerr << "Can't pin core " << core.index << " to CPU " << core.cpu << ": " << strerror(error) << std::endl;
+        return false;
+    }
+
+    if (!numa_) {
+        return true;
+    }
+
+    core.node = nodeOf(core.cpu);
+    if (core.node < 0  ||  core.node >= (int) (8 * sizeof(unsigned long))) {
+        std::cerr << "No memory node for CPU " << core.cpu << ", core " << core.index << " allocates from any" << std::endl;
+        core.node = -1;
+        return true;
+    }
+
+    unsigned long const nodes = 1UL << core.node;
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodes, 8 * sizeof(nodes) + 1) != 0) {
+        std::cerr << "Can't set memory policy of core " << core.index << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Core's thread. Place the core and open its shard, and tell open() how
+    it went. Listen when all cores have opened. After stopping serve the
+    inbox until every core has stopped, as another core may still wait
+    for an answer.
+
+  Wants:
+    The core.
+    Sink's options.
+    Destination for the result of opening.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+CoreGroup::run(Core &core, std::string const &opts, std::promise<bool> *const opened)
+{
+    bool const ok = place(core)  &&  core.sink->open(opts);
+
+    if (ok) {
+        core.source->bindSink(core.sink);
+        core.source->watch(core.wakeFd, [this, &core] () { onWake(core); });
+    }
+    opened->set_value(ok);
+
+    while (!started_  &&  !stopping_) {
+        awaitWake(core.wakeFd);
+    }
+
+    if (ok  &&  started_  &&  !stopping_) {
+        core.source->blockingListen();
+    }
+
+    if (1 == listening_--) {
+        for (size_t i = 0; i < cores_.size(); ++i) {
+            wake(i);
+        }
+    }
+
+    while (listening_ > 0) {
+        if (!core.sink->impl()->serve()) {
+            awaitWake(core.wakeFd);
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    The core's eventfd is readable: serve the inbox, and print the
+    statistics if asked for. Runs in the core's listening loop.
+----------------------------------------------------------------------------*/
+void
+CoreGroup::onWake(Core &core)
+{
+    uint64_t count;
+
+    if (read(core.wakeFd, &count, sizeof(count)) < 0) {
+        // Read already by a core that waited for answers
+    }
+
+    core.sink->impl()->serve();
+
+    if (core.statsWanted.exchange(false)) {
+        std::lock_guard<std::mutex> guard(printLock_);
+        core.sink->printStats(std::cout);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Wake a core up from select() or awaitWake(). Any thread.
+----------------------------------------------------------------------------*/
+void
+CoreGroup::wake(unsigned const core) const
+{
+    uint64_t const one = 1;
+
+    if (write(cores_[core]->wakeFd, &one, sizeof(one)) < 0) {
+        // Counter is full: the core has been woken up anyway
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Sleep until the eventfd is written or for a while, and reset it.
+----------------------------------------------------------------------------*/
+void
+CoreGroup::awaitWake(int const fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint64_t count;
+
+    if (poll(&pfd, 1, CORE_WAIT_MS) > 0  &&  read(fd, &count, sizeof(count)) < 0) {
+        // Another reader was first
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop every core's listening loop. Any thread.
+----------------------------------------------------------------------------*/
+void
+CoreGroup::stop(void)
+{
+    stopping_ = true;
+
+    for (size_t i = 0; i < cores_.size(); ++i) {
+        if (cores_[i]->source) {
+            cores_[i]->source->stop();
+        }
+        if (cores_[i]->wakeFd >= 0) {
+            wake(i);
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Make every core print its statistics in its own thread. Any thread.
+----------------------------------------------------------------------------*/
+void
+CoreGroup::requestStats(void)
+{
+    for (size_t i = 0; i < cores_.size(); ++i) {
+        cores_[i]->statsWanted = true;
+        wake(i);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Parse a list of CPUs such as 0-3,8.
+
+  Wants:
+    The list.
+    Destination for the CPUs, in the order given.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+CoreGroup::parseCpus(std::string const &list, std::vector<int> &cpus)
+{
+    std::string::size_type start = 0;
+
+
+    while (start < list.length()) {
+        std::string::size_type end = list.find(',', start);
+        if (list.npos == end) {
+            end = list.length();
+        }
+
+        std::string const item(list, start, end - start);
+        char const *const first = item.c_str();
+        char *stop;
+        long const from = strtol(first, &stop, 10);
+        long to = from;
+
+        if (stop == first) {
+            return false;
+        }
+        if ('-' == *stop) {
+            char const *const last = stop + 1;
+            to = strtol(last, &stop, 10);
+            if (stop == last) {
+                return false;
+            }
+        }
+        if (*stop  ||  from < 0  ||  to < from  ||  to >= CPU_SETSIZE) {
+            return false;
+        }
+
+        for (long cpu = from; cpu <= to; ++cpu) {
+            cpus.push_back(cpu);
+        }
+
+        start = end + 1;
+    }
+
+    return !cpus.empty();
+}
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. The shard is opened by open().
+----------------------------------------------------------------------------*/
+CoreSinkImpl::CoreSinkImpl(CoreGroup &group, CoreGroup::Core &core)
+: group_(group), core_(core), index_(core.index), gather_(NULL)
+{
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the core's shard with the core's suffix .cI on its path.
+
+  Wants:
+    Sink's options.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+CoreSinkImpl::open(std::string const &opts)
+{
+    std::string const own(opts + (opts.empty() ? "" : ",") + "suffix=.c" + std::to_string(index_));
+
+    if (!core_.shard->open(own)) {
+        return false;
+    }
+
+    processRecord_ = core_.shard->processRecFunc();
+    processRecords_ = core_.shard->processRecsFunc();
+    flushRecords_ = core_.shard->flushFunc();
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process record received from client based on its 'action'. Stores go
+    to the core's shard, queries to every core.
+  
+  Wants:
+    Record's data.
+    Handler to a function to use to send the reply.
+    
+  Gives:
+    1 on successful store action, or
+    0 on other success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+CoreSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    if (rec.query()) {
+        return gather(rec, send);
+    }
+
+    int const ret = processRecord_(rec, send);
+
+    if (1 == ret) {
+        ++stats_.stored;
+        if (othersInterested()) {
+            outbox_.push_back(rec);
+        }
+    }
+
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process Records received together. Every run of stores goes to the
+    shard as one batch, anything else is processed one by one.
+  
+  Wants:
+    Records and their count.
+    Destination for every Record's result, as processRec() gives it.
+    Handler to a function to use to send the replies.
+    
+  Gives:
+    Number of Records stored.
+----------------------------------------------------------------------------*/
+int
+CoreSinkImpl::processRecs(Record const *const recs, size_t const count, int *const rets, Sink::SendRecord_f const &send)
+{
+    int stored = 0;
+    size_t i = 0;
+
+
+    while (i < count) {
+        if (REC_ACT_STORE != recs[i].action) {
+            rets[i] = processRec(recs[i], send);
+            stored += 1 == rets[i];
+            ++i;
+            continue;
+        }
+
+        size_t end = i;
+        while (end < count  &&  REC_ACT_STORE == recs[end].action) {
+            ++end;
+        }
+
+        int const got = processRecords_(recs + i, end - i, rets + i, send);
+
+        if (got > 0  &&  othersInterested()) {
+            for (size_t j = i; j < end; ++j) {
+                if (1 == rets[j]) {
+                    outbox_.push_back(recs[j]);
+                }
+            }
+        }
+
+        stats_.stored += got;
+        stored += got;
+        i = end;
+    }
+
+    return stored;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    End of a batch of Records: flush the shard and relay what it stored.
+    The core stays interested in relays only while it has Observers.
+----------------------------------------------------------------------------*/
+void
+CoreSinkImpl::flush(void)
+{
+    if (flushRecords_) {
+        flushRecords_();
+    }
+
+    sendRelays();
+    core_.interest = core_.observer.size() > 0;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell if any other core wants the Records stored here.
+----------------------------------------------------------------------------*/
+bool
+CoreSinkImpl::othersInterested(void) const
+{
+    for (size_t i = 0; i < group_.cores_.size(); ++i) {
+        if (i != index_  &&  group_.cores_[i]->interest.load(std::memory_order_acquire)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Put a message to another core's inbox and wake it up. While the inbox
+    is full serve our own, as its core may be waiting for room in ours.
+
+  Wants:
+    Receiving core.
+    Message. It is moved from.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+CoreSinkImpl::post(unsigned const to, Message &&msg)
+{
+    while (!group_.cores_[to]->inbox.push(std::move(msg))) {
+        if (!serve()) {
+            sched_yield();
+        }
+    }
+
+    group_.wake(to);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Relay the Records stored since the last time to the cores that are
+    interested, all cores sharing one copy.
+----------------------------------------------------------------------------*/
+void
+CoreSinkImpl::sendRelays(void)
+{
+    if (outbox_.empty()) {
+        return;
+    }
+
+    std::shared_ptr<std::vector<Record> const> const relayed(new std::vector<Record>(std::move(outbox_)));
+    outbox_.clear();
+
+    for (unsigned i = 0; i < group_.cores_.size(); ++i) {
+        if (i != index_  &&  group_.cores_[i]->interest.load(std::memory_order_acquire)) {
+            Message msg(Message::RELAY, index_, NULL);
+            msg.relayed = relayed;
+            post(i, std::move(msg));
+            ++stats_.relaysSent;
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Serve the messages in our inbox.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True if there was any.
+----------------------------------------------------------------------------*/
+bool
+CoreSinkImpl::serve(void)
+{
+    bool served = false;
+
+    while (true) {
+        Message msg;
+
+        if (!core_.inbox.pop(msg)) {
+            break;
+        }
+        served = true;
+
+        switch (msg.type) {
+        case Message::QUERY:
+            answer(msg);
+            break;
+
+        case Message::ANSWER: {
+            CoreGather &gather = *msg.gather;
+            gather.answers[msg.from] = std::move(msg.recs);
+            gather.rets[msg.from] = msg.ret;
+            gather.answered[msg.from] = true;
+            --gather.pending;
+            break;
+        }
+
+        case Message::RELAY:
+            receive(msg);
+            break;
+        }
+    }
+
+    return served;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run another core's query on our shard and send back the replies.
+    Everything stored before is relayed first, so that the asking core
+    gets the Records our answer has before the answer, and those stored
+    after it after the answer.
+
+  Wants:
+    QUERY message.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+CoreSinkImpl::answer(Message &msg)
+{
+    Message reply(Message::ANSWER, index_, msg.gather);
+    std::vector<Record> *const recs = &reply.recs;
+    Sink::SendRecord_f const collect = [recs] (Record const &rec, uint64_t) { recs->push_back(rec); return 0; };
+
+
+    sendRelays();
+
+    reply.ret = processRecord_(*msg.ref, collect);
+    ++stats_.answered;
+
+    post(msg.from, std::move(reply));
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Relay Records stored by another core to our Observers. If we are
+    waiting for answers to a GET_AFTER and the core has answered already,
+    the matching ones are also added to its answer.
+
+  Wants:
+    RELAY message.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+CoreSinkImpl::receive(Message &msg)
+{
+    std::vector<Record> const &recs = *msg.relayed;
+    bool const stash = gather_  &&  gather_->stash  &&  gather_->answered[msg.from];
+
+
+    for (size_t i = 0; i < recs.size(); ++i) {
+        core_.source->relay(recs[i]);
+
+        if (stash  &&  recs[i].match(gather_->ref)) {
+            gather_->answers[msg.from].push_back(recs[i]);
+            ++stats_.stashed;
+        }
+    }
+
+    ++stats_.relaysReceived;
+    stats_.relayed += recs.size();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run a query on every core's shard, ours while the others run theirs,
+    and send the merged answer. We are interested in relays from the
+    moment the query is sent until the end of the batch.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    
+  Gives: 
+    0 on success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+CoreSinkImpl::gather(Record const &reference, Sink::SendRecord_f const &send)
+{
+    unsigned const cores = group_.cores_.size();
+    CoreGather gather(reference, cores);
+
+
+    if (!QueryPage::splitCursor(reference, gather.refs, "cores")) {
+        return -1;
+    }
+    gather.stash = !reference.paged()  &&  REC_ACT_GET_AFTER == reference.action;
+
+    core_.interest = true;
+    gather_ = &gather;
+
+    for (unsigned i = 0; i < cores; ++i) {
+        if (i != index_) {
+            Message msg(Message::QUERY, index_, &gather);
+            msg.ref = &gather.refs[i];
+            post(i, std::move(msg));
+            ++stats_.queries;
+        }
+    }
+
+    std::vector<Record> *const own = &gather.answers[index_];
+    Sink::SendRecord_f const collect = [own] (Record const &rec, uint64_t) { own->push_back(rec); return 0; };
+
+    gather.rets[index_] = processRecord_(gather.refs[index_], collect);
+    gather.answered[index_] = true;
+    --gather.pending;
+
+    while (gather.pending > 0) {
+        if (!serve()) {
+            CoreGroup::awaitWake(core_.wakeFd);
+        }
+    }
+
+    gather_ = NULL;
+
+    for (unsigned i = 0; i < cores; ++i) {
+        if (gather.rets[i] < 0) {
+            return -1;
+        }
+    }
+
+    bool ok;
+    switch (reference.action) {
+    case REC_ACT_COUNT:
+    case REC_ACT_STATS:
+        ok = mergeAggregate(gather, send);
+        break;
+
+    case REC_ACT_GET_LATEST:
+        ok = mergeLatest(gather, send);
+        break;
+
+    default:
+        ok = QueryPage::mergeParts(reference, gather.refs, gather.answers, send, stats_.merged);
+        break;
+    }
+
+    return ok ? 0 : -1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add up the groups every core replied to a COUNT or STATS, and send
+    them.
+----------------------------------------------------------------------------*/
+bool
+CoreSinkImpl::mergeAggregate(CoreGather &gather, Sink::SendRecord_f const &send)
+{
+    Aggregate agg(gather.ref);
+
+    for (size_t i = 0; i < gather.answers.size(); ++i) {
+        for (size_t j = 0; j < gather.answers[i].size(); ++j) {
+            if (!agg.addReply(gather.answers[i][j])) {
+                std::cerr << "Core " << i << " gave an invalid aggregate" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    return agg.send(send);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send the newest of every device's latest Records the cores replied to
+    a GET_LATEST, oldest first. A device may have sent to any core.
+----------------------------------------------------------------------------*/
+bool
+CoreSinkImpl::mergeLatest(CoreGather &gather, Sink::SendRecord_f const &send)
+{
+    typedef std::map<std::pair<std::string, std::string>, Record const *> Latest_t;
+    Latest_t latest;
+    std::vector<Record const *> order;
+
+
+    for (size_t i = 0; i < gather.answers.size(); ++i) {
+        for (size_t j = 0; j < gather.answers[i].size(); ++j) {
+            Record const &rec = gather.answers[i][j];
+            Record const *&newest = latest[std::make_pair(rec.serial, rec.devType)];
+
+            if (!newest  ||  timercmp(&rec.timestamp, &newest->timestamp, > )) {
+                newest = &rec;
+            }
+        }
+    }
+
+    for (Latest_t::const_iterator it = latest.begin(); it != latest.end(); ++it) {
+        order.push_back(it->second);
+    }
+    std::stable_sort(order.begin(), order.end(), [] (Record const *a, Record const *b) { return timercmp(&a->timestamp, &b->timestamp, < ); });
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (send(*order[i], gather.ref.priv) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print the core's placement, its traffic with the other cores and its
+    shard's statistics.
+
+  Wants:
+    Output stream.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+CoreSinkImpl::printStats(std::ostream &os) const
+{
+    os << "Core " << index_ << ": CPU " << core_.cpu << ", node " << core_.node << " (-1 = any), " 
+        << stats_.stored << " Records stored, " << stats_.queries << " queries sent to other cores, " 
+        << stats_.answered << " answered for them, " << stats_.relaysSent << " relays sent, " 
+        << stats_.relaysReceived << " received with " << stats_.relayed << " Records, " 
+        << stats_.stashed << " of them added to answers, " << stats_.merged << " Records of merged answers sent" << std::endl;
+
+    core_.shard->printStats(os);
+}
@@ -0,0 +1,246 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#ifndef HOMEWORK_SERVER_CORE_GROUP_HPP
+#define HOMEWORK_SERVER_CORE_GROUP_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <future>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "sink.hpp"
+#include "record.hpp"
+
+class CoreSinkImpl;
+struct CoreGather;
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Shared-nothing mode: N cores, each a thread with its own listening
+    socket on the shared port, its own connections, its own instance of
+    the Sink (its shard, files FILE.cI) and its own Observer. A core
+    stores the Records its clients send to its own shard, so the store
+    path takes no lock and touches no other core's memory.
+
+    The kernel spreads the connections over the listening sockets
+    (SO_REUSEPORT). A classic BPF program steers each connection to the
+    core pinned on the CPU that received it, or with no pinning to the
+    CPU's number modulo N.
+
+    Anything between cores goes as messages through every core's bounded
+    lock-free inbox, which the core serves from its own listening loop,
+    woken by an eventfd:
+    QUERY   run the request on the receiver's shard and answer with the
+            replies collected
+    ANSWER  replies to a QUERY, for the core that asked
+    RELAY   Records stored on another core, for the receiver's Observer
+
+    Cores can be pinned to CPUs, and with NUMA awareness a core allocates
+    from the memory node of its CPU: the policy is set before the core
+    opens its shard, so the shard's memory is first touched there.
+----------------------------------------------------------------------------*/
+class CoreGroup
+{
+public:
+    CoreGroup(unsigned cores, std::vector<int> const &cpus, bool numa);
+    ~CoreGroup();
+
+    bool open(int port, Sink const *sink, std::string const &opts);
+    void stop(void);
+    void requestStats(void);
+
+    static bool parseCpus(std::string const &list, std::vector<int> &cpus);
+
+private:
+    friend class CoreSinkImpl;
+
+    struct Core;
+
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        Message from one core to another.
+    ----------------------------------------------------------------------------*/
+    struct Message {
+        enum Type { QUERY, ANSWER, RELAY };
+
+        Message() : type(QUERY), from(0), gather(NULL), ref(NULL), ret(0) {}
+        Message(Type t, unsigned f, CoreGather *g) : type(t), from(f), gather(g), ref(NULL), ret(0) {}
+
+        Type type;
+        unsigned from;                   // Sender's core
+        CoreGather *gather;              // QUERY and ANSWER: the asking core's query
+        Record const *ref;               // QUERY: request for the receiver's shard
+        int ret;                         // ANSWER: the shard's result
+        std::vector<Record> recs;        // ANSWER: replies
+        std::shared_ptr<std::vector<Record> const> relayed;  // RELAY: shared by all cores it goes to
+    };
+
+    // No copying
+    CoreGroup(CoreGroup const &);
+    CoreGroup &operator = (CoreGroup const &);
+
+    bool steer(void);
+    bool place(Core &core);
+    void run(Core &core, std::string const &opts, std::promise<bool> *opened);
+    void onWake(Core &core);
+    void wake(unsigned core) const;
+    static void awaitWake(int fd);
+
+    std::vector<Core *> cores_;
+    std::vector<int> cpus_;              // CPU of each core, empty for no pinning
+    bool numa_;
+
+    std::atomic<bool> started_;          // All cores opened and listening
+    std::atomic<bool> stopping_;
+    std::atomic<unsigned> listening_;    // Cores still in their listening loop
+    std::mutex printLock_;               // Statistics output only
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Implement the Sink that a core's TcpSource is bound to. Stores go
+    straight to the core's shard. A query is sent to every other core and
+    run on this core's shard meanwhile, and the answers are merged:
+    GET_AFTER       in timestamp order, equal timestamps in core order. The
+                    cursor of a paged query holds a position in every
+                    shard, as the shard Sink's does.
+    COUNT, STATS    groups added up
+    GET_LATEST      newest Record of every device, oldest first
+    While a core waits for the answers it keeps serving its inbox, so two
+    cores asking each other never deadlock.
+
+    Stored Records are relayed to the other cores at the end of every
+    batch, but only to cores that are interested: they have Observers or
+    a query going on. The Records a core stores after answering a
+    GET_AFTER reach the asking core before it attaches an Observer, and
+    are added to the answer, so an Observer that replays history gets
+    every Record once, as with one core.
+
+    Everything runs in the core's own thread.
+----------------------------------------------------------------------------*/
+class CoreSinkImpl
+{
+public:
+    CoreSinkImpl(CoreGroup &group, CoreGroup::Core &core);
+    ~CoreSinkImpl() {}
+
+    bool open(std::string const &opts);
+
+    int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    int processRecs(Record const *recs, size_t count, int *rets, Sink::SendRecord_f const &send);
+    void flush(void);
+
+    bool serve(void);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    typedef CoreGroup::Message Message;
+
+    // No copying
+    CoreSinkImpl(CoreSinkImpl const &);
+    CoreSinkImpl &operator = (CoreSinkImpl const &);
+
+    bool othersInterested(void) const;
+    void post(unsigned to, Message &&msg);
+    void sendRelays(void);
+    void answer(Message &msg);
+    void receive(Message &msg);
+
+    int gather(Record const &ref, Sink::SendRecord_f const &send);
+    bool mergeAggregate(CoreGather &gather, Sink::SendRecord_f const &send);
+    bool mergeLatest(CoreGather &gather, Sink::SendRecord_f const &send);
+
+    CoreGroup &group_;
+    CoreGroup::Core &core_;
+    unsigned const index_;
+
+    // The core's shard
+    Sink::ProcessRecord_f processRecord_;
+    Sink::ProcessRecords_f processRecords_;
+    Sink::FlushRecords_f flushRecords_;
+
+    std::vector<Record> outbox_;       // Stored since the last relay
+    CoreGather *gather_;               // Query being answered, or NULL
+
+    struct Stats {
+        Stats() : stored(0), queries(0), answered(0), relaysSent(0), relaysReceived(0), relayed(0), stashed(0), merged(0) {}
+
+        uint64_t stored;
+        uint64_t queries;              // Sent to the other cores
+        uint64_t answered;             // For the other cores
+        uint64_t relaysSent;
+        uint64_t relaysReceived;
+        uint64_t relayed;              // Records received in relays
+        uint64_t stashed;              // Of them added to an answer
+        uint64_t merged;               // Replies sent of merged GET_AFTER answers
+    } stats_;
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    One core's Sink. Not registered: there is one for every core, made by
+    CoreGroup.
+----------------------------------------------------------------------------*/
+class CoreSink : public Sink
+{
+public:
+    explicit CoreSink(CoreSinkImpl *const impl) : Sink(NULL), pImpl_(impl) {}
+    virtual ~CoreSink() { if (pImpl_) delete pImpl_; }
+
+    virtual bool open(std::string const &opts) { return pImpl_->open(opts); }
+
+    CoreSinkImpl *impl(void) const { return pImpl_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Creates binding to implementation's functions.
+    ----------------------------------------------------------------------------*/
+    virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&CoreSinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&CoreSinkImpl::processRecs, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&CoreSinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { pImpl_->printStats(os); }
+
+private:
+    CoreSinkImpl *pImpl_;
+};
+
+
+#endif  // HOMEWORK_SERVER_CORE_GROUP_HPP
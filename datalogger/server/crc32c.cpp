@@ -0,0 +1,129 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "crc32c.hpp"
+
+#if defined(__GNUC__)  &&  defined(__x86_64__)
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY  0x82f63b78
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Portable version, one byte per table lookup.
+----------------------------------------------------------------------------*/
+static uint32_t crcTable[256];
+
+static uint32_t
+crc32cTable(void const *const data, size_t const len, uint32_t crc)
+{
+    uint8_t const *ptr = (uint8_t const *) data;
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = crcTable[(crc ^ ptr[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+#ifdef CRC32C_SSE42
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    SSE4.2 version, 8 bytes per instruction.
+----------------------------------------------------------------------------*/
+__attribute__((target("sse4.2"))) static uint32_t
+crc32cHw(void const *const data, size_t const len, uint32_t const crc)
+{
+    uint8_t const *ptr = (uint8_t const *) data;
+    uint8_t const *const end = ptr + len;
+    uint64_t c = ~crc;
+
+    for (; ptr + sizeof(uint64_t) <= end; ptr += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, ptr, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    for (; ptr < end; ++ptr) {
+        c = _mm_crc32_u8(c, *ptr);
+    }
+    return ~c;
+}
+
+#endif  // CRC32C_SSE42
+
+
+/*---- Variable -------------------------------------------------------------
+  Does:
+    Implementation in use, picked on application startup.
+----------------------------------------------------------------------------*/
+struct Crc32c {
+    Crc32c() : func(crc32cTable), name("table")
+    {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            }
+            crcTable[i] = c;
+        }
+
+#ifdef CRC32C_SSE42
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            func = crc32cHw;
+            name = "sse4.2";
+        }
+#endif
+    }
+
+    uint32_t (*func)(void const *, size_t, uint32_t);
+    char const *name;
+};
+
+static Crc32c const impl;
+
+
+uint32_t
+crc32c(void const *const data, size_t const len, uint32_t const crc)
+{
+    return impl.func(data, len, crc);
+}
+
+
+char const *
+crc32cName(void)
+{
+    return impl.name;
+}
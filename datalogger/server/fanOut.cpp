@@ -0,0 +1,295 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <iostream>
+#include "fanOut.hpp"
+#include "monoClock.hpp"
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Allocate the workers. Threads are started by start().
+----------------------------------------------------------------------------*/
+FanOut::FanOut(unsigned const threads, size_t const queueSize) : stop_(false), fullStalls_(0)
+{
+    for (unsigned i = 0; i < (threads > 0 ? threads : 1); ++i) {
+        workers_.push_back(new Worker(queueSize));
+    }
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Stop the threads and release the workers.
+----------------------------------------------------------------------------*/
+FanOut::~FanOut()
+{
+    stop();
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        delete workers_[i];
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Start the fan-out threads.
+
+  Wants:
+    Send function the threads use to deliver Records to Lurkers. It is
+    called concurrently from every fan-out thread.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+FanOut::start(Sink::SendRecord_f const &send)
+{
+    if (workers_[0]->thread.joinable()) {
+        return false;
+    }
+
+    send_ = send;
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        Worker &w = *workers_[i];
+        w.thread = std::thread([this, &w] () { run(w); });
+    }
+
+    std::cout << "Started " << workers_.size() << " observer fan-out threads" << std::endl;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop the fan-out threads. Events still queued are delivered first.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+FanOut::stop(void)
+{
+    stop_ = true;
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        Worker &w = *workers_[i];
+
+        if (w.thread.joinable()) {
+            w.wakeup.notify();
+            w.thread.join();
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue Lurker attachment to the thread that owns the handle.
+
+  Wants:
+    Reference Record to match with new stored Records.
+    Private data 'id' that is used to identify the Lurker at the Source's
+    end.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+FanOut::attachLurker(Record const &rec, uint64_t const id)
+{
+    Event ev;
+    ev.type = Event::ATTACH;
+    ev.id = id;
+    ev.rec = rec;
+
+    push(owner(id), std::move(ev));
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue Lurker removal to the thread that owns the handle.
+
+  Wants:
+    Private data 'id' that identifies previously attached Lurker.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+FanOut::detachLurker(uint64_t const id)
+{
+    Event ev;
+    ev.type = Event::DETACH;
+    ev.id = id;
+
+    push(owner(id), std::move(ev));
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue a stored Record to every fan-out thread.
+
+  Wants:
+    Stored Record.
+
+  Gives:
+    Number of threads the Record was queued to.
+----------------------------------------------------------------------------*/
+int
+FanOut::relayRec(Record const &rec)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        Event ev;
+        ev.rec = rec;
+        ev.queued = now;
+        push(*workers_[i], std::move(ev));
+    }
+
+    return workers_.size();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Push an event to worker's queue and wake the worker if it sleeps.
+    A full queue is waited out rather than dropping Records: observers must
+    not miss anything.
+
+  Wants:
+    Worker and the event.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+FanOut::push(Worker &w, Event &&ev)
+{
+    if (!w.queue.push(std::move(ev))) {
+        ++fullStalls_;
+        while (!w.queue.push(std::move(ev))) {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t const depth = w.queue.size();
+    if (depth > w.maxDepth.load(std::memory_order_relaxed)) {
+        w.maxDepth.store(depth, std::memory_order_relaxed);
+    }
+
+    w.wakeup.notify();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Fan-out thread's loop. Drain the queue, sleep when it's empty.
+
+  Wants:
+    Worker owned by this thread.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+FanOut::run(Worker &w)
+{
+    Event ev;
+
+    while (true) {
+        if (!w.queue.pop(ev)) {
+            if (stop_) {
+                return;
+            }
+
+            w.wakeup.wait([this, &w] () { return stop_  ||  !w.queue.empty(); });
+            continue;
+        }
+
+        switch (ev.type) {
+        case Event::ATTACH:
+            w.observer.attachLurker(ev.rec, ev.id);
+            break;
+
+        case Event::DETACH:
+            w.observer.detachLurker(ev.id);
+            break;
+
+        case Event::RELAY: {
+            w.observer.relayRec(ev.rec, send_);
+
+            uint64_t const latency = monoClock::elapsedUs(ev.queued);
+            w.relayed.fetch_add(1, std::memory_order_relaxed);
+            w.latencySumUs.fetch_add(latency, std::memory_order_relaxed);
+            if (latency > w.latencyMaxUs.load(std::memory_order_relaxed)) {
+                w.latencyMaxUs.store(latency, std::memory_order_relaxed);
+            }
+            break;
+        }
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print queue depth and relay latency of every fan-out thread.
+
+  Wants:
+    Output stream.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+FanOut::printStats(std::ostream &os) const
+{
+    os << "Fan-out: " << workers_.size() << " threads, " << fullStalls_ << " full queue stalls" << std::endl;
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        Worker const &w = *workers_[i];
+        uint64_t const relayed = w.relayed.load();
+
+        os << "  thread " << i << ": queue " << w.queue.size() << "/" << w.queue.capacity()
+            << " (max " << w.maxDepth.load() << "), relayed " << relayed
+            << ", latency avg " << (relayed ? w.latencySumUs.load() / relayed : 0)
+            << " us, max " << w.latencyMaxUs.load() << " us" << std::endl;
+    }
+}
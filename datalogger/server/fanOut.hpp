@@ -0,0 +1,126 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_FAN_OUT_HPP
+#define HOMEWORK_SERVER_FAN_OUT_HPP
+
+#include <time.h>
+#include <atomic>
+#include <iosfwd>
+#include <thread>
+#include <vector>
+#include "sink.hpp"
+#include "record.hpp"
+#include "observer.hpp"
+#include "lockfreeQueue.hpp"
+#include "wakeup.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Move Observer work off the thread that stores Records. Every fan-out
+    thread owns an Observer holding a slice of the Lurkers (by handle).
+    Stored Records are pushed to every thread's lock-free queue, and each
+    thread matches and sends them to its own Lurkers.
+
+    Attach and detach requests travel through the same queues, so they are
+    ordered exactly against the relayed Records.
+
+    Producer side (relayRec, attachLurker, detachLurker) must be called from
+    one thread only.
+----------------------------------------------------------------------------*/
+class FanOut
+{
+public:
+    FanOut(unsigned threads, size_t queueSize);
+    ~FanOut();
+
+    bool start(Sink::SendRecord_f const &send);
+    void stop(void);
+
+    bool attachLurker(Record const &rec, uint64_t id);
+    bool detachLurker(uint64_t id);
+
+    int relayRec(Record const &rec);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    // No copying
+    FanOut(FanOut const &);
+    FanOut &operator = (FanOut const &);
+
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        One message from the storing thread to a fan-out thread.
+    ----------------------------------------------------------------------------*/
+    struct Event {
+        enum Type { RELAY, ATTACH, DETACH };
+
+        Event() : type(RELAY), id(0) {}
+
+        Type type;
+        uint64_t id;
+        Record rec;
+        struct timespec queued;
+    };
+
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        Fan-out thread's private state. Only 'queue' and the statistics are
+        touched by other threads.
+    ----------------------------------------------------------------------------*/
+    struct Worker {
+        Worker(size_t queueSize) : queue(queueSize), maxDepth(0), relayed(0), latencySumUs(0), latencyMaxUs(0) {}
+
+        std::thread thread;
+        Observer observer;
+        SpscQueue<Event> queue;
+
+        Wakeup wakeup;   // Idle sleep
+
+        // Statistics
+        std::atomic<size_t> maxDepth;
+        std::atomic<uint64_t> relayed;
+        std::atomic<uint64_t> latencySumUs;
+        std::atomic<uint64_t> latencyMaxUs;
+    };
+
+    void push(Worker &w, Event &&ev);
+    void run(Worker &w);
+
+    Worker &owner(uint64_t const id) { return *workers_[id % workers_.size()]; }
+
+    std::vector<Worker *> workers_;
+    Sink::SendRecord_f send_;
+    std::atomic<bool> stop_;
+
+    uint64_t fullStalls_;  // Producer found a queue full
+};
+
+
+#endif  // HOMEWORK_SERVER_FAN_OUT_HPP
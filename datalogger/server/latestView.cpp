@@ -0,0 +1,294 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include "latestView.hpp"
+#include "bintxtRow.hpp"
+
+
+// Header of the saved view: magic, version, log segment, 64 bit offset in
+// it and number of Records. Network byte order.
+#define LATEST_MAGIC        0x42544c56  // "BTLV"
+#define LATEST_VERSION      1
+#define LATEST_HEADER_SIZE  24
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Make the Record the latest of its serial and devType, unless the view
+    already has a newer one.
+
+  Wants:
+    Record, or its fields.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+LatestView::store(Record const &rec)
+{
+    store(rec.serial.data(), rec.serial.length(), rec.devType.data(), rec.devType.length(), 
+          rec.timestamp, rec.data.data(), rec.data.length());
+}
+
+
+void
+LatestView::store(char const *const serial, size_t const serialLen, char const *const devType, size_t const devTypeLen, 
+                  struct timeval const &ts, char const *const data, size_t const dataLen)
+{
+    key_.assign(serial, serialLen);
+
+    Serials_t::iterator bySerial = serials_.find(key_);
+    if (serials_.end() == bySerial) {
+        bySerial = serials_.insert(std::make_pair(key_, DevTypes_t())).first;
+    }
+
+    std::string const devKey(devType, devTypeLen);
+    DevTypes_t::iterator it = bySerial->second.find(devKey);
+
+    if (bySerial->second.end() == it) {
+        it = bySerial->second.insert(std::make_pair(devKey, Record(REC_ACT_REPLY))).first;
+        it->second.serial = key_;
+        it->second.devType = devKey;
+        ++records_;
+    }
+    else if (timercmp(&ts, &it->second.timestamp, < )) {
+        return;
+    }
+
+    it->second.timestamp = ts;
+    it->second.data.assign(data, dataLen);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give a send function that stores the Records to the view, to rebuild
+    it with a query for everything. It must not outlive the view.
+----------------------------------------------------------------------------*/
+Sink::SendRecord_f
+LatestView::collector(void)
+{
+    return [this] (Record const &rec, uint64_t) { store(rec); return 0; };
+}
+
+
+void
+LatestView::clear(void)
+{
+    serials_.clear();
+    records_ = 0;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send the latest Record of every serial and devType matching the
+    reference, if it is new enough, oldest first. One serial and devType
+    is a lookup.
+
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+LatestView::send(Record const &ref, Sink::SendRecord_f const &send) const
+{
+    std::vector<Record const *> hits;
+
+
+    Serials_t::const_iterator first = serials_.begin();
+    Serials_t::const_iterator last = serials_.end();
+
+    if ("*" != ref.serial) {
+        first = serials_.find(ref.serial);
+        if (serials_.end() == first) {
+            return true;
+        }
+        last = first;
+        ++last;
+    }
+
+    for (Serials_t::const_iterator bySerial = first; bySerial != last; ++bySerial) {
+        DevTypes_t const &devTypes = bySerial->second;
+
+        if ("*" != ref.devType) {
+            DevTypes_t::const_iterator const it = devTypes.find(ref.devType);
+            if (devTypes.end() != it  &&  it->second.match(ref)) {
+                hits.push_back(&it->second);
+            }
+            continue;
+        }
+
+        for (DevTypes_t::const_iterator it = devTypes.begin(); it != devTypes.end(); ++it) {
+            if (it->second.match(ref)) {
+                hits.push_back(&it->second);
+            }
+        }
+    }
+
+    std::stable_sort(hits.begin(), hits.end(), [] (Record const *a, Record const *b) { 
+        return timercmp(&a->timestamp, &b->timestamp, < ); 
+    });
+
+    for (size_t i = 0; i < hits.size(); ++i) {
+        if (send(*hits[i], ref.priv) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Read a saved view. On failure the view is left empty.
+
+  Wants:
+    File's path.
+    Destinations for the log position the view covers.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+LatestView::load(std::string const &path, uint32_t &segment, uint64_t &offset)
+{
+    struct stat st;
+    std::vector<char> file;
+
+
+    clear();
+
+    int const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = fstat(fd, &st) == 0  &&  st.st_size >= LATEST_HEADER_SIZE;
+    if (ok) {
+        file.resize(st.st_size);
+        ok = pread(fd, &file[0], file.size(), 0) == (ssize_t) file.size();
+    }
+    close(fd);
+
+    uint32_t header[LATEST_HEADER_SIZE / sizeof(uint32_t)];
+    if (!ok) {
+        return false;
+    }
+    memcpy(header, &file[0], sizeof(header));
+
+    if (LATEST_MAGIC != ntohl(header[0])  ||  LATEST_VERSION != ntohl(header[1])) {
+        return false;
+    }
+
+    uint32_t const count = ntohl(header[5]);
+    size_t pos = LATEST_HEADER_SIZE;
+    bintxt::RowView view;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        int const len = bintxt::viewRow(view, &file[pos], file.size() - pos);
+        if (0 == len) {
+            clear();
+            return false;
+        }
+        store(view.serial, view.serialLen, view.devType, view.devTypeLen, view.timestamp, view.data, view.dataLen);
+        pos += len;
+    }
+
+    if (pos != file.size()) {
+        clear();
+        return false;
+    }
+
+    segment = ntohl(header[2]);
+    offset = ((uint64_t) ntohl(header[3]) << 32) | ntohl(header[4]);
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Save the view next to the log and atomically replace the old one.
+
+  Wants:
+    File's path.
+    Log position the view covers: segment and offset of the row data in
+    it after the last Record stored.
+    True to fdatasync() the file before it replaces the old one.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+LatestView::save(std::string const &path, uint32_t const segment, uint64_t const offset, bool const durable) const
+{
+    uint32_t const header[LATEST_HEADER_SIZE / sizeof(uint32_t)] = {
+        htonl(LATEST_MAGIC), htonl(LATEST_VERSION), htonl(segment), 
+        htonl(offset >> 32), htonl(offset & 0xffffffff), htonl(records_)
+    };
+    std::string const tmp(path + ".tmp");
+    std::vector<char> file((char const *) header, (char const *) header + sizeof(header));
+
+
+    for (Serials_t::const_iterator bySerial = serials_.begin(); bySerial != serials_.end(); ++bySerial) {
+        for (DevTypes_t::const_iterator it = bySerial->second.begin(); it != bySerial->second.end(); ++it) {
+            size_t const pos = file.size();
+            file.resize(pos + bintxt::rowSize(it->second, true));
+            bintxt::encodeRow(&file[pos], it->second, true);
+        }
+    }
+
+    int const fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Can't create " << tmp << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool const ok = write(fd, &file[0], file.size()) == (ssize_t) file.size()  &&  (!durable  ||  0 == fdatasync(fd));
+
+    if (close(fd) < 0  ||  !ok  ||  rename(tmp.c_str(), path.c_str()) < 0) {
+        std::cerr << "Can't write " << path << ": " << strerror(errno) << std::endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
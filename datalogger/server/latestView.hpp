@@ -0,0 +1,78 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_LATEST_VIEW_HPP
+#define HOMEWORK_SERVER_LATEST_VIEW_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include "sink.hpp"
+#include "record.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Latest Record of every serial and devType, kept up to date on every
+    store so that GET_LATEST needs no scan. A serial's devTypes are found
+    with one hash lookup; a wildcard serial visits every serial.
+
+    The view can be saved to a file with the position in the log it
+    covers, so that on start only the rows after it need to be read. The
+    file holds the Records as bintxt rows with CRC, after a header of
+    magic, version, log position and Record count.
+----------------------------------------------------------------------------*/
+class LatestView
+{
+public:
+    LatestView() : records_(0) {}
+
+    void store(Record const &rec);
+    void store(char const *serial, size_t serialLen, char const *devType, size_t devTypeLen, 
+               struct timeval const &ts, char const *data, size_t dataLen);
+    bool send(Record const &ref, Sink::SendRecord_f const &send) const;
+    Sink::SendRecord_f collector(void);
+    void clear(void);
+
+    bool load(std::string const &path, uint32_t &segment, uint64_t &offset);
+    bool save(std::string const &path, uint32_t segment, uint64_t offset, bool durable) const;
+
+    size_t size(void) const { return records_; }
+
+private:
+    typedef std::map<std::string, Record> DevTypes_t;               // Sorted for replies
+    typedef std::unordered_map<std::string, DevTypes_t> Serials_t;
+
+    Serials_t serials_;
+    size_t records_;
+    std::string key_;    // Reused to look serials up without allocating
+};
+
+
+#endif  // HOMEWORK_SERVER_LATEST_VIEW_HPP
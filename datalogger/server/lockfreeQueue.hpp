@@ -0,0 +1,272 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_LOCKFREE_QUEUE_HPP
+#define HOMEWORK_SERVER_LOCKFREE_QUEUE_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+
+
+// Keep producer and consumer indices on separate cache lines
+#define CACHE_LINE_SIZE  64
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Bounded single producer, single consumer ring buffer. Neither end ever
+    blocks or takes a lock: push() fails when the ring is full and pop()
+    fails when it is empty.
+
+    Capacity is rounded up to the next power of two.
+----------------------------------------------------------------------------*/
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t const capacity)
+    : mask_(roundUp(capacity) - 1), slots_(new T[mask_ + 1]), head_(0), tailCache_(0), tail_(0), headCache_(0) {}
+
+    ~SpscQueue() { delete [] slots_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Append an item. Producer side only.
+
+      Wants:
+        Item to move into the ring.
+
+      Gives:
+        True on success, false if the ring was full.
+    ----------------------------------------------------------------------------*/
+    bool push(T &&item)
+    {
+        size_t const head = head_.load(std::memory_order_relaxed);
+
+        if (head - tailCache_ > mask_) {
+            tailCache_ = tail_.load(std::memory_order_acquire);
+            if (head - tailCache_ > mask_) {
+                return false;
+            }
+        }
+
+        slots_[head & mask_] = std::move(item);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Take the oldest item. Consumer side only.
+
+      Wants:
+        Destination for the item.
+
+      Gives:
+        True on success, false if the ring was empty.
+    ----------------------------------------------------------------------------*/
+    bool pop(T &item)
+    {
+        size_t const tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail == headCache_) {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if (tail == headCache_) {
+                return false;
+            }
+        }
+
+        item = std::move(slots_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called from a third thread
+    size_t size(void) const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+    bool empty(void) const { return 0 == size(); }
+    size_t capacity(void) const { return mask_ + 1; }
+
+private:
+    // No copying
+    SpscQueue(SpscQueue const &);
+    SpscQueue &operator = (SpscQueue const &);
+
+    static size_t roundUp(size_t n) {
+        size_t p = 2;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    size_t const mask_;
+    T *const slots_;
+
+    // Padding instead of alignas(): c++0x operator new ignores extended alignment
+    char pad0_[CACHE_LINE_SIZE];
+    std::atomic<size_t> head_;
+    size_t tailCache_;  // Producer's last view of tail_
+
+    char pad1_[CACHE_LINE_SIZE];
+    std::atomic<size_t> tail_;
+    size_t headCache_;  // Consumer's last view of head_
+
+    char pad2_[CACHE_LINE_SIZE];
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Bounded multiple producer, single consumer ring buffer. Every slot has
+    a sequence number that tells whether it is free for the producer that
+    claimed it or ready for the consumer. Producers claim slots by
+    compare-and-swap on the head; the consumer needs no atomic
+    read-modify-write at all. Neither end ever blocks or takes a lock.
+
+    Capacity is rounded up to the next power of two.
+----------------------------------------------------------------------------*/
+template <typename T>
+class MpscQueue
+{
+public:
+    explicit MpscQueue(size_t const capacity)
+    : mask_(roundUp(capacity) - 1), slots_(new Slot[mask_ + 1]), head_(0), tail_(0)
+    {
+        for (size_t i = 0; i <= mask_; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpscQueue() { delete [] slots_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Append an item. Any thread.
+
+      Wants:
+        Item to move into the ring.
+
+      Gives:
+        True on success, false if the ring was full.
+    ----------------------------------------------------------------------------*/
+    bool push(T &&item)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        while (true) {
+            Slot &slot = slots_[head & mask_];
+            ptrdiff_t const diff = (ptrdiff_t) (slot.seq.load(std::memory_order_acquire) - head);
+
+            if (0 == diff) {
+                if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                    slot.item = std::move(item);
+                    slot.seq.store(head + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                // Consumer has not freed the slot from the previous lap
+                return false;
+            }
+            else {
+                head = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Take the oldest item. Consumer side only.
+
+      Wants:
+        Destination for the item.
+
+      Gives:
+        True on success, false if the ring was empty or the oldest item is
+        still being written.
+    ----------------------------------------------------------------------------*/
+    bool pop(T &item)
+    {
+        size_t const tail = tail_.load(std::memory_order_relaxed);
+        Slot &slot = slots_[tail & mask_];
+
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+            return false;
+        }
+
+        item = std::move(slot.item);
+        slot.seq.store(tail + mask_ + 1, std::memory_order_release);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called while other threads push or pop
+    size_t size(void) const { 
+        size_t const tail = tail_.load(std::memory_order_acquire);
+        size_t const head = head_.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+    bool empty(void) const { return 0 == size(); }
+    size_t capacity(void) const { return mask_ + 1; }
+
+private:
+    // No copying
+    MpscQueue(MpscQueue const &);
+    MpscQueue &operator = (MpscQueue const &);
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        T item;
+    };
+
+    static size_t roundUp(size_t n) {
+        size_t p = 2;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    size_t const mask_;
+    Slot *const slots_;
+
+    char pad0_[CACHE_LINE_SIZE];
+    std::atomic<size_t> head_;
+
+    char pad1_[CACHE_LINE_SIZE];
+    std::atomic<size_t> tail_;
+
+    char pad2_[CACHE_LINE_SIZE];
+};
+
+
+#endif  // HOMEWORK_SERVER_LOCKFREE_QUEUE_HPP
@@ -0,0 +1,298 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <string.h>
+#include "lz4Block.hpp"
+
+
+// Format's limits: a match is at least 4 bytes, the last 5 bytes are always
+// literals and the last match starts at least 12 bytes before the end.
+#define MIN_MATCH      4
+#define LAST_LITERALS  5
+#define MF_LIMIT       12
+#define MAX_OFFSET     65535
+
+#define HASH_LOG       12
+
+
+namespace lz4 {
+
+
+static inline uint32_t
+read32(char const *const ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+
+static inline uint32_t
+hash(uint32_t const sequence)
+{
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write a length that did not fit in the token's nibble: 255s and the rest.
+
+  Gives:
+    Destination after the bytes, or NULL if they did not fit.
+----------------------------------------------------------------------------*/
+static char *
+putLength(char *op, char const *const end, int len)
+{
+    for (; len >= 255; len -= 255) {
+        if (op >= end) {
+            return NULL;
+        }
+        *op++ = (char) 255;
+    }
+
+    if (op >= end) {
+        return NULL;
+    }
+    *op++ = (char) len;
+    return op;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Write one sequence: token, literals and, unless this is the last one,
+    match offset and length.
+
+  Gives:
+    Destination after the sequence, or NULL if it did not fit.
+----------------------------------------------------------------------------*/
+static char *
+putSequence(char *op, char const *const end, char const *const literals, int const litLen, int const offset, int const matchLen)
+{
+    int const ml = matchLen - MIN_MATCH;
+    char *const token = op++;
+
+    if (op > end) {
+        return NULL;
+    }
+
+    *token = (char) (((litLen < 15 ? litLen : 15) << 4) | (matchLen > 0 ? (ml < 15 ? ml : 15) : 0));
+
+    if (litLen >= 15  &&  NULL == (op = putLength(op, end, litLen - 15))) {
+        return NULL;
+    }
+
+    if (end - op < litLen) {
+        return NULL;
+    }
+    if (litLen > 0) {
+        memcpy(op, literals, litLen);
+    }
+    op += litLen;
+
+    if (0 == matchLen) {
+        return op;
+    }
+
+    if (end - op < 2) {
+        return NULL;
+    }
+    *op++ = (char) (offset & 0xff);
+    *op++ = (char) (offset >> 8);
+
+    if (ml >= 15  &&  NULL == (op = putLength(op, end, ml - 15))) {
+        return NULL;
+    }
+
+    return op;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Compress a buffer.
+
+  Wants:
+    Source and its size.
+    Destination and its capacity, compressBound() is always enough.
+
+  Gives:
+    Compressed size, or
+    0 if it did not fit the destination.
+----------------------------------------------------------------------------*/
+int
+compress(char const *const src, int const srcSize, char *const dst, int const dstCapacity)
+{
+    int32_t table[1 << HASH_LOG];   // Position + 1 of the last sequence with the hash
+    char const *const end = dst + dstCapacity;
+    char *op = dst;
+    int anchor = 0;
+    int ip = 0;
+
+
+    memset(table, 0, sizeof(table));
+
+    int const matchLimit = srcSize - LAST_LITERALS;
+    int const startLimit = srcSize - MF_LIMIT;
+
+    while (ip < startLimit) {
+        uint32_t const sequence = read32(src + ip);
+        uint32_t const h = hash(sequence);
+        int const ref = table[h] - 1;
+
+        table[h] = ip + 1;
+
+        if (ref < 0  ||  ip - ref > MAX_OFFSET  ||  read32(src + ref) != sequence) {
+            // Skip faster through data that does not compress
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        int len = MIN_MATCH;
+        while (ip + len < matchLimit  &&  src[ref + len] == src[ip + len]) {
+            ++len;
+        }
+
+        if (NULL == (op = putSequence(op, end, src + anchor, ip - anchor, ip - ref, len))) {
+            return 0;
+        }
+
+        ip += len;
+        anchor = ip;
+
+        if (ip - 2 < startLimit) {
+            table[hash(read32(src + ip - 2))] = ip - 2 + 1;
+        }
+    }
+
+    if (NULL == (op = putSequence(op, end, src + anchor, srcSize - anchor, 0, 0))) {
+        return 0;
+    }
+
+    return op - dst;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Decompress a buffer.
+
+  Wants:
+    Compressed data and its size.
+    Destination and its capacity.
+
+  Gives:
+    Decompressed size, or
+    -1 if the data is invalid or does not fit the destination.
+----------------------------------------------------------------------------*/
+int
+decompress(char const *const src, int const srcSize, char *const dst, int const dstCapacity)
+{
+    uint8_t const *const in = (uint8_t const *) src;
+    int ip = 0;
+    int op = 0;
+
+
+    while (ip < srcSize) {
+        int const token = in[ip++];
+        int litLen = token >> 4;
+
+        if (15 == litLen) {
+            int b;
+            do {
+                if (ip >= srcSize) {
+                    return -1;
+                }
+                b = in[ip++];
+                litLen += b;
+                if (litLen > dstCapacity) {
+                    return -1;
+                }
+            } while (255 == b);
+        }
+
+        if (litLen > srcSize - ip  ||  litLen > dstCapacity - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+
+        if (ip == srcSize) {
+            // Last sequence has no match
+            break;
+        }
+
+        if (srcSize - ip < 2) {
+            return -1;
+        }
+        int const offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+
+        if (0 == offset  ||  offset > op) {
+            return -1;
+        }
+
+        int matchLen = token & 15;
+        if (15 == matchLen) {
+            int b;
+            do {
+                if (ip >= srcSize) {
+                    return -1;
+                }
+                b = in[ip++];
+                matchLen += b;
+                if (matchLen > dstCapacity) {
+                    return -1;
+                }
+            } while (255 == b);
+        }
+        matchLen += MIN_MATCH;
+
+        if (matchLen > dstCapacity - op) {
+            return -1;
+        }
+
+        // Overlapping copy repeats the pattern
+        if (offset >= matchLen) {
+            memcpy(dst + op, dst + op - offset, matchLen);
+        }
+        else {
+            for (int i = 0; i < matchLen; ++i) {
+                dst[op + i] = dst[op - offset + i];
+            }
+        }
+        op += matchLen;
+    }
+
+    return op;
+}
+
+
+}  // namespace lz4
@@ -0,0 +1,51 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_LZ4_BLOCK_HPP
+#define HOMEWORK_SERVER_LZ4_BLOCK_HPP
+
+
+/*---- Namespace ------------------------------------------------------------
+  Contains:
+    Self-contained codec for the LZ4 block format: sequences of a token,
+    literals, 16 bit match offset and match length. The compressor is a
+    greedy single-pass one with a small hash table; the decompressor checks
+    every length against both buffers, so garbage input can not make it
+    read or write out of bounds.
+----------------------------------------------------------------------------*/
+namespace lz4 {
+
+    // Worst case size of compressed data
+    inline int compressBound(int const size) { return size + size / 255 + 16; }
+
+    int compress(char const *src, int srcSize, char *dst, int dstCapacity);
+    int decompress(char const *src, int srcSize, char *dst, int dstCapacity);
+
+}  // namespace lz4
+
+
+#endif  // HOMEWORK_SERVER_LZ4_BLOCK_HPP
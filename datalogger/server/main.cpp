@@ -25,19 +25,29 @@ OTHER DEALINGS IN THE SOFTWARE.
 For more information, please refer to <http://unlicense.org>
 ----------------------------------------------------------------------------*/
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "sinkManager.hpp"
 #include "bintxtSink.hpp"
 #include "tcpSource.hpp"
 #include "observer.hpp"
+#include "fanOut.hpp"
+#include "writeBehind.hpp"
+#include "coreGroup.hpp"
 
 
 // Some defaults for cmdline arguments
 static char const defaultSink[] = "bintxt";
 static int const defaultTcpPort = 12345;
+static unsigned const defaultFanOutThreads = 0;
+static size_t const fanOutQueueSize = 65536;
+static size_t const defaultWriteQueueSize = 0;
+static size_t const writeBatchMax = 1024;
 
 // This is for C-style signal handler
 static TcpSource *tpcPtr = NULL;
@@ -64,6 +74,12 @@ signalHandler(int const sig)
         }
         break;
 
+    case SIGUSR1:
+        if (tpcPtr) {
+            tpcPtr->requestStats();
+        }
+        break;
+
     default:
         break;
     }
@@ -87,11 +103,59 @@ printHelp(void)
 
     SINKMGR.forEachName( [&allSinks] (std::string const &name) { allSinks += "      "; allSinks += name; allSinks += '\n'; } );
 
-    std::cerr << "Usage: [-o SINK[:OPTS]] [-p PORT]" << std::endl;
+    std::cerr << "Usage: [-o SINK[:OPTS]] [-p PORT] [-f THREADS] [-w QUEUE] [-c CORES [-a CPUS [-n]]]" << std::endl;
     std::cerr << "  -o SINK      Select Sink (database) to use. (default " << defaultSink << ")" << std::endl;
     std::cerr << "      Built with sinks:" << std::endl;
     std::cerr << allSinks;
     std::cerr << "  -p PORT      TCP port to listen (default " << defaultTcpPort << ")" << std::endl;
+    std::cerr << "  -f THREADS   Relay Records to observers in THREADS fan-out threads (default " << defaultFanOutThreads << ": in network thread)" << std::endl;
+    std::cerr << "  -w QUEUE     Write to Sink in a writer thread through a queue of QUEUE Records (default " << defaultWriteQueueSize << ": in network thread)" << std::endl;
+    std::cerr << "  -c CORES     Shared-nothing: CORES threads, each with its own listener, connections and Sink files FILE.cI" << std::endl;
+    std::cerr << "  -a CPUS      Pin the cores to CPUS, e.g. 0-3,8 (default no pinning; sets CORES if not given)" << std::endl;
+    std::cerr << "  -n           Allocate every core's memory from its CPU's NUMA node" << std::endl;
+    std::cerr << "  SIGUSR1 prints runtime statistics" << std::endl;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run the server in shared-nothing mode until an interrupting signal.
+    The signals are blocked in every thread and taken here with sigwait(),
+    so no core is interrupted.
+  
+  Wants:
+    Number of cores, their CPUs (or empty) and NUMA awareness.
+    TCP port.
+    Sink and its options.
+    
+  Gives: 
+    Exit code.
+----------------------------------------------------------------------------*/
+static int
+runCores(unsigned const cores, std::vector<int> const &cpus, bool const numa, int const tcpPort, 
+         Sink const *const sink, std::string const &sinkOpt)
+{
+    sigset_t sigs;
+    int sig;
+
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    CoreGroup group(cores, cpus, numa);
+
+    if (!group.open(tcpPort, sink, sinkOpt)) {
+        return -1;
+    }
+
+    while (0 == sigwait(&sigs, &sig)  &&  SIGUSR1 == sig) {
+        group.requestStats();
+    }
+
+    group.stop();
+    return 0;
 }
 
 
@@ -110,11 +174,16 @@ printHelp(void)
 int 
 main(int argc, char **argv)
 {
-    char const opts[] = "hp:o:";
+    char const opts[] = "hp:o:f:w:c:a:n";
 
     std::string sinkName(defaultSink);
     std::string sinkOpt;
     int tcpPort = defaultTcpPort;
+    unsigned fanOutThreads = defaultFanOutThreads;
+    size_t writeQueueSize = defaultWriteQueueSize;
+    unsigned cores = 0;
+    std::vector<int> cpus;
+    bool numa = false;
     int c;
 
 
@@ -124,6 +193,29 @@ main(int argc, char **argv)
             tcpPort = atoi(optarg);
             break;
 
+        case 'f':
+            fanOutThreads = atoi(optarg);
+            break;
+
+        case 'w':
+            writeQueueSize = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'c':
+            cores = atoi(optarg);
+            break;
+
+        case 'a':
+            if (!CoreGroup::parseCpus(optarg, cpus)) {
+                std::cerr << "Invalid CPU list '" << optarg << "'" << std::endl;
+                return -1;
+            }
+            break;
+
+        case 'n':
+            numa = true;
+            break;
+
         case 'o':
             size_t pos;
             sinkName = optarg;
@@ -145,15 +237,49 @@ main(int argc, char **argv)
     }
 
 
+    if (!cpus.empty()  &&  0 == cores) {
+        cores = cpus.size();
+    }
+
+    if (cores > 0  &&  (fanOutThreads > 0  ||  writeQueueSize > 0)) {
+        std::cerr << "-c can't be used with -f or -w: every core relays and writes in its own thread" << std::endl;
+        return -1;
+    }
+    if (cpus.size() > 0  &&  cpus.size() < cores) {
+        std::cerr << "-a gives " << cpus.size() << " CPUs for " << cores << " cores" << std::endl;
+        return -1;
+    }
+    if (numa  &&  cpus.empty()) {
+        std::cerr << "-n needs the cores pinned with -a" << std::endl;
+        return -1;
+    }
+
+    if (cores > 0) {
+        Sink const *const sink = SINKMGR.sinkGet(sinkName);
+
+        if (!sink) {
+            std::cerr << "Sink '" << sinkName << "' not recognised" << std::endl;
+            printHelp();
+            return -1;
+        }
+
+        std::cout << "Using sink '" << sinkName << "' on " << cores << " cores" << std::endl;
+        return runCores(cores, cpus, numa, tcpPort, sink, sinkOpt);
+    }
+
+
     signal(SIGHUP, signalHandler);
     signal(SIGINT, signalHandler);
     signal(SIGKILL, signalHandler);
+    signal(SIGUSR1, signalHandler);
 
     // Since TcpSource is local var and Sinks are singleton, it ensures that
     // the port will be closed before the Sinks, preventing calls to a closed
     // Sink.
     Observer observer;
-    TcpSource tcp(&observer);
+    FanOut fanOut(fanOutThreads, fanOutQueueSize);
+    WriteBehind writer(writeQueueSize > 0 ? writeQueueSize : 1, writeBatchMax);
+    TcpSource tcp(&observer, fanOutThreads > 0 ? &fanOut : NULL, writeQueueSize > 0 ? &writer : NULL);
 
 
     Sink *const sink = SINKMGR.sinkGet(sinkName);
@@ -176,6 +302,15 @@ main(int argc, char **argv)
     }
 
     tcp.bindSink(sink);
+    tcp.setStatsReporter( [sink, &fanOut, fanOutThreads, &writer, writeQueueSize] () {
+        sink->printStats(std::cout);
+        if (writeQueueSize > 0) {
+            writer.printStats(std::cout);
+        }
+        if (fanOutThreads > 0) {
+            fanOut.printStats(std::cout);
+        }
+    } );
     tcp.blockingListen();  // Daemonize here
 
     tpcPtr = NULL;
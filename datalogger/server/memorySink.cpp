@@ -0,0 +1,470 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <iostream>
+#include <algorithm>
+#include "memorySink.hpp"
+#include "bintxtRow.hpp"
+#include "sinkOptions.hpp"
+#include "aggregate.hpp"
+#include "queryPage.hpp"
+#include "record.hpp"
+
+
+/*---- Singleton ------------------------------------------------------------
+  Does:
+    Register the sink to sinkManager on application startup.
+----------------------------------------------------------------------------*/
+static MemorySink const *sinkSingleton = new MemorySink;
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members.
+----------------------------------------------------------------------------*/
+MemorySinkImpl::MemorySinkImpl()
+: chunkSecs_(0), chunkBytes_(0), keepSecs_(0), maxBytes_(0), nextChunk_(0), sealedBytes_(0), records_(0)
+{
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Called on application termination. Everything is forgotten.
+----------------------------------------------------------------------------*/
+MemorySinkImpl::~MemorySinkImpl()
+{ 
+    if (chunkSecs_ > 0) {
+        std::cout << "Closed sink memory" << std::endl;
+        printStats(std::cout);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Set the partitioning and retention.
+  
+  Wants:
+    Seconds per chunk.
+    Bytes after which a chunk is full before its time is up.
+    Age after which chunks are dropped, 0 for never.
+    Total bytes over which the oldest chunks are dropped, 0 for no limit.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+MemorySinkImpl::open(uint32_t const chunkSecs, size_t const chunkBytes, uint32_t const keepSecs, uint64_t const maxBytes)
+{
+    if (chunkSecs_ > 0  ||  0 == chunkSecs) {
+        return false;
+    }
+
+    chunkSecs_ = chunkSecs;
+    chunkBytes_ = chunkBytes;
+    keepSecs_ = keepSecs;
+    maxBytes_ = maxBytes;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process record received from client based on its 'action'.
+  
+  Wants:
+    Record's data.
+    Handler to a function to use to send the reply.
+    
+  Gives: 
+    1 on successful store action, or
+    0 on other success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+MemorySinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    bool ret = false;
+
+
+    switch (rec.action) {
+    case REC_ACT_STORE:
+        if (true == (ret = storeRec(rec))) {
+            return 1;
+        }
+        break;
+
+    case REC_ACT_GET_AFTER:
+        ret = queryRec(rec, send);
+        break;
+
+    case REC_ACT_COUNT:
+    case REC_ACT_STATS: {
+        Aggregate agg(rec);
+        ret = aggregate(rec, agg)  &&  agg.send(send);
+        break;
+    }
+
+    case REC_ACT_GET_LATEST:
+        ret = latest_.send(rec, send);
+        break;
+    }
+
+    return ret ? 0 : -1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    End of a batch of Records, or the idle tick. Nothing to write; drop the
+    chunks that have grown too old meanwhile.
+----------------------------------------------------------------------------*/
+void
+MemorySinkImpl::flush(void)
+{
+    if (keepSecs_ > 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        retain(now.tv_sec * 1000000LL + now.tv_usec);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append one record to the chunk of its time partition. Start a new chunk
+    when the partition changes or the chunk is full.
+  
+  Wants:
+    Record's data.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+MemorySinkImpl::storeRec(Record const &rec)
+{
+    int64_t const ts = rec.timestamp.tv_sec * 1000000LL + rec.timestamp.tv_usec;
+    int64_t const partition = rec.timestamp.tv_sec / chunkSecs_;
+    int const size = bintxt::rowSize(rec, false);
+
+
+    if (chunks_.empty()  ||  chunks_.back().partition != partition  ||  chunks_.back().rows.size() + size > chunkBytes_) {
+        if (!chunks_.empty()) {
+            sealedBytes_ += chunks_.back().bytes();
+        }
+        chunks_.push_back(Chunk(partition, nextChunk_++));
+    }
+
+    Chunk &chunk = chunks_.back();
+    size_t const pos = chunk.rows.size();
+
+    chunk.rows.resize(pos + size);
+    bintxt::encodeRow(&chunk.rows[pos], rec, false);
+    chunk.offsets.push_back(pos);
+    chunk.ts.push_back(ts);
+
+    if (ts < chunk.maxTs) {
+        chunk.sorted = false;
+    }
+    chunk.minTs = std::min(chunk.minTs, ts);
+    chunk.maxTs = std::max(chunk.maxTs, ts);
+
+    ++records_;
+    ++stats_.stored;
+    latest_.store(rec);
+
+    retain(ts);
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Drop whole chunks from the old end: those with nothing newer than the
+    age limit, then the oldest ones while over the size limit. The newest
+    chunk is kept unless it has expired too.
+  
+  Wants:
+    Timestamp that the age is counted from, in microseconds.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+MemorySinkImpl::retain(int64_t const newestTs)
+{
+    int64_t const oldest = keepSecs_ > 0 ? newestTs - keepSecs_ * 1000000LL : INT64_MIN;
+
+    while (!chunks_.empty()) {
+        Chunk const &chunk = chunks_.front();
+        bool const last = 1 == chunks_.size();
+
+        if (chunk.maxTs < oldest) {
+            ++stats_.droppedByAge;
+        }
+        else if (maxBytes_ > 0  &&  !last  &&  bytes() > maxBytes_) {
+            ++stats_.droppedBySize;
+        }
+        else {
+            break;
+        }
+
+        if (!last) {
+            sealedBytes_ -= chunk.bytes();
+        }
+        records_ -= chunk.ts.size();
+        stats_.droppedRecs += chunk.ts.size();
+        chunks_.pop_front();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print the chunks held and dropped.
+  
+  Wants:
+    Output stream.
+    
+  Gives: 
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+MemorySinkImpl::printStats(std::ostream &os) const
+{
+    os << "Memory: " << records_ << " records in " << chunks_.size() << " chunks, " << bytes() << " bytes, " 
+        << stats_.queries << " queries read " << stats_.chunksRead << " and skipped " << stats_.chunksSkipped << " chunks" << std::endl;
+
+    os << "  dropped " << stats_.droppedByAge << " chunks by age and " << stats_.droppedBySize << " by size, " 
+        << stats_.droppedRecs << " records" << std::endl;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every record matching the given reference, oldest chunk first.
+    A paged query starts from the chunk and row in its cursor and stops
+    when the page is full.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+MemorySinkImpl::queryRec(Record const &reference, Sink::SendRecord_f const &send)
+{
+    QueryPage page(reference);
+    Record rec(REC_ACT_REPLY);
+    bool failed = false;
+
+
+    if (!page.valid()) {
+        return false;
+    }
+
+    matchRows(reference, [&] (bintxt::RowView const &view, uint32_t const chunk, size_t const row) {
+        view.toRecord(rec);
+        failed = page.send(rec, chunk, row + 1, send) < 0;
+        return !failed  &&  !page.full();
+    }, page.part(), page.position());
+
+    return !failed;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Count every record matching the given reference to an aggregate.
+  
+  Wants:
+    Reference Record.
+    Aggregate to add to.
+    
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+MemorySinkImpl::aggregate(Record const &reference, Aggregate &agg)
+{
+    return matchRows(reference, [&agg] (bintxt::RowView const &view, uint32_t, size_t) {
+        agg.add(view.serial, view.serialLen, view.devType, view.devTypeLen, view.timestamp, view.dataLen);
+        return true;
+    });
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Hand every row matching the given reference to the visitor, oldest
+    chunk first. Skip the chunks that have only older Records, or only
+    Records past the end of the reference's window.
+  
+  Wants:
+    Reference Record.
+    Visitor.
+    Chunk and row to start from.
+    
+  Gives: 
+    True on success, false if the visitor stopped.
+----------------------------------------------------------------------------*/
+bool
+MemorySinkImpl::matchRows(Record const &reference, RowMatch_f const &hit, uint32_t const fromChunk, size_t const fromRow)
+{
+    int64_t const after = reference.timestamp.tv_sec * 1000000LL + reference.timestamp.tv_usec;
+    int64_t const before = timerisset(&reference.until) ? reference.until.tv_sec * 1000000LL + reference.until.tv_usec : INT64_MAX;
+
+
+    ++stats_.queries;
+
+    for (std::deque<Chunk>::const_iterator it = chunks_.begin(); it != chunks_.end(); ++it) {
+        if (it->id < fromChunk) {
+            continue;
+        }
+
+        if (it->maxTs < after  ||  it->minTs >= before) {
+            ++stats_.chunksSkipped;
+            continue;
+        }
+
+        ++stats_.chunksRead;
+        if (!matchChunk(*it, reference, after, before, it->id == fromChunk ? fromRow : 0, hit)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Hand the matching rows of one chunk to the visitor. If the chunk is in
+    timestamp order, read only the rows within the window.
+  
+  Wants:
+    Chunk.
+    Reference Record, its timestamp and end in microseconds.
+    Row to start from.
+    Visitor.
+    
+  Gives: 
+    True on success, false if the visitor stopped.
+----------------------------------------------------------------------------*/
+bool
+MemorySinkImpl::matchChunk(Chunk const &chunk, Record const &reference, int64_t const after, int64_t const before, 
+                           size_t const fromRow, RowMatch_f const &hit)
+{
+    size_t first = 0;
+    size_t last = chunk.ts.size();
+    bintxt::RowView view;
+
+
+    if (chunk.sorted) {
+        first = std::lower_bound(chunk.ts.begin(), chunk.ts.end(), after) - chunk.ts.begin();
+        last = std::lower_bound(chunk.ts.begin() + first, chunk.ts.end(), before) - chunk.ts.begin();
+    }
+
+    for (size_t i = std::max(first, fromRow); i < last; ++i) {
+        size_t const offset = chunk.offsets[i];
+        size_t const end = i + 1 < chunk.offsets.size() ? chunk.offsets[i + 1] : chunk.rows.size();
+
+        if (!bintxt::viewRow(view, &chunk.rows[offset], end - offset)  ||  !view.match(reference)) {
+            continue;
+        }
+
+        if (!hit(view, chunk.id, i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate implementation for Memory sink. Allow only one instance.
+      
+  Wants:
+    Options: [chunk=SECONDS][,chunkbytes=BYTES][,keep=SECONDS][,bytes=BYTES]
+
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+MemorySink::open(std::string const &opts)
+{
+    SinkOptions const options(opts, "");
+    long const chunkSecs = options.getInt("chunk", 60);
+    long long const chunkBytes = options.getSize("chunkbytes", 64 << 20);
+    long const keepSecs = options.getInt("keep", 0);
+    long long const maxBytes = options.getSize("bytes", 0);
+
+
+    if (pImpl_) {
+        return false;
+    }
+
+    if (options.unknown().length() > 0  ||  options.path().length() > 0) {
+        std::cerr << "Unknown memory option '" << options.unknown() << options.path() << "'" << std::endl;
+        return false;
+    }
+
+    if (chunkSecs <= 0  ||  chunkSecs > 86400 * 365) {
+        std::cerr << "Invalid chunk time " << chunkSecs << std::endl;
+        return false;
+    }
+
+    if (chunkBytes < 4096  ||  chunkBytes > (1LL << 31)) {
+        std::cerr << "Invalid chunk size " << chunkBytes << std::endl;
+        return false;
+    }
+
+    if (keepSecs < 0  ||  maxBytes < 0) {
+        std::cerr << "Invalid retention" << std::endl;
+        return false;
+    }
+
+    if (NULL == (pImpl_ = new MemorySinkImpl)) {
+        return false;
+    }
+
+    if (!pImpl_->open(chunkSecs, chunkBytes, keepSecs, maxBytes)) {
+        return false;
+    }
+
+    std::cout << "Opened sink: Memory, " << chunkSecs << " s chunks, keep " << keepSecs << " s and " << maxBytes << " bytes (0 = all)" << std::endl;
+    return true;
+}
@@ -0,0 +1,168 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_MEMORY_SINK_HPP
+#define HOMEWORK_SERVER_MEMORY_SINK_HPP
+
+#include <stdint.h>
+#include <deque>
+#include <iosfwd>
+#include <vector>
+#include "sink.hpp"
+#include "bintxtRow.hpp"
+#include "latestView.hpp"
+
+struct Record;
+class Aggregate;
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Implement Memory Sink functionality: keep the Records in memory only.
+    Records are appended to chunks that each cover one time partition of
+    SECONDS. A chunk holds the rows in bintxt format back to back, with
+    their offsets and timestamps in microseconds for binary search.
+
+    Retention drops whole chunks from the old end: those with no Record
+    newer than the age limit, and the oldest ones while the total size is
+    over the byte limit. Dropping a chunk is O(1) whatever it holds.
+
+    Queries skip the chunks that have only older Records and binary search
+    the first new enough Record in the rest. A chunk that got a Record out
+    of timestamp order is scanned whole. COUNT and STATS scan the same way
+    and count the rows in place. A paged query resumes from the chunk and
+    row in its cursor; chunks are numbered in the order they were started. GET_LATEST is answered from the latest
+    Record of every serial and devType, which retention does not drop.
+----------------------------------------------------------------------------*/
+class MemorySinkImpl
+{
+public:
+    MemorySinkImpl();
+    ~MemorySinkImpl();
+
+    bool open(uint32_t chunkSecs, size_t chunkBytes, uint32_t keepSecs, uint64_t maxBytes);
+
+    int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    void flush(void);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        One time partition of Records.
+    ----------------------------------------------------------------------------*/
+    struct Chunk {
+        Chunk(int64_t p, uint32_t i) : partition(p), id(i), minTs(INT64_MAX), maxTs(INT64_MIN), sorted(true) {}
+
+        size_t bytes(void) const { return rows.capacity() + offsets.capacity() * sizeof(uint32_t) + ts.capacity() * sizeof(int64_t); }
+
+        int64_t partition;       // Timestamp seconds / chunk seconds
+        uint32_t id;             // Number of the chunk since start
+        int64_t minTs;           // Microseconds
+        int64_t maxTs;
+        bool sorted;             // Timestamps never went backwards
+
+        std::vector<char> rows;
+        std::vector<uint32_t> offsets;
+        std::vector<int64_t> ts;
+    };
+
+    // Gets a matching row decoded in place and its chunk and row number, gives true to go on
+    typedef std::function<bool (bintxt::RowView const &view, uint32_t chunk, size_t row)> RowMatch_f;
+
+    bool storeRec(Record const &rec);
+    bool queryRec(Record const &ref, Sink::SendRecord_f const &send);
+    bool aggregate(Record const &ref, Aggregate &agg);
+    bool matchRows(Record const &ref, RowMatch_f const &hit, uint32_t fromChunk = 0, size_t fromRow = 0);
+    bool matchChunk(Chunk const &chunk, Record const &ref, int64_t after, int64_t before, size_t fromRow, RowMatch_f const &hit);
+    void retain(int64_t newestTs);
+
+    uint32_t chunkSecs_;
+    size_t chunkBytes_;          // Full chunk even within its partition
+    uint32_t keepSecs_;          // 0 keeps any age
+    uint64_t maxBytes_;          // 0 keeps any size
+
+    std::deque<Chunk> chunks_;   // Oldest first
+    uint32_t nextChunk_;         // Id of the next chunk started
+    uint64_t sealedBytes_;       // Memory held by the chunks before the newest one
+    uint64_t records_;
+    LatestView latest_;
+
+    uint64_t bytes(void) const { return sealedBytes_ + (chunks_.empty() ? 0 : chunks_.back().bytes()); }
+
+    struct Stats {
+        Stats() : stored(0), queries(0), chunksRead(0), chunksSkipped(0), droppedByAge(0), droppedBySize(0), droppedRecs(0) {}
+
+        uint64_t stored;
+        uint64_t queries;
+        uint64_t chunksRead;
+        uint64_t chunksSkipped;
+        uint64_t droppedByAge;
+        uint64_t droppedBySize;
+        uint64_t droppedRecs;
+    } stats_;
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Intended to be used as singleton.
+    Is fired up on application start. Registers its name to SinkManager 
+    upon construction.
+----------------------------------------------------------------------------*/
+class MemorySink : public Sink
+{
+public:
+    explicit MemorySink(char const *const name = "memory") : Sink(name), pImpl_(NULL) {}
+    virtual ~MemorySink() { if (pImpl_) delete pImpl_; }
+
+    virtual bool open(std::string const &opts);
+    
+    MemorySinkImpl const *impl(void) const { return pImpl_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Creates binding to implementation's functions.
+    ----------------------------------------------------------------------------*/
+    virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&MemorySinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&Sink::processEach<MemorySinkImpl *>, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&MemorySinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { if (pImpl_) pImpl_->printStats(os); }
+    virtual Sink *another(void) const { return new MemorySink(NULL); }
+
+private:
+    MemorySinkImpl *pImpl_;
+};
+
+
+#endif  // HOMEWORK_SERVER_MEMORY_SINK_HPP
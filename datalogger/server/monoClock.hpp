@@ -0,0 +1,54 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#ifndef HOMEWORK_SERVER_MONO_CLOCK_HPP
+#define HOMEWORK_SERVER_MONO_CLOCK_HPP
+
+#include <stdint.h>
+#include <time.h>
+
+
+/*---- Namespace ------------------------------------------------------------
+  Contains:
+    Helpers for CLOCK_MONOTONIC, which latencies and timeouts are measured
+    on so that they don't jump with the wall clock.
+----------------------------------------------------------------------------*/
+namespace monoClock {
+
+    // Microseconds elapsed since the given monotonic time
+    inline uint64_t elapsedUs(struct timespec const &since)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - since.tv_sec) * 1000000LL + (now.tv_nsec - since.tv_nsec) / 1000;
+    }
+
+}  // namespace monoClock
+
+
+#endif  // HOMEWORK_SERVER_MONO_CLOCK_HPP
@@ -51,6 +51,8 @@ public:
 
     int relayRec(Record const &rec, Sink::SendRecord_f const &send) const;
 
+    size_t size(void) const { return lurkers_.size(); }
+
 private:
     typedef std::map<uint64_t, Record> Lurkers_t;
     Lurkers_t lurkers_;
@@ -39,6 +39,10 @@ For more information, please refer to <http://unlicense.org>
 #define PRM_DEVTYPE     0x0003
 #define PRM_DATA        0x0004
 #define PRM_TIME        0x0005
+#define PRM_GROUPBY     0x0006
+#define PRM_TIME_END    0x0007
+#define PRM_LIMIT       0x0008
+#define PRM_CURSOR      0x0009
 
 
 /*---- Namespace ------------------------------------------------------------
@@ -59,6 +63,7 @@ namespace wdc {  // Stands for Wire Data Converter
         
         union {
             uint16_t u16;
+            uint32_t u32;
             char d[1];
             struct {
                 uint32_t sec;
@@ -99,6 +104,20 @@ namespace wdc {  // Stands for Wire Data Converter
         bool operator () (BinRec const &bin) const { return ntohs(bin.len) <= 80; } 
     };
 
+    struct GroupByValidator { 
+        bool operator () (BinRec const &bin) const { 
+            return ntohs(bin.len) == 2  &&  0 == (ntohs(bin.value.u16) & ~(REC_GROUP_SERIAL | REC_GROUP_DEVTYPE)); 
+        } 
+    };
+
+    struct LimitValidator { 
+        bool operator () (BinRec const &bin) const { return ntohs(bin.len) == 4; } 
+    };
+
+    struct CursorValidator { 
+        bool operator () (BinRec const &bin) const { return ntohs(bin.len) <= REC_CURSOR_MAX; } 
+    };
+
     struct TimeValidator { 
         bool operator () (BinRec const &bin) const { return ntohs(bin.len) == 8  &&  ntohl(bin.value.time.usec) < 1000000; } 
     };
@@ -119,6 +138,10 @@ namespace wdc {  // Stands for Wire Data Converter
         bool operator () (BinRec &bin, uint16_t const &src) const { bin.value.u16 = htons(src); return true; } 
     };
 
+    struct Uint32ToWire { 
+        bool operator () (BinRec &bin, uint32_t const &src) const { bin.value.u32 = htonl(src); return true; } 
+    };
+
     struct StrToWire { 
         bool operator () (BinRec &bin, std::string const &src) const { src.copy(bin.value.d, src.length()); return true; } 
     };
@@ -134,6 +157,10 @@ namespace wdc {  // Stands for Wire Data Converter
         bool operator () (uint16_t &dst, BinRec const &bin) const { dst = ntohs(bin.value.u16); return true; } 
     };
 
+    struct Uint32FromWire { 
+        bool operator () (uint32_t &dst, BinRec const &bin) const { dst = ntohl(bin.value.u32); return true; } 
+    };
+
     struct StrFromWire { 
         bool operator () (std::string &dst, BinRec const &bin) const { 
             dst.assign(bin.value.d, (std::string::size_type) ntohs(bin.len)); return true; 
@@ -334,6 +361,34 @@ public:
                 ret = timeParser_.deserialize(rec.timestamp, buffer + processed, dataSize - processed);
                 break;
 
+            case PRM_GROUPBY:
+                if (rec.groupBy != 0) {
+                    return processed;  // Sama param again: Must be another record
+                }
+                ret = groupByParser_.deserialize(rec.groupBy, buffer + processed, dataSize - processed);
+                break;
+
+            case PRM_TIME_END:
+                if (timerisset(&rec.until)) {
+                    return processed;  // Sama param again: Must be another record
+                }
+                ret = timeParser_.deserialize(rec.until, buffer + processed, dataSize - processed);
+                break;
+
+            case PRM_LIMIT:
+                if (rec.limit != 0) {
+                    return processed;  // Sama param again: Must be another record
+                }
+                ret = limitParser_.deserialize(rec.limit, buffer + processed, dataSize - processed);
+                break;
+
+            case PRM_CURSOR:
+                if (rec.cursor.length() > 0) {
+                    return processed;  // Sama param again: Must be another record
+                }
+                ret = cursorParser_.deserialize(rec.cursor, buffer + processed, dataSize - processed);
+                break;
+
             default:
                 // Packet ended?
                 // std::cerr << "Invalid protocol param type " << type << std::endl;
@@ -404,6 +459,15 @@ public:
         }
         bytes += ret;
 
+        // Only replies to paged queries have a cursor
+        if (rec.cursor.length() > 0) {
+            if ((ret = cursorParser_.serialize(buffer + bytes, bufSize - bytes, rec.cursor, PRM_CURSOR)) < 0) {
+                std::cerr << "Invalid record cursor" << std::endl;
+                return -1;
+            }
+            bytes += ret;
+        }
+
         return bytes;
     }
 
@@ -414,6 +478,9 @@ private:
     wdc::TlvParser <wdc::DevtypeValidator,   wdc::StrToWire,    wdc::StrFromWire> const    devtypeParser_;
     wdc::TlvParser <wdc::DataFieldValidator, wdc::StrToWire,    wdc::StrFromWire> const    dataFieldParser_;
     wdc::TlvParser <wdc::TimeValidator,      wdc::TimeToWire,   wdc::TimeFromWire> const   timeParser_;
+    wdc::TlvParser <wdc::GroupByValidator,   wdc::Uint16ToWire, wdc::Uint16FromWire> const groupByParser_;
+    wdc::TlvParser <wdc::LimitValidator,     wdc::Uint32ToWire, wdc::Uint32FromWire> const limitParser_;
+    wdc::TlvParser <wdc::CursorValidator,    wdc::StrToWire,    wdc::StrFromWire> const    cursorParser_;
 };
 
 
@@ -0,0 +1,240 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include "queryPage.hpp"
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Read the limit and the cursor of a paged request. Other requests send
+    everything. A cursor that is not one position leaves the page invalid.
+
+  Wants:
+    Request. Its priv is used when sending.
+----------------------------------------------------------------------------*/
+QueryPage::QueryPage(Record const &ref)
+: limit_(ref.paged() ? ref.limit : 0), sent_(0), part_(0), position_(0), paged_(ref.paged()), valid_(true), priv_(ref.priv)
+{
+    if (paged_  &&  ref.cursor.length() > 0) {
+        valid_ = CURSOR_POSITION_SIZE == ref.cursor.length()  &&  getPosition(ref.cursor, 0, part_, position_);
+        if (!valid_) {
+            std::cerr << "Invalid query cursor of " << ref.cursor.length() << " bytes" << std::endl;
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell if a row is at or after the position to resume from.
+
+  Wants:
+    Row's part and position.
+----------------------------------------------------------------------------*/
+bool
+QueryPage::reached(uint32_t const part, uint64_t const position) const
+{
+    return part > part_  ||  (part == part_  &&  position >= position_);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send one matching Record, with the cursor of the next row if the
+    query is paged, and count it to the page.
+
+  Wants:
+    Reply Record. Its cursor is overwritten.
+    Part and position of the row after it.
+    Handler to a function to use to send the reply.
+
+  Gives:
+    What the send function gave.
+----------------------------------------------------------------------------*/
+int
+QueryPage::send(Record &rec, uint32_t const nextPart, uint64_t const nextPosition, Sink::SendRecord_f const &send)
+{
+    if (paged_) {
+        rec.cursor.clear();
+        putPosition(rec.cursor, nextPart, nextPosition);
+    }
+
+    ++sent_;
+    return send(rec, priv_);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Append one position to a cursor, or read the position at given index.
+
+  Wants:
+    Cursor.
+    Index of the position, for reading.
+    Part and position.
+
+  Gives:
+    False if the cursor is too short.
+----------------------------------------------------------------------------*/
+void
+QueryPage::putPosition(std::string &cursor, uint32_t const part, uint64_t const position)
+{
+    uint32_t const words[3] = { htonl(part), htonl(position >> 32), htonl(position & 0xffffffff) };
+
+    cursor.append((char const *) words, sizeof(words));
+}
+
+
+bool
+QueryPage::getPosition(std::string const &cursor, size_t const index, uint32_t &part, uint64_t &position)
+{
+    uint32_t words[3];
+
+    if (cursor.length() < (index + 1) * CURSOR_POSITION_SIZE) {
+        return false;
+    }
+
+    memcpy(words, cursor.data() + index * CURSOR_POSITION_SIZE, sizeof(words));
+    part = ntohl(words[0]);
+    position = (uint64_t) ntohl(words[1]) << 32 | ntohl(words[2]);
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give every part of a Sink its own request, with its position from the
+    request's cursor if it is paged. An empty cursor starts every part
+    from its beginning.
+
+  Wants:
+    Request.
+    Request for every part, copies of the request. Their cursors are
+    overwritten.
+    Name of the parts, for the error message.
+
+  Gives:
+    False if the cursor does not have a position for every part.
+----------------------------------------------------------------------------*/
+bool
+QueryPage::splitCursor(Record const &ref, std::vector<Record> &refs, char const *const partName)
+{
+    size_t const parts = refs.size();
+    std::string cursor(ref.cursor);
+
+
+    if (!ref.paged()) {
+        return true;
+    }
+
+    if (parts * CURSOR_POSITION_SIZE > REC_CURSOR_MAX  ||  (cursor.length() > 0  &&  cursor.length() != parts * CURSOR_POSITION_SIZE)) {
+        std::cerr << "Invalid query cursor of " << cursor.length() << " bytes for " << parts << " " << partName << std::endl;
+        return false;
+    }
+
+    if (cursor.empty()) {
+        for (size_t i = 0; i < parts; ++i) {
+            putPosition(cursor, 0, 0);
+        }
+    }
+    for (size_t i = 0; i < parts; ++i) {
+        refs[i].cursor = cursor.substr(i * CURSOR_POSITION_SIZE, CURSOR_POSITION_SIZE);
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send the parts' answers to a GET_AFTER merged in timestamp order,
+    Records with the same timestamp in part order. A paged query sends one
+    page. A reply's cursor has the position after it in its part, and in
+    the other parts the position after their last Record sent before it.
+    Every part answered a page of its own, and none can run out of it
+    before the merged page is full, so the merge never skips a Record.
+
+  Wants:
+    Request.
+    Requests the parts answered, from splitCursor().
+    Every part's answer. Records sent get the merged cursor.
+    Handler to a function to use to send the replies.
+    Counter of Records sent, added to.
+
+  Gives:
+    False if sending failed.
+----------------------------------------------------------------------------*/
+bool
+QueryPage::mergeParts(Record const &ref, std::vector<Record> const &refs, std::vector<std::vector<Record> > &answers, 
+                      Sink::SendRecord_f const &send, uint64_t &sent)
+{
+    size_t const parts = answers.size();
+    bool const paged = ref.paged();
+    std::vector<size_t> next(parts, 0);
+    std::string cursor;
+    uint32_t page = 0;
+
+
+    for (size_t i = 0; paged  &&  i < parts; ++i) {
+        cursor += refs[i].cursor;
+    }
+
+    while (!(ref.limit > 0  &&  page >= ref.limit)) {
+        size_t best = parts;
+
+        for (size_t i = 0; i < parts; ++i) {
+            if (next[i] < answers[i].size()  &&  
+                (parts == best  ||  timercmp(&answers[i][next[i]].timestamp, &answers[best][next[best]].timestamp, < ))) 
+            {
+                best = i;
+            }
+        }
+
+        if (parts == best) {
+            break;
+        }
+
+        Record &rec = answers[best][next[best]++];
+
+        if (paged) {
+            cursor.replace(best * CURSOR_POSITION_SIZE, CURSOR_POSITION_SIZE, rec.cursor);
+            rec.cursor = cursor;
+        }
+
+        ++page;
+        ++sent;
+        if (send(rec, ref.priv) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,94 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#ifndef HOMEWORK_SERVER_QUERY_PAGE_HPP
+#define HOMEWORK_SERVER_QUERY_PAGE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "sink.hpp"
+#include "record.hpp"
+
+// Bytes of one position in a cursor: part and position in it
+#define CURSOR_POSITION_SIZE  12
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    One page of a paged GET_AFTER: sends at most the request's limit of
+    Records and stamps each with the cursor of the position after it.
+
+    A cursor is a list of positions in the Sink's own terms, each a part
+    (a segment, a chunk) and a position in it (a byte offset, a row
+    number), 32 and 64 bits in network byte order. A position tells the
+    next row to read, so a client that resumes from the cursor of the last
+    reply it got gets the Records after it. An empty cursor starts from
+    the beginning. The client never looks inside a cursor.
+
+    Sinks read only from the cursor on and stop as soon as the page is
+    full, so a page costs its own Records and not those before it.
+
+    A Sink made of parts that answer on their own (shards, cores) splits
+    the request's cursor to one position per part with splitCursor(), and
+    merges their answers to one page with mergeParts().
+----------------------------------------------------------------------------*/
+class QueryPage
+{
+public:
+    explicit QueryPage(Record const &ref);
+
+    bool valid(void) const { return valid_; }
+    bool full(void) const { return limit_ > 0  &&  sent_ >= limit_; }
+
+    uint32_t part(void) const { return part_; }
+    uint64_t position(void) const { return position_; }
+    bool reached(uint32_t part, uint64_t position) const;
+
+    int send(Record &rec, uint32_t nextPart, uint64_t nextPosition, Sink::SendRecord_f const &send);
+
+    static void putPosition(std::string &cursor, uint32_t part, uint64_t position);
+    static bool getPosition(std::string const &cursor, size_t index, uint32_t &part, uint64_t &position);
+
+    static bool splitCursor(Record const &ref, std::vector<Record> &refs, char const *partName);
+    static bool mergeParts(Record const &ref, std::vector<Record> const &refs, std::vector<std::vector<Record> > &answers, 
+                           Sink::SendRecord_f const &send, uint64_t &sent);
+
+private:
+    uint32_t limit_;      // 0 for no limit
+    uint32_t sent_;
+    uint32_t part_;       // Where to resume from
+    uint64_t position_;
+    bool paged_;          // Replies get a cursor
+    bool valid_;          // The cursor could be read
+    uint64_t priv_;
+};
+
+
+#endif  // HOMEWORK_SERVER_QUERY_PAGE_HPP
@@ -30,14 +30,25 @@ For more information, please refer to <http://unlicense.org>
 
 #include <sys/time.h>
 #include <string>
+#include <utility>
 
 
 #define REC_ACT_REPLY             0x0000
 #define REC_ACT_STORE             0x0001
 #define REC_ACT_GET_AFTER         0x0002
 #define REC_ACT_OBSERVE           0x0003
+#define REC_ACT_COUNT             0x0004
+#define REC_ACT_STATS             0x0005
+#define REC_ACT_GET_LATEST        0x0006
 #define REC_ACT_UNDEFINED         0xFFFF
 
+// Fields COUNT and STATS group the matching Records by
+#define REC_GROUP_SERIAL          0x0001
+#define REC_GROUP_DEVTYPE         0x0002
+
+// Longest resume cursor a query gives or takes
+#define REC_CURSOR_MAX            192
+
 
 /*---- Struct ---------------------------------------------------------------
   Purpose: 
@@ -46,26 +57,49 @@ For more information, please refer to <http://unlicense.org>
   Contains:
     The actual data received/stored by daemon (devType, serial, data)
     Timestamp from the moment the Record entered daemon from outside world.
-    Action this Record shall perform.
+    Action this Record shall perform, and how an aggregation groups.
+    Query window and paging: end timestamp, maximum Record count and the
+    cursor to resume from. A reply to a paged query carries the cursor of
+    the position after it.
     Private data used by Record's receiver (Source). Used to carry
     information of the Record's sender.
 ----------------------------------------------------------------------------*/
 struct Record
 {
-    Record(uint16_t const act = REC_ACT_UNDEFINED) : timestamp({0, 0}), action(act), priv(0) {}
+    Record(uint16_t const act = REC_ACT_UNDEFINED) : timestamp({0, 0}), until({0, 0}), action(act), groupBy(0), limit(0), priv(0) {}
     
     Record(Record const &rhs) 
-    : timestamp(rhs.timestamp), action(rhs.action), devType(rhs.devType), serial(rhs.serial), data(rhs.data), priv(0) {}
+    : timestamp(rhs.timestamp), until(rhs.until), action(rhs.action), groupBy(rhs.groupBy), limit(rhs.limit), 
+      devType(rhs.devType), serial(rhs.serial), data(rhs.data), cursor(rhs.cursor), priv(0) {}
     
     Record(Record &&rhs) 
-    : timestamp(rhs.timestamp), action(rhs.action), devType(rhs.devType), serial(rhs.serial), data(rhs.data), priv(0) {}
+    : timestamp(rhs.timestamp), until(rhs.until), action(rhs.action), groupBy(rhs.groupBy), limit(rhs.limit), 
+      devType(std::move(rhs.devType)), serial(std::move(rhs.serial)), data(std::move(rhs.data)), cursor(std::move(rhs.cursor)), priv(0) {}
     
     Record &operator = (Record const &rhs) {
         timestamp = rhs.timestamp;
+        until = rhs.until;
         action = rhs.action;
+        groupBy = rhs.groupBy;
+        limit = rhs.limit;
         devType = rhs.devType;
         serial = rhs.serial;
         data = rhs.data;
+        cursor = rhs.cursor;
+        priv = 0;
+        return *this;
+    }
+
+    Record &operator = (Record &&rhs) {
+        timestamp = rhs.timestamp;
+        until = rhs.until;
+        action = rhs.action;
+        groupBy = rhs.groupBy;
+        limit = rhs.limit;
+        devType = std::move(rhs.devType);
+        serial = std::move(rhs.serial);
+        data = std::move(rhs.data);
+        cursor = std::move(rhs.cursor);
         priv = 0;
         return *this;
     }
@@ -95,6 +129,9 @@ struct Record
 
         case REC_ACT_GET_AFTER:
         case REC_ACT_OBSERVE:
+        case REC_ACT_COUNT:
+        case REC_ACT_STATS:
+        case REC_ACT_GET_LATEST:
             if (serial.length() > 0) {
                 return true;
             }
@@ -111,10 +148,43 @@ struct Record
     }
 
 
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Tell if the Record asks the Sink for an answer that ends with an
+        empty reply.
+    ----------------------------------------------------------------------------*/
+    bool query(void) const
+    {
+        return REC_ACT_GET_AFTER == action  ||  REC_ACT_COUNT == action  ||  REC_ACT_STATS == action  ||  
+               REC_ACT_GET_LATEST == action;
+    }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Tell if a query asks for its replies a page at a time. Only
+        GET_AFTER is paged.
+    ----------------------------------------------------------------------------*/
+    bool paged(void) const
+    {
+        return REC_ACT_GET_AFTER == action  &&  (limit > 0  ||  !cursor.empty());
+    }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Tell if the timestamp is before the end of the reference's window.
+    ----------------------------------------------------------------------------*/
+    bool beforeEnd(struct timeval const &ts) const
+    {
+        return !timerisset(&until)  ||  timercmp(&ts, &until, < );
+    }
+
+
     /*---- Function -------------------------------------------------------------
       Does:
         Match record to reference:
-        - Record must be newer.
+        - Record must be newer, and older than the end if one is given.
         - Serial and devtype must match, unless wildcard is given.
 
       Wants:
@@ -125,7 +195,7 @@ struct Record
     ----------------------------------------------------------------------------*/
     bool match(Record const &rhs) const 
     {
-        if (timercmp(&timestamp, &rhs.timestamp, < )) {
+        if (timercmp(&timestamp, &rhs.timestamp, < )  ||  !rhs.beforeEnd(timestamp)) {
             return false;
         }
         if (rhs.devType != "*"  &&  devType != rhs.devType) {
@@ -139,12 +209,16 @@ struct Record
     }
 
     struct timeval timestamp;
+    struct timeval until;     // Zero for no end
     
     uint16_t action;
+    uint16_t groupBy;
+    uint32_t limit;           // Zero for no limit
 
     std::string devType;
     std::string serial;
     std::string data;
+    std::string cursor;
 
     uint64_t priv;
 };
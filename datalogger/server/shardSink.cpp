@@ -0,0 +1,517 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include "shardSink.hpp"
+#include "bintxtSink.hpp"
+#include "sinkWorker.hpp"
+#include "queryPage.hpp"
+
+
+// Default length of each shard's queue, in Records
+#define DEFAULT_QUEUE_SIZE  65536
+
+#define MAX_SHARDS  256
+
+
+/*---- Singleton ------------------------------------------------------------
+  Does:
+    Register the sink to sinkManager on application startup.
+----------------------------------------------------------------------------*/
+static ShardSink const *sinkSingleton = new ShardSink;
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Shards are opened by open().
+----------------------------------------------------------------------------*/
+ShardSinkImpl::ShardSinkImpl()
+{
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Called on application termination. Let the threads write what they
+    have queued, then close the shards.
+----------------------------------------------------------------------------*/
+ShardSinkImpl::~ShardSinkImpl()
+{
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        delete workers_[i];
+    }
+
+    for (size_t i = 0; i < impls_.size(); ++i) {
+        delete impls_[i];
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open the shards as bintxt files FILE.s0, FILE.s1... and start their
+    threads.
+  
+  Wants:
+    Path of the database.
+    Bintxt options for every shard, without the path.
+    Number of shards.
+    Length of each shard's queue.
+    
+  Gives: 
+    True on success
+----------------------------------------------------------------------------*/
+bool
+ShardSinkImpl::open(std::string const &path, std::string const &opts, unsigned const shards, size_t const queueSize)
+{
+    if (!impls_.empty()  ||  !checkShards(path, shards)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < shards; ++i) {
+        std::string const name(path + ".s" + std::to_string(i));
+        BintxtSinkImpl *const impl = BintxtSink::create(name + (opts.empty() ? "" : ",") + opts);
+
+        if (!impl) {
+            return false;
+        }
+
+        impls_.push_back(impl);
+        workers_.push_back(new SinkWorker(name, std::bind(&Sink::processEach<BintxtSinkImpl *>, impl, std::placeholders::_1, 
+                                                                std::placeholders::_2, std::placeholders::_3, std::placeholders::_4),
+                                          std::bind(&BintxtSinkImpl::flush, impl), queueSize));
+    }
+
+    answers_.resize(shards);
+    batches_.resize(shards);
+    places_.resize(shards);
+    results_.resize(shards);
+
+    for (unsigned i = 0; i < shards; ++i) {
+        workers_[i]->start();
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Check that the database was written with the same number of shards,
+    or record the number for a new database.
+  
+  Wants:
+    Path of the database.
+    Number of shards.
+    
+  Gives: 
+    True if the number is right.
+----------------------------------------------------------------------------*/
+bool
+ShardSinkImpl::checkShards(std::string const &path, unsigned const shards) const
+{
+    std::string const name(path + ".shards");
+    FILE *file = fopen(name.c_str(), "r");
+    unsigned stored = 0;
+
+    if (file) {
+        int const got = fscanf(file, "%u", &stored);
+        fclose(file);
+
+        if (1 == got  &&  stored != shards) {
+            std::cerr << path << " was written with " << stored << " shards, not " << shards << std::endl;
+            return false;
+        }
+        if (1 == got) {
+            return true;
+        }
+    }
+
+    file = fopen(name.c_str(), "w");
+    if (!file  ||  fprintf(file, "%u\n", shards) < 0  ||  0 != fclose(file)) {
+        std::cerr << "Can't write " << name << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Give the shard of a serial: FNV-1a hash modulo the number of shards. It
+    must never change, or serials' Records would be looked for in the
+    wrong shard.
+----------------------------------------------------------------------------*/
+unsigned
+ShardSinkImpl::shardOf(std::string const &serial) const
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < serial.length(); ++i) {
+        hash = (hash ^ (unsigned char) serial[i]) * 16777619u;
+    }
+
+    return hash % impls_.size();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process record received from client based on its 'action'. Stores are
+    queued to the serial's shard, and give its result once stored. Queries
+    for one serial are answered by its shard, in its thread, after
+    everything queued before them.
+  
+  Wants:
+    Record's data.
+    Handler to a function to use to send the reply.
+    
+  Gives: 
+    1 on successful store action, or
+    0 on other success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+ShardSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    if ((REC_ACT_GET_AFTER == rec.action  ||  REC_ACT_GET_LATEST == rec.action)  &&  "*" == rec.serial) {
+        return queryAll(rec, send);
+    }
+    if ((REC_ACT_COUNT == rec.action  ||  REC_ACT_STATS == rec.action)  &&  "*" == rec.serial) {
+        return aggregateAll(rec, send);
+    }
+
+    unsigned const shard = shardOf(rec.serial);
+
+    if (REC_ACT_STORE == rec.action) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int ret = -1;
+        workers_[shard]->store(rec, now, &ret);
+        workers_[shard]->wait();
+        return ret;
+    }
+
+    BintxtSinkImpl *const impl = impls_[shard];
+    int ret = -1;
+
+    ++stats_.singleQueries;
+    workers_[shard]->call([impl, &rec, &send, &ret] () { ret = impl->processRec(rec, send); });
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process Records received together. Every run of stores is split by
+    shard and queued to each shard as one batch, and the shards' results
+    are waited for. Anything else is processed one by one.
+  
+  Wants:
+    Records and their count.
+    Destination for every Record's result, as processRec() gives it.
+    Handler to a function to use to send the replies.
+    
+  Gives:
+    Number of Records stored.
+----------------------------------------------------------------------------*/
+int
+ShardSinkImpl::processRecs(Record const *const recs, size_t const count, int *const rets, Sink::SendRecord_f const &send)
+{
+    int stored = 0;
+    size_t i = 0;
+
+
+    while (i < count) {
+        if (REC_ACT_STORE != recs[i].action) {
+            rets[i] = processRec(recs[i], send);
+            stored += 1 == rets[i];
+            ++i;
+            continue;
+        }
+
+        for (; i < count  &&  REC_ACT_STORE == recs[i].action; ++i) {
+            unsigned const shard = shardOf(recs[i].serial);
+            batches_[shard].push_back(recs[i]);
+            places_[shard].push_back(i);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // Every shard stores its part at once, then collect what they gave
+        for (size_t s = 0; s < batches_.size(); ++s) {
+            if (!batches_[s].empty()) {
+                results_[s].resize(batches_[s].size());
+                workers_[s]->store(std::move(batches_[s]), now, &results_[s][0]);
+                batches_[s].clear();
+            }
+        }
+
+        for (size_t s = 0; s < places_.size(); ++s) {
+            if (places_[s].empty()) {
+                continue;
+            }
+
+            workers_[s]->wait();
+            for (size_t k = 0; k < places_[s].size(); ++k) {
+                rets[places_[s][k]] = results_[s][k];
+                stored += 1 == results_[s][k];
+            }
+            places_[s].clear();
+        }
+    }
+
+    return stored;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run a wildcard query in every shard at once, each collecting its
+    answer, and send the answers merged in timestamp order. A paged query
+    asks every shard for a page of its own, from the shard's position in
+    the cursor, and sends the first page of the merged Records.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    
+  Gives: 
+    0 on success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+ShardSinkImpl::queryAll(Record const &reference, Sink::SendRecord_f const &send)
+{
+    size_t const shards = impls_.size();
+    std::vector<Record> refs(shards, reference);
+    std::vector<int> rets(shards, -1);
+
+
+    ++stats_.wildQueries;
+
+    if (!QueryPage::splitCursor(reference, refs, "shards")) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < shards; ++i) {
+        BintxtSinkImpl *const impl = impls_[i];
+        std::vector<Record> *const answer = &answers_[i];
+        Record const *const ref = &refs[i];
+        int *const ret = &rets[i];
+
+        workers_[i]->post([impl, answer, ret, ref] () {
+            Sink::SendRecord_f const collect = [answer] (Record const &rec, uint64_t) { answer->push_back(rec); return 0; };
+            *ret = impl->processRec(*ref, collect);
+        });
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < shards; ++i) {
+        workers_[i]->wait();
+        ok = ok  &&  rets[i] >= 0;
+    }
+
+    ok = ok  &&  QueryPage::mergeParts(reference, refs, answers_, send, stats_.merged);
+
+    for (size_t i = 0; i < shards; ++i) {
+        answers_[i].clear();
+    }
+
+    return ok ? 0 : -1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Count a wildcard COUNT or STATS in every shard at once, each to an
+    aggregate of its own, and send the merged groups.
+  
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+    
+  Gives: 
+    0 on success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+ShardSinkImpl::aggregateAll(Record const &reference, Sink::SendRecord_f const &send)
+{
+    size_t const shards = impls_.size();
+    std::vector<Aggregate> aggs(shards, Aggregate(reference));
+    std::vector<char> oks(shards, false);
+
+
+    ++stats_.wildQueries;
+
+    for (size_t i = 0; i < shards; ++i) {
+        BintxtSinkImpl *const impl = impls_[i];
+        Aggregate *const agg = &aggs[i];
+        char *const ok = &oks[i];
+
+        workers_[i]->post([impl, agg, ok, &reference] () { *ok = impl->aggregate(reference, *agg); });
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < shards; ++i) {
+        workers_[i]->wait();
+        ok = ok  &&  oks[i];
+        if (i > 0) {
+            aggs[0].merge(aggs[i]);
+        }
+    }
+
+    return ok  &&  aggs[0].send(send) ? 0 : -1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    End of a batch of Records. Every shard flushes at once, and we wait
+    for all of them.
+----------------------------------------------------------------------------*/
+void
+ShardSinkImpl::flush(void)
+{
+    for (size_t i = 0; i < impls_.size(); ++i) {
+        BintxtSinkImpl *const impl = impls_[i];
+        workers_[i]->post([impl] () { impl->flush(); });
+    }
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->wait();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print every shard's queue depth, lag and errors, and its bintxt
+    statistics, which it prints in its thread.
+
+  Wants:
+    Output stream.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+ShardSinkImpl::printStats(std::ostream &os) const
+{
+    os << "Shard: " << impls_.size() << " bintxt shards, " << stats_.singleQueries << " single shard queries, " 
+        << stats_.wildQueries << " fanned out, " << stats_.merged << " Records merged" << std::endl;
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->printStats(os);
+    }
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        BintxtSinkImpl const *const impl = impls_[i];
+        workers_[i]->call([impl, &os] () { impl->printStats(os); });
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate implementation for Shard sink. Allow only one instance.
+    shards and queue are Shard's own options, everything else is passed to
+    every bintxt shard.
+      
+  Wants:
+    Options: FILE[,shards=N][,queue=N][,bintxt options]
+
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+ShardSink::open(std::string const &opts)
+{
+    std::string path("filedb.bin");
+    std::string shardOpts;
+    long shards = 4;
+    long queueSize = DEFAULT_QUEUE_SIZE;
+    std::string::size_type start = 0;
+
+
+    if (pImpl_) {
+        return false;
+    }
+
+    while (start < opts.length()) {
+        std::string::size_type end = opts.find(',', start);
+        if (opts.npos == end) {
+            end = opts.length();
+        }
+
+        std::string const item(opts, start, end - start);
+        start = end + 1;
+
+        if (0 == item.compare(0, 7, "shards=")) {
+            shards = strtol(item.c_str() + 7, NULL, 0);
+        }
+        else if (0 == item.compare(0, 6, "queue=")) {
+            queueSize = strtol(item.c_str() + 6, NULL, 0);
+        }
+        else if (item.npos == item.find('=')) {
+            path = item.empty() ? path : item;
+        }
+        else {
+            shardOpts += shardOpts.empty() ? "" : ",";
+            shardOpts += item;
+        }
+    }
+
+    if (shards < 1  ||  shards > MAX_SHARDS) {
+        std::cerr << "Invalid number of shards " << shards << std::endl;
+        return false;
+    }
+
+    if (queueSize < 2  ||  queueSize > (1 << 24)) {
+        std::cerr << "Invalid shard queue size " << queueSize << std::endl;
+        return false;
+    }
+
+    if (NULL == (pImpl_ = new ShardSinkImpl)) {
+        return false;
+    }
+
+    if (!pImpl_->open(path, shardOpts, shards, queueSize)) {
+        std::cerr << "Can't open shards of " << path << std::endl;
+        abort();
+    }
+
+    std::cout << "Opened sink: " << shards << " shards of " << path << ", queue " << queueSize << std::endl;
+    return true;
+}
@@ -0,0 +1,136 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_SHARD_SINK_HPP
+#define HOMEWORK_SERVER_SHARD_SINK_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "sink.hpp"
+#include "record.hpp"
+
+class BintxtSinkImpl;
+class SinkWorker;
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Implement Shard Sink functionality: spread the Records over N bintxt
+    instances by a hash of their serial. Every shard has its own file
+    FILE.sI and its own writer thread fed through a lock-free queue, so the
+    shards write concurrently. Records received together are split by
+    shard and queued to each as one job, and their results are the
+    shards' own, once every shard has stored its part.
+
+    A query for one serial is answered by its shard alone. A wildcard query
+    is run by every shard at once, and their answers are merged in
+    timestamp order. The cursor of a paged wildcard query holds a position
+    in every shard. The end of a batch waits until every shard has flushed
+    it, so bintxt's commit policy holds for the whole Sink.
+
+    The number of shards is kept in FILE.shards, because a serial's shard
+    depends on it.
+----------------------------------------------------------------------------*/
+class ShardSinkImpl
+{
+public:
+    ShardSinkImpl();
+    ~ShardSinkImpl();
+
+    bool open(std::string const &path, std::string const &opts, unsigned shards, size_t queueSize);
+
+    int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    int processRecs(Record const *recs, size_t count, int *rets, Sink::SendRecord_f const &send);
+    void flush(void);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    // No copying
+    ShardSinkImpl(ShardSinkImpl const &);
+    ShardSinkImpl &operator = (ShardSinkImpl const &);
+
+    bool checkShards(std::string const &path, unsigned shards) const;
+    unsigned shardOf(std::string const &serial) const;
+    int queryAll(Record const &ref, Sink::SendRecord_f const &send);
+    int aggregateAll(Record const &ref, Sink::SendRecord_f const &send);
+
+    std::vector<BintxtSinkImpl *> impls_;
+    std::vector<SinkWorker *> workers_;
+
+    std::vector<std::vector<Record> > answers_;   // Of wildcard queries, per shard
+    std::vector<std::vector<Record> > batches_;   // Stores received together, per shard
+    std::vector<std::vector<size_t> > places_;    // Their places in what was received
+    std::vector<std::vector<int> > results_;      // And their results
+
+    struct Stats {
+        Stats() : singleQueries(0), wildQueries(0), merged(0) {}
+
+        uint64_t singleQueries;
+        uint64_t wildQueries;
+        uint64_t merged;
+    } stats_;
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Intended to be used as singleton.
+    Is fired up on application start. Registers its name to SinkManager 
+    upon construction.
+----------------------------------------------------------------------------*/
+class ShardSink : public Sink
+{
+public:
+    ShardSink() : Sink("shard"), pImpl_(NULL) {}
+    virtual ~ShardSink() { if (pImpl_) delete pImpl_; }
+
+    virtual bool open(std::string const &opts);
+    
+    ShardSinkImpl const *impl(void) const { return pImpl_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Creates binding to implementation's functions.
+    ----------------------------------------------------------------------------*/
+    virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&ShardSinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&ShardSinkImpl::processRecs, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&ShardSinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { if (pImpl_) pImpl_->printStats(os); }
+
+private:
+    ShardSinkImpl *pImpl_;
+};
+
+
+#endif  // HOMEWORK_SERVER_SHARD_SINK_HPP
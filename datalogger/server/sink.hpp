@@ -28,7 +28,9 @@ For more information, please refer to <http://unlicense.org>
 #ifndef HOMEWORK_SERVER_SINK_HPP
 #define HOMEWORK_SERVER_SINK_HPP
 
+#include <stddef.h>
 #include <functional>
+#include <iosfwd>
 #include "sinkManager.hpp"
 
 struct Record;
@@ -38,22 +40,73 @@ struct Record;
   Does:
     Base class for all Sinks. Intended to be used as singleton.
     Registers its name to SinkManager at daemon startup, where it can be
-    requested from by the user.
+    requested from by the user. Instances made with another() have no name
+    and are not registered.
 ----------------------------------------------------------------------------*/
 class Sink
 {
 public:
 	typedef std::function<int (Record const &, uint64_t)> SendRecord_f;
 	typedef std::function<int (Record const &, SendRecord_f const &)> ProcessRecord_f;
+	typedef std::function<int (Record const *recs, size_t count, int *rets, SendRecord_f const &send)> ProcessRecords_f;
+	typedef std::function<void (void)> FlushRecords_f;
 
-    Sink(char const *const sinkName) { SINKMGR.sinkRegister(sinkName, this); }
+    Sink(char const *const sinkName) { if (sinkName) SINKMGR.sinkRegister(sinkName, this); }
     virtual ~Sink() {}
 
     virtual bool open(std::string const &opts) = 0;
 
     virtual ProcessRecord_f processRecFunc(void) const = 0;
 
+    // Records received together, in order. Sinks that can do a batch at
+    // once override this; by default every Record goes to processRecFunc().
+    virtual ProcessRecords_f processRecsFunc(void) const;
+
+    // Called after every batch of Records received together, and when idle.
+    // Sinks that buffer writes commit them here. Empty function if not needed.
+    virtual FlushRecords_f flushFunc(void) const { return FlushRecords_f(); }
+
+    virtual void printStats(std::ostream &) const {}
+
+    // New unregistered instance of the same Sink, not yet opened, owned by the caller.
+    // NULL if the Sink can't have more than one instance.
+    virtual Sink *another(void) const { return NULL; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Process a batch of Records one by one with a Sink's processRec().
+        With the Sink's implementation as the processor the calls need no
+        std::function.
+
+      Wants:
+        Sink implementation, or anything callable like processRec().
+        Records and their count.
+        Destination for every Record's processRec() result.
+        Handler to a function to use to send the replies.
+
+      Gives:
+        Number of Records stored.
+    ----------------------------------------------------------------------------*/
+    template <typename P, typename R = Record>
+    static int processEach(P const &process, R const *const recs, size_t const count, int *const rets, 
+                           SendRecord_f const &send) 
+    {
+        int stored = 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            rets[i] = call(process, recs[i], send);
+            stored += 1 == rets[i];
+        }
+
+        return stored;
+    }
+
 private:
+    template <typename Impl, typename R>
+    static int call(Impl *const impl, R const &rec, SendRecord_f const &send) { return impl->processRec(rec, send); }
+    static int call(ProcessRecord_f const &process, Record const &rec, SendRecord_f const &send) { return process(rec, send); }
+
     // No copying the singleton
     Sink(Sink &);
     Sink(Sink &&);
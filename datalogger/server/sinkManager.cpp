@@ -29,6 +29,7 @@ For more information, please refer to <http://unlicense.org>
 #include <iostream>
 #include "sinkManager.hpp"
 #include "sink.hpp"
+#include "record.hpp"
 
 
 SinkManager *SinkManager::inst_ = NULL;
@@ -144,3 +145,25 @@ SinkManager::sinkGet(std::string const &sinkName)
 
     return it->second;
 }
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Default batch processing of a Sink: every Record through the Sink's
+    processRecFunc().
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    Batch processing function.
+----------------------------------------------------------------------------*/
+Sink::ProcessRecords_f
+Sink::processRecsFunc(void) const
+{
+    ProcessRecord_f const process = processRecFunc();
+
+    return [process] (Record const *recs, size_t count, int *rets, SendRecord_f const &send) { 
+        return processEach(process, recs, count, rets, send); 
+    };
+}
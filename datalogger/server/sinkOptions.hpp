@@ -0,0 +1,142 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_SINK_OPTIONS_HPP
+#define HOMEWORK_SERVER_SINK_OPTIONS_HPP
+
+#include <stdlib.h>
+#include <string>
+#include <map>
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Parse Sink's OPTS string of format PATH[,KEY=VALUE[,KEY=VALUE...]].
+    PATH is optional. Keys that were never asked for can be listed with
+    unknown() to catch typos.
+    Key suffix is not the Sink's: its value is appended to PATH, or to the
+    default path, unless that is empty. It gives every core's instance of
+    a Sink files of its own, see CoreGroup.
+----------------------------------------------------------------------------*/
+class SinkOptions
+{
+public:
+    SinkOptions(std::string const &opts, std::string const &defaultPath)
+    : path_(defaultPath)
+    {
+        std::string::size_type start = 0;
+
+        while (start <= opts.length()) {
+            std::string::size_type end = opts.find(',', start);
+            if (opts.npos == end) {
+                end = opts.length();
+            }
+
+            std::string const item(opts, start, end - start);
+            std::string::size_type const eq = item.find('=');
+
+            if (item.npos != eq) {
+                values_[item.substr(0, eq)] = item.substr(eq + 1);
+            }
+            else if (item.length() > 0) {
+                path_ = item;
+            }
+
+            start = end + 1;
+        }
+
+        Values_t::iterator const suffix = values_.find("suffix");
+        if (values_.end() != suffix) {
+            if (path_.length() > 0) {
+                path_ += suffix->second;
+            }
+            values_.erase(suffix);
+        }
+    }
+
+    std::string const &path(void) const { return path_; }
+
+    bool has(std::string const &key) const { return values_.find(key) != values_.end(); }
+
+    std::string get(std::string const &key, std::string const &def) const {
+        Values_t::const_iterator const it = values_.find(key);
+        if (values_.end() == it) {
+            return def;
+        }
+        used_[key] = true;
+        return it->second;
+    }
+
+    long getInt(std::string const &key, long const def) const {
+        return has(key) ? strtol(get(key, "").c_str(), NULL, 0) : def;
+    }
+
+    // Number with optional K, M or G suffix for powers of 1024
+    long long getSize(std::string const &key, long long const def) const {
+        if (!has(key)) {
+            return def;
+        }
+        std::string const value(get(key, ""));
+        char *end;
+        long long const num = strtoll(value.c_str(), &end, 0);
+        switch (*end) {
+        case 'G':  case 'g':  return num << 30;
+        case 'M':  case 'm':  return num << 20;
+        case 'K':  case 'k':  return num << 10;
+        }
+        return num;
+    }
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Give the first option that was never asked for.
+
+      Wants:
+        Nothing.
+
+      Gives:
+        Option key, or empty string.
+    ----------------------------------------------------------------------------*/
+    std::string unknown(void) const {
+        for (Values_t::const_iterator it = values_.begin(); it != values_.end(); ++it) {
+            if (used_.find(it->first) == used_.end()) {
+                return it->first;
+            }
+        }
+        return std::string();
+    }
+
+private:
+    typedef std::map<std::string, std::string> Values_t;
+
+    std::string path_;
+    Values_t values_;
+    mutable std::map<std::string, bool> used_;
+};
+
+
+#endif  // HOMEWORK_SERVER_SINK_OPTIONS_HPP
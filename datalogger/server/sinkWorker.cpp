@@ -0,0 +1,380 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#include <algorithm>
+#include <iostream>
+#include "sinkWorker.hpp"
+#include "monoClock.hpp"
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. The thread is started by start().
+----------------------------------------------------------------------------*/
+SinkWorker::SinkWorker(std::string const &name, Sink::ProcessRecords_f const &process, Sink::FlushRecords_f const &flush, 
+                       size_t const queueSize)
+: name_(name), process_(process), flush_(flush), queue_(queueSize), stop_(false), done_(true), 
+  maxDepth_(0), records_(0), errors_(0), lagSumUs_(0), lagMaxUs_(0), stalls_(0)
+{
+}
+
+
+SinkWorker::~SinkWorker()
+{
+    stop();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Start the thread.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+SinkWorker::start(void)
+{
+    if (thread_.joinable()) {
+        return false;
+    }
+
+    thread_ = std::thread(&SinkWorker::run, this);
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop the thread. Records still queued are written and flushed first.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::stop(void)
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    stop_ = true;
+    wakeup_.notify();
+    thread_.join();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue a Record to be stored. With a destination for its result, wait()
+    blocks until it is stored, like after post().
+
+  Wants:
+    Record.
+    Time it was handed over, for the lag statistics.
+    Destination for the Sink's result, or NULL.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::store(Record const &rec, struct timespec const &queued, int *const rets)
+{
+    Job job;
+    job.rec = rec;
+    job.rets = rets;
+    job.queued = queued;
+
+    if (rets) {
+        expect();
+    }
+    push(std::move(job));
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue Records received together, to be stored with one call to the
+    Sink. With a destination for their results, wait() blocks until they
+    are stored, like after post().
+
+  Wants:
+    Records. They are moved from.
+    Time they were handed over, for the lag statistics.
+    Destination for the Sink's result of every Record, or NULL.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::store(std::vector<Record> &&recs, struct timespec const &queued, int *const rets)
+{
+    Job job;
+    job.type = Job::BATCH;
+    job.recs = std::move(recs);
+    job.rets = rets;
+    job.queued = queued;
+
+    if (rets) {
+        expect();
+    }
+    push(std::move(job));
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue the end of a batch. The Sink flushes when it gets there.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::flush(void)
+{
+    Job job;
+    job.type = Job::FLUSH;
+    push(std::move(job));
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue a function to run in the thread after the jobs queued before it.
+    wait() blocks until it has run. Only one function, or store with
+    results, may be waited for at a time. Without a thread the function
+    runs right away.
+
+  Wants:
+    Function.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::post(Call_f const &f)
+{
+    if (!thread_.joinable()) {
+        f();
+        return;
+    }
+
+    expect();
+
+    Job job;
+    job.type = Job::CALL;
+    job.call = f;
+    push(std::move(job));
+}
+
+
+void
+SinkWorker::wait(void)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    finished_.wait(guard, [this] () { return done_; });
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Mark that a job is queued that wait() waits for, and signal the waiter
+    when the thread has run it.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::expect(void)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    done_ = false;
+}
+
+
+void
+SinkWorker::finish(void)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        done_ = true;
+    }
+    finished_.notify_one();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Push a job to the queue and wake the thread if it sleeps. A full queue
+    is waited out rather than dropping Records.
+
+  Wants:
+    Job.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::push(Job &&job)
+{
+    if (!queue_.push(std::move(job))) {
+        ++stalls_;
+        while (!queue_.push(std::move(job))) {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t const depth = queue_.size();
+    if (depth > maxDepth_.load(std::memory_order_relaxed)) {
+        maxDepth_.store(depth, std::memory_order_relaxed);
+    }
+
+    wakeup_.notify();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Thread's loop. Drain the queue, sleep when it's empty. Flush the Sink
+    once more when stopped.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::run(void)
+{
+    Job job;
+
+    while (true) {
+        if (!queue_.pop(job)) {
+            if (stop_) {
+                break;
+            }
+
+            wakeup_.wait([this] () { return stop_  ||  !queue_.empty(); });
+            continue;
+        }
+
+        switch (job.type) {
+        case Job::STORE:
+        case Job::BATCH:
+            storeJob(job);
+            break;
+
+        case Job::FLUSH:
+            if (flush_) {
+                flush_();
+            }
+            break;
+
+        case Job::CALL:
+            job.call();
+            finish();
+            break;
+        }
+    }
+
+    if (flush_) {
+        flush_();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Store a job's Record or Records and account for them. Give the results
+    to the job's destination, if it has one, and signal its waiter.
+
+  Wants:
+    STORE or BATCH job.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::storeJob(Job &job)
+{
+    static Sink::SendRecord_f const noSend = [] (Record const &, uint64_t) { return -1; };
+    Record const *const recs = Job::BATCH == job.type ? job.recs.data() : &job.rec;
+    size_t const count = Job::BATCH == job.type ? job.recs.size() : 1;
+
+
+    if (0 == count) {
+        if (job.rets) {
+            finish();
+        }
+        return;
+    }
+
+    rets_.resize(count);
+    process_(recs, count, &rets_[0], noSend);
+
+    if (job.rets) {
+        std::copy(rets_.begin(), rets_.end(), job.rets);
+        finish();
+    }
+
+    uint64_t errors = 0;
+    for (size_t i = 0; i < count; ++i) {
+        errors += rets_[i] < 0;
+    }
+
+    uint64_t const lag = monoClock::elapsedUs(job.queued);
+    errors_.fetch_add(errors, std::memory_order_relaxed);
+    records_.fetch_add(count, std::memory_order_relaxed);
+    lagSumUs_.fetch_add(lag * count, std::memory_order_relaxed);
+    if (lag > lagMaxUs_.load(std::memory_order_relaxed)) {
+        lagMaxUs_.store(lag, std::memory_order_relaxed);
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print queue depth, lag and errors.
+
+  Wants:
+    Output stream.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+SinkWorker::printStats(std::ostream &os) const
+{
+    uint64_t const records = records_.load();
+
+    os << "  " << name_ << ": queue " << queue_.size() << "/" << queue_.capacity() << " (max " << maxDepth_.load() 
+        << "), " << records << " records, " << errors_.load() << " errors, lag avg " 
+        << (records ? lagSumUs_.load() / records : 0) << " us, max " << lagMaxUs_.load() << " us, " 
+        << stalls_ << " full queue stalls" << std::endl;
+}
@@ -0,0 +1,137 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_SINK_WORKER_HPP
+#define HOMEWORK_SERVER_SINK_WORKER_HPP
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sink.hpp"
+#include "record.hpp"
+#include "lockfreeQueue.hpp"
+#include "wakeup.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Run one Sink in its own thread, fed through a lock-free queue. Stores
+    and flushes are queued and done in the thread's own time; any other
+    call is queued behind them and can be waited for. The Sink is only
+    called from this thread, so it needs no locking.
+
+    Producer side (everything but printStats) must be called from one
+    thread only.
+----------------------------------------------------------------------------*/
+class SinkWorker
+{
+public:
+    typedef std::function<void (void)> Call_f;
+
+    SinkWorker(std::string const &name, Sink::ProcessRecords_f const &process, Sink::FlushRecords_f const &flush, size_t queueSize);
+    ~SinkWorker();
+
+    bool start(void);
+    void stop(void);
+
+    std::string const &name(void) const { return name_; }
+
+    void store(Record const &rec, struct timespec const &queued, int *rets = NULL);
+    void store(std::vector<Record> &&recs, struct timespec const &queued, int *rets = NULL);
+    void flush(void);
+
+    void post(Call_f const &f);
+    void wait(void);
+    void call(Call_f const &f) { post(f); wait(); }
+
+    void printStats(std::ostream &os) const;
+
+private:
+    // No copying
+    SinkWorker(SinkWorker const &);
+    SinkWorker &operator = (SinkWorker const &);
+
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        One request to the thread. BATCH stores Records received together
+        with one call to the Sink. CALL runs a function there and signals
+        the caller that waits for it, like a store that has 'rets' to give
+        its results to.
+    ----------------------------------------------------------------------------*/
+    struct Job {
+        enum Type { STORE, BATCH, FLUSH, CALL };
+
+        Job() : type(STORE), rets(NULL) {}
+
+        Type type;
+        Record rec;
+        std::vector<Record> recs;
+        Call_f call;
+        int *rets;
+        struct timespec queued;
+    };
+
+    void expect(void);
+    void finish(void);
+    void push(Job &&job);
+    void run(void);
+    void storeJob(Job &job);
+
+    std::string const name_;
+    Sink::ProcessRecords_f const process_;
+    Sink::FlushRecords_f const flush_;
+
+    std::thread thread_;
+    SpscQueue<Job> queue_;
+    std::atomic<bool> stop_;
+    std::vector<int> rets_;   // Thread only
+
+    Wakeup wakeup_;   // Idle sleep
+
+    // Caller's wait for a CALL to finish
+    std::mutex lock_;
+    bool done_;
+    std::condition_variable finished_;
+
+    // Statistics
+    std::atomic<size_t> maxDepth_;
+    std::atomic<uint64_t> records_;
+    std::atomic<uint64_t> errors_;
+    std::atomic<uint64_t> lagSumUs_;
+    std::atomic<uint64_t> lagMaxUs_;
+    uint64_t stalls_;   // Producer only
+};
+
+
+#endif  // HOMEWORK_SERVER_SINK_WORKER_HPP
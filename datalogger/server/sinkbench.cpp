@@ -0,0 +1,590 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "sinkManager.hpp"
+#include "sink.hpp"
+#include "record.hpp"
+#include "lz4Block.hpp"
+
+
+// Some defaults for cmdline arguments
+static char const defaultSink[] = "bintxt:bench.bin";
+static unsigned const defaultRecords = 1000000;
+static unsigned const defaultBatch = 64;
+static unsigned const defaultDevices = 100;
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Seconds elapsed since the given monotonic time.
+----------------------------------------------------------------------------*/
+static double
+elapsed(struct timespec const &since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since.tv_sec) + (now.tv_nsec - since.tv_nsec) / 1e9;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print benchmark usage to command line stderr.
+----------------------------------------------------------------------------*/
+static void 
+printHelp(void)
+{
+    std::string allSinks;
+
+    SINKMGR.forEachName( [&allSinks] (std::string const &name) { allSinks += "      "; allSinks += name; allSinks += '\n'; } );
+
+    std::cerr << "Usage: [-o SINK[:OPTS]] [-n RECORDS] [-b BATCH] [-d DEVICES] [-v]" << std::endl;
+    std::cerr << "  -o SINK      Sink (database) to benchmark, in a fresh location (default " << defaultSink << ")" << std::endl;
+    std::cerr << "      Built with sinks:" << std::endl;
+    std::cerr << allSinks;
+    std::cerr << "  -n RECORDS   Records to store (default " << defaultRecords << ")" << std::endl;
+    std::cerr << "  -b BATCH     Records per flush, like Records received together (default " << defaultBatch << ")" << std::endl;
+    std::cerr << "  -d DEVICES   Number of serials the Records are spread over (default " << defaultDevices << ")" << std::endl;
+    std::cerr << "  -v           Check the LZ4 codec first, and that the queries give back exactly what was stored" << std::endl;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Fill in the generated Record of a sequence number: devices report
+    slowly changing readings a millisecond apart, starting a millisecond
+    after the given time.
+----------------------------------------------------------------------------*/
+static void
+makeRecord(Record &rec, unsigned const seq, unsigned const devices, struct timeval const &first)
+{
+    char buffer[64];
+
+    snprintf(buffer, sizeof(buffer), "dev%06u", seq % devices);
+    rec.serial = buffer;
+    rec.devType = seq % devices % 4 ? "thermometer" : "hygrometer";
+    snprintf(buffer, sizeof(buffer), "value=%d.%d;status=ok;seq=%u", 20 + (int) (seq / devices % 97) / 10, seq % 10, seq);
+    rec.data = buffer;
+
+    uint64_t const usec = first.tv_usec + (uint64_t) (seq + 1) * 1000;
+    rec.timestamp.tv_sec = first.tv_sec + usec / 1000000;
+    rec.timestamp.tv_usec = usec % 1000000;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Compress a buffer and check that it decompresses back to the same,
+    that a destination one byte too small is refused on both ways, and
+    that truncated and corrupted compressed data never decompresses to
+    the original or writes past the destination.
+
+  Gives:
+    Number of failed checks.
+----------------------------------------------------------------------------*/
+static unsigned
+checkCodecBuffer(char const *const name, std::string const &raw)
+{
+    int const rawSize = raw.size();
+    int const guard = 64;
+    unsigned failed = 0;
+
+    std::vector<char> packed(lz4::compressBound(rawSize) + guard, 'g');
+    int const size = lz4::compress(raw.data(), rawSize, &packed[0], packed.size() - guard);
+
+    if (size <= 0  ||  std::count(packed.end() - guard, packed.end(), 'g') != guard) {
+        printf("lz4 %s: compressing %d bytes failed\n", name, rawSize);
+        return 1;
+    }
+    packed.resize(size);
+
+    std::vector<char> small(size - 1 + guard, 'g');
+    if (lz4::compress(raw.data(), rawSize, &small[0], size - 1) != 0  ||  std::count(small.end() - guard, small.end(), 'g') != guard) {
+        printf("lz4 %s: compressing to %d bytes did not fail cleanly\n", name, size - 1);
+        ++failed;
+    }
+
+    // Decompress exactly the given input, to a destination followed by guard bytes
+    std::vector<char> out;
+    auto const unpack = [&out, guard] (std::vector<char> const &in, int const capacity) {
+        out.assign(capacity + guard, 'g');
+        int const got = lz4::decompress(in.empty() ? NULL : &in[0], in.size(), &out[0], capacity);
+        return std::count(out.end() - guard, out.end(), 'g') == guard ? got : -2;
+    };
+
+    if (unpack(packed, rawSize) != rawSize  ||  0 != memcmp(&out[0], raw.data(), rawSize)) {
+        printf("lz4 %s: %d bytes did not decompress back\n", name, rawSize);
+        ++failed;
+    }
+
+    if (rawSize > 0  &&  unpack(packed, rawSize - 1) != -1) {
+        printf("lz4 %s: decompressing to %d bytes did not fail\n", name, rawSize - 1);
+        ++failed;
+    }
+
+    // All cuts of small data, some 2000 of big, and the last bytes
+    int const step = std::max(1, size / 2000);
+
+    for (int cut = 0; cut < size; cut += (cut < size - 16 ? step : 1)) {
+        std::vector<char> const truncated(packed.begin(), packed.begin() + cut);
+        int const got = unpack(truncated, rawSize);
+
+        if (-2 == got  ||  (rawSize > 0  &&  rawSize == got)) {
+            printf("lz4 %s: data truncated to %d of %d bytes %s\n", name, cut, size, -2 == got ? "overflowed" : "decompressed");
+            ++failed;
+        }
+    }
+
+    // Any result of corrupted data is fine, as long as it is in bounds
+    std::vector<char> corrupt;
+    for (int i = 0; i < size; i += step) {
+        for (int bits = 1; bits < 256; bits <<= 1) {
+            corrupt = packed;
+            corrupt[i] ^= bits;
+
+            int const got = unpack(corrupt, rawSize);
+            if (got < -1  ||  got > rawSize) {
+                printf("lz4 %s: byte %d flipped with 0x%02x overflowed\n", name, i, bits);
+                ++failed;
+            }
+        }
+    }
+
+    return failed;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Check the LZ4 codec with data that has long literals, long and
+    overlapping matches, matches at the largest offset, rows like the
+    generated Records, and sizes around the format's end limits.
+
+  Gives:
+    True if all checks passed.
+----------------------------------------------------------------------------*/
+static bool
+checkCodec(unsigned const devices)
+{
+    struct timeval const zero = { 0, 0 };
+    uint32_t random = 2463534242U;
+    std::vector<std::pair<std::string, std::string> > buffers;
+    std::string raw;
+    Record rec;
+    unsigned failed = 0;
+
+    auto const next = [&random] () {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return random;
+    };
+
+
+    for (unsigned seq = 0; raw.size() < 64 * 1024; ++seq) {
+        makeRecord(rec, seq, devices, zero);
+        raw += rec.serial + '\0' + rec.devType + '\0' + rec.data + '\n';
+    }
+    buffers.push_back(std::make_pair("rows", raw));
+
+    for (unsigned size = 0; size <= 40; ++size) {
+        buffers.push_back(std::make_pair("short", raw.substr(0, size)));
+    }
+
+    buffers.push_back(std::make_pair("zeros", std::string(100000, '\0')));
+
+    raw.clear();
+    while (raw.size() < 70000) {
+        raw += (char) next();
+    }
+    buffers.push_back(std::make_pair("random", raw));
+
+    // Random with a repeat at exactly the largest offset and runs of short patterns
+    raw.resize(65535);
+    raw += raw.substr(0, 1000);
+    raw += std::string(300, 'a') + "ab" + std::string(5000, 'b');
+    for (unsigned i = 0; i < 3000; ++i) {
+        raw += "xyz"[i % 3];
+    }
+    for (unsigned i = 0; i < 1000; ++i) {
+        raw += (char) next();
+    }
+    buffers.push_back(std::make_pair("offsets", raw));
+
+    for (auto const &buffer : buffers) {
+        failed += checkCodecBuffer(buffer.first.c_str(), buffer.second);
+    }
+
+    printf("lz4      %10u buffers checked, %u failed\n", (unsigned) buffers.size(), failed);
+    return 0 == failed;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Page through all Records the query matches, the given number at a time
+    or all at once if 0, and check that every stored Record comes back
+    once and the same as it was generated.
+
+  Gives:
+    True if all were.
+----------------------------------------------------------------------------*/
+static bool
+verifyQuery(char const *const name, Sink::ProcessRecord_f const &process, Record ref, uint32_t const limit, unsigned const records, 
+            unsigned const devices, struct timeval const &first)
+{
+    std::vector<bool> seen(records);
+    Record expect;
+    uint64_t rows = 0;
+    uint64_t wrong = 0;
+    uint32_t got;
+
+    Sink::SendRecord_f const check = [&] (Record const &rec, uint64_t) {
+        int64_t const usec = (int64_t) (rec.timestamp.tv_sec - first.tv_sec) * 1000000 + (rec.timestamp.tv_usec - first.tv_usec);
+        int64_t const seq = usec / 1000 - 1;
+
+        ++got;
+        ++rows;
+        ref.cursor = rec.cursor;
+
+        if (seq < 0  ||  seq >= records  ||  usec % 1000 != 0  ||  seen[seq]) {
+            ++wrong;
+            return 0;
+        }
+        seen[seq] = true;
+
+        makeRecord(expect, seq, devices, first);
+        if (rec.serial != expect.serial  ||  rec.devType != expect.devType  ||  rec.data != expect.data) {
+            ++wrong;
+        }
+        return 0;
+    };
+
+
+    ref.limit = limit;
+    do {
+        got = 0;
+        if (process(ref, check) < 0) {
+            printf("%-8s query failed\n", name);
+            return false;
+        }
+    } while (limit > 0  &&  got == limit);
+
+    uint64_t const missing = records - std::count(seen.begin(), seen.end(), true);
+
+    printf("%-8s %10llu records back, %llu wrong, %llu missing\n", name, (unsigned long long) rows, (unsigned long long) wrong, 
+           (unsigned long long) missing);
+    return 0 == wrong  &&  0 == missing;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Time one query and print its throughput.
+
+  Wants:
+    Query's name.
+    Sink's processing function.
+    Reference Record.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+static void
+timeQuery(char const *const name, Sink::ProcessRecord_f const &process, Record const &ref)
+{
+    struct timespec start;
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+
+    Sink::SendRecord_f const count = [&rows, &bytes] (Record const &rec, uint64_t) {
+        ++rows;
+        bytes += rec.data.length();
+        return 0;
+    };
+
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    process(ref, count);
+    double const secs = elapsed(start);
+
+    printf("%-8s %10llu records in %8.3f s, %10.0f records/s\n", name, (unsigned long long) rows, secs, rows / secs);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Page through all Records matching the reference, resuming every page
+    from the cursor of the last Record of the previous one, and print how
+    long it took.
+----------------------------------------------------------------------------*/
+static void
+timePages(char const *const name, Sink::ProcessRecord_f const &process, Record ref)
+{
+    struct timespec start;
+    uint64_t pages = 0;
+    uint64_t rows = 0;
+    uint32_t got;
+
+    Sink::SendRecord_f const count = [&ref, &got] (Record const &rec, uint64_t) {
+        ++got;
+        ref.cursor = rec.cursor;
+        return 0;
+    };
+
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        got = 0;
+        if (process(ref, count) < 0) {
+            break;
+        }
+        ++pages;
+        rows += got;
+    } while (got == ref.limit);
+    double const secs = elapsed(start);
+
+    printf("%-8s %10llu records in %8.3f s, %10.0f records/s, %llu pages\n", name, (unsigned long long) rows, secs, rows / secs, 
+           (unsigned long long) pages);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run one COUNT or STATS request through the Sink and print how long it
+    took, and how many Records in how many groups it counted.
+----------------------------------------------------------------------------*/
+static void
+timeAggregate(char const *const name, Sink::ProcessRecord_f const &process, Record const &ref)
+{
+    struct timespec start;
+    uint64_t groups = 0;
+    uint64_t rows = 0;
+
+    Sink::SendRecord_f const count = [&groups, &rows] (Record const &rec, uint64_t) {
+        uint32_t half[2];
+        memcpy(half, rec.data.data(), sizeof(half));
+        ++groups;
+        rows += (uint64_t) ntohl(half[0]) << 32 | ntohl(half[1]);
+        return 0;
+    };
+
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    process(ref, count);
+    double const secs = elapsed(start);
+
+    printf("%-8s %10llu records in %8.3f s, %10.0f records/s, %llu groups\n", name, (unsigned long long) rows, secs, rows / secs, 
+           (unsigned long long) groups);
+}
+
+
+/*---- Main Function --------------------------------------------------------
+  Does:
+    Store generated Records to a Sink the way TcpSource does, in batches
+    handed over at once and followed by a flush, and time it. Then time
+    queries for all Records, for the newest 1 % of them and for one serial,
+    paging through all of them 1000 at a time, STATS of all of them by
+    serial, and the latest Records of one serial. With -v check the LZ4
+    codec first, and at the end that querying all Records and paging
+    through them gives back every Record once and as it was stored.
+  
+  Wants:
+    Nothing.
+    
+  Gives: 
+    Non-zero if the Sink did not open or a check failed.
+----------------------------------------------------------------------------*/
+int 
+main(int argc, char **argv)
+{
+    char const opts[] = "ho:n:b:d:v";
+
+    std::string sinkName(defaultSink);
+    std::string sinkOpt;
+    unsigned records = defaultRecords;
+    unsigned batch = defaultBatch;
+    unsigned devices = defaultDevices;
+    bool verify = false;
+    int c;
+
+
+    while (-1 != (c = getopt(argc, argv, opts))) {
+        switch (c) {
+        case 'o':
+            size_t pos;
+            sinkName = optarg;
+
+            if ((pos = sinkName.find(':')) != sinkName.npos) {
+                sinkOpt = sinkName.substr(pos+1);
+                sinkName.erase(pos);
+            }
+            break;
+
+        case 'n':
+            records = atoi(optarg);
+            break;
+
+        case 'b':
+            batch = atoi(optarg);
+            break;
+
+        case 'd':
+            devices = atoi(optarg);
+            break;
+
+        case 'v':
+            verify = true;
+            break;
+
+        case 'h':
+            printHelp();
+            return 0;
+
+        default:
+            printHelp();
+            return -1;
+        }
+    }
+
+    if (0 == batch  ||  0 == devices) {
+        printHelp();
+        return -1;
+    }
+
+    if (verify  &&  !checkCodec(devices)) {
+        return -1;
+    }
+
+    Sink *const sink = SINKMGR.sinkGet(sinkName);
+
+    if (!sink) {
+        std::cerr << "Sink '" << sinkName << "' not recognised" << std::endl;
+        printHelp();
+        return -1;
+    }
+
+    if (!sink->open(sinkOpt)) {
+        return -1;
+    }
+
+    Sink::ProcessRecord_f const process = sink->processRecFunc();
+    Sink::ProcessRecords_f const processBatch = sink->processRecsFunc();
+    Sink::FlushRecords_f const flush = sink->flushFunc();
+    Sink::SendRecord_f const ignore = [] (Record const &, uint64_t) { return 0; };
+
+    // Devices report slowly changing readings a millisecond apart
+    std::vector<Record> recs(batch, Record(REC_ACT_STORE));
+    std::vector<int> rets(batch);
+    struct timeval ts;
+    struct timespec start;
+    uint64_t bytes = 0;
+    double sinkSecs = 0;   // Of it in the Sink's calls
+
+    gettimeofday(&ts, NULL);
+    ts.tv_sec -= records / 1000 + 1;
+    struct timeval const first = ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned i = 0; i < records; i += batch) {
+        unsigned const n = std::min(batch, records - i);
+
+        for (unsigned j = 0; j < n; ++j) {
+            makeRecord(recs[j], i + j, devices, first);
+            bytes += recs[j].data.length();
+        }
+        ts = recs[n - 1].timestamp;
+
+        struct timespec call;
+        clock_gettime(CLOCK_MONOTONIC, &call);
+
+        processBatch(&recs[0], n, &rets[0], ignore);
+
+        if (flush) {
+            flush();
+        }
+        sinkSecs += elapsed(call);
+    }
+
+    double const secs = elapsed(start);
+
+    printf("ingest   %10u records in %8.3f s, %10.0f records/s, %.1f MB/s of data\n", records, secs, records / secs, bytes / secs / 1e6);
+    printf("in sink  %10u records in %8.3f s, %10.0f records/s\n", records, sinkSecs, records / sinkSecs);
+
+    Record ref(REC_ACT_GET_AFTER);
+    ref.serial = "*";
+    ref.devType = "*";
+    ref.timestamp = first;
+    timeQuery("all", process, ref);
+
+    ref.timestamp = ts;
+    ref.timestamp.tv_sec -= records / 100 / 1000;
+    timeQuery("newest", process, ref);
+
+    ref.timestamp = first;
+    ref.serial = "dev000001";
+    timeQuery("serial", process, ref);
+
+    ref.serial = "*";
+    ref.limit = 1000;
+    timePages("pages", process, ref);
+    ref.limit = 0;
+
+    ref.action = REC_ACT_STATS;
+    ref.serial = "*";
+    ref.groupBy = REC_GROUP_SERIAL;
+    timeAggregate("stats", process, ref);
+
+    ref.action = REC_ACT_GET_LATEST;
+    ref.serial = "dev000001";
+    ref.groupBy = 0;
+    timeQuery("latest", process, ref);
+
+    bool ok = true;
+    if (verify) {
+        ref.action = REC_ACT_GET_AFTER;
+        ref.serial = "*";
+        ref.timestamp = first;
+        ref.cursor.clear();
+        ok = verifyQuery("verify", process, ref, 0, records, devices, first);
+        ok = verifyQuery("vpages", process, ref, 1000, records, devices, first)  &&  ok;
+    }
+
+    sink->printStats(std::cout);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,243 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <iostream>
+#include "tailCache.hpp"
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Cache is disabled until configure().
+----------------------------------------------------------------------------*/
+TailCache::TailCache()
+: maxRecs_(0), maxSecs_(0)
+{
+    timerclear(&uncachedMax_);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Set the cache's size. Records stored before this are not cached; they
+    were stamped before now, unless the clock has been turned back.
+
+  Wants:
+    Maximum number of Records, 0 for no limit.
+    Maximum age relative to the newest Record, 0 for no limit.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TailCache::configure(size_t const maxRecs, uint32_t const maxSecs)
+{
+    maxRecs_ = maxRecs;
+    maxSecs_ = maxSecs;
+    gettimeofday(&uncachedMax_, NULL);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add a Record that was stored at the end of the log, and evict what no
+    longer fits.
+
+  Wants:
+    Record's data.
+    Segment and offset where it was stored, and its row's size.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TailCache::store(Record const &rec, unsigned const segment, uint64_t const offset, uint32_t const size)
+{
+    if (!enabled()) {
+        return;
+    }
+
+    entries_.push_back(Entry(rec, segment, offset, size));
+    entries_.back().rec.action = REC_ACT_REPLY;
+    entries_.back().rec.priv = 0;
+    evict();
+}
+
+
+void
+TailCache::evict(void)
+{
+    struct timeval limit = { 0, 0 };
+
+    if (maxSecs_ > 0  &&  !entries_.empty()) {
+        limit = entries_.back().rec.timestamp;
+        limit.tv_sec -= maxSecs_;
+    }
+
+    while (!entries_.empty()  &&  
+           ((maxRecs_ > 0  &&  entries_.size() > maxRecs_)  ||  timercmp(&entries_.front().rec.timestamp, &limit, < )))
+    {
+        if (timercmp(&entries_.front().rec.timestamp, &uncachedMax_, > )) {
+            uncachedMax_ = entries_.front().rec.timestamp;
+        }
+        entries_.pop_front();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Forget the Records of a segment that was deleted, and those before it.
+----------------------------------------------------------------------------*/
+void
+TailCache::dropSegment(unsigned const segment)
+{
+    while (!entries_.empty()  &&  entries_.front().segment <= segment) {
+        if (timercmp(&entries_.front().rec.timestamp, &uncachedMax_, > )) {
+            uncachedMax_ = entries_.front().rec.timestamp;
+        }
+        entries_.pop_front();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Forget everything, e.g. when cached Records failed to reach the disk.
+----------------------------------------------------------------------------*/
+void
+TailCache::invalidate(void)
+{
+    dropSegment(~0U);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell whether the cache has every Record that matches the reference.
+    Count a hit or a miss.
+----------------------------------------------------------------------------*/
+bool
+TailCache::covers(Record const &ref)
+{
+    if (timercmp(&ref.timestamp, &uncachedMax_, > )) {
+        ++stats_.hits;
+        return true;
+    }
+
+    ++stats_.misses;
+    return false;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Tell where in the log the oldest cached Record is.
+
+  Wants:
+    Destination for segment and offset.
+
+  Gives:
+    False if the cache is empty.
+----------------------------------------------------------------------------*/
+bool
+TailCache::start(unsigned &segment, uint64_t &offset) const
+{
+    if (entries_.empty()) {
+        return false;
+    }
+
+    segment = entries_.front().segment;
+    offset = entries_.front().offset;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send every cached Record matching the reference.
+
+  Wants:
+    Reference Record.
+    Handler to a function to use to send the replies.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+TailCache::send(Record const &ref, Sink::SendRecord_f const &send)
+{
+    for (std::deque<Entry>::const_iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        if (!it->rec.match(ref)) {
+            continue;
+        }
+
+        ++stats_.cacheRecs;
+        if (send(it->rec, ref.priv) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Hand every cached Record matching the reference to a function with
+    its place in the log, for queries that resume.
+
+  Wants:
+    Reference Record.
+    Function to call for the matching Records.
+
+  Gives:
+    True if all were handed, false if the function stopped.
+----------------------------------------------------------------------------*/
+bool
+TailCache::match(Record const &ref, Match_f const &hit)
+{
+    for (std::deque<Entry>::const_iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        if (!it->rec.match(ref)) {
+            continue;
+        }
+
+        ++stats_.cacheRecs;
+        if (!hit(it->rec, it->segment, it->offset, it->size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void
+TailCache::printStats(std::ostream &os) const
+{
+    os << "  Cache: " << entries_.size() << " records, " << stats_.hits << " hits, " << stats_.misses << " misses, " 
+        << stats_.cacheRecs << " records sent from memory" << std::endl;
+}
@@ -0,0 +1,100 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_TAIL_CACHE_HPP
+#define HOMEWORK_SERVER_TAIL_CACHE_HPP
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <deque>
+#include <iosfwd>
+#include "sink.hpp"
+#include "record.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    In-memory copy of the most recently stored Records, at most N of them
+    and none more than T seconds older than the newest. The cached Records
+    are always the tail of the log; each knows its segment, offset and size
+    in it.
+
+    A query newer than every Record that is not cached is answered from
+    memory alone. Other queries read the disk only up to where the cache
+    starts and take the rest from memory.
+----------------------------------------------------------------------------*/
+class TailCache
+{
+public:
+    // Gets a matching Record and its row's segment, offset and size, gives true to go on
+    typedef std::function<bool (Record const &rec, unsigned segment, uint64_t offset, uint32_t size)> Match_f;
+
+    TailCache();
+
+    void configure(size_t maxRecs, uint32_t maxSecs);
+    bool enabled(void) const { return maxRecs_ > 0  ||  maxSecs_ > 0; }
+
+    void store(Record const &rec, unsigned segment, uint64_t offset, uint32_t size);
+    void dropSegment(unsigned segment);
+    void invalidate(void);
+
+    bool covers(Record const &ref);
+    bool start(unsigned &segment, uint64_t &offset) const;
+    bool send(Record const &ref, Sink::SendRecord_f const &send);
+    bool match(Record const &ref, Match_f const &hit);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    struct Entry {
+        Entry(Record const &r, unsigned s, uint64_t o, uint32_t z) : rec(r), segment(s), offset(o), size(z) {}
+
+        Record rec;
+        unsigned segment;
+        uint64_t offset;
+        uint32_t size;      // Of the row
+    };
+
+    void evict(void);
+
+    size_t maxRecs_;
+    uint32_t maxSecs_;
+
+    std::deque<Entry> entries_;    // Oldest first
+    struct timeval uncachedMax_;   // Newest timestamp of Records not in cache
+
+    struct Stats {
+        Stats() : hits(0), misses(0), cacheRecs(0) {}
+
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t cacheRecs;   // Sent from memory
+    } stats_;
+};
+
+
+#endif  // HOMEWORK_SERVER_TAIL_CACHE_HPP
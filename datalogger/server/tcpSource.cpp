@@ -36,24 +36,43 @@ For more information, please refer to <http://unlicense.org>
 #include "tcpSource.hpp"
 #include "protocol.hpp"
 #include "observer.hpp"
+#include "fanOut.hpp"
+#include "writeBehind.hpp"
 
 
 /*---- Constructor ----------------------------------------------------------
   Does:
-    Just initialize some members.
+    Initialize members. Start the fan-out threads, if there are any, with
+    our send function. The write-behind thread is started by bindSink().
 ----------------------------------------------------------------------------*/
-TcpSource::TcpSource(Observer *const obs) : socket_(0), port_(0), stop_(false), fdmax_(0), observer_(obs) 
+TcpSource::TcpSource(Observer *const obs, FanOut *const fanOut, WriteBehind *const writer) 
+: socket_(0), port_(0), stop_(false), watchFd_(-1), fdmax_(0), statsRequested_(0), observer_(obs), fanOut_(fanOut), writer_(writer),
+  sendFunc_(std::bind(&TcpSource::sendToClient, this, std::placeholders::_1, std::placeholders::_2)),
+  batchFunc_(std::bind(&TcpSource::batchReply, this, std::placeholders::_1, std::placeholders::_2)), txSocket_(-1)
 {
     FD_ZERO(&readFds_);
+
+    if (fanOut_) {
+        fanOut_->start(std::bind(&TcpSource::sendToClient, this, std::placeholders::_1, std::placeholders::_2));
+    }
 }
 
 
 /*---- Destructor -----------------------------------------------------------
   Does:
-    Close the socket.
+    Stop the write-behind and fan-out threads that send through us, in this
+    order because the writer relays to fan-out. Close the socket.
 ----------------------------------------------------------------------------*/
 TcpSource::~TcpSource()
 { 
+    if (writer_) {
+        writer_->stop();
+    }
+
+    if (fanOut_) {
+        fanOut_->stop();
+    }
+
     if (socket_) {
         close(socket_); 
         std::cout << "Closed TCP port " << port_ << std::endl;
@@ -69,12 +88,14 @@ TcpSource::~TcpSource()
   
   Wants:
     Port number.
+    True to share the port with other listening sockets (SO_REUSEPORT),
+    that the kernel spreads the connections to.
     
   Gives: 
     True on success.
 ----------------------------------------------------------------------------*/
 bool
-TcpSource::open(int const port)
+TcpSource::open(int const port, bool const sharePort)
 {
     struct sockaddr_in sockaddr;
     int yes = 1;
@@ -100,6 +121,11 @@ TcpSource::open(int const port)
         std::cerr << "setsockopt error: " << strerror(errno) << std::endl;
         // Try to continue
     }
+
+    if (sharePort  &&  setsockopt(socket_, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        std::cerr << "Can't share port " << port << ": " << strerror(errno) << std::endl;
+        goto error;
+    }
     
     if (bind(socket_, (struct sockaddr *) &sockaddr, sizeof(sockaddr)) == -1) {
         std::cerr << "bind error: " << strerror(errno) << std::endl;
@@ -112,7 +138,9 @@ TcpSource::open(int const port)
     }
     
     port_ = port;
-    fdmax_ = socket_ + 1;
+    if (socket_ >= fdmax_) {
+        fdmax_ = socket_ + 1;
+    }
     FD_SET(socket_, &readFds_);
 
     std::cout << "Opened TCP port " << port_ << " in socket " << socket_ << std::endl;
@@ -129,12 +157,41 @@ error:
 }
 
 
+/*---- Function -------------------------------------------------------------
+  Does:
+    Add a file descriptor to the ones select() waits for. Only one can be
+    watched.
+
+  Wants:
+    File descriptor.
+    Function to call when it is readable. It must read what is there.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TcpSource::watch(int const fd, std::function<void(void)> const &onReady)
+{
+    watchFd_ = fd;
+    onWatch_ = onReady;
+
+    FD_SET(fd, &readFds_);
+    if (fd >= fdmax_) {
+        fdmax_ = fd + 1;
+    }
+}
+
+
 /*---- Function -------------------------------------------------------------
   Does:
     Block to listen the socket infinitely. This is the thread's loop.
     Accept incoming connections to the TCP socket.
     Receive data from clients from opened sockets.
     Manage the fd_set on connection open and close.
+    Call the watch function when its descriptor is readable.
+    Let the Sink commit everything received in one round, and tick it when
+    idle. In write-behind mode the writer thread does both, and a full
+    queue stops reading the clients until it has room.
   
   Wants:
     Nothing.
@@ -151,11 +208,21 @@ TcpSource::blockingListen(void)
 
 
     while (!stop_) {
+        if (writer_) {
+            writer_->waitForRoom();
+        }
+
+        struct timeval tick = { 0, IDLE_TICK_US };
         fdset = readFds_;
-        int selected = select(fdmax_, &fdset, NULL, NULL, NULL);
+        int selected = select(fdmax_, &fdset, NULL, NULL, flushRecords_  &&  !writer_ ? &tick : NULL);
         int const error = errno;
 
         if (-1 == selected) {
+            if (EINTR == error  &&  statsRequested_  &&  !stop_) {
+                statsRequested_ = 0;
+                reportStats();
+                continue;
+            }
             if (EINTR == error) {
                 std::cout << "Select caught signal" << std::endl;
                 return;
@@ -164,11 +231,20 @@ TcpSource::blockingListen(void)
             return;
         }
 
+        if (0 == selected) {
+            flushRecords_();
+            continue;
+        }
+
 
         for (i=0; i < fdmax_ && selected > 0; ++i)  if (FD_ISSET(i, &fdset)) {
             --selected;
 
-            if (i == socket_) {
+            if (i == watchFd_) {
+                onWatch_();
+            }
+
+            else if (i == socket_) {
                 socklen_t addrSize = sizeof(peerAddr);
                 int const peer = accept(socket_, (struct sockaddr *) &peerAddr, &addrSize);
                 
@@ -200,6 +276,10 @@ TcpSource::blockingListen(void)
             }
         }
 
+        if (flushRecords_  &&  !writer_) {
+            flushRecords_();
+        }
+
     }
 }
 
@@ -218,6 +298,7 @@ TcpSource::blockingListen(void)
 void
 TcpSource::onClientConnect(int const peer)
 {
+    std::lock_guard<std::mutex> guard(clientsLock_);
     bool const ret = clients_.insert(ClientMap_t::value_type(peer, ClientConnection())).second;
     if (!ret) {
         std::cerr << "BUG! Accepted socket that already existed" << std::endl;
@@ -247,11 +328,19 @@ TcpSource::onClientDisconnect(ClientMap_t::iterator const connIt)
 {
     int const peer = connIt->first;
 
-    if (observer_  &&  connIt->second.observerConnected) {
-        observer_->detachLurker(peer);
+    if (connIt->second.observerConnected) {
+        if (writer_) {
+            writer_->push(WriteBehind::Job(WriteBehind::Job::DETACH, peer));
+        }
+        else {
+            detachLurker(peer);
+        }
     }
 
-    clients_.erase(connIt);
+    {
+        std::lock_guard<std::mutex> guard(clientsLock_);
+        clients_.erase(connIt);
+    }
     FD_CLR(peer, &readFds_);
 
     if (peer == fdmax_ - 1) {
@@ -288,8 +377,8 @@ TcpSource::scanForStart(char const *const buffer, int const dataSize) const
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Read byte stream from client and deserialize it to Record structure.
-    Pass the Record to the Sink for processing.
+    Read byte stream from client and deserialize it to Record structures.
+    Pass the Records to the Sink for processing, all of one recv() together.
   
   Wants:
     Socket number.
@@ -303,9 +392,6 @@ TcpSource::scanForStart(char const *const buffer, int const dataSize) const
 int
 TcpSource::recvFromClient(int const socket, ClientConnection &conn)
 {
-    // Optimize by saving const bind to TcpSource::sendToClient
-    static Sink::SendRecord_f const sendFunc(std::bind(&TcpSource::sendToClient, this, std::placeholders::_1, std::placeholders::_2));
-
     int ret;
     int bytes = recv(socket, conn.rxBuffer + conn.rxPos, RX_BUFFER_SIZE - conn.rxPos, 0);
 
@@ -358,68 +444,279 @@ TcpSource::recvFromClient(int const socket, ClientConnection &conn)
             continue;
         }
 
-        
-        // Store the Record to Observer or to Sink
-        if (REC_ACT_OBSERVE == rec.action) {
-            if (observer_) {
-                observer_->attachLurker(rec, socket);
-                conn.observerConnected = true;
-            }
+        rxRecs_.push_back(std::move(rec));
+    }
+
+    handleRecs(socket, conn);
+
+
+    // Move the unhandled data to the start of the buffer
+    int const moveBytes = bytes - conn.rxPos;
+    memmove(conn.rxBuffer, conn.rxBuffer + conn.rxPos, moveBytes);
+    conn.rxPos = moveBytes;
+
+    return 1;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Handle the Records decoded from one recv(), in order. Every run of
+    stores goes to the Sink as one batch, except in write-behind mode
+    where the writer thread makes the batches.
+
+  Wants:
+    Client socket's number.
+    Reference to client's Connection structure.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TcpSource::handleRecs(int const socket, ClientConnection &conn)
+{
+    size_t const count = rxRecs_.size();
+    size_t i = 0;
+
+
+    while (i < count) {
+        if (writer_  ||  REC_ACT_STORE != rxRecs_[i].action) {
+            handleRec(rxRecs_[i++], socket, conn);
+            continue;
+        }
+
+        size_t end = i;
+        while (end < count  &&  REC_ACT_STORE == rxRecs_[end].action) {
+            rxRecs_[end++].priv = socket;
+        }
+
+        rxRets_.resize(end - i);
+        storeRecs(&rxRecs_[i], end - i, &rxRets_[0], NULL);
+        i = end;
+    }
+
+    rxRecs_.clear();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Store Records received together with one call to the Sink, and relay
+    the stored ones to Observers or move them to be relayed later.
+
+  Wants:
+    Records and their count. They are moved from if there is toRelay.
+    Room for the Sink's result of every Record.
+    Destination for the Records to relay, or NULL to relay them now.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TcpSource::storeRecs(Record const *const recs, size_t const count, int *const rets, std::vector<Record> *const toRelay)
+{
+    if (processRecords_(recs, count, rets, batchFunc_) <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (1 != rets[i]) {
+            continue;
+        }
+
+        if (toRelay) {
+            toRelay->push_back(std::move(const_cast<Record &>(recs[i])));
         }
         else {
-            rec.priv = socket;
-            if (processRecord_(rec, sendFunc) == 1  &&  observer_) {
-                observer_->relayRec(rec, sendFunc);
+            relayRec(recs[i], sendFunc_);
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Store the Record to Observer or to Sink, or queue it to the writer
+    thread in write-behind mode.
+
+  Wants:
+    Received Record. It may be moved from.
+    Client socket's number.
+    Reference to client's Connection structure.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TcpSource::handleRec(Record &rec, int const socket, ClientConnection &conn)
+{
+    if (REC_ACT_OBSERVE == rec.action) {
+        if (observer_  ||  fanOut_) {
+            if (writer_) {
+                writer_->push(WriteBehind::Job(WriteBehind::Job::OBSERVE, socket, std::move(rec)));
             }
+            else {
+                catchUpObserver(rec, socket);
+                attachLurker(rec, socket);
+            }
+            conn.observerConnected = true;
+        }
+    }
+    else if (writer_) {
+        WriteBehind::Job::Type const type = REC_ACT_STORE == rec.action ? WriteBehind::Job::STORE : WriteBehind::Job::QUERY;
+        writer_->push(WriteBehind::Job(type, socket, std::move(rec)));
+    }
+    else {
+        rec.priv = socket;
+        if (answerQuery(rec, socket, rec.query()) == 1) {
+            relayRec(rec, sendFunc_);
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Start the write-behind thread, if there is one, once the Sink is bound.
+    The writer runs all Sink and Observer calls, so they stay in one thread
+    as without it, and only the committed Records are relayed.
+
+  Wants:
+    Nothing.
 
-            if (REC_ACT_GET_AFTER == rec.action) {
-                sendEmptyRecord(socket);
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TcpSource::startWriter(void)
+{
+    if (!writer_  ||  writer_->started()) {
+        return;
+    }
+
+    WriteBehind::Execute_f const execute = [this] (WriteBehind::Job &job) -> bool {
+        Record &rec = job.rec;
+        int const socket = (int) job.priv;
+        bool relay = false;
+
+        rec.priv = job.priv;
+
+        switch (job.type) {
+        case WriteBehind::Job::STORE:
+        case WriteBehind::Job::QUERY:
+            relay = answerQuery(rec, socket, rec.query()) == 1;
+            break;
+
+        case WriteBehind::Job::OBSERVE:
+            catchUpObserver(rec, socket);
+            attachLurker(rec, socket);
+            break;
+
+        case WriteBehind::Job::DETACH:
+            detachLurker(socket);
+            break;
+
+        case WriteBehind::Job::STATS:
+            if (statsReporter_) {
+                statsReporter_();
             }
+            break;
         }
+
+        return relay;
+    };
+
+    WriteBehind::Store_f const store = [this] (std::vector<Record> &recs, std::vector<Record> &toRelay) {
+        writerRets_.resize(recs.size());
+        storeRecs(&recs[0], recs.size(), &writerRets_[0], &toRelay);
+    };
+
+    Sink::FlushRecords_f const flush = flushRecords_;
+    writer_->start(execute, store, 
+                   [flush] () { if (flush) flush(); }, 
+                   [this] (Record const &rec) { relayRec(rec, sendFunc_); });
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print the statistics now, or from the writer thread in write-behind
+    mode so that the Sink is not read while it is written.
+----------------------------------------------------------------------------*/
+void
+TcpSource::reportStats(void)
+{
+    if (writer_  &&  writer_->started()) {
+        writer_->push(WriteBehind::Job(WriteBehind::Job::STATS, 0));
     }
+    else if (statsReporter_) {
+        statsReporter_();
+    }
+}
 
 
-    // Move the unhandled data to the start of the buffer
-    int const moveBytes = bytes - conn.rxPos;
-    memmove(conn.rxBuffer, conn.rxBuffer + conn.rxPos, moveBytes);
-    conn.rxPos = moveBytes;
+/*---- Function -------------------------------------------------------------
+  Does:
+    Replay the history of an OBSERVE request that carries a start timestamp.
+    Records newer than the timestamp are sent from the Sink as replies before
+    the Lurker is attached.
+
+    Stores are processed in this same thread, so nothing can be stored
+    between the scan and attachLurker(): every Record is delivered either
+    from history or from the live stream, never both and never neither.
+    In write-behind mode this is the writer thread, and the batch before
+    is committed and relayed first.
+    With fan-out threads the attachment is queued behind every Record
+    relayed so far, which keeps the same guarantee. The replies are sent
+    in batches, all of them before the Lurker is attached.
 
-    return 1;
+  Wants:
+    OBSERVE Record.
+    Client socket's number.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TcpSource::catchUpObserver(Record const &rec, int const socket)
+{
+    if (0 == rec.timestamp.tv_sec  &&  0 == rec.timestamp.tv_usec) {
+        return;
+    }
+
+    Record history(rec);
+    history.action = REC_ACT_GET_AFTER;
+    history.priv = socket;
+
+    if (answerQuery(history, socket, false) < 0) {
+        std::cerr << "History replay failed for observer in socket " << socket << std::endl;
+    }
 }
 
 
 /*---- Function -------------------------------------------------------------
   Does:
-    Serialize one Record to buffer and send it to client's socket. 
+    Serialize one Record to buffer, preceded by the start marker.
   
   Wants:
+    Destination buffer and its size.
     Record structure.
-    Private data containing handle (client socket's number) to the peer's
-    data.
     
   Gives: 
-    True on success.
+    Number of bytes written, or
+    -1 if the Record does not fit.
 ----------------------------------------------------------------------------*/
 int
-TcpSource::sendToClient(Record const &rec, uint64_t const priv) const
+TcpSource::frameRecord(char *const buffer, int const size, Record const &rec) const
 {
-    int const socket = (int) priv;
-
-    ClientMap_t::const_iterator const cl = clients_.find(socket);
-    if (clients_.end() == cl) {
-        std::cerr << "Connection to client in socket " << socket << " does not exist" << std::endl;
-        return -1;
-    }
-
     Protocol p;
-    char buffer[150];
 
     // This is to suppress warning "dereferencing type-punned pointer will break strict-aliasing rules"
     // when casting char[] to uint16_t*
     struct StartWordInserter { StartWordInserter (void *const ptr) { *((uint16_t *) ptr) = htons(DATA_START_WORD); } };
     StartWordInserter s(buffer);
     
-    int const bytes = p.serialize(buffer + sizeof(DATA_START_WORD), sizeof(buffer) - sizeof(DATA_START_WORD), rec);
+    int const bytes = p.serialize(buffer + sizeof(DATA_START_WORD), size - sizeof(DATA_START_WORD), rec);
     if (bytes < 0) {
         std::cerr << "Error in serialize. Buffer overflow?" << std::endl;
         return -1;
@@ -429,20 +726,199 @@ TcpSource::sendToClient(Record const &rec, uint64_t const priv) const
 // for (int i=0; i<bytes; ++i) fprintf(stderr, " %02X", (unsigned char) buffer[i]);
 // fprintf(stderr, "\n");
 
-    int const ret = send(socket, buffer, bytes + sizeof(DATA_START_WORD), 0);
-    if (ret < 0) {
-        std::cerr << "Error in send: " << strerror(errno) << std::endl;
-        return -1;
+    return bytes + sizeof(DATA_START_WORD);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send bytes to client's socket, all of them, under the socket's lock.
+  
+  Wants:
+    Client socket's number.
+    Bytes and their count.
+    
+  Gives: 
+    0 on success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+TcpSource::sendBytes(int const socket, char const *const bytes, size_t const size) const
+{
+    std::shared_ptr<std::mutex> txLock;
+
+    {
+        std::lock_guard<std::mutex> guard(clientsLock_);
+        ClientMap_t::const_iterator const cl = clients_.find(socket);
+        if (clients_.end() == cl) {
+            std::cerr << "Connection to client in socket " << socket << " does not exist" << std::endl;
+            return -1;
+        }
+        txLock = cl->second.txLock;
+    }
+
+    std::lock_guard<std::mutex> guard(*txLock);
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t const ret = send(socket, bytes + done, size - done, 0);
+        if (ret < 0  &&  EINTR == errno) {
+            continue;
+        }
+        if (ret < 0) {
+            std::cerr << "Error in send: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        done += ret;
     }
 
     return 0;
 }
 
 
+/*---- Function -------------------------------------------------------------
+  Does:
+    Serialize one Record to buffer and send it to client's socket.
+  
+  Wants:
+    Record structure.
+    Private data containing handle (client socket's number) to the peer's
+    data.
+    
+  Gives: 
+    0 on success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+TcpSource::sendToClient(Record const &rec, uint64_t const priv) const
+{
+    char buffer[TX_RECORD_MAX];
+    int const bytes = frameRecord(buffer, sizeof(buffer), rec);
+
+    if (bytes < 0) {
+        return -1;
+    }
+
+    return sendBytes((int) priv, buffer, bytes);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Reply sink of the query being answered: serialize the reply to the
+    batch, and send the batch when it is full or another client's.
+  
+  Wants:
+    Record structure.
+    Client socket's number.
+    
+  Gives: 
+    0 on success, or
+    -1 on failure.
+----------------------------------------------------------------------------*/
+int
+TcpSource::batchReply(Record const &rec, uint64_t const priv)
+{
+    int const socket = (int) priv;
+    int ret = 0;
+
+
+    if (socket != txSocket_  ||  txBatch_.size() + TX_RECORD_MAX > TX_BATCH_SIZE) {
+        ret = flushReplies();
+        txSocket_ = socket;
+    }
+
+    size_t const at = txBatch_.size();
+    txBatch_.resize(at + TX_RECORD_MAX);
+
+    int const bytes = frameRecord(&txBatch_[at], TX_RECORD_MAX, rec);
+    txBatch_.resize(at + (bytes > 0 ? bytes : 0));
+
+    return bytes < 0 ? -1 : ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Send the replies batched so far with one send().
+----------------------------------------------------------------------------*/
 int
-TcpSource::sendEmptyRecord(int const socket) const
+TcpSource::flushReplies(void)
+{
+    if (txBatch_.empty()) {
+        return 0;
+    }
+
+    int const ret = sendBytes(txSocket_, &txBatch_[0], txBatch_.size());
+    txBatch_.clear();
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run a request through the Sink and send its replies in batches, ended
+    with an empty Record if the request is a query.
+  
+  Wants:
+    Record's data.
+    Client socket's number.
+    True to end the answer with an empty Record.
+    
+  Gives: 
+    The Sink's result.
+----------------------------------------------------------------------------*/
+int
+TcpSource::answerQuery(Record const &rec, int const socket, bool const terminate)
 {
     static Record const emptyRec(REC_ACT_REPLY);
+    int const ret = processRecord_(rec, batchFunc_);
 
-    return sendToClient(emptyRec, socket);
+    if (terminate) {
+        batchReply(emptyRec, socket);
+    }
+    flushReplies();
+
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Route Observer calls either to the fan-out threads or to the Observer
+    that runs in this thread.
+----------------------------------------------------------------------------*/
+void
+TcpSource::attachLurker(Record const &rec, int const socket)
+{
+    if (fanOut_) {
+        fanOut_->attachLurker(rec, socket);
+    }
+    else if (observer_) {
+        observer_->attachLurker(rec, socket);
+    }
+}
+
+
+void
+TcpSource::detachLurker(int const socket)
+{
+    if (fanOut_) {
+        fanOut_->detachLurker(socket);
+    }
+    else if (observer_) {
+        observer_->detachLurker(socket);
+    }
+}
+
+
+void
+TcpSource::relayRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    if (fanOut_) {
+        fanOut_->relayRec(rec);
+    }
+    else if (observer_) {
+        observer_->relayRec(rec, send);
+    }
 }
@@ -28,10 +28,18 @@ For more information, please refer to <http://unlicense.org>
 #ifndef HOMEWORK_SERVER_TCP_SOURCE_HPP
 #define HOMEWORK_SERVER_TCP_SOURCE_HPP
 
+#include <signal.h>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "sink.hpp"
+#include "record.hpp"
 
 class Observer;
+class FanOut;
+class WriteBehind;
 
 
 /*---- Class ----------------------------------------------------------------
@@ -42,19 +50,33 @@ class Observer;
 class TcpSource
 {
 public:
-    TcpSource(Observer *obs = NULL);
+    TcpSource(Observer *obs = NULL, FanOut *fanOut = NULL, WriteBehind *writer = NULL);
     ~TcpSource();
 
-    bool open(int port);
+    bool open(int port, bool sharePort = false);
+    int listenSocket(void) const { return socket_; }
     void blockingListen(void);
     void stop(void) { stop_ = true; }
 
+    // Call onReady in the listening thread whenever fd is readable, e.g. an eventfd another thread wakes us with
+    void watch(int fd, std::function<void(void)> const &onReady);
+
+    // Relay a Record stored elsewhere to the Observers, in the listening thread
+    void relay(Record const &rec) { relayRec(rec, sendFunc_); }
+
+    // Signal safe: the report is printed by the listening thread
+    void requestStats(void) { statsRequested_ = true; }
+    void setStatsReporter(std::function<void(void)> const &f) { statsReporter_ = f; }
+
     //
     // This is for optimization purpose and niftyness. We could also save the sink pointer and refer to
     // pSink->impl()->write().
     //
     void bindSink(Sink *const sink) {
         processRecord_ = sink->processRecFunc();
+        processRecords_ = sink->processRecsFunc();
+        flushRecords_ = sink->flushFunc();
+        startWriter();
     }
 
     typedef std::function<void(Record const &)> RecordSend_f;
@@ -64,19 +86,22 @@ private:
     // Data start delimeter for TCP stream
     #define DATA_START_WORD  ((uint16_t) 0x5A5A)
     #define RX_BUFFER_SIZE   1500
+    #define IDLE_TICK_US     100000
+    #define TX_RECORD_MAX    (150 + REC_MINSIZE + REC_CURSOR_MAX)   // Serialized Record with start marker
+    #define TX_BATCH_SIZE    65536
 
     /*---- Struct ---------------------------------------------------------------
       Does:
         Contains peer data (receive buffer) of a client connectee.
     ----------------------------------------------------------------------------*/
     struct ClientConnection {
-        ClientConnection() : rxBuffer(new char[RX_BUFFER_SIZE]), rxPos(0), observerConnected(false) {}
+        ClientConnection() : rxBuffer(new char[RX_BUFFER_SIZE]), rxPos(0), observerConnected(false), txLock(new std::mutex) {}
         
         // Prevent to use copy constructor by coder's mistake
         ClientConnection(ClientConnection const &) { abort(); }
 
         // Move constructor is the preferred method: Steal the buffer from the copy source.
-        ClientConnection(ClientConnection &&rhs) : rxBuffer(rhs.rxBuffer), rxPos(0) {
+        ClientConnection(ClientConnection &&rhs) : rxBuffer(rhs.rxBuffer), rxPos(0), observerConnected(rhs.observerConnected), txLock(std::move(rhs.txLock)) {
             rhs.rxBuffer = NULL;
         }
 
@@ -87,30 +112,71 @@ private:
         int rxPos;
 
         bool observerConnected;
+
+        // Fan-out threads may send to the same socket concurrently
+        std::shared_ptr<std::mutex> txLock;
     };
 
     typedef std::map<int, ClientConnection> ClientMap_t;
     ClientMap_t clients_;
+    mutable std::mutex clientsLock_;  // Held when clients_ is modified or read outside the listening thread
 
     void onClientConnect(int peer);
     void onClientDisconnect(ClientMap_t::iterator connIt);
 
     int scanForStart(char const *buffer, int dataSize) const;
     int recvFromClient(int socket, ClientConnection &conn);
+    void catchUpObserver(Record const &rec, int socket);
+    int frameRecord(char *buffer, int size, Record const &rec) const;
+    int sendBytes(int socket, char const *bytes, size_t size) const;
     int sendToClient(Record const &, uint64_t const priv) const;
-    int sendEmptyRecord(int socket) const;
+    int batchReply(Record const &rec, uint64_t priv);
+    int flushReplies(void);
+    int answerQuery(Record const &rec, int socket, bool terminate);
+
+    void attachLurker(Record const &rec, int socket);
+    void detachLurker(int socket);
+    void relayRec(Record const &rec, Sink::SendRecord_f const &send);
+
+    void startWriter(void);
+    void handleRecs(int socket, ClientConnection &conn);
+    void handleRec(Record &rec, int socket, ClientConnection &conn);
+    void storeRecs(Record const *recs, size_t count, int *rets, std::vector<Record> *toRelay);
+    void reportStats(void);
 
 
     int socket_;
     int port_;
-    bool stop_;
+    std::atomic<bool> stop_;
+
+    int watchFd_;
+    std::function<void(void)> onWatch_;
 
     fd_set readFds_;
     int fdmax_;
 
+    volatile sig_atomic_t statsRequested_;
+    std::function<void(void)> statsReporter_;
+
     Sink::ProcessRecord_f processRecord_;
+    Sink::ProcessRecords_f processRecords_;
+    Sink::FlushRecords_f flushRecords_;
 
     Observer *const observer_;
+    FanOut *const fanOut_;
+    WriteBehind *const writer_;
+
+    Sink::SendRecord_f sendFunc_;
+
+    // Records decoded from one recv() and the Sink's results for them. Network thread only.
+    std::vector<Record> rxRecs_;
+    std::vector<int> rxRets_;
+    std::vector<int> writerRets_;   // Writer thread's
+
+    // Replies to the query being answered, sent together. Only the thread that runs the Sink uses them.
+    Sink::SendRecord_f batchFunc_;
+    std::vector<char> txBatch_;
+    int txSocket_;
 };
 
 
@@ -0,0 +1,375 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#include <stdlib.h>
+#include <iostream>
+#include "teeSink.hpp"
+
+
+// Default length of each child's queue, in Records
+#define DEFAULT_QUEUE_SIZE  65536
+
+
+/*---- Singleton ------------------------------------------------------------
+  Does:
+    Register the sink to sinkManager on application startup.
+----------------------------------------------------------------------------*/
+static TeeSink const *sinkSingleton = new TeeSink;
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. Children are added by addChild().
+----------------------------------------------------------------------------*/
+TeeSinkImpl::TeeSinkImpl()
+{
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Stop the threads and release the children's state. The child Sinks
+    themselves are singletons closed by SinkManager.
+----------------------------------------------------------------------------*/
+TeeSinkImpl::~TeeSinkImpl()
+{
+    stop();
+
+    for (size_t i = 0; i < children_.size(); ++i) {
+        delete children_[i].worker;
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Open a registered Sink as a child. The first child is the primary.
+
+  Wants:
+    Sink's name and its OPTS.
+    Length of its queue.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+TeeSinkImpl::addChild(std::string const &name, std::string const &opts, size_t const queueSize)
+{
+    Sink *const sink = "tee" == name ? NULL : SINKMGR.sinkGet(name);
+
+    if (!sink) {
+        std::cerr << "Sink '" << name << "' can't be a tee child" << std::endl;
+        return false;
+    }
+
+    if (!sink->open(opts)) {
+        std::cerr << "Can't open tee child '" << name << "'" << std::endl;
+        return false;
+    }
+
+    Child const c = { sink, new SinkWorker(name, sink->processRecsFunc(), sink->flushFunc(), queueSize) };
+    children_.push_back(c);
+
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Start the children's threads.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+TeeSinkImpl::start(void)
+{
+    bool ok = !children_.empty();
+
+    for (size_t i = 0; i < children_.size(); ++i) {
+        ok = children_[i].worker->start()  &&  ok;
+    }
+
+    return ok;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop the children's threads. Records still queued are written and
+    flushed first.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TeeSinkImpl::stop(void)
+{
+    for (size_t i = 0; i < children_.size(); ++i) {
+        children_[i].worker->stop();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process record received from client. Stores are queued to every child
+    and give the primary's result once it has stored them, anything else
+    is run by the primary.
+  
+  Wants:
+    Record's data.
+    Handler to a function to use to send the reply.
+    
+  Gives: 
+    Primary's result.
+----------------------------------------------------------------------------*/
+int
+TeeSinkImpl::processRec(Record const &rec, Sink::SendRecord_f const &send)
+{
+    if (REC_ACT_STORE != rec.action) {
+        Sink::ProcessRecord_f const process = children_[0].sink->processRecFunc();
+        int ret = -1;
+
+        children_[0].worker->call([&process, &rec, &send, &ret] () { ret = process(rec, send); });
+        return ret;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 1; i < children_.size(); ++i) {
+        children_[i].worker->store(rec, now);
+    }
+
+    int ret = -1;
+    children_[0].worker->store(rec, now, &ret);
+    children_[0].worker->wait();
+    return ret;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Process Records received together. Every run of stores is queued to
+    every child as one batch, and gives the primary's results once it has
+    stored it. Anything else is processed one by one.
+  
+  Wants:
+    Records and their count.
+    Destination for every Record's result, as processRec() gives it.
+    Handler to a function to use to send the replies.
+    
+  Gives:
+    Number of Records stored.
+----------------------------------------------------------------------------*/
+int
+TeeSinkImpl::processRecs(Record const *const recs, size_t const count, int *const rets, Sink::SendRecord_f const &send)
+{
+    int stored = 0;
+    size_t i = 0;
+
+
+    while (i < count) {
+        if (REC_ACT_STORE != recs[i].action) {
+            rets[i] = processRec(recs[i], send);
+            stored += 1 == rets[i];
+            ++i;
+            continue;
+        }
+
+        size_t end = i;
+        while (end < count  &&  REC_ACT_STORE == recs[end].action) {
+            ++end;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        for (size_t c = 1; c < children_.size(); ++c) {
+            children_[c].worker->store(std::vector<Record>(recs + i, recs + end), now);
+        }
+
+        children_[0].worker->store(std::vector<Record>(recs + i, recs + end), now, rets + i);
+        children_[0].worker->wait();
+
+        for (; i < end; ++i) {
+            stored += 1 == rets[i];
+        }
+    }
+
+    return stored;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    End of a batch of Records. Every child flushes it in its own time, and
+    the primary before we return.
+----------------------------------------------------------------------------*/
+void
+TeeSinkImpl::flush(void)
+{
+    for (size_t i = 1; i < children_.size(); ++i) {
+        children_[i].worker->flush();
+    }
+
+    Sink::FlushRecords_f const flush = children_[0].sink->flushFunc();
+    children_[0].worker->call([&flush] () { if (flush) flush(); });
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print every child's queue depth, lag and errors, and the child's own
+    statistics, which it prints in its thread.
+
+  Wants:
+    Output stream.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+TeeSinkImpl::printStats(std::ostream &os) const
+{
+    os << "Tee: " << children_.size() << " children, primary " << (children_.empty() ? "none" : children_[0].worker->name()) << std::endl;
+
+    for (size_t i = 0; i < children_.size(); ++i) {
+        children_[i].worker->printStats(os);
+    }
+
+    for (size_t i = 0; i < children_.size(); ++i) {
+        Sink const *const sink = children_[i].sink;
+        children_[i].worker->call([sink, &os] () { sink->printStats(os); });
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop the children's threads before SinkManager closes the children.
+    Registered after SinkManager's own atexit(), so it runs before it.
+----------------------------------------------------------------------------*/
+void
+TeeSink::stopAtExit(void)
+{
+    if (sinkSingleton  &&  sinkSingleton->pImpl_) {
+        sinkSingleton->pImpl_->stop();
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Allocate implementation for Tee sink and open its children. Allow only
+    one instance.
+
+    Children are listed by name, each followed by its own options:
+    NAME[:OPTS] starts a child, and KEY=VALUE items after it belong to it.
+    KEY=VALUE items before the first child are Tee's own.
+      
+  Wants:
+    Options: [queue=N,]SINK[:OPTS][,KEY=VALUE...],SINK[:OPTS]...
+
+  Gives: 
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+TeeSink::open(std::string const &opts)
+{
+    std::vector<std::pair<std::string, std::string> > children;
+    long queueSize = DEFAULT_QUEUE_SIZE;
+    std::string::size_type start = 0;
+
+
+    if (pImpl_) {
+        return false;
+    }
+
+    while (start < opts.length()) {
+        std::string::size_type end = opts.find(',', start);
+        if (opts.npos == end) {
+            end = opts.length();
+        }
+
+        std::string const item(opts, start, end - start);
+        std::string const name(item, 0, item.find(':'));
+        start = end + 1;
+
+        if (name.npos == name.find('=')  &&  SINKMGR.sinkGet(name)) {
+            std::string::size_type const colon = item.find(':');
+            children.push_back(std::make_pair(name, colon == item.npos ? "" : item.substr(colon + 1)));
+        }
+        else if (item.npos != item.find('=')  &&  !children.empty()) {
+            std::string &childOpts = children.back().second;
+            childOpts += childOpts.empty() ? "" : ",";
+            childOpts += item;
+        }
+        else if (0 == item.compare(0, 6, "queue=")) {
+            queueSize = strtol(item.c_str() + 6, NULL, 0);
+        }
+        else if (item.length() > 0) {
+            std::cerr << "Unknown tee option or sink '" << item << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (children.empty()) {
+        std::cerr << "Tee needs at least one child sink" << std::endl;
+        return false;
+    }
+
+    if (queueSize < 2  ||  queueSize > (1 << 24)) {
+        std::cerr << "Invalid tee queue size " << queueSize << std::endl;
+        return false;
+    }
+
+    if (NULL == (pImpl_ = new TeeSinkImpl)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < children.size(); ++i) {
+        if (!pImpl_->addChild(children[i].first, children[i].second, queueSize)) {
+            return false;
+        }
+    }
+
+    pImpl_->start();
+    atexit(&stopAtExit);
+
+    std::cout << "Opened sink: Tee to " << children.size() << " sinks, primary " << children[0].first 
+        << ", queue " << queueSize << std::endl;
+    return true;
+}
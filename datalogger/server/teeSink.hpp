@@ -0,0 +1,123 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_TEE_SINK_HPP
+#define HOMEWORK_SERVER_TEE_SINK_HPP
+
+#include <string>
+#include <vector>
+#include "sink.hpp"
+#include "sinkWorker.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Implement Tee Sink functionality: write every Record to several other
+    registered Sinks. Each child Sink runs in its own thread and is fed
+    through its own lock-free queue, so the children write concurrently
+    and a slow one does not hold up the others until its queue is full.
+
+    The first child is the primary. Queries are answered by it alone, in
+    its thread, after everything queued before them. Stores give the
+    primary's results, once it has stored them, and the end of a batch
+    waits until the primary has flushed it. The other children may lag
+    behind, and their failures only show in their statistics.
+
+    Records received together are queued to each child as one job and
+    stored with one call to its batch processing.
+
+    A child is only called from its own thread, so the Sinks need no
+    locking.
+----------------------------------------------------------------------------*/
+class TeeSinkImpl
+{
+public:
+    TeeSinkImpl();
+    ~TeeSinkImpl();
+
+    bool addChild(std::string const &name, std::string const &opts, size_t queueSize);
+    bool start(void);
+    void stop(void);
+
+    int processRec(Record const &rec, Sink::SendRecord_f const &send);
+    int processRecs(Record const *recs, size_t count, int *rets, Sink::SendRecord_f const &send);
+    void flush(void);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    // No copying
+    TeeSinkImpl(TeeSinkImpl const &);
+    TeeSinkImpl &operator = (TeeSinkImpl const &);
+
+    struct Child {
+        Sink *sink;
+        SinkWorker *worker;
+    };
+
+    std::vector<Child> children_;
+};
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Intended to be used as singleton.
+    Is fired up on application start. Registers its name to SinkManager 
+    upon construction.
+----------------------------------------------------------------------------*/
+class TeeSink : public Sink
+{
+public:
+    TeeSink() : Sink("tee"), pImpl_(NULL) {}
+    virtual ~TeeSink() { if (pImpl_) delete pImpl_; }
+
+    virtual bool open(std::string const &opts);
+    
+    TeeSinkImpl const *impl(void) const { return pImpl_; }
+
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Creates binding to implementation's functions.
+    ----------------------------------------------------------------------------*/
+    virtual ProcessRecord_f processRecFunc(void) const { return std::bind(&TeeSinkImpl::processRec, pImpl_, std::placeholders::_1, std::placeholders::_2); }
+    virtual ProcessRecords_f processRecsFunc(void) const { 
+        return std::bind(&TeeSinkImpl::processRecs, pImpl_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, 
+                         std::placeholders::_4); 
+    }
+    virtual FlushRecords_f flushFunc(void) const { return std::bind(&TeeSinkImpl::flush, pImpl_); }
+
+    virtual void printStats(std::ostream &os) const { if (pImpl_) pImpl_->printStats(os); }
+
+private:
+    static void stopAtExit(void);
+
+    TeeSinkImpl *pImpl_;
+};
+
+
+#endif  // HOMEWORK_SERVER_TEE_SINK_HPP
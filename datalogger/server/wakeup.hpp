@@ -0,0 +1,112 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+
+#ifndef HOMEWORK_SERVER_WAKEUP_HPP
+#define HOMEWORK_SERVER_WAKEUP_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Let threads sleep until a condition that others make true without a
+    lock, like a lock-free queue running non-empty. Sleepers announce
+    themselves before their last check of the condition, and notify()
+    takes the lock only when someone has announced, so a busy producer
+    never touches it.
+
+    Both sides fence between their store and their load: the waker between
+    making the condition true and reading the sleeper count, the sleeper
+    between announcing and checking the condition. At least one of them
+    then sees the other's store, so a wakeup can not be lost.
+----------------------------------------------------------------------------*/
+class Wakeup
+{
+public:
+    Wakeup() : sleepers_(0) {}
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Wake the sleepers, if any. Call after making the condition true.
+    ----------------------------------------------------------------------------*/
+    void notify(void)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> guard(lock_);
+            wakeup_.notify_all();
+        }
+    }
+
+    /*---- Function -------------------------------------------------------------
+      Does:
+        Sleep until the condition holds or the timeout passes.
+
+      Wants:
+        Condition, called with the lock held.
+        Timeout in milliseconds, 0 for none.
+
+      Gives:
+        False if the timeout passed with the condition still false.
+    ----------------------------------------------------------------------------*/
+    template <typename Ready_f>
+    bool wait(Ready_f const &ready, unsigned const timeoutMs = 0)
+    {
+        bool woken = true;
+
+        sleepers_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            if (timeoutMs > 0) {
+                woken = wakeup_.wait_for(guard, std::chrono::milliseconds(timeoutMs), ready);
+            }
+            else {
+                wakeup_.wait(guard, ready);
+            }
+        }
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+
+        return woken;
+    }
+
+private:
+    // No copying
+    Wakeup(Wakeup const &);
+    Wakeup &operator = (Wakeup const &);
+
+    std::atomic<unsigned> sleepers_;
+    std::mutex lock_;
+    std::condition_variable wakeup_;
+};
+
+
+#endif  // HOMEWORK_SERVER_WAKEUP_HPP
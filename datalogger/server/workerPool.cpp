@@ -0,0 +1,181 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include "workerPool.hpp"
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Start the threads.
+----------------------------------------------------------------------------*/
+WorkerPool::WorkerPool(unsigned const threads) : batch_(0), pending_(0), stop_(false), steals_(0)
+{
+    for (unsigned i = 0; i < (threads > 0 ? threads : 1); ++i) {
+        workers_.push_back(new Worker);
+    }
+
+    for (unsigned i = 0; i < workers_.size(); ++i) {
+        workers_[i]->thread = std::thread(&WorkerPool::work, this, i);
+    }
+}
+
+
+/*---- Destructor -----------------------------------------------------------
+  Does:
+    Stop and join the threads.
+----------------------------------------------------------------------------*/
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    wakeup_.notify_all();
+
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->thread.join();
+        delete workers_[i];
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Run a batch of tasks and wait for all of them to finish.
+
+  Wants:
+    Tasks. They are moved out of the vector.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WorkerPool::run(std::vector<Task_f> &tasks)
+{
+    if (tasks.empty()) {
+        return;
+    }
+
+    // Set before dealing: a thread still busy with the previous batch may
+    // take a task right away
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        pending_ = tasks.size();
+    }
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        Worker &w = *workers_[i % workers_.size()];
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.tasks.push_back(std::move(tasks[i]));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        ++batch_;
+    }
+    wakeup_.notify_all();
+
+    std::unique_lock<std::mutex> guard(lock_);
+    done_.wait(guard, [this] { return 0 == pending_; });
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Take a task from the front of own deque, or steal one from the back of
+    another thread's.
+
+  Wants:
+    Index of the calling thread.
+    Destination for the task.
+
+  Gives:
+    True if a task was found.
+----------------------------------------------------------------------------*/
+bool
+WorkerPool::take(unsigned const self, Task_f &task)
+{
+    for (unsigned i = 0; i < workers_.size(); ++i) {
+        Worker &w = *workers_[(self + i) % workers_.size()];
+        std::lock_guard<std::mutex> guard(w.lock);
+
+        if (!w.tasks.empty()) {
+            if (0 == i) {
+                task = std::move(w.tasks.front());
+                w.tasks.pop_front();
+            }
+            else {
+                task = std::move(w.tasks.back());
+                w.tasks.pop_back();
+                ++steals_;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Thread's main loop: sleep until a batch is dealt, then run tasks until
+    none are left anywhere.
+
+  Wants:
+    Index of the thread.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WorkerPool::work(unsigned const self)
+{
+    uint64_t seen = 0;
+    Task_f task;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            wakeup_.wait(guard, [this, seen] { return stop_  ||  batch_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = batch_;
+        }
+
+        while (take(self, task)) {
+            task();
+            task = Task_f();
+
+            std::lock_guard<std::mutex> guard(lock_);
+            if (0 == --pending_) {
+                done_.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_WORKER_POOL_HPP
+#define HOMEWORK_SERVER_WORKER_POOL_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Fixed pool of threads that runs batches of tasks. A batch is dealt to
+    the threads' own deques round robin. A thread takes from the front of
+    its own deque and, when that is empty, steals from the back of the
+    others', so uneven tasks do not leave threads idle.
+
+    run() blocks until the whole batch is done, and must be called from one
+    thread at a time.
+----------------------------------------------------------------------------*/
+class WorkerPool
+{
+public:
+    typedef std::function<void (void)> Task_f;
+
+    explicit WorkerPool(unsigned threads);
+    ~WorkerPool();
+
+    void run(std::vector<Task_f> &tasks);
+
+    unsigned size(void) const { return workers_.size(); }
+    uint64_t steals(void) const { return steals_; }
+
+private:
+    // No copying
+    WorkerPool(WorkerPool const &);
+    WorkerPool &operator = (WorkerPool const &);
+
+    struct Worker {
+        std::thread thread;
+        std::mutex lock;
+        std::deque<Task_f> tasks;
+    };
+
+    void work(unsigned self);
+    bool take(unsigned self, Task_f &task);
+
+    std::vector<Worker *> workers_;
+
+    std::mutex lock_;                  // Guards the rest
+    std::condition_variable wakeup_;
+    std::condition_variable done_;
+    uint64_t batch_;                   // Number of the latest batch
+    size_t pending_;                   // Tasks of it not done
+    bool stop_;
+
+    std::atomic<uint64_t> steals_;
+};
+
+
+#endif  // HOMEWORK_SERVER_WORKER_POOL_HPP
@@ -0,0 +1,284 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#include <iostream>
+#include "writeBehind.hpp"
+#include "monoClock.hpp"
+
+
+// Writer commits at least this often when idle, like the network thread's tick
+#define IDLE_COMMIT_MS  100
+
+
+/*---- Constructor ----------------------------------------------------------
+  Does:
+    Just initialize some members. The thread is started by start().
+----------------------------------------------------------------------------*/
+WriteBehind::WriteBehind(size_t const queueSize, size_t const batchMax) 
+: queue_(queueSize), batchMax_(batchMax > 0 ? batchMax : 1), stop_(false), batchJobs_(0),
+  maxDepth_(0), batches_(0), jobs_(0), relayed_(0), stalls_(0), stalledUs_(0)
+{
+}
+
+
+WriteBehind::~WriteBehind()
+{
+    stop();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Start the writer thread.
+
+  Wants:
+    Function that runs a job.
+    Function that stores a run of STORE jobs' Records.
+    Function that commits what the jobs stored.
+    Function that relays a committed Record to Observers.
+
+  Gives:
+    True on success.
+----------------------------------------------------------------------------*/
+bool
+WriteBehind::start(Execute_f const &execute, Store_f const &store, Commit_f const &commit, Relay_f const &relay)
+{
+    if (thread_.joinable()) {
+        return false;
+    }
+
+    execute_ = execute;
+    store_ = store;
+    commit_ = commit;
+    relay_ = relay;
+    thread_ = std::thread(&WriteBehind::run, this);
+
+    std::cout << "Started write-behind thread, queue " << queue_.capacity() << ", batch " << batchMax_ << std::endl;
+    return true;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Stop the writer thread. Jobs still queued are run and committed first.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::stop(void)
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    stop_ = true;
+    wakeup_.notify();
+    room_.notify();
+    thread_.join();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Queue a job to the writer and wake it if it sleeps. A full queue is
+    waited out: the caller stops until the writer makes room.
+
+  Wants:
+    Job.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::push(Job &&job)
+{
+    while (!queue_.push(std::move(job))) {
+        waitForRoom();
+    }
+
+    size_t const depth = queue_.size();
+    if (depth > maxDepth_.load(std::memory_order_relaxed)) {
+        maxDepth_.store(depth, std::memory_order_relaxed);
+    }
+
+    wakeup_.notify();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Wait while the queue is full. Reading threads call this before they
+    read their clients, so a slow writer throttles the clients through TCP
+    flow control instead of growing memory.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::waitForRoom(void)
+{
+    if (queue_.size() < queue_.capacity()) {
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ++stalls_;
+
+    wakeup_.notify();
+    room_.wait([this] () { return stop_  ||  queue_.size() < queue_.capacity(); });
+
+    stalledUs_ += monoClock::elapsedUs(start);
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Store the Records of the STORE jobs run so far.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::storeRun(void)
+{
+    if (stores_.empty()) {
+        return;
+    }
+
+    store_(stores_, toRelay_);
+    stores_.clear();
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Commit the batch and relay the Records it stored.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::endBatch(void)
+{
+    if (0 == batchJobs_) {
+        return;
+    }
+
+    storeRun();
+    commit_();
+
+    for (size_t i = 0; i < toRelay_.size(); ++i) {
+        relay_(toRelay_[i]);
+    }
+
+    relayed_.fetch_add(toRelay_.size(), std::memory_order_relaxed);
+    jobs_.fetch_add(batchJobs_, std::memory_order_relaxed);
+    batches_.fetch_add(1, std::memory_order_relaxed);
+
+    toRelay_.clear();
+    batchJobs_ = 0;
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Writer thread's loop. Run jobs in batches; end the batch when the queue
+    runs empty, when it is full size, or before Observer changes. Runs of
+    STORE jobs are stored at once before any other job. Commit
+    on an idle tick too, for commit policies that count time.
+
+  Wants:
+    Nothing.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::run(void)
+{
+    Job job;
+
+    while (true) {
+        if (!queue_.pop(job)) {
+            endBatch();
+
+            if (stop_  &&  queue_.empty()) {
+                return;
+            }
+
+            if (!wakeup_.wait([this] () { return stop_  ||  !queue_.empty(); }, IDLE_COMMIT_MS)) {
+                commit_();
+            }
+            continue;
+        }
+
+        room_.notify();
+
+        if (Job::OBSERVE == job.type  ||  Job::DETACH == job.type  ||  Job::STATS == job.type) {
+            endBatch();
+        }
+
+        ++batchJobs_;
+        if (Job::STORE == job.type) {
+            stores_.push_back(std::move(job.rec));
+        }
+        else {
+            storeRun();
+            if (execute_(job)) {
+                toRelay_.push_back(std::move(job.rec));
+            }
+        }
+
+        if (batchJobs_ >= batchMax_) {
+            endBatch();
+        }
+    }
+}
+
+
+/*---- Function -------------------------------------------------------------
+  Does:
+    Print queue depth, batch sizes and how long readers waited for room.
+
+  Wants:
+    Output stream.
+
+  Gives:
+    Nothing.
+----------------------------------------------------------------------------*/
+void
+WriteBehind::printStats(std::ostream &os) const
+{
+    uint64_t const batches = batches_.load();
+
+    os << "Write-behind: queue " << queue_.size() << "/" << queue_.capacity() << " (max " << maxDepth_.load() << "), "
+        << batches << " batches, " << (batches ? jobs_.load() / batches : 0) << " jobs per batch, " 
+        << relayed_.load() << " relayed after commit" << std::endl;
+    os << "  " << stalls_.load() << " stalls on full queue, " << stalledUs_.load() / 1000 << " ms stalled" << std::endl;
+}
@@ -0,0 +1,134 @@
+/*---- Unlicense ------------------------------------------------------------
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org>
+----------------------------------------------------------------------------*/
+
+#ifndef HOMEWORK_SERVER_WRITE_BEHIND_HPP
+#define HOMEWORK_SERVER_WRITE_BEHIND_HPP
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <functional>
+#include <iosfwd>
+#include <thread>
+#include <vector>
+#include "record.hpp"
+#include "lockfreeQueue.hpp"
+#include "wakeup.hpp"
+
+
+/*---- Class ----------------------------------------------------------------
+  Does:
+    Move Sink and Observer work off the thread that reads the clients. The
+    reading threads push jobs to a bounded lock-free queue, and one writer
+    thread drains it in batches. It is the only thread that touches the
+    Sink and the Observers, so neither needs locking.
+
+    Records stored in a batch are relayed to Observers only after the
+    batch is committed, so Lurkers see only what the Sink has committed.
+    A batch ends when the queue runs empty or grows to its maximum size.
+    Consecutive stores in it are handed to the Sink at once.
+    Observer attach and detach end the current batch before they run, so a
+    Lurker's history replay and its live stream meet exactly.
+
+    When the queue is full the reading threads wait, and stop reading
+    their clients until the writer catches up.
+----------------------------------------------------------------------------*/
+class WriteBehind
+{
+public:
+    /*---- Struct ---------------------------------------------------------------
+      Does:
+        One request from a reading thread to the writer.
+    ----------------------------------------------------------------------------*/
+    struct Job {
+        enum Type { STORE, QUERY, OBSERVE, DETACH, STATS };
+
+        Job() : type(STORE), priv(0) {}
+        Job(Type const t, uint64_t const p, Record &&r = Record()) : type(t), priv(p), rec(std::move(r)) {}
+
+        Type type;
+        uint64_t priv;   // Client's handle. Record's own priv does not survive a move.
+        Record rec;
+    };
+
+    // Run a job in the writer thread. Gives true if the job stored a Record to relay.
+    typedef std::function<bool (Job &job)> Execute_f;
+    // Store the Records of consecutive STORE jobs at once. Moves the stored ones to toRelay.
+    typedef std::function<void (std::vector<Record> &recs, std::vector<Record> &toRelay)> Store_f;
+    typedef std::function<void (void)> Commit_f;
+    typedef std::function<void (Record const &rec)> Relay_f;
+
+    WriteBehind(size_t queueSize, size_t batchMax);
+    ~WriteBehind();
+
+    bool start(Execute_f const &execute, Store_f const &store, Commit_f const &commit, Relay_f const &relay);
+    void stop(void);
+    bool started(void) const { return thread_.joinable(); }
+
+    void push(Job &&job);
+    void waitForRoom(void);
+
+    void printStats(std::ostream &os) const;
+
+private:
+    // No copying
+    WriteBehind(WriteBehind const &);
+    WriteBehind &operator = (WriteBehind const &);
+
+    void run(void);
+    void storeRun(void);
+    void endBatch(void);
+
+    MpscQueue<Job> queue_;
+    size_t const batchMax_;
+    std::thread thread_;
+    std::atomic<bool> stop_;
+
+    Execute_f execute_;
+    Store_f store_;
+    Commit_f commit_;
+    Relay_f relay_;
+
+    // Writer thread only
+    std::vector<Record> stores_;    // Run of STORE jobs not stored yet
+    std::vector<Record> toRelay_;   // Stored in this batch
+    size_t batchJobs_;
+
+    Wakeup wakeup_;   // Writer's idle sleep
+    Wakeup room_;     // Readers' wait for room
+
+    // Statistics
+    std::atomic<size_t> maxDepth_;
+    std::atomic<uint64_t> batches_;
+    std::atomic<uint64_t> jobs_;
+    std::atomic<uint64_t> relayed_;
+    std::atomic<uint64_t> stalls_;
+    std::atomic<uint64_t> stalledUs_;
+};
+
+
+#endif  // HOMEWORK_SERVER_WRITE_BEHIND_HPP